@@ -5,6 +5,14 @@
 #include "can_manager.h"
 #include "modbus_manager.h"
 #include "mapping.h"
+#include "capture_manager.h"
+#include "profiler.h"
+#include "events.h"
+#include "console.h"
+#include "poll_planner.h"
+#include "group_writer.h"
+#include "warm_start.h"
+#include "static_config.h"
 
 // ===== SD paths =====
 constexpr uint8_t PIN_SD_CS   = 10;
@@ -12,25 +20,56 @@ constexpr char    CAN_PATH[]  = "/CAN~1.JSO";
 constexpr char    MB_PATH[]   = "/MODBUS~1.JSO";
 constexpr char    MAP_PATH[]  = "/MAPPIN~1.JSO";
 
+// ===== cattura traffico su SD (CAPxxxxx.BIN) =====
+constexpr bool     CAPTURE_ENABLED    = true;
+constexpr bool     CAPTURE_PRETRIGGER = true;   // su SD solo attorno a un errore
+constexpr uint32_t CAPTURE_PRE_MS     = 5000;
+
 // ===== runtime config =====
 long g_canBitrate = 500000;
+CanShaperConfig g_shaper;
 std::vector<CanMessageSpec>     g_canMsgs;
 ModbusRtuConfig                 g_rtu;
+ModbusSlaveConfig               g_slave;       // gateway come slave verso SCADA
 std::vector<ModbusResourceSpec> g_mbRes;
 std::vector<MappingRule>        g_rules;
+CanDispatch                     g_canDispatch; // id CAN -> regole CAN2MB
+CanDispatch                     g_reqDispatch; // id CAN -> regole MB2CAN su richiesta
 
-// Per il polling MB2CAN: manteniamo un last_ms per ogni risorsa coinvolta
+// Per il polling MB2CAN: manteniamo la prossima scadenza per ogni risorsa coinvolta
 struct PollState {
   const ModbusResourceSpec* res;
-  uint32_t last_ms = 0;
+  uint32_t next_ms = 0;
+  bool     queued  = false; // PollDue gia' in coda
+  bool     demand  = false; // lettura urgente chiesta da un frame di richiesta
+  bool     inflight = false; // lettura accodata o in corso sulla sua linea
+  bool     urgentRd = false; // la lettura in volo e' partita da una richiesta, non dal periodo
+  bool     changedOnDemand = false; // variazione vista da letture su richiesta, va al prossimo PLN::onRead
+  uint16_t plan    = 0;     // indice nel pianificatore (PLN)
+  uint32_t period_ms = 0;   // periodo corrente, adattato da PLN
+
+  // ultima lettura riuscita, per le richieste "request" (max_age_ms)
+  std::vector<uint16_t> cache;
+  uint32_t cache_ms = 0;
+  bool     cache_ok = false;
+  bool     stale    = false;  // cache dall'immagine di boot, non ancora riletta
+  uint32_t key      = 0;      // WARM::resourceKey
 };
 std::vector<PollState> g_pollers;
 
+// scadenza piu' vicina tra tutti i poller: il loop confronta solo questa
+static uint32_t g_nextDue  = 0;
+static bool     g_haveDue  = false;
+
+// foto delle cache su SD per la ripartenza a caldo
+static bool     g_warmDirty  = false;
+static uint32_t g_lastSnapMs = 0;
+
 static void buildPollers() {
   // Inserisce una voce per ogni risorsa Modbus usata in regole MB2CAN (una sola volta)
   for (auto& r : g_rules) 
   {
-    if (r.dir != RuleDir::MB2CAN || !r.fromModbus) 
+    if (r.dir != RuleDir::MB2CAN || !r.fromModbus || r.fromModbus->local) 
     {
       continue;
     }
@@ -46,9 +85,98 @@ static void buildPollers() {
 
     if (!already) 
     {
-      g_pollers.push_back({ r.fromModbus, 0 });
+      PollState p;
+      p.res = r.fromModbus;
+      p.cache.assign(mbResourceWords(*r.fromModbus), 0);
+      g_pollers.push_back(p);
+    }
+  }
+}
+
+static int16_t pollerOf(const ModbusResourceSpec* res)
+{
+  for (uint16_t i = 0; i < g_pollers.size(); ++i) 
+  {
+    if (g_pollers[i].res == res) return (int16_t)i;
+  }
+  return -1;
+}
+
+static void handleCanFrame(const CanMsg& rx); // usata anche dalla console (INJ)
+static void onWriteDone(const ModbusResourceSpec& res, bool ok, const uint16_t* regs, uint16_t words, uint16_t tag);
+static void onReadDone(const ModbusResourceSpec& res, bool ok, const uint16_t* regs, uint16_t words, uint16_t idx);
+static void onSlaveWrite(const ModbusResourceSpec& res);
+static void onCanRequest(uint16_t ruleIdx, const CanMsg& rx);
+
+// ========= ripartenza a caldo =========
+static void publishResource(const ModbusResourceSpec* res, const uint16_t* regs, uint16_t words, bool stale = false);
+
+// record dell'immagine di boot: solo se la risorsa esiste ancora identica
+static void onWarmRecord(uint32_t key, const uint16_t* regs, uint16_t words, uint32_t ageMs)
+{
+  for (auto& p : g_pollers) 
+  {
+    if (p.key != key || words != mbResourceWords(*p.res)) 
+    {
+      continue;
+    }
+    memcpy(p.cache.data(), regs, words * sizeof(uint16_t));
+    p.cache_ms = millis() - ageMs; // eta' minima: il tempo da spento non e' noto
+    p.cache_ok = true;
+    p.stale    = true;
+    Serial.print(F("[WARM] ")); Serial.print(p.res->name);
+    Serial.print(F(" eta' >= ")); Serial.print(ageMs / 1000); Serial.println(F(" s"));
+    publishResource(p.res, regs, words, true);
+    return;
+  }
+}
+
+// Prime scadenze: le risorse senza dato subito, distanziate del loro tempo di
+// linea al budget (ogni linea per conto suo); quelle gia' pubblicate
+// dall'immagine su ramp_ms
+static void rampPollers(uint32_t now)
+{
+  std::vector<uint32_t> at(g_rtu.lines.size(), now);
+  uint32_t last = now;
+  uint16_t warm = 0;
+  for (auto& p : g_pollers) 
+  {
+    if (p.stale) 
+    { 
+      warm++; 
+      continue; 
+    }
+    uint8_t budget = g_rtu.lines[p.res->line].budget_pct;
+    p.next_ms = at[p.res->line];
+    at[p.res->line] += PLN::wireUs(*p.res) / (10UL * (budget ? budget : 100)) + 1;
+    if ((int32_t)(at[p.res->line] - last) > 0) last = at[p.res->line];
+  }
+  uint16_t k = 0;
+  for (auto& p : g_pollers) 
+  {
+    if (!p.stale) continue;
+    p.next_ms = last + (uint32_t)((uint64_t)g_rtu.ramp_ms * ++k / warm);
+  }
+  g_nextDue = now;
+  g_haveDue = !g_pollers.empty();
+}
+
+// Foto delle cache: in RAM subito, su SD a pezzi da runPending()
+static void takeSnapshot(uint32_t now)
+{
+  if (!WARM::beginSnapshot()) return;
+  for (auto& p : g_pollers) 
+  {
+    if (!p.cache_ok) continue;
+    if (!WARM::add(p.key, p.cache.data(), mbResourceWords(*p.res), now - p.cache_ms)) 
+    {
+      Serial.println(F("[WARM] immagine piena (WARM_MAX_BYTES)"));
+      break;
     }
   }
+  WARM::commit();
+  g_warmDirty  = false;
+  g_lastSnapMs = now;
 }
 
 void setup() 
@@ -65,6 +193,28 @@ void setup()
     while(true){} 
   }
 
+  // Cattura (i blocchi arrivano su SD solo da service() in loop)
+  CAPM::Config cap;
+  cap.enabled    = CAPTURE_ENABLED;
+  cap.preTrigger = CAPTURE_PRETRIGGER;
+  cap.preMs      = CAPTURE_PRE_MS;
+  CAPM::begin(cap);
+
+#if GW_STATIC_CONFIG
+  // Configurazione in flash (gw_config.h): nessun JSON da SD
+  if (!loadStaticConfig(g_canBitrate, g_shaper, g_canMsgs, g_rtu, g_slave, g_mbRes, g_rules,
+                        g_canDispatch, g_reqDispatch)) 
+  { 
+    Serial.println(F("[CFG] static FAIL")); 
+    while(true){} 
+  }
+  Serial.print(F("[CFG] statica: CAN bitrate=")); 
+  Serial.print(g_canBitrate);
+  Serial.print(F(" MB RTU linee=")); 
+  Serial.print((int)g_rtu.lines.size());
+  Serial.print(F(" rules=")); 
+  Serial.println((int)g_rules.size());
+#else
   // Load CAN
   String canJson;
   if (!SDM_readText(CAN_PATH, canJson)) 
@@ -72,7 +222,7 @@ void setup()
     Serial.println(F("[SD] can.json missing")); 
     while(true){} 
   }
-  if (!parseCanJson(canJson, g_canBitrate, g_canMsgs)) 
+  if (!parseCanJson(canJson, g_canBitrate, g_canMsgs, &g_shaper)) 
   { 
     Serial.println(F("[JSON] can FAIL")); 
     while(true){} 
@@ -88,16 +238,18 @@ void setup()
     while(true){} 
   }
 
-  if (!parseModbusJson(mbJson, g_rtu, g_mbRes)) 
+  if (!parseModbusJson(mbJson, g_rtu, g_mbRes, &g_slave)) 
   { 
     Serial.println(F("[JSON] modbus FAIL")); 
     while(true){} 
   }
 
-  Serial.print(F("[CFG] MB RTU baud=")); 
-  Serial.print(g_rtu.baud);
+  Serial.print(F("[CFG] MB RTU linee=")); 
+  Serial.print((int)g_rtu.lines.size());
+  Serial.print(F(" baud=")); 
+  Serial.print(g_rtu.lines[0].baud);
   Serial.print(F(" slave=")); 
-  Serial.println(g_rtu.slave_id);
+  Serial.println(g_rtu.lines[0].slave_id);
 
   // Load Mapping
   String mapJson;
@@ -113,6 +265,9 @@ void setup()
   }
   Serial.print(F("[CFG] rules=")); 
   Serial.println((int)g_rules.size());
+  buildCanDispatch(g_rules, g_canDispatch);
+  buildRequestDispatch(g_rules, g_reqDispatch);
+#endif
 
   // Init CAN
   if (!CANM::begin(g_canBitrate)) 
@@ -121,101 +276,478 @@ void setup()
     while(true){} 
   }
   Serial.println(F("[CAN] init OK"));
+  CANM::shaperBegin(g_shaper, g_canMsgs);
 
-  // Init ModbusMaster (DE/RE su D7)
-  if (!MBM::begin(g_rtu, 7)) 
-  { 
-    Serial.println(F("[MB] init FAIL")); 
+  // Init master RTU, una porta e un DE/RE per linea: serve solo se ci sono
+  // risorse remote
+  bool needMaster = false;
+  for (auto& r : g_mbRes) needMaster |= !r.local;
+  bool slaveOnMasterPort = false;
+  for (auto& l : g_rtu.lines) slaveOnMasterPort |= g_slave.enabled && g_slave.port.equalsIgnoreCase(l.port);
+  if (needMaster && slaveOnMasterPort) 
+  {
+    Serial.println(F("[MB] master e slave sulla stessa porta")); 
     while(true){} 
   }
-  Serial.println(F("[MB] init OK"));
+  if (needMaster) 
+  {
+    if (!MBM::begin(g_rtu)) 
+    { 
+      Serial.println(F("[MB] init FAIL")); 
+      while(true){} 
+    }
+    Serial.println(F("[MB] init OK"));
+  }
 
-  // Prepara pollers
+  // Slave verso SCADA: immagine delle risorse "local"
+  if (g_slave.enabled && !MBM::slaveBegin(g_slave, g_mbRes, onSlaveWrite)) 
+  {
+    Serial.println(F("[MBS] init FAIL")); 
+    while(true){} 
+  }
+
+  // Prepara pollers e piano delle linee RS-485
   buildPollers();
+  PLN::begin(g_rtu);
+  GRP::begin(g_rules);
+  for (auto& p : g_pollers) 
+  {
+    p.plan = PLN::add(*p.res);
+  }
+  for (auto& r : g_mbRes) 
+  {
+    if (!r.local && pollerOf(&r) < 0) PLN::add(r); // scritture: solo per il report
+  }
+  PLN::plan();
+  for (auto& p : g_pollers) 
+  {
+    p.period_ms = PLN::period(p.plan);
+  }
+  PLN::report(Serial);
+  CANM::loadReport(Serial, g_canMsgs, g_rules);
+
+  // Ripartenza a caldo: gli ultimi valori noti escono subito (marcati stale),
+  // le prime letture si distribuiscono invece di partire tutte insieme
+  for (auto& p : g_pollers) 
+  {
+    p.key = WARM::resourceKey(*p.res);
+  }
+  WARM::load(onWarmRecord);
+  rampPollers(millis());
+  g_lastSnapMs = millis();
+
+  // Console: INJ/BURST INJ passano dallo stesso percorso dei frame dal bus
+  CONS::Handlers h;
+  h.inject = handleCanFrame;
+  CONS::begin(g_canMsgs, g_rules, h);
+
+  PROF_BEGIN();
 }
 
 // buffer temporanei per registri
 static uint16_t regsBuf[16]; // sufficiente per i nostri esempi (aumenta se serve)
 
-void loop() {
-  // ========= RX CAN → Modbus (CAN2MB) =========
-  if (CAN.available()) 
+// frame CAN gestiti per evento CanRx prima di ridare spazio agli altri eventi
+constexpr uint8_t CAN_RX_BURST = 8;
+
+static bool g_canRxQueued   = false;
+static bool g_consoleQueued = false;
+
+// ===== scheduler: pubblica PollDue per i poller scaduti =====
+static void schedulePollers(uint32_t now)
+{
+  bool     any  = false;
+  uint32_t next = now;
+
+  for (uint16_t i = 0; i < g_pollers.size(); ++i)
   {
-    CanMsg rx = CAN.read();
+    PollState& p = g_pollers[i];
+    if (!p.res || p.period_ms == 0) 
+    {
+      continue;
+    }
+    if (!p.queued && !p.inflight && (int32_t)(now - p.next_ms) >= 0)
+    {
+      if (EVQ::post(EVQ::EvType::PollDue, i))
+      {
+        p.queued  = true;
+        p.next_ms = now + p.period_ms;
+      }
+    }
+    if (!any || (int32_t)(p.next_ms - next) < 0)
+    {
+      next = p.next_ms;
+    }
+    any = true;
+  }
+  g_nextDue = next;
+  g_haveDue = any;
+}
+
+// ========= RX CAN → Modbus (CAN2MB) =========
+static void handleCanFrame(const CanMsg& rx)
+{
+  {
+    PROF_SCOPE(PrettyPrint);
     CANM::prettyPrintRx(g_canMsgs, rx);
+  }
 
-    for (auto& rule : g_rules) 
+  const CanDispatchEntry* d;
+  const CanDispatchEntry* q;
+  {
+    PROF_SCOPE(RuleScan);
+    const uint32_t id = CANM::msgId(rx);
+    d = dispatchCan(g_canDispatch, id);
+    q = dispatchCan(g_reqDispatch, id);
+  }
+  for (uint16_t k = 0; q && k < q->count; ++k) 
+  {
+    onCanRequest(g_reqDispatch.ruleIdx[q->first + k], rx);
+  }
+  for (uint16_t k = 0; d && k < d->count; ++k) 
+  {
+    uint16_t ruleIdx = g_canDispatch.ruleIdx[d->first + k];
+    const MappingRule& rule = g_rules[ruleIdx];
+    PROF_RULE(ruleIdx);
+
+    uint16_t outCount = mbResourceWords(*rule.toModbus); // parole valide nel buffer
+    if (outCount > sizeof(regsBuf)/sizeof(regsBuf[0]))
+    {
+      continue;
+    }
+    // risorsa locale: si parte dall'immagine dello slave, i campi non mappati
+    // (o scritti da altre regole) restano com'erano; remota: non mappati a 0
+    if (!rule.toModbus->local || !MBM::slaveLoad(*rule.toModbus, regsBuf))
+    {
+      memset(regsBuf, 0, outCount * sizeof(regsBuf[0]));
+    }
+    bool ok;
     {
-      if (rule.dir != RuleDir::CAN2MB || !rule.fromCan || !rule.toModbus) 
+      PROF_SCOPE(Extract);
+      ok = extractModbusFromCan(rule, rx.data, rx.data_length, regsBuf, outCount);
+    }
+    if (ok && rule.toModbus->local) 
+    {
+      // risorsa dello slave: basta aggiornare l'immagine, lo SCADA la legge da RAM
+      MBM::slaveStore(*rule.toModbus, regsBuf, outCount);
+    } else if (ok && GRP::isGroup(ruleIdx)) 
+    {
+      // un comando per tutto il gruppo: broadcast o unicast in pipeline
+      bool wr;
       {
-        continue;
+        PROF_SCOPE(MbWrite);
+        wr = GRP::write(ruleIdx, regsBuf, outCount);
       }
-      if (rule.fromCan->id != rx.id)
+      if (!wr) 
       {
-        continue;
+        Serial.print(F("[CAN->MB] coda linea piena, comando di gruppo scartato: ")); 
+        Serial.println(rule.toModbus->name);
+        CAPM::trigger();
       }
-
-      uint16_t outCount=0;
-      if (extractModbusFromCan(rule, rx.data, rx.data_length, regsBuf, outCount)) 
+    } else if (ok) 
+    {
+      // accodata sulla linea della risorsa, l'esito arriva in onWriteDone
+      bool wr;
+      {
+        PROF_SCOPE(MbWrite);
+        wr = MBM::submitWrite(*rule.toModbus, regsBuf, outCount, onWriteDone, ruleIdx);
+      }
+      if (!wr) 
       {
-        if (!MBM::writeResource(*rule.toModbus, regsBuf, outCount)) 
-        {
-          Serial.println(F("[CAN->MB] writeResource FAIL"));
-        } else 
-        {
-          Serial.print(F("[CAN->MB] write OK to ")); 
-          Serial.print(rule.toModbus->name);
-          Serial.print(F(" @addr=")); 
-          Serial.println(rule.toModbus->address);
-        }
+        Serial.print(F("[CAN->MB] coda linea piena, scrittura scartata: ")); 
+        Serial.println(rule.toModbus->name);
+        CAPM::trigger();
       }
     }
   }
+}
 
-  // ========= Poll Modbus → CAN (MB2CAN) =========
-  uint32_t now = millis();
-  for (auto& p : g_pollers) 
+static void onWriteDone(const ModbusResourceSpec& res, bool ok, const uint16_t*, uint16_t, uint16_t)
+{
+  if (!ok) 
   {
-    const ModbusResourceSpec* res = p.res;
-    if (!res || res->period_ms == 0) 
+    Serial.print(F("[CAN->MB] write FAIL to ")); 
+    Serial.println(res.name);
+    CAPM::trigger();
+    return;
+  }
+  Serial.print(F("[CAN->MB] write OK to ")); 
+  Serial.print(res.name);
+  Serial.print(F(" @addr=")); 
+  Serial.println(res.address);
+}
+
+static void onCanRx()
+{
+  g_canRxQueued = false;
+  for (uint8_t n = 0; n < CAN_RX_BURST && CAN.available(); ++n)
+  {
+    CanMsg rx;
     {
-      continue;
+      PROF_SCOPE(CanRx);
+      rx = CAN.read();
+      CAPM::logCan(CAPM::RecType::CanRx, CANM::msgId(rx), rx.data_length, rx.data);
     }
-    if (now - p.last_ms < res->period_ms) 
+    handleCanFrame(rx);
+  }
+}
+
+// ========= Poll Modbus → CAN (MB2CAN) =========
+static void publishRule(uint16_t ruleIdx, const uint16_t* regs, uint16_t words, bool stale = false);
+
+// La lettura va in coda alla linea della risorsa (in testa se urgente) e
+// si chiude in onReadDone: le linee lavorano in parallelo, il loop non attende
+static void onPollDue(uint16_t idx)
+{
+  if (idx >= g_pollers.size()) return;
+  PollState& p = g_pollers[idx];
+  if (!p.queued) return; // gia' servito da una lettura urgente
+  p.queued = false;
+  if (p.inflight) return;
+
+  const ModbusResourceSpec* res = p.res;
+  bool rd;
+  {
+    PROF_SCOPE(MbRead);
+    rd = MBM::submitRead(*res, onReadDone, idx, p.demand);
+  }
+  if (!rd) 
+  {
+    // linea satura: il prossimo periodo ci riprova
+    p.demand = false;
+    Serial.print(F("[MB poll] coda linea piena: ")); 
+    Serial.println(res->name);
+    return;
+  }
+  p.inflight = true;
+  p.urgentRd = p.demand;
+}
+
+static void onReadDone(const ModbusResourceSpec& res, bool ok, const uint16_t* regs, uint16_t words, uint16_t idx)
+{
+  if (idx >= g_pollers.size()) return;
+  PollState& p = g_pollers[idx];
+  const bool urgent = p.urgentRd;
+  p.inflight = false;
+  p.demand   = false;
+  p.urgentRd = false;
+  if (!ok) 
+  {
+    Serial.print(F("[MB poll] read FAIL for ")); 
+    Serial.println(res.name);
+    CAPM::trigger();
+    return;
+  }
+
+  bool changed = !p.cache_ok || memcmp(p.cache.data(), regs, words * sizeof(uint16_t)) != 0;
+  memcpy(p.cache.data(), regs, words * sizeof(uint16_t));
+  p.cache_ms = millis();
+  p.cache_ok = true;
+  p.stale    = false;
+  g_warmDirty |= changed;
+
+  // il periodo segue la frequenza di variazione, entro min/max e budget di
+  // linea. Le letture su richiesta non sono campioni del periodo: la
+  // variazione che vedono passa alla prossima lettura periodica
+  if (urgent)
+  {
+    p.changedOnDemand |= changed;
+  } else
+  {
+    p.period_ms = PLN::onRead(p.plan, changed || p.changedOnDemand);
+    p.changedOnDemand = false;
+    if (p.period_ms) 
     {
-      continue; // non ancora tempo
+      p.next_ms = p.cache_ms + p.period_ms; // dato appena letto: il periodico puo' aspettare
     }
-    p.last_ms = now;
+  }
 
-    // Leggi registri per la risorsa
-    if (!MBM::readResource(*res, regsBuf)) 
+  publishResource(&res, regs, words);
+}
+
+// Frame di richiesta: cache se abbastanza giovane, altrimenti lettura urgente.
+// Piu' richieste sulla stessa risorsa durante la lettura diventano una sola
+// transazione: alla fine si pubblicano tutte le regole della risorsa.
+static void onCanRequest(uint16_t ruleIdx, const CanMsg& rx)
+{
+  const MappingRule& rule = g_rules[ruleIdx];
+  if (rule.request.rtr && rx.data_length != 0) 
+  {
+    return; // il core R4 non espone il bit RTR: richiesta = frame senza dati
+  }
+
+  const ModbusResourceSpec* res = rule.fromModbus;
+  uint16_t words = mbResourceWords(*res);
+  if (res->local) 
+  {
+    // risorsa dello slave: l'immagine e' gia' in RAM
+    if (words <= sizeof(regsBuf)/sizeof(regsBuf[0]) && MBM::slaveLoad(*res, regsBuf)) 
     {
-      Serial.print(F("[MB poll] read FAIL for ")); 
-      Serial.println(res->name);
-      continue;
+      publishRule(ruleIdx, regsBuf, words);
+    }
+    return;
+  }
+
+  int16_t pi = pollerOf(res);
+  if (pi < 0) return;
+  PollState& p = g_pollers[pi];
+
+  if (p.cache_ok && !p.stale && millis() - p.cache_ms <= rule.request.max_age_ms) 
+  {
+    Serial.print(F("[REQ] cache ")); Serial.println(rule.toCan->name);
+    publishRule(ruleIdx, p.cache.data(), words);
+    return;
+  }
+  if (p.demand) 
+  {
+    return; // lettura gia' in arrivo
+  }
+  if (p.inflight) 
+  {
+    // la lettura periodica gia' accodata serve anche la richiesta: passa in
+    // testa alla coda della linea invece di aspettare il suo turno
+    p.demand = true;
+    MBM::promoteRead(*res, onReadDone, (uint16_t)pi);
+    return;
+  }
+
+  // in testa alla coda eventi: passa davanti ai poll periodici in attesa
+  if (EVQ::postUrgent(EVQ::EvType::PollDue, (uint16_t)pi)) 
+  {
+    p.demand = true;
+    p.queued = true;
+    Serial.print(F("[REQ] lettura ")); Serial.println(res->name);
+  }
+}
+
+// Scrittura dello SCADA su una risorsa local: stesso percorso MB2CAN del polling
+static void onSlaveWrite(const ModbusResourceSpec& res)
+{
+  uint16_t words = mbResourceWords(res);
+  if (words > sizeof(regsBuf)/sizeof(regsBuf[0]) || !MBM::slaveLoad(res, regsBuf)) 
+  {
+    return;
+  }
+  publishResource(&res, regsBuf, words);
+}
+
+// costruisce e accoda il frame di una regola MB2CAN
+static void publishRule(uint16_t ruleIdx, const uint16_t* regs, uint16_t words, bool stale)
+{
+  const MappingRule& rule = g_rules[ruleIdx];
+  PROF_RULE(ruleIdx);
+
+  uint32_t id; uint8_t dlc; uint8_t data[8];
+  bool built;
+  {
+    PROF_SCOPE(BuildCan);
+    built = buildCanFromModbus(rule, regs, words, id, dlc, data);
+  }
+  if (built) 
+  {
+    if (stale && rule.toCan->stale_field >= 0) 
+    {
+      CANM::setBoolField(rule.toCan->fields[rule.toCan->stale_field], data, true);
+    }
+    // la coda riempie le mailbox appena si liberano (serviceTx)
+    if (!CANM::enqueue(id, dlc, data)) 
+    {
+      Serial.println(F("[MB->CAN] coda TX piena, frame scartato"));
+      CAPM::trigger();
+    } else 
+    {
+      Serial.print(F("[MB->CAN] TX ")); Serial.print(rule.toCan->name);
+      Serial.print(F(" id=0x")); Serial.print(id, HEX);
+      Serial.print(F(" dlc=")); Serial.println(dlc);
     }
+  }
+}
 
-    // per ogni regola MB2CAN che usa questa risorsa, costruisci e invia il frame
-    for (auto& rule : g_rules) 
+// per ogni regola MB2CAN che usa questa risorsa, costruisci e invia il frame
+static void publishResource(const ModbusResourceSpec* res, const uint16_t* regs, uint16_t words, bool stale)
+{
+  for (uint16_t ruleIdx = 0; ruleIdx < g_rules.size(); ++ruleIdx) 
+  {
+    const MappingRule& rule = g_rules[ruleIdx];
+    if (rule.dir != RuleDir::MB2CAN || rule.fromModbus != res || !rule.toCan) 
     {
-      if (rule.dir != RuleDir::MB2CAN || rule.fromModbus != res || !rule.toCan) 
-      {
-        continue;
-      }
+      continue;
+    }
+    publishRule(ruleIdx, regs, words, stale);
+  }
+}
 
-      uint32_t id; uint8_t dlc; uint8_t data[8];
-      if (buildCanFromModbus(rule, regsBuf, res->count, id, dlc, data)) 
-      {
-        if (!CANM::sendRaw(id, dlc, data)) 
-        {
-          Serial.println(F("[MB->CAN] sendRaw FAIL (bus busy/no ACK)"));
-        } else 
-        {
-          Serial.print(F("[MB->CAN] TX ")); Serial.print(rule.toCan->name);
-          Serial.print(F(" id=0x")); Serial.print(id, HEX);
-          Serial.print(F(" dlc=")); Serial.println(dlc);
-        }
-      }
+// Raccoglie le sorgenti ed evade tutti gli eventi pendenti
+static void runPending()
+{
+  PROF_SCOPE(Loop);
+
+  {
+    PROF_SCOPE(Capture);
+    CAPM::service();
+  }
+
+  // foto per la ripartenza a caldo: su SD un pezzo per giro, come la cattura
+  if (!WARM::service() && g_rtu.snapshot_ms && g_warmDirty && millis() - g_lastSnapMs >= g_rtu.snapshot_ms) 
+  {
+    takeSnapshot(millis());
+  }
+
+  // richieste dello SCADA: risposta da RAM, nessun giro sul CAN
+  if (g_slave.enabled) MBM::slaveService();
+
+  // transazioni delle linee RTU: le DoneFn pubblicano sul CAN da qui
+  MBM::service();
+  // riletture di verifica dei gruppi in broadcast
+  GRP::service(millis());
+
+  // La ISR di Arduino_CAN accoda i frame nel buffer della libreria e risveglia
+  // il core: qui basta trasformare "buffer non vuoto" in un evento
+  if (!g_canRxQueued && CAN.available())
+  {
+    g_canRxQueued = EVQ::post(EVQ::EvType::CanRx);
+  }
+  if (!g_consoleQueued && Serial.available() > 0)
+  {
+    g_consoleQueued = EVQ::post(EVQ::EvType::Console);
+  }
+  uint32_t now = millis();
+  if (g_haveDue && (int32_t)(now - g_nextDue) >= 0) 
+  {
+    schedulePollers(now);
+  }
+
+  EVQ::Event ev;
+  while (EVQ::pop(ev))
+  {
+    switch (ev.type)
+    {
+      case EVQ::EvType::CanRx:   onCanRx(); break;
+      case EVQ::EvType::PollDue: onPollDue(ev.arg); break;
+      case EVQ::EvType::Console: g_consoleQueued = false; CONS::poll(); break;
     }
   }
+
+  // burst ed elenchi della console avanzano a piccoli passi
+  CONS::service();
+
+  // le mailbox liberate dall'ultima TX (o dal giro precedente) si riempiono qui
+  {
+    PROF_SCOPE(CanTx);
+    CANM::serviceTx();
+  }
+}
+
+void loop() {
+  runPending();
+
+  // niente da fare: dorme fino al prossimo interrupt (RX CAN, fine TX CAN,
+  // UART/USB o tick di millis(), che limita a 1 ms la latenza dello scheduler
+  // e dei ritentativi della coda TX). Una linea RTU a meta' transazione conta
+  // i microsecondi: niente sonno finche' non aspetta solo la risposta.
+  if (EVQ::empty() && !CAN.available() && !CAPM::hasPending() && !CONS::busy() && !WARM::busy() &&
+      !MBM::busy())
+  {
+    EVQ::idle();
+  }
 }
@@ -1,16 +1,409 @@
 #include "can_manager.h"
+#include "capture_manager.h"
 
 namespace CANM {
 
+static long s_bitrate = 500000;
+
 bool begin(long bitrate) 
 {
+  s_bitrate = bitrate;
   return CAN.begin(bitrate);
 }
 
+CanMsg makeMsg(uint32_t id, uint8_t dlc, const uint8_t* data)
+{
+  if (isExtendedId(id)) return CanMsg(CanExtendedId(id), dlc, (uint8_t*)data);
+  return CanMsg(CanStandardId(id), dlc, (uint8_t*)data);
+}
+
 bool sendRaw(uint32_t id, uint8_t dlc, const uint8_t data[8]) 
 {
-  CanMsg m(CanStandardId(id), dlc, (uint8_t*)data);
-  return CAN.write(m) >= 0;
+  CanMsg m = makeMsg(id, dlc, data);
+  if (CAN.write(m) < 0) return false;
+  CAPM::logCan(CAPM::RecType::CanTx, id, dlc, data);
+  return true;
+}
+
+// ----- coda TX (array ordinato per id, piccolo: inserimento lineare) -----
+struct TxEntry {
+  uint32_t id;
+  uint8_t  dlc;
+  uint8_t  tries;
+  bool     held;      // gia' contato in shaped
+  uint32_t lastTry_us;
+  uint8_t  data[8];
+};
+
+static TxEntry s_txq[CANM_TXQ_SIZE];
+static uint8_t s_txLen = 0;
+static TxStats s_tx;
+
+static void txRemove(uint8_t pos)
+{
+  for (uint8_t i = pos; i + 1 < s_txLen; ++i) s_txq[i] = s_txq[i + 1];
+  s_txLen--;
+  s_tx.depth = s_txLen;
+}
+
+bool enqueue(uint32_t id, uint8_t dlc, const uint8_t data[8]) 
+{
+  if (dlc > 8) dlc = 8;
+
+  // stesso id gia' in coda: vale solo l'ultimo valore
+  for (uint8_t i = 0; i < s_txLen; ++i) 
+  {
+    if (s_txq[i].id == id) 
+    {
+      s_txq[i].dlc   = dlc;
+      s_txq[i].tries = 0;
+      s_txq[i].held  = false;
+      memcpy(s_txq[i].data, data, dlc);
+      s_tx.replaced++;
+      return true;
+    }
+  }
+
+  if (s_txLen >= CANM_TXQ_SIZE) 
+  {
+    // coda piena: si sacrifica il frame meno prioritario (l'ultimo) se il nuovo vale di piu'
+    if (id >= s_txq[s_txLen - 1].id) 
+    {
+      s_tx.dropsFull++;
+      return false;
+    }
+    s_txLen--;
+    s_tx.dropsFull++;
+  }
+
+  uint8_t pos = s_txLen;
+  while (pos > 0 && s_txq[pos - 1].id > id) 
+  {
+    s_txq[pos] = s_txq[pos - 1];
+    pos--;
+  }
+  TxEntry& e = s_txq[pos];
+  e.id         = id;
+  e.dlc        = dlc;
+  e.tries      = 0;
+  e.held       = false;
+  e.lastTry_us = 0;
+  memcpy(e.data, data, dlc);
+
+  s_txLen++;
+  s_tx.enqueued++;
+  s_tx.depth = s_txLen;
+  if (s_txLen > s_tx.maxDepth) s_tx.maxDepth = s_txLen;
+  return true;
+}
+
+// ----- tempo di bus -----
+uint16_t frameBits(uint8_t dlc, bool extended, bool worstStuffing)
+{
+  if (dlc > 8) dlc = 8;
+  uint16_t stuffed = (uint16_t)((extended ? 54 : 34) + 8 * dlc); // SOF..CRC
+  uint16_t bits    = stuffed + 13;                               // delim, ACK, EOF, IFS
+  if (worstStuffing) bits += (uint16_t)((stuffed - 1) / 4);
+  return bits;
+}
+
+uint32_t frameUs(uint8_t dlc, bool extended, bool worstStuffing)
+{
+  return (uint32_t)(((uint64_t)frameBits(dlc, extended, worstStuffing) * 1000000UL + s_bitrate - 1) / s_bitrate);
+}
+
+// ----- shaper: token bucket in millesimi di bit -----
+struct Bucket {
+  uint32_t rateBps = 0;
+  uint32_t depth   = 0;
+  uint32_t tokens  = 0;
+  uint32_t lastUs  = 0;
+};
+
+struct IdBucket {
+  uint32_t id;
+  Bucket   b;
+};
+
+static bool                  s_shaping = false;
+static Bucket                s_total;           // rateBps 0 = nessun tetto totale
+static std::vector<IdBucket> s_idBuckets;       // ordinati per id
+
+static void bucketInit(Bucket& b, uint32_t rateBps, uint16_t frameBits, uint8_t burst)
+{
+  b.rateBps = rateBps;
+  b.depth   = (uint32_t)frameBits * burst * 1000UL;
+  b.tokens  = b.depth;
+  b.lastUs  = micros();
+}
+
+static bool bucketHas(Bucket& b, uint32_t now, uint32_t need)
+{
+  uint32_t dt = now - b.lastUs;
+  b.lastUs = now;
+  uint64_t t = b.tokens + (uint64_t)dt * b.rateBps / 1000UL;
+  b.tokens = t > b.depth ? b.depth : (uint32_t)t;
+  return b.tokens >= need;
+}
+
+static Bucket* idBucket(uint32_t id)
+{
+  size_t lo = 0, hi = s_idBuckets.size();
+  while (lo < hi) 
+  {
+    size_t mid = (lo + hi) / 2;
+    if (s_idBuckets[mid].id < id) lo = mid + 1; else hi = mid;
+  }
+  return (lo < s_idBuckets.size() && s_idBuckets[lo].id == id) ? &s_idBuckets[lo].b : nullptr;
+}
+
+void shaperBegin(const CanShaperConfig& cfg, const std::vector<CanMessageSpec>& specs)
+{
+  s_idBuckets.clear();
+  s_total   = Bucket();
+  s_shaping = cfg.enabled;
+  if (!s_shaping) return;
+
+  // profondita' del tetto totale: burst frame da 8 byte, estesi se ce ne sono
+  bool anyExt = false;
+  for (auto& m : specs) anyExt |= m.dir != CanDir::INT2NET && isExtendedId(m.id);
+  if (cfg.max_load_pct) 
+  {
+    bucketInit(s_total, (uint32_t)((uint64_t)s_bitrate * cfg.max_load_pct / 100), frameBits(8, anyExt, true), cfg.burst_frames);
+  }
+  for (auto& m : specs) 
+  {
+    if (!m.max_rate_hz || m.dir == CanDir::INT2NET) continue;
+    uint16_t bits = frameBits(m.dlc, isExtendedId(m.id), true);
+    IdBucket ib;
+    ib.id = m.id;
+    bucketInit(ib.b, (uint32_t)bits * m.max_rate_hz, bits, cfg.burst_frames);
+    size_t pos = s_idBuckets.size();
+    s_idBuckets.push_back(ib);
+    while (pos > 0 && s_idBuckets[pos - 1].id > ib.id) 
+    {
+      s_idBuckets[pos] = s_idBuckets[pos - 1];
+      s_idBuckets[pos - 1] = ib;
+      pos--;
+    }
+  }
+}
+
+static void printPct(Print& out, uint32_t ppm)
+{
+  out.print(ppm / 10000.0, 2);
+  out.print('%');
+}
+
+static uint32_t busPpm(uint16_t bits, uint32_t rateMhz)
+{
+  return (uint32_t)((uint64_t)bits * rateMhz * 1000UL / (uint64_t)s_bitrate);
+}
+
+void loadReport(Print& out, const std::vector<CanMessageSpec>& specs, const std::vector<MappingRule>& rules)
+{
+  out.print(F("[BUS] ")); out.print(s_bitrate); out.print(F(" bit/s, shaper "));
+  if (!s_shaping)          out.println(F("spento"));
+  else if (!s_total.rateBps) out.println(F("solo per id"));
+  else 
+  {
+    out.print(F("tetto ")); printPct(out, (uint32_t)((uint64_t)s_total.rateBps * 1000000UL / (uint64_t)s_bitrate));
+    out.println();
+  }
+
+  uint32_t plannedPpm = 0, worstPpm = 0;
+  for (auto& m : specs) 
+  {
+    // frequenze in mHz: periodo configurato e periodo minimo delle sorgenti
+    uint32_t planned = 0, worst = 0;
+    bool onEvent = false, onRequest = false, used = false;
+    for (auto& r : rules) 
+    {
+      if (r.dir != RuleDir::MB2CAN || r.toCan != &m || !r.fromModbus) continue;
+      used = true;
+      onRequest |= r.request.enabled;
+      if (!r.fromModbus->period_ms) { onEvent = true; continue; }
+      planned += 1000000UL / r.fromModbus->period_ms;
+      worst   += 1000000UL / (r.fromModbus->min_period_ms ? r.fromModbus->min_period_ms : r.fromModbus->period_ms);
+    }
+    if (!used) continue;
+
+    uint32_t cap = (s_shaping && m.max_rate_hz) ? m.max_rate_hz * 1000UL : 0;
+    if (cap && planned > cap) planned = cap;
+    if (cap && worst > cap)   worst   = cap;
+
+    const bool ext = isExtendedId(m.id);
+    uint16_t bits  = frameBits(m.dlc, ext, false);
+    uint16_t wbits = frameBits(m.dlc, ext, true);
+    out.print(F("  ")); out.print(m.name);
+    out.print(F(" 0x")); out.print(m.id, HEX);
+    if (ext) out.print(F(" ext"));
+    out.print(F(" dlc")); out.print(m.dlc);
+    out.print(F(" bit=")); out.print(bits); out.print(F("..")); out.print(wbits);
+    out.print(F(" (")); out.print(frameUs(m.dlc, ext, false));
+    out.print(F("..")); out.print(frameUs(m.dlc, ext, true)); out.print(F(" us)"));
+    out.print(F(" ")); out.print(planned / 1000.0, 2); out.print(F(" Hz carico="));
+    printPct(out, busPpm(wbits, planned));
+    out.print(F(" (max ")); printPct(out, busPpm(wbits, worst)); out.print(')');
+    if (cap)       { out.print(F(" tetto ")); out.print(m.max_rate_hz); out.print(F(" Hz")); }
+    if (onEvent)   out.print(F(" +evento"));
+    if (onRequest) out.print(F(" +richieste"));
+    out.println();
+
+    plannedPpm += busPpm(wbits, planned);
+    worstPpm   += busPpm(wbits, worst);
+  }
+
+  out.print(F("[BUS] quota gateway ")); printPct(out, plannedPpm);
+  out.print(F(" (a periodo minimo ")); printPct(out, worstPpm);
+  out.println(')');
+  if (s_shaping && s_total.rateBps && (uint64_t)worstPpm * s_bitrate > (uint64_t)s_total.rateBps * 1000000UL) 
+  {
+    out.println(F("[BUS] ATTENZIONE: a periodo minimo lo shaper trattiene frame"));
+  }
+}
+
+void serviceTx() 
+{
+  uint32_t now = micros();
+  uint8_t i = 0;
+  while (i < s_txLen) 
+  {
+    TxEntry& e = s_txq[i];
+    if (e.tries && now - e.lastTry_us < CANM_TX_RETRY_US) 
+    {
+      return; // mailbox ancora piene all'ultimo tentativo
+    }
+
+    // shaper: il costo si addebita solo se il frame parte davvero
+    uint32_t cost = 0;
+    Bucket*  own  = nullptr;
+    if (s_shaping) 
+    {
+      cost = (uint32_t)frameBits(e.dlc, isExtendedId(e.id), true) * 1000UL;
+      if (s_total.rateBps && !bucketHas(s_total, now, cost)) 
+      {
+        return; // tetto totale: si riparte in ordine di priorita' al prossimo giro
+      }
+      own = idBucket(e.id);
+      if (own && !bucketHas(*own, now, cost)) 
+      {
+        if (!e.held) { e.held = true; s_tx.shaped++; }
+        i++;      // questo id aspetta, gli altri possono passare
+        continue;
+      }
+    }
+
+    if (sendRaw(e.id, e.dlc, e.data)) 
+    {
+      if (s_shaping) 
+      {
+        if (s_total.rateBps) s_total.tokens -= cost;
+        if (own)             own->tokens    -= cost;
+      }
+      s_tx.sent++;
+      txRemove(i);
+      continue; // prova a riempire la mailbox successiva
+    }
+
+    s_tx.retries++;
+    e.lastTry_us = now;
+    if (++e.tries < CANM_TX_MAX_TRIES) 
+    {
+      return;
+    }
+    Serial.print(F("[CAN] TX drop id=0x")); 
+    Serial.println(e.id, HEX);
+    s_tx.dropsRetry++;
+    txRemove(i);
+    CAPM::trigger();
+  }
+}
+
+bool txPending() 
+{
+  return s_txLen > 0;
+}
+
+const TxStats& txStats() 
+{
+  return s_tx;
+}
+
+// ----- codifica per campo -----
+const CanMessageSpec* findSpec(const std::vector<CanMessageSpec>& specs, const char* name) 
+{
+  for (auto& m : specs) if (m.name == name) return &m;
+  return nullptr;
+}
+
+void setBoolField(const FieldSpec& f, uint8_t data[8], bool v)
+{
+  if (f.offset + f.size > 8) return;
+  uint8_t* p = data + f.offset;
+  if (f.bit != 0xFF) p[0] = v ? (p[0] | (1u << f.bit)) : (p[0] & ~(1u << f.bit));
+  else               writeValue<uint8_t>(p, v ? 1 : 0, f.endian, f.size);
+}
+
+static bool encodeOneField(const FieldSpec& f, const char* v, uint8_t* p) 
+{
+  char* end;
+  switch (f.type) 
+  {
+    case FieldType::Bool: {
+      bool b;
+      if (!strToBool(v, b)) return false;
+      if (f.bit != 0xFF) p[0] = b ? (p[0] | (1u << f.bit)) : (p[0] & ~(1u << f.bit));
+      else               writeValue<uint8_t>(p, b ? 1 : 0, f.endian, f.size);
+    } break;
+    case FieldType::Uint16: {
+      double d = strtod(v, &end);
+      if (end == v) return false;
+      writeValue<uint16_t>(p, (uint16_t)(d * f.scale), f.endian, f.size);
+    } break;
+    case FieldType::Int16: {
+      double d = strtod(v, &end);
+      if (end == v) return false;
+      writeValue<int16_t>(p, (int16_t)(d * f.scale), f.endian, f.size);
+    } break;
+    case FieldType::Float32: {
+      double d = strtod(v, &end);
+      if (end == v) return false;
+      writeValue<float>(p, (float)(d * f.scale), f.endian, f.size);
+    } break;
+    default: return false;
+  }
+  return true;
+}
+
+bool encodeFields(const CanMessageSpec& spec, const char* const* kv, uint8_t kvCount, uint8_t out[8]) 
+{
+  memset(out, 0, 8);
+  for (uint8_t i = 0; i < kvCount; ++i) 
+  {
+    const char* eq = strchr(kv[i], '=');
+    if (!eq) return false;
+
+    const FieldSpec* fs = nullptr;
+    size_t klen = (size_t)(eq - kv[i]);
+    for (auto& f : spec.fields) 
+    {
+      if (f.name.length() == klen && !strncmp(f.name.c_str(), kv[i], klen)) { fs = &f; break; }
+    }
+    if (!fs || fs->offset + fs->size > spec.dlc) return false;
+    if (!encodeOneField(*fs, eq + 1, &out[fs->offset])) return false;
+  }
+  return true;
+}
+
+bool sendByName(const std::vector<CanMessageSpec>& specs, const char* name, const char* const* kv, uint8_t kvCount) 
+{
+  const CanMessageSpec* spec = findSpec(specs, name);
+  if (!spec) return false;
+
+  uint8_t data[8];
+  if (!encodeFields(*spec, kv, kvCount, data)) return false;
+  return enqueue(spec->id, spec->dlc, data);
 }
 
 static void printOneField(const FieldSpec& f, const uint8_t* p) 
@@ -20,7 +413,7 @@ static void printOneField(const FieldSpec& f, const uint8_t* p)
   switch (f.type) 
   {
     case FieldType::Bool: {
-      uint8_t v = readValue<uint8_t>(p, f.endian, f.size);
+      uint8_t v = (f.bit != 0xFF) ? ((p[0] >> f.bit) & 1) : readValue<uint8_t>(p, f.endian, f.size);
       Serial.print(v ? F("true") : F("false"));
     } break;
     case FieldType::Uint16: {
@@ -45,9 +438,10 @@ static void printOneField(const FieldSpec& f, const uint8_t* p)
 void prettyPrintRx(const std::vector<CanMessageSpec>& specs, const CanMsg& rx) {
   // trova spec per id
   const CanMessageSpec* spec=nullptr;
-  for (auto& m : specs) if (m.id == rx.id) { spec=&m; break; }
+  const uint32_t id = msgId(rx);
+  for (auto& m : specs) if (m.id == id) { spec=&m; break; }
 
-  Serial.print(F("[RX] id=0x")); Serial.print(rx.id, HEX);
+  Serial.print(F("[RX] id=0x")); Serial.print(id, HEX);
   Serial.print(F(" dlc=")); Serial.print(rx.data_length);
   Serial.print(F(" data:"));
   for (uint8_t i=0;i<rx.data_length;i++){ Serial.print(' '); Serial.print(rx.data[i], HEX); }
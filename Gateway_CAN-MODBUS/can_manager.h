@@ -4,14 +4,85 @@
 #include <vector>
 #include "utils.h"
 
+#ifndef CANM_TXQ_SIZE
+#define CANM_TXQ_SIZE      16    // frame in coda TX
+#endif
+#ifndef CANM_TX_MAX_TRIES
+#define CANM_TX_MAX_TRIES  20    // tentativi sulle mailbox prima di scartare il frame
+#endif
+#ifndef CANM_TX_RETRY_US
+#define CANM_TX_RETRY_US   500   // attesa minima tra due tentativi dello stesso frame
+#endif
+
 namespace CANM {
 
 bool begin(long bitrate);
+
+// Gli id del gateway (can.json, coda TX, cattura, replay) sono numeri senza
+// flag: oltre 0x7FF l'id e' a 29 bit e il frame e' esteso. msgId() toglie il
+// flag IDE che il core mette nell'id dei frame estesi ricevuti
+inline bool     isExtendedId(uint32_t id) { return id > 0x7FF; }
+inline uint32_t msgId(const CanMsg& m)    { return m.isExtendedId() ? m.getExtendedId() : m.getStandardId(); }
+CanMsg          makeMsg(uint32_t id, uint8_t dlc, const uint8_t* data);
+
+// Scrittura diretta sulle mailbox: false se sono tutte occupate
 bool sendRaw(uint32_t id, uint8_t dlc, const uint8_t data[8]);
 
-// Trasmissione “per nome” secondo spec + key=value dal terminale
+// ----- coda TX -----
+// La coda e' ordinata per id (id piu' basso = priorita' CAN piu' alta) e tiene
+// un solo frame per id: un nuovo valore sostituisce quello ancora in coda.
+// serviceTx() riempie le mailbox finche' le accettano; il frame in testa
+// riprova fino a CANM_TX_MAX_TRIES volte, poi viene scartato.
+struct TxStats {
+  uint32_t enqueued   = 0;
+  uint32_t replaced   = 0;  // valore in coda sovrascritto (stesso id)
+  uint32_t sent       = 0;
+  uint32_t retries    = 0;  // mailbox piene al tentativo
+  uint32_t dropsFull  = 0;  // coda piena
+  uint32_t dropsRetry = 0;  // tentativi esauriti
+  uint32_t shaped     = 0;  // frame trattenuti dallo shaper (una volta per valore in coda)
+  uint8_t  depth      = 0;
+  uint8_t  maxDepth   = 0;
+};
+
+// false solo se il frame e' stato scartato (coda piena di frame piu' prioritari)
+bool enqueue(uint32_t id, uint8_t dlc, const uint8_t data[8]);
+void serviceTx();
+bool txPending();
+const TxStats& txStats();
+
+// ----- tempo di bus e shaper -----
+// Bit di un frame dati classico, da SOF a fine intermissione (3 bit):
+//   standard 47 + 8*dlc, esteso 67 + 8*dlc.
+// Nel caso peggiore si aggiunge un bit di stuffing ogni 4 dopo il primo
+// nella zona soggetta (SOF..CRC): floor((34 + 8*dlc - 1) / 4) standard,
+// floor((54 + 8*dlc - 1) / 4) esteso. Frame standard da 8 byte: 111..135 bit.
+uint16_t frameBits(uint8_t dlc, bool extended, bool worstStuffing);
+uint32_t frameUs(uint8_t dlc, bool extended, bool worstStuffing);
+
+// Token bucket (in bit, a stuffing peggiore) per id con max_rate_hz e sul
+// totale (max_load_pct del bitrate). serviceTx() salta i frame di un id senza
+// credito e lascia passare quelli degli altri id; senza credito totale si ferma.
+// Chiamare dopo begin().
+void shaperBegin(const CanShaperConfig& cfg, const std::vector<CanMessageSpec>& specs);
+
+// Quota di bus pianificata dalle regole MB2CAN (periodo delle risorse sorgente)
+void loadReport(Print& out, const std::vector<CanMessageSpec>& specs, const std::vector<MappingRule>& rules);
+
+// Codifica "per campo" di un payload secondo la spec: kv = {"fan_speed=1200", "fan_on=1", ...}
+// Valori in unita' ingegneristiche (raw = valore * scale), campi non citati a 0.
+// Nessuna allocazione: i token puntano nel buffer del chiamante.
+bool encodeFields(const CanMessageSpec& spec, const char* const* kv, uint8_t kvCount, uint8_t out[8]);
+
+// Scrive un campo bool nel payload (bit singolo o byte intero)
+void setBoolField(const FieldSpec& f, uint8_t data[8], bool v);
+
+// Trasmissione “per nome” secondo spec + key=value dal terminale (via coda TX)
 // Esempio cmd: TXN CAN_CMD fan_speed=1200 fan_on=1
-bool sendByName(const std::vector<CanMessageSpec>& specs, const String& name, const std::vector<String>& kvPairs);
+bool sendByName(const std::vector<CanMessageSpec>& specs, const char* name, const char* const* kv, uint8_t kvCount);
+
+// Ricerca spec per nome senza allocare String
+const CanMessageSpec* findSpec(const std::vector<CanMessageSpec>& specs, const char* name);
 
 // Decodifica e stampa un frame ricevuto usando la spec (se c’è match id)
 void prettyPrintRx(const std::vector<CanMessageSpec>& specs, const CanMsg& rx);
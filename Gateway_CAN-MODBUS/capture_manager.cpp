@@ -0,0 +1,328 @@
+#include "capture_manager.h"
+#include "sd_manager.h"
+
+namespace CAPM {
+
+static_assert(CAPM_BLOCKS >= 2, "servono almeno due blocchi (doppio buffer)");
+
+static Config   s_cfg;
+static Stats    s_stats;
+static bool     s_inited = false;
+
+// anello di blocchi: s_head = blocco in riempimento, s_tail..s_head-1 = blocchi chiusi
+static uint8_t  s_blocks[CAPM_BLOCKS][CAPM_BLOCK_SIZE];
+static uint32_t s_lastMs[CAPM_BLOCKS];     // millis() dell'ultimo record del blocco
+static uint8_t  s_head   = 0;
+static uint8_t  s_tail   = 0;
+static uint8_t  s_sealed = 0;              // blocchi chiusi in attesa di SD
+static uint32_t s_seq    = 0;
+static uint32_t s_dropsPending = 0;        // drop da riportare nel prossimo header
+
+static File     s_file;
+static uint32_t s_fileBytes = 0;
+static uint8_t  s_sinceFlush = 0;
+static bool     s_backoff = false;         // SD in errore: si riprova dopo CAPM_RETRY_MS
+static uint32_t s_failMs  = 0;
+
+// rotazione a passi, uno per service(): chiusura, verifica del nome,
+// apertura, salvataggio dell'indice; il blocco resta in coda nel frattempo
+enum class Rot : uint8_t { None, Probe, Open, SaveIdx };
+static Rot      s_rot = Rot::Probe;
+
+static const char IDX_PATH[] = "/CAP.IDX";
+
+static BlockHdr* hdr(uint8_t i)
+{
+  return reinterpret_cast<BlockHdr*>(s_blocks[i]);
+}
+
+static void openBlock(uint8_t i)
+{
+  BlockHdr* h = hdr(i);
+  memcpy(h->magic, "GWCP", 4);
+  h->seq   = s_seq++;
+  h->t_ms  = millis();
+  h->used  = sizeof(BlockHdr);
+  h->drops = 0;
+  s_lastMs[i] = h->t_ms;
+}
+
+static void dropTail()
+{
+  s_tail = (s_tail + 1) % CAPM_BLOCKS;
+  s_sealed--;
+}
+
+// chiude il blocco corrente e ne apre uno nuovo; false se l'anello e' pieno
+static bool seal()
+{
+  if (s_sealed >= CAPM_BLOCKS - 1)
+  {
+    if (!s_cfg.preTrigger || s_stats.triggered)
+    {
+      return false;
+    }
+    dropTail(); // pre-trigger: si perde la storia piu' vecchia, non e' un drop
+  }
+
+  BlockHdr* h = hdr(s_head);
+  memset(&s_blocks[s_head][h->used], 0, CAPM_BLOCK_SIZE - h->used);
+
+  s_head = (s_head + 1) % CAPM_BLOCKS;
+  s_sealed++;
+  openBlock(s_head);
+  // i record persi sono arrivati dopo l'ultimo del blocco chiuso: si contano
+  // nell'header del blocco che li segue
+  hdr(s_head)->drops = s_dropsPending > 0xFFFF ? 0xFFFF : (uint16_t)s_dropsPending;
+  s_dropsPending = 0;
+  return true;
+}
+
+static uint8_t* reserve(RecType type, uint8_t len)
+{
+  if (!s_inited) return nullptr;
+
+  uint16_t need = sizeof(RecHdr) + len;
+  if (hdr(s_head)->used + need > CAPM_BLOCK_SIZE && !seal())
+  {
+    s_stats.drops++;
+    s_dropsPending++;
+    return nullptr;
+  }
+
+  BlockHdr* h = hdr(s_head);
+  RecHdr rh;
+  rh.t_us = micros();
+  rh.type = (uint8_t)type;
+  rh.len  = len;
+  memcpy(&s_blocks[s_head][h->used], &rh, sizeof(rh));
+
+  uint8_t* payload = &s_blocks[s_head][h->used + sizeof(RecHdr)];
+  h->used += need;
+  s_lastMs[s_head] = millis();
+  s_stats.records++;
+  return payload;
+}
+
+static void nextFileIndex()
+{
+  s_stats.fileIndex = (s_stats.fileIndex + 1) % CAPM_FILE_WRAP;
+}
+
+static void saveFileIndex()
+{
+  uint32_t next = (s_stats.fileIndex + 1) % CAPM_FILE_WRAP;
+  File f = SDM_openTruncate(IDX_PATH);
+  if (!f) return;  // al prossimo boot si salta solo qualche nome gia' preso
+  f.write(reinterpret_cast<const uint8_t*>(&next), sizeof(next));
+  f.close();
+}
+
+static void filePath(char* path, size_t len)
+{
+  snprintf(path, len, "/CAP%05u.BIN", (unsigned)(s_stats.fileIndex % CAPM_FILE_WRAP));
+}
+
+// Un solo nome per chiamata: se e' gia' sulla SD si passa al successivo al
+// prossimo service()
+static bool nameFree()
+{
+  char path[20];
+  filePath(path, sizeof(path));
+  if (!SDM_exists(path)) return true;
+  nextFileIndex();
+  return false;
+}
+
+static bool openFile()
+{
+  char path[20];
+  filePath(path, sizeof(path));
+  s_file = SDM_openAppend(path);
+  s_fileBytes = 0;
+  s_sinceFlush = 0;
+  if (!s_file)
+  {
+    Serial.print(F("[CAP] open FAIL "));
+    Serial.println(path);
+    return false;
+  }
+  Serial.print(F("[CAP] file "));
+  Serial.println(path);
+  return true;
+}
+
+static void sdFailed(uint32_t now)
+{
+  s_stats.sdErrors++;
+  s_backoff = true;
+  s_failMs  = now;
+}
+
+bool begin(const Config& cfg)
+{
+  s_cfg   = cfg;
+  s_stats = Stats();
+  s_head = s_tail = s_sealed = 0;
+  s_seq = 0;
+  s_dropsPending = 0;
+  s_backoff = false;
+  s_rot = Rot::Probe;
+  s_inited = cfg.enabled;
+  if (!s_inited) return true;
+
+  // riparte dopo l'ultimo file del boot precedente (0 se l'indice manca)
+  uint32_t idx = 0;
+  if (SDM_readBin(IDX_PATH, reinterpret_cast<uint8_t*>(&idx), sizeof(idx)) == (int32_t)sizeof(idx))
+  {
+    s_stats.fileIndex = idx % CAPM_FILE_WRAP;
+  }
+
+  s_stats.triggered = !cfg.preTrigger;
+  openBlock(s_head);
+  return true;
+}
+
+void logCan(RecType type, uint32_t id, uint8_t dlc, const uint8_t* data)
+{
+  if (dlc > 8) dlc = 8;
+  uint8_t* p = reserve(type, 4 + dlc);
+  if (!p) return;
+  memcpy(p, &id, 4);
+  memcpy(p + 4, data, dlc);
+}
+
+void logModbus(RecType type, uint8_t slave, uint8_t fn, uint16_t addr,
+               const uint16_t* regs, uint16_t count, uint8_t status)
+{
+  // header fisso 7 byte + registri (troncati a quanto sta in un record)
+  uint16_t n = regs ? count : 0;
+  if (n > (255 - 7) / 2) n = (255 - 7) / 2;
+
+  uint8_t* p = reserve(type, (uint8_t)(7 + 2 * n));
+  if (!p) return;
+  p[0] = slave;
+  p[1] = fn;
+  memcpy(p + 2, &addr, 2);
+  memcpy(p + 4, &count, 2);
+  p[6] = status;
+  if (n) memcpy(p + 7, regs, 2 * n);
+}
+
+void trigger()
+{
+  if (!s_inited || s_stats.triggered) return;
+  s_stats.triggered = true;
+  Serial.println(F("[CAP] trigger"));
+}
+
+void service()
+{
+  if (!s_inited) return;
+  uint32_t now = millis();
+
+  // un blocco parziale non resta in RAM per sempre
+  if (hdr(s_head)->used > sizeof(BlockHdr) && now - hdr(s_head)->t_ms >= s_cfg.sealMs)
+  {
+    seal();
+  }
+
+  if (!s_stats.triggered)
+  {
+    // pre-trigger: si tengono solo i blocchi degli ultimi preMs
+    while (s_sealed && now - s_lastMs[s_tail] > s_cfg.preMs)
+    {
+      dropTail();
+    }
+    s_stats.pending = s_sealed;
+    return;
+  }
+
+  if (s_sealed == 0)
+  {
+    s_stats.pending = 0;
+    return;
+  }
+
+  if (s_backoff && now - s_failMs < CAPM_RETRY_MS)
+  {
+    // SD in errore: il blocco si perde senza toccare la SD, la cattura continua
+    s_stats.blocksLost++;
+    dropTail();
+    s_stats.pending = s_sealed;
+    return;
+  }
+  s_backoff = false;
+
+  // un solo accesso SD per chiamata anche durante la rotazione
+  if (s_rot == Rot::None && s_file && s_fileBytes >= s_cfg.rotateBytes)
+  {
+    s_file.close();
+    nextFileIndex();
+    s_rot = Rot::Probe;
+    s_stats.pending = s_sealed;
+    return;
+  }
+  switch (s_rot)
+  {
+    case Rot::Probe:
+      if (nameFree()) s_rot = Rot::Open;
+      s_stats.pending = s_sealed;
+      return;
+
+    case Rot::Open:
+      if (!openFile())
+      {
+        s_rot = Rot::Probe;
+        sdFailed(now);
+        s_stats.blocksLost++;
+        dropTail();
+      } else
+      {
+        s_rot = Rot::SaveIdx;
+      }
+      s_stats.pending = s_sealed;
+      return;
+
+    case Rot::SaveIdx:
+      saveFileIndex();
+      s_rot = Rot::None;
+      s_stats.pending = s_sealed;
+      return;
+
+    case Rot::None:
+      break;
+  }
+
+  size_t w = s_file.write(s_blocks[s_tail], CAPM_BLOCK_SIZE);
+  if (w != CAPM_BLOCK_SIZE)
+  {
+    sdFailed(now);
+    s_stats.blocksLost++;
+    s_file.close();
+    s_rot = Rot::Probe;
+  } else
+  {
+    s_stats.blocksWritten++;
+    s_fileBytes += CAPM_BLOCK_SIZE;
+    if (++s_sinceFlush >= 16)
+    {
+      s_file.flush(); // aggiorna la FAT ogni 8 KB
+      s_sinceFlush = 0;
+    }
+  }
+  dropTail();
+  s_stats.pending = s_sealed;
+}
+
+bool hasPending()
+{
+  return s_inited && s_stats.triggered && s_sealed > 0;
+}
+
+const Stats& stats()
+{
+  return s_stats;
+}
+
+} // namespace
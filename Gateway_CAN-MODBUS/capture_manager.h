@@ -0,0 +1,88 @@
+#pragma once
+#include <Arduino.h>
+#include "utils.h"
+
+// Cattura binaria del traffico CAN / Modbus su SD.
+//
+// I record finiscono in un anello di blocchi da 512 byte in RAM; service()
+// scrive su SD al massimo UN blocco completo per chiamata, quindi i file
+// crescono solo a settori interi e loop() non resta mai bloccato su SD.
+// Anche la rotazione dei file procede un accesso SD per chiamata.
+// Se la SD non tiene il passo i nuovi record vengono scartati (drops).
+//
+// Formato blocco (little endian):
+//   BlockHdr (16 byte) + record { u32 t_us, u8 type, u8 len, payload[len] }
+//   CanRx/CanTx : u32 id, data[dlc]            (len = 4 + dlc)
+//   MbReq/MbResp: u8 slave, u8 fn, u16 addr, u16 count, u8 status, regs[]
+// Il resto del blocco e' riempito con zeri (type 0 = padding).
+
+#ifndef CAPM_BLOCKS
+#define CAPM_BLOCKS 8            // blocchi in RAM (min 2 = doppio buffer)
+#endif
+#define CAPM_BLOCK_SIZE 512
+
+// File /CAPnnnnn.BIN (8.3): l'indice riparte da 0 dopo 99999. Il prossimo
+// indice libero si salva in /CAP.IDX, cosi' al boot non si scandisce la SD
+#define CAPM_FILE_WRAP 100000UL
+
+#ifndef CAPM_RETRY_MS
+#define CAPM_RETRY_MS 1000       // dopo un errore SD niente accessi per questo tempo
+#endif
+
+namespace CAPM {
+
+enum class RecType : uint8_t { Pad = 0, CanRx = 1, CanTx = 2, MbReq = 3, MbResp = 4, Marker = 5 };
+
+#pragma pack(push, 1)
+struct BlockHdr {
+  char     magic[4];   // "GWCP"
+  uint32_t seq;        // numero progressivo del blocco
+  uint32_t t_ms;       // millis() all'apertura del blocco
+  uint16_t used;       // byte validi, header compreso
+  uint16_t drops;      // record persi tra il blocco precedente e questo (saturato)
+};
+
+struct RecHdr {
+  uint32_t t_us;       // micros() al momento del record
+  uint8_t  type;       // RecType
+  uint8_t  len;        // byte di payload
+};
+#pragma pack(pop)
+
+struct Config {
+  bool     enabled        = false;
+  bool     preTrigger     = false;           // tiene in RAM solo gli ultimi preMs fino a trigger()
+  uint32_t preMs          = 5000;
+  uint32_t rotateBytes    = 4UL * 1024 * 1024; // nuova file oltre questa dimensione
+  uint32_t sealMs         = 1000;            // chiude un blocco parziale dopo questo tempo
+};
+
+struct Stats {
+  uint32_t records       = 0;
+  uint32_t drops         = 0;  // record persi perche' la RAM era piena
+  uint32_t blocksWritten = 0;
+  uint32_t blocksLost    = 0;  // blocchi chiusi ma non scritti (errore SD)
+  uint32_t sdErrors      = 0;
+  uint32_t fileIndex     = 0;
+  uint8_t  pending       = 0;  // blocchi pronti non ancora su SD
+  bool     triggered     = false;
+};
+
+bool begin(const Config& cfg);
+
+void logCan(RecType type, uint32_t id, uint8_t dlc, const uint8_t* data);
+void logModbus(RecType type, uint8_t slave, uint8_t fn, uint16_t addr,
+               const uint16_t* regs, uint16_t count, uint8_t status);
+
+// In modalita' pre-trigger: da qui in poi tutto (anche la storia in RAM) va su SD
+void trigger();
+
+// Da chiamare a ogni giro di loop(): al massimo una scrittura da 512 byte
+void service();
+
+// true se ci sono blocchi da scrivere (il loop non deve dormire)
+bool hasPending();
+
+const Stats& stats();
+
+} // namespace
@@ -0,0 +1,402 @@
+#include "console.h"
+#include "can_manager.h"
+#include "capture_manager.h"
+#include "modbus_manager.h"
+#include "profiler.h"
+#include "poll_planner.h"
+#include "group_writer.h"
+#include "events.h"
+
+namespace CONS {
+
+static const std::vector<CanMessageSpec>* s_msgs  = nullptr;
+static const std::vector<MappingRule>*    s_rules = nullptr;
+static Handlers s_h;
+
+static char    s_line[CONS_LINE_LEN];
+static uint8_t s_len = 0;
+static bool    s_overflow = false;
+
+// ----- burst -----
+enum class BurstMode : uint8_t { None, Txn, Inj };
+
+struct Burst {
+  BurstMode mode = BurstMode::None;
+  uint32_t  id = 0;
+  uint8_t   dlc = 0;
+  uint8_t   data[8] = {0};
+  uint32_t  remaining = 0;
+  uint32_t  periodUs = 0;
+  uint32_t  nextUs = 0;
+  uint32_t  startUs = 0;
+  uint32_t  done = 0;
+  uint32_t  fails = 0;     // frame rifiutati dalla coda TX
+};
+static Burst s_burst;
+
+// ----- elenchi (una riga per service()) -----
+enum class ListKind : uint8_t { None, Msgs, Rules };
+static ListKind s_list = ListKind::None;
+static uint16_t s_listIdx = 0;
+
+void begin(const std::vector<CanMessageSpec>& msgs,
+           const std::vector<MappingRule>& rules,
+           const Handlers& h)
+{
+  s_msgs  = &msgs;
+  s_rules = &rules;
+  s_h     = h;
+  s_len   = 0;
+  s_overflow = false;
+  s_burst = Burst();
+  s_list  = ListKind::None;
+}
+
+// spezza la riga sul posto: spazi -> terminatori
+static uint8_t tokenize(char* line, char** tok, uint8_t maxTok)
+{
+  uint8_t n = 0;
+  char* p = line;
+  while (*p && n < maxTok)
+  {
+    while (*p == ' ' || *p == '\t') *p++ = 0;
+    if (!*p) break;
+    tok[n++] = p;
+    while (*p && *p != ' ' && *p != '\t') p++;
+  }
+  while (*p == ' ' || *p == '\t') *p++ = 0;
+  return *p ? 0xFF : n; // 0xFF = troppi token
+}
+
+static int8_t hexNibble(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// "B00401", "B0 04 01" (piu' token) -> byte
+static bool parseHexBytes(char* const* tok, uint8_t n, uint8_t out[8], uint8_t& dlc)
+{
+  dlc = 0;
+  for (uint8_t t = 0; t < n; ++t)
+  {
+    for (const char* p = tok[t]; *p; p += 2)
+    {
+      int8_t hi = hexNibble(p[0]);
+      int8_t lo = p[1] ? hexNibble(p[1]) : -1;
+      if (hi < 0 || lo < 0 || dlc >= 8) return false;
+      out[dlc++] = (uint8_t)((hi << 4) | lo);
+    }
+  }
+  return true;
+}
+
+static bool parseU32(const char* s, uint32_t& v)
+{
+  char* end;
+  v = strtoul(s, &end, 0);
+  return end != s && *end == 0;
+}
+
+static void inject(uint32_t id, uint8_t dlc, const uint8_t* data)
+{
+  s_h.inject(CANM::makeMsg(id, dlc, data));
+}
+
+// <msg> k=v ... -> id/dlc/data tramite le FieldSpec
+static bool encodeNamed(char* const* tok, uint8_t n, uint32_t& id, uint8_t& dlc, uint8_t data[8])
+{
+  if (n < 1) return false;
+  const CanMessageSpec* spec = CANM::findSpec(*s_msgs, tok[0]);
+  if (!spec)
+  {
+    Serial.print(F("[CONS] messaggio sconosciuto: "));
+    Serial.println(tok[0]);
+    return false;
+  }
+  if (!CANM::encodeFields(*spec, tok + 1, n - 1, data))
+  {
+    Serial.println(F("[CONS] campi non validi"));
+    return false;
+  }
+  id  = spec->id;
+  dlc = spec->dlc;
+  return true;
+}
+
+static void printHelp()
+{
+  Serial.println(F("[CONS] TXN|INJ <msg> k=v.. | TX <id> <hex> | BURST <n> <hz> TXN|INJ <msg> k=v.. | BURST STOP"));
+  Serial.println(F("[CONS] STAT | MSGS | RULES | PLAN | GROUP | BUS | CAP TRIG | PROF [TRACE|RESET] | HELP"));
+}
+
+static void printStat()
+{
+  const CANM::TxStats& tx = CANM::txStats();
+  Serial.print(F("[STAT] txq depth=")); Serial.print(tx.depth);
+  Serial.print(F(" max="));      Serial.print(tx.maxDepth);
+  Serial.print(F(" enq="));      Serial.print(tx.enqueued);
+  Serial.print(F(" repl="));     Serial.print(tx.replaced);
+  Serial.print(F(" sent="));     Serial.print(tx.sent);
+  Serial.print(F(" retry="));    Serial.print(tx.retries);
+  Serial.print(F(" dropFull=")); Serial.print(tx.dropsFull);
+  Serial.print(F(" dropRetry="));Serial.print(tx.dropsRetry);
+  Serial.print(F(" shaped="));   Serial.println(tx.shaped);
+
+  const EVQ::Stats& ev = EVQ::stats();
+  Serial.print(F("[STAT] evq posted=")); Serial.print(ev.posted);
+  Serial.print(F(" dropped="));  Serial.print(ev.dropped);
+  Serial.print(F(" maxDepth=")); Serial.print(ev.maxDepth);
+  Serial.print(F(" wakeups="));  Serial.println(ev.wakeups);
+
+  const CAPM::Stats& cap = CAPM::stats();
+  Serial.print(F("[STAT] cap rec=")); Serial.print(cap.records);
+  Serial.print(F(" drops="));    Serial.print(cap.drops);
+  Serial.print(F(" blocks="));   Serial.print(cap.blocksWritten);
+  Serial.print(F(" lost="));     Serial.print(cap.blocksLost);
+  Serial.print(F(" pending="));  Serial.print(cap.pending);
+  Serial.print(F(" trig="));     Serial.println(cap.triggered ? 1 : 0);
+
+  const MBM::SlaveStats& sl = MBM::slaveStats();
+  Serial.print(F("[STAT] mbs req=")); Serial.print(sl.requests);
+  Serial.print(F(" rep="));      Serial.print(sl.replies);
+  Serial.print(F(" exc="));      Serial.print(sl.exceptions);
+  Serial.print(F(" crc="));      Serial.print(sl.crcErrors);
+  Serial.print(F(" altri="));    Serial.println(sl.foreign);
+
+  for (uint8_t i = 0; i < MBM::lineCount(); ++i)
+  {
+    const MBM::LineStats& ls = MBM::lineStats(i);
+    Serial.print(F("[STAT] mb "));  Serial.print(MBM::lineName(i));
+    Serial.print(F(" req="));       Serial.print(ls.requests);
+    Serial.print(F(" err="));       Serial.print(ls.errors);
+    Serial.print(F(" tmo="));       Serial.print(ls.timeouts);
+    Serial.print(F(" bcast="));     Serial.print(ls.broadcasts);
+    Serial.print(F(" full="));      Serial.print(ls.queueFull);
+    Serial.print(F(" maxQ="));      Serial.println(ls.maxQueue);
+  }
+
+  Serial.print(F("[STAT] burst "));
+  if (s_burst.mode == BurstMode::None)
+  {
+    Serial.println(F("fermo"));
+  } else
+  {
+    Serial.print(F("fatti="));    Serial.print(s_burst.done);
+    Serial.print(F(" restano=")); Serial.print(s_burst.remaining);
+    Serial.print(F(" fail="));    Serial.println(s_burst.fails);
+  }
+}
+
+static void burstEnd()
+{
+  uint32_t dt = micros() - s_burst.startUs;
+  Serial.print(F("[CONS] burst fine: n=")); Serial.print(s_burst.done);
+  Serial.print(F(" fail="));  Serial.print(s_burst.fails);
+  Serial.print(F(" t_ms="));  Serial.println(dt / 1000);
+  s_burst.mode = BurstMode::None;
+}
+
+// BURST <n> <hz> TXN|INJ <msg> k=v ...
+static void cmdBurst(char* const* tok, uint8_t n)
+{
+  if (n == 2 && strEqI(tok[1], "STOP"))
+  {
+    if (s_burst.mode != BurstMode::None) burstEnd();
+    return;
+  }
+
+  uint32_t count, hz;
+  if (n < 5 || !parseU32(tok[1], count) || !parseU32(tok[2], hz) || count == 0 || hz == 0)
+  {
+    Serial.println(F("[CONS] uso: BURST <n> <hz> TXN|INJ <msg> k=v .."));
+    return;
+  }
+
+  BurstMode mode;
+  if      (strEqI(tok[3], "TXN")) mode = BurstMode::Txn;
+  else if (strEqI(tok[3], "INJ")) mode = BurstMode::Inj;
+  else
+  {
+    Serial.println(F("[CONS] modo burst: TXN o INJ"));
+    return;
+  }
+  if (mode == BurstMode::Inj && !s_h.inject)
+  {
+    Serial.println(F("[CONS] INJ non disponibile"));
+    return;
+  }
+
+  Burst b;
+  if (!encodeNamed(tok + 4, n - 4, b.id, b.dlc, b.data)) return;
+  b.mode      = mode;
+  b.remaining = count;
+  b.periodUs  = hz >= 1000000UL ? 1 : 1000000UL / hz;
+  b.startUs   = micros();
+  b.nextUs    = b.startUs;
+  s_burst = b;
+
+  Serial.print(F("[CONS] burst n=")); Serial.print(count);
+  Serial.print(F(" periodo_us="));    Serial.println(b.periodUs);
+}
+
+static void execute(char* line)
+{
+  // PROF, PLAN e GROUP hanno il loro parser: ricevono la riga intatta
+  if (PROF::handleCommand(line)) return;
+  if (PLN::handleCommand(line)) return;
+  if (GRP::handleCommand(line)) return;
+
+  char*   tok[CONS_MAX_TOKENS];
+  uint8_t n = tokenize(line, tok, CONS_MAX_TOKENS);
+  if (n == 0) return;
+  if (n == 0xFF)
+  {
+    Serial.println(F("[CONS] troppi argomenti"));
+    return;
+  }
+
+  uint32_t id; uint8_t dlc; uint8_t data[8];
+
+  if (strEqI(tok[0], "TXN"))
+  {
+    if (!encodeNamed(tok + 1, n - 1, id, dlc, data)) return;
+    Serial.println(CANM::enqueue(id, dlc, data) ? F("[CONS] TXN in coda") : F("[CONS] coda TX piena"));
+  }
+  else if (strEqI(tok[0], "INJ"))
+  {
+    if (!s_h.inject) { Serial.println(F("[CONS] INJ non disponibile")); return; }
+    if (!encodeNamed(tok + 1, n - 1, id, dlc, data)) return;
+    inject(id, dlc, data);
+  }
+  else if (strEqI(tok[0], "TX"))
+  {
+    memset(data, 0, sizeof(data));
+    if (n < 2 || !parseU32(tok[1], id) || id > 0x1FFFFFFF || !parseHexBytes(tok + 2, n - 2, data, dlc))
+    {
+      Serial.println(F("[CONS] uso: TX <id> <hex>"));
+      return;
+    }
+    Serial.println(CANM::enqueue(id, dlc, data) ? F("[CONS] TX in coda") : F("[CONS] coda TX piena"));
+  }
+  else if (strEqI(tok[0], "BURST"))
+  {
+    cmdBurst(tok, n);
+  }
+  else if (strEqI(tok[0], "STAT"))
+  {
+    printStat();
+  }
+  else if (strEqI(tok[0], "MSGS"))
+  {
+    s_list = ListKind::Msgs;
+    s_listIdx = 0;
+  }
+  else if (strEqI(tok[0], "RULES"))
+  {
+    s_list = ListKind::Rules;
+    s_listIdx = 0;
+  }
+  else if (strEqI(tok[0], "BUS"))
+  {
+    CANM::loadReport(Serial, *s_msgs, *s_rules);
+  }
+  else if (strEqI(tok[0], "CAP") && n == 2 && strEqI(tok[1], "TRIG"))
+  {
+    CAPM::trigger();
+  }
+  else if (strEqI(tok[0], "HELP"))
+  {
+    printHelp();
+  }
+  else
+  {
+    Serial.println(F("[CMD] sconosciuto (HELP)"));
+  }
+}
+
+void poll()
+{
+  while (Serial.available() > 0)
+  {
+    char c = (char)Serial.read();
+    if (c == '\r' || c == '\n')
+    {
+      bool over = s_overflow;
+      s_overflow = false;
+      if (s_len == 0 && !over) continue;
+      s_line[s_len] = 0;
+      s_len = 0;
+      if (over)
+      {
+        Serial.println(F("[CONS] riga troppo lunga"));
+      } else
+      {
+        execute(s_line);
+      }
+      return; // un comando per evento
+    }
+    if (s_len < CONS_LINE_LEN - 1) s_line[s_len++] = c;
+    else                           s_overflow = true;
+  }
+}
+
+static void listStep()
+{
+  if (s_list == ListKind::Msgs)
+  {
+    if (s_listIdx >= s_msgs->size()) { s_list = ListKind::None; return; }
+    const CanMessageSpec& m = (*s_msgs)[s_listIdx++];
+    Serial.print(F("[MSG] ")); Serial.print(m.name);
+    Serial.print(F(" id=0x")); Serial.print(m.id, HEX);
+    Serial.print(F(" dlc="));  Serial.print(m.dlc);
+    Serial.print(F(" :"));
+    for (auto& f : m.fields)
+    {
+      Serial.print(' ');
+      Serial.print(f.name);
+    }
+    Serial.println();
+  } else if (s_list == ListKind::Rules)
+  {
+    if (s_listIdx >= s_rules->size()) { s_list = ListKind::None; return; }
+    const MappingRule& r = (*s_rules)[s_listIdx];
+    Serial.print(F("[RULE] ")); Serial.print(s_listIdx++);
+    Serial.print(r.dir == RuleDir::MB2CAN ? F(" MB2CAN ") : F(" CAN2MB "));
+    Serial.print(r.from); Serial.print(F(" -> ")); Serial.print(r.to);
+    Serial.print(F(" pairs=")); Serial.println((int)r.pairs.size());
+  }
+}
+
+void service()
+{
+  if (s_list != ListKind::None) listStep();
+
+  if (s_burst.mode == BurstMode::None) return;
+
+  uint32_t now = micros();
+  for (uint8_t k = 0; k < CONS_BURST_STEP && s_burst.remaining; ++k)
+  {
+    if ((int32_t)(now - s_burst.nextUs) < 0) break;
+    if (s_burst.mode == BurstMode::Inj)
+    {
+      inject(s_burst.id, s_burst.dlc, s_burst.data);
+    } else if (!CANM::enqueue(s_burst.id, s_burst.dlc, s_burst.data))
+    {
+      s_burst.fails++;
+    }
+    s_burst.done++;
+    s_burst.remaining--;
+    s_burst.nextUs += s_burst.periodUs;
+  }
+  if (!s_burst.remaining) burstEnd();
+}
+
+bool busy()
+{
+  return s_list != ListKind::None || s_burst.mode != BurstMode::None;
+}
+
+} // namespace
@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+#include <Arduino_CAN.h>
+#include <vector>
+#include "utils.h"
+
+// Console comandi sulla seriale di debug.
+//
+// La riga arriva in un buffer fisso e viene spezzata in token sul posto:
+// niente String, niente heap. I payload "per nome" passano dalle FieldSpec
+// gia' caricate (CANM::encodeFields).
+//
+//   TXN <msg> k=v ...               accoda il frame sul bus (coda TX)
+//   INJ <msg> k=v ...               inietta il frame nel percorso RX locale (CAN2MB)
+//   TX  <id> <hex>                  frame grezzo, es. TX 0x101 B004 01
+//   BURST <n> <hz> TXN|INJ <msg> k=v ...   n frame a hz frame/s, senza bloccare loop()
+//   BURST STOP
+//   STAT                            statistiche coda TX, eventi, cattura, burst
+//   MSGS | RULES                    elenco (una riga per giro di loop)
+//   PLAN                            piano e carico della linea RS-485
+//   CAP TRIG                        trigger manuale della cattura
+//   PROF [TRACE|RESET]              profiler
+//   HELP
+
+#ifndef CONS_LINE_LEN
+#define CONS_LINE_LEN    96     // caratteri per riga (terminatore compreso)
+#endif
+#ifndef CONS_MAX_TOKENS
+#define CONS_MAX_TOKENS  12
+#endif
+#ifndef CONS_BURST_STEP
+#define CONS_BURST_STEP  16     // frame di burst al massimo per chiamata di service()
+#endif
+
+namespace CONS {
+
+struct Handlers {
+  // frame da trattare come se fosse arrivato dal bus
+  void (*inject)(const CanMsg& msg) = nullptr;
+};
+
+void begin(const std::vector<CanMessageSpec>& msgs,
+           const std::vector<MappingRule>& rules,
+           const Handlers& h);
+
+// Legge i byte disponibili ed esegue al massimo un comando
+void poll();
+
+// Avanza burst ed elenchi in corso (da chiamare a ogni giro di loop)
+void service();
+
+// true se c'e' un burst o un elenco in corso (il loop non deve dormire)
+bool busy();
+
+} // namespace
@@ -0,0 +1,100 @@
+#include "events.h"
+
+namespace EVQ {
+
+static_assert((EVQ_SIZE & (EVQ_SIZE - 1)) == 0, "EVQ_SIZE deve essere potenza di due");
+static_assert(EVQ_SIZE <= 128, "s_head/s_tail sono uint8_t: la profondita' deve stare in 7 bit");
+
+static Event             s_ring[EVQ_SIZE];
+static volatile uint8_t  s_head = 0;   // prossimo slot libero (produttori)
+static volatile uint8_t  s_tail = 0;   // prossimo evento da consumare (loop)
+static Stats             s_stats;
+
+bool post(EvType type, uint16_t arg)
+{
+  bool ok = false;
+  noInterrupts();
+  uint8_t depth = (uint8_t)(s_head - s_tail);
+  if (depth < EVQ_SIZE)
+  {
+    Event& e = s_ring[s_head & (EVQ_SIZE - 1)];
+    e.type = type;
+    e.arg  = arg;
+    s_head = s_head + 1;
+    s_stats.posted++;
+    if (depth + 1 > s_stats.maxDepth) s_stats.maxDepth = depth + 1;
+    ok = true;
+  } else
+  {
+    s_stats.dropped++;
+  }
+  interrupts();
+  return ok;
+}
+
+bool postUrgent(EvType type, uint16_t arg)
+{
+  bool ok = false;
+  noInterrupts();
+  uint8_t depth = (uint8_t)(s_head - s_tail);
+  if (depth < EVQ_SIZE)
+  {
+    uint8_t t = (uint8_t)(s_tail - 1);
+    Event& e = s_ring[t & (EVQ_SIZE - 1)];
+    e.type = type;
+    e.arg  = arg;
+    s_tail = t;
+    s_stats.posted++;
+    if (depth + 1 > s_stats.maxDepth) s_stats.maxDepth = depth + 1;
+    ok = true;
+  } else
+  {
+    s_stats.dropped++;
+  }
+  interrupts();
+  return ok;
+}
+
+bool pop(Event& out)
+{
+  if (s_head == s_tail) return false;
+  out = s_ring[s_tail & (EVQ_SIZE - 1)];
+  noInterrupts();
+  s_tail = s_tail + 1;
+  interrupts();
+  return true;
+}
+
+bool empty()
+{
+  return s_head == s_tail;
+}
+
+void idle()
+{
+  // un post() da interrupt tra il controllo del chiamante e wfi non deve
+  // farci dormire fino al tick successivo: si ricontrolla a interrupt
+  // disabilitati. wfi si sveglia comunque su un interrupt pendente anche con
+  // PRIMASK attivo, che viene servito subito dopo interrupts()
+  noInterrupts();
+  if (!empty())
+  {
+    interrupts();
+    return;
+  }
+#if defined(__arm__)
+  __asm volatile ("dsb" ::: "memory");
+  __asm volatile ("wfi");
+#elif defined(GW_HOST_SIM)
+  hostIdle();   // Host/sim: il tempo simulato salta al prossimo evento
+#endif
+  interrupts();
+  s_stats.wakeups++;
+}
+
+const Stats& stats()
+{
+  return s_stats;
+}
+
+} // namespace
@@ -0,0 +1,49 @@
+#pragma once
+#include <Arduino.h>
+
+// Coda eventi del main loop.
+//
+// Le sorgenti (ISR o loop) pubblicano eventi con post(); loop() li consuma
+// con pop() e, quando la coda e' vuota, chiama idle() che addormenta il core
+// (WFI) fino al prossimo interrupt: RX CAN, UART, USB o tick di millis().
+// post() e' sicura da ISR: l'aggiornamento degli indici avviene a interrupt
+// disabilitati.
+
+#ifndef EVQ_SIZE
+#define EVQ_SIZE 32   // potenza di due
+#endif
+
+namespace EVQ {
+
+enum class EvType : uint8_t {
+  CanRx,      // frame CAN in ricezione (arg non usato)
+  PollDue,    // risorsa Modbus da interrogare (arg = indice poller)
+  Console,    // byte disponibili sulla seriale di debug
+};
+
+struct Event {
+  EvType   type;
+  uint16_t arg;
+};
+
+struct Stats {
+  uint32_t posted   = 0;
+  uint32_t dropped  = 0;  // coda piena
+  uint32_t wakeups  = 0;  // ritorni da idle()
+  uint8_t  maxDepth = 0;
+};
+
+bool post(EvType type, uint16_t arg = 0);
+
+// In testa alla coda (solo dal loop): evento servito prima di quelli gia' in attesa
+bool postUrgent(EvType type, uint16_t arg = 0);
+bool pop(Event& out);
+bool empty();
+
+// dorme fino al prossimo interrupt (no-op su host); ritorna subito se nel
+// frattempo e' arrivato un evento
+void idle();
+
+const Stats& stats();
+
+} // namespace
@@ -0,0 +1,181 @@
+#include "group_writer.h"
+#include "capture_manager.h"
+
+namespace GRP {
+
+struct Group {
+  uint16_t                  rule = 0;
+  const ModbusResourceSpec* res  = nullptr;
+  const MbGroupSpec*        spec = nullptr;
+
+  // ultimo valore comandato: e' quello che la verifica si aspetta
+  uint16_t regs[MBM_JOB_WORDS];
+  uint16_t words   = 0;
+  uint32_t gen     = 0;      // cresce a ogni comando accodato
+  bool     written = false;  // almeno un broadcast uscito sulla linea
+
+  uint8_t  next      = 0;    // prossimo slave da rileggere
+  bool     verifying = false;
+  uint8_t  vSlave    = 0;
+  uint32_t vGen      = 0;
+  uint32_t lastVerifyMs = 0;
+};
+
+static std::vector<Group>   s_groups;
+static std::vector<int16_t> s_byRule;   // regola -> indice in s_groups (-1 = nessun gruppo)
+static Stats                s_stats;
+
+// parole confrontabili di una scrittura (FC05/06: una sola)
+static uint16_t writeWords(const ModbusResourceSpec& res)
+{
+  if (res.fn == ModbusFn::WriteSingle || res.fn == ModbusFn::WriteCoil) return 1;
+  return mbResourceWords(res);
+}
+
+void begin(const std::vector<MappingRule>& rules)
+{
+  s_groups.clear();
+  s_byRule.assign(rules.size(), -1);
+  s_stats = Stats();
+  for (uint16_t i = 0; i < rules.size(); ++i)
+  {
+    const MappingRule& r = rules[i];
+    if (r.dir != RuleDir::CAN2MB || !r.toModbus || !r.group.active()) continue;
+    Group g;
+    g.rule  = i;
+    g.res   = r.toModbus;
+    g.spec  = &r.group;
+    g.words = writeWords(*r.toModbus);
+    s_byRule[i] = (int16_t)s_groups.size();
+    s_groups.push_back(g);
+
+    Serial.print(F("[GRP] ")); Serial.print(r.toModbus->name);
+    Serial.print(r.group.broadcast ? F(" broadcast") : F(" unicast"));
+    Serial.print(F(" slave=")); Serial.print((int)r.group.slaves.size());
+    Serial.print(F(" verifica_ms=")); Serial.println(r.group.verify_ms);
+  }
+}
+
+bool isGroup(uint16_t ruleIdx)
+{
+  return ruleIdx < s_byRule.size() && s_byRule[ruleIdx] >= 0;
+}
+
+static void onBroadcastDone(const ModbusResourceSpec& res, bool, const uint16_t*, uint16_t, uint16_t gi)
+{
+  s_groups[gi].written = true;
+  Serial.print(F("[GRP] broadcast ")); Serial.println(res.name);
+}
+
+static void onGroupDone(const ModbusResourceSpec& res, uint8_t slaves, uint8_t failed, uint16_t)
+{
+  s_stats.failed += failed;
+  Serial.print(F("[GRP] ")); Serial.print(res.name);
+  Serial.print(F(" slave=")); Serial.print(slaves);
+  Serial.print(F(" senza conferma=")); Serial.println(failed);
+  if (failed) CAPM::trigger();
+}
+
+bool write(uint16_t ruleIdx, const uint16_t* regs, uint16_t count)
+{
+  if (!isGroup(ruleIdx)) return false;
+  uint16_t gi = (uint16_t)s_byRule[ruleIdx];
+  Group& g = s_groups[gi];
+
+  bool ok = g.spec->broadcast
+              ? MBM::submitWriteTo(*g.res, 0, regs, count, onBroadcastDone, gi)
+              : MBM::submitWriteGroup(*g.res, g.spec->slaves.data(), (uint8_t)g.spec->slaves.size(), regs, count,
+                                      onGroupDone, gi);
+  if (!ok)
+  {
+    s_stats.rejected++;
+    return false;
+  }
+  s_stats.commands++;
+  memcpy(g.regs, regs, g.words * sizeof(uint16_t));
+  g.gen++;
+  return true;
+}
+
+static bool sameValue(const Group& g, const uint16_t* regs, uint16_t words)
+{
+  if (words < g.words) return false;
+  if (isBitFn(g.res->fn))
+  {
+    uint16_t n = g.res->fn == ModbusFn::WriteCoil ? 1 : g.res->count;
+    for (uint16_t i = 0; i < n; ++i)
+    {
+      if (getBit(regs, i) != getBit(g.regs, i)) return false;
+    }
+    return true;
+  }
+  return memcmp(regs, g.regs, g.words * sizeof(uint16_t)) == 0;
+}
+
+// Rilettura di uno slave dopo i broadcast: un valore diverso si riscrive a
+// lui solo; uno slave muto si segnala e basta (riscriverlo costerebbe un
+// timeout di linea a ogni giro)
+static void onVerify(const ModbusResourceSpec& res, bool ok, const uint16_t* regs, uint16_t words, uint16_t gi)
+{
+  Group& g = s_groups[gi];
+  g.verifying = false;
+  if (g.vGen != g.gen) return;  // comando nuovo accodato nel frattempo: confronto non valido
+  s_stats.verifies++;
+  if (ok && sameValue(g, regs, words)) return;
+
+  s_stats.mismatches++;
+  Serial.print(F("[GRP] verifica FAIL ")); Serial.print(res.name);
+  Serial.print(F(" slave="));              Serial.print(g.vSlave);
+  Serial.println(ok ? F(" valore diverso") : F(" nessuna risposta"));
+  CAPM::trigger();
+
+  if (ok && MBM::submitWriteTo(res, g.vSlave, g.regs, g.words, nullptr, gi))
+  {
+    s_stats.repairs++;
+  }
+}
+
+void service(uint32_t nowMs)
+{
+  for (uint16_t gi = 0; gi < s_groups.size(); ++gi)
+  {
+    Group& g = s_groups[gi];
+    const MbGroupSpec& s = *g.spec;
+    if (!s.broadcast || !s.verify_ms || s.slaves.empty() || !g.written || g.verifying) continue;
+    if (nowMs - g.lastVerifyMs < s.verify_ms) continue;
+
+    uint8_t slave = s.slaves[g.next];
+    if (!MBM::submitReadBack(*g.res, slave, onVerify, gi)) continue;  // linea piena: al prossimo giro
+    g.next         = (uint8_t)((g.next + 1) % s.slaves.size());
+    g.verifying    = true;
+    g.vSlave       = slave;
+    g.vGen         = g.gen;
+    g.lastVerifyMs = nowMs;
+  }
+}
+
+const Stats& stats()
+{
+  return s_stats;
+}
+
+bool handleCommand(const char* line)
+{
+  if (strncmp(line, "GROUP", 5) != 0 || (line[5] && line[5] != ' ')) return false;
+  Serial.print(F("[GRP] comandi="));  Serial.print(s_stats.commands);
+  Serial.print(F(" rifiutati="));     Serial.print(s_stats.rejected);
+  Serial.print(F(" senza conferma="));Serial.print(s_stats.failed);
+  Serial.print(F(" verifiche="));     Serial.print(s_stats.verifies);
+  Serial.print(F(" diverse="));       Serial.print(s_stats.mismatches);
+  Serial.print(F(" riscritture="));   Serial.println(s_stats.repairs);
+  for (auto& g : s_groups)
+  {
+    Serial.print(F("  "));            Serial.print(g.res->name);
+    Serial.print(g.spec->broadcast ? F(" broadcast") : F(" unicast"));
+    Serial.print(F(" slave="));       Serial.print((int)g.spec->slaves.size());
+    Serial.print(F(" verifica_ms=")); Serial.println(g.spec->verify_ms);
+  }
+  return true;
+}
+
+} // namespace
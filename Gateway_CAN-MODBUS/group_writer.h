@@ -0,0 +1,53 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "utils.h"
+#include "modbus_manager.h"
+
+// Scritture CAN2MB verso gruppi di slave identici ("group" della regola in
+// mapping.json), per esempio la velocita' di tutti i ventilatori di un quadro.
+//
+//   broadcast: un solo frame a id 0 sulla linea della risorsa, nessuna
+//              risposta: costa un tempo di frame piu' la pausa di
+//              broadcast della linea (broadcast_turnaround_ms, 100 ms di
+//              default come da spec) invece di un giro richiesta/risposta
+//              per slave. Con
+//              verify_ms e la lista "slaves", uno slave alla volta viene
+//              riletto ogni verify_ms; se non ha il valore atteso gli si
+//              riscrive in unicast, se non risponde lo si segnala soltanto.
+//   unicast:   la stessa scrittura a ogni slave della lista, in fila nel
+//              motore della linea senza ripassare dal loop; una riga di log
+//              per comando, non per slave.
+//
+// Esempio:
+//   "group": { "slaves": [ "1-20" ], "broadcast": true, "verify_ms": 1000 }
+
+namespace GRP {
+
+struct Stats {
+  uint32_t commands   = 0;   // comandi CAN accettati
+  uint32_t rejected   = 0;   // linea piena
+  uint32_t failed     = 0;   // slave senza conferma (unicast)
+  uint32_t verifies   = 0;
+  uint32_t mismatches = 0;   // rilettura diversa o senza risposta
+  uint32_t repairs    = 0;   // riscritture unicast dopo una verifica
+};
+
+// Stato per le regole CAN2MB con gruppo
+void begin(const std::vector<MappingRule>& rules);
+
+// true se la regola scrive a un gruppo (la scrittura passa da write())
+bool isGroup(uint16_t ruleIdx);
+
+// Scrittura del comando al gruppo; false se la linea non lo accetta
+bool write(uint16_t ruleIdx, const uint16_t* regs, uint16_t count);
+
+// Letture di verifica dei broadcast, al piu' una in volo per regola
+void service(uint32_t nowMs);
+
+const Stats& stats();
+
+// Comando da seriale "GROUP": true se gestito
+bool handleCommand(const char* line);
+
+} // namespace
@@ -1,4 +1,97 @@
 #include "mapping.h"
+#include <algorithm>
+
+// -----------------------------------------------------------------------------
+// "expr": risoluzione dei nomi e compilazione
+// -----------------------------------------------------------------------------
+// Tipo con cui un campo sorgente entra nell'espressione: lo stesso valore che
+// vedrebbe la copia diretta (Modbus diviso per scale, CAN grezzo).
+static XF::VType mbVarType(const ModbusField& f)
+{
+  if (f.type == FieldType::Float32) return XF::VType::Float;
+  if (f.type == FieldType::Bool)    return XF::VType::Int;
+  return f.scale == 1.0 ? XF::VType::Int : XF::VType::Float;
+}
+
+static XF::VType canVarType(const FieldSpec& f)
+{
+  return f.type == FieldType::Float32 ? XF::VType::Float : XF::VType::Int;
+}
+
+struct XfCtx {
+  const MappingRule* rule;
+  MapPair*           pair;
+};
+
+static bool nameIs(const String& s, const char* name, uint8_t len)
+{
+  return s.length() == len && strncmp(s.c_str(), name, len) == 0;
+}
+
+template <typename F>
+static bool addVar(std::vector<const F*>& vars, const F* f, uint8_t& var)
+{
+  for (uint8_t i = 0; i < vars.size(); ++i)
+  {
+    if (vars[i] == f) { var = i; return true; }
+  }
+  if (vars.size() >= XF_MAX_VARS) return false;
+  var = (uint8_t)vars.size();
+  vars.push_back(f);
+  return true;
+}
+
+static bool resolveVar(void* c, const char* name, uint8_t len, uint8_t& var, XF::VType& type)
+{
+  XfCtx& ctx = *(XfCtx*)c;
+  MapPair& p = *ctx.pair;
+
+  // "x" = campo src della coppia, se non esiste un campo con quel nome
+  if (ctx.rule->dir == RuleDir::MB2CAN)
+  {
+    const ModbusField* f = nullptr;
+    for (auto& mf : ctx.rule->fromModbus->fields) if (nameIs(mf.name, name, len)) { f = &mf; break; }
+    if (!f && len == 1 && name[0] == 'x') f = p.mbField;
+    if (!f || !addVar(p.mbVars, f, var)) return false;
+    type = mbVarType(*f);
+  } else
+  {
+    const FieldSpec* f = nullptr;
+    for (auto& cf : ctx.rule->fromCan->fields) if (nameIs(cf.name, name, len)) { f = &cf; break; }
+    if (!f && len == 1 && name[0] == 'x') f = p.canField;
+    if (!f || !addVar(p.canVars, f, var)) return false;
+    type = canVarType(*f);
+  }
+  return true;
+}
+
+bool compilePairExpr(const MappingRule& rule, MapPair& pair, const char* expr)
+{
+  XfCtx ctx = { &rule, &pair };
+  String err;
+  if (!XF::compile(expr, resolveVar, &ctx, pair.xf, err))
+  {
+    Serial.print(F("[MAP] expr non valida per "));
+    Serial.print(pair.dst);
+    Serial.print(F(": "));
+    Serial.println(err);
+    return false;
+  }
+
+  // ridotta a un solo campo: torna alla copia diretta
+  uint8_t var;
+  if (XF::isPlainLoad(pair.xf, var))
+  {
+    if (rule.dir == RuleDir::MB2CAN) pair.mbField  = pair.mbVars[var];
+    else                             pair.canField = pair.canVars[var];
+    pair.xf = XF::Program();
+    pair.mbVars.clear();
+    pair.canVars.clear();
+    return true;
+  }
+  pair.expr = expr;
+  return true;
+}
 
 // -----------------------------------------------------------------------------
 // PARSE del mapping.json
@@ -91,6 +184,28 @@ bool parseMappingJson(const String& json,
         return false; 
       }
 
+      // richiesta on-demand (facoltativa)
+      if (r.hasOwnProperty("request")) 
+      {
+        JSONVar rq = r["request"];
+        CanRequestSpec& req = rule.request;
+        req.enabled    = true;
+        req.rtr        = rq.hasOwnProperty("rtr") && (bool)rq["rtr"];
+        req.max_age_ms = rq.hasOwnProperty("max_age_ms") ? (uint32_t)((long)rq["max_age_ms"]) : 0;
+        req.id         = rule.toCan->id;
+        if (rq.hasOwnProperty("id") && !parseUIntFlexible((const char*)rq["id"], req.id)) 
+        {
+          Serial.println(F("[MAP] request.id invalido"));
+          return false;
+        }
+        if (!req.rtr && req.id == rule.toCan->id) 
+        {
+          // un frame dati sull'id della risposta sarebbe la risposta stessa
+          Serial.println(F("[MAP] request: serve rtr o un id di query diverso"));
+          return false;
+        }
+      }
+
       // map array
       if (!r.hasOwnProperty("map") || JSON.typeof(r["map"]) != "array") 
       {
@@ -103,24 +218,34 @@ bool parseMappingJson(const String& json,
       for (unsigned int k=0; k<mp.length(); ++k) 
       {
         JSONVar m = mp[k];
-        if (JSON.typeof(m) != "object" || !m.hasOwnProperty("src") || !m.hasOwnProperty("dst"))
+        bool hasExpr = JSON.typeof(m) == "object" && m.hasOwnProperty("expr");
+        if (JSON.typeof(m) != "object" || !m.hasOwnProperty("dst") || (!m.hasOwnProperty("src") && !hasExpr))
         {
           continue;
         }
           
-        String src = (const char*)m["src"];
+        String src = m.hasOwnProperty("src") ? (const char*)m["src"] : "";
         String dst = (const char*)m["dst"];
 
-        // validazione nomi di campo
-        const ModbusField* srcF = findMbFieldByName(rule.fromModbus->fields, src);
+        // validazione nomi di campo (src facoltativo se c'e' expr)
+        const ModbusField* srcF = src.length() ? findMbFieldByName(rule.fromModbus->fields, src) : nullptr;
         const FieldSpec*   dstF = findFieldByName(rule.toCan->fields, dst);
 
-        if (!srcF || !dstF) 
+        if ((src.length() && !srcF) || !dstF) 
         {
           Serial.println(F("[MAP] campo src/dst non trovato in MB2CAN"));
           return false;
         }
-        rule.pairs.push_back({src, dst});
+        MapPair pair;
+        pair.src      = src;
+        pair.dst      = dst;
+        pair.mbField  = srcF;
+        pair.canField = dstF;
+        if (hasExpr && !compilePairExpr(rule, pair, (const char*)m["expr"]))
+        {
+          return false;
+        }
+        rule.pairs.push_back(pair);
       }
     } else { // CAN2MB
       // from_can.message + to_modbus.resource
@@ -155,6 +280,44 @@ bool parseMappingJson(const String& json,
         return false; 
       }
 
+      // gruppo di slave (facoltativo): "slaves" = id o intervalli "a-b"
+      if (r.hasOwnProperty("group")) 
+      {
+        JSONVar g = r["group"];
+        MbGroupSpec& grp = rule.group;
+        grp.broadcast = g.hasOwnProperty("broadcast") && (bool)g["broadcast"];
+        grp.verify_ms = g.hasOwnProperty("verify_ms") ? (uint32_t)((long)g["verify_ms"]) : 0;
+        if (g.hasOwnProperty("slaves") && JSON.typeof(g["slaves"]) == "array") 
+        {
+          JSONVar sl = g["slaves"];
+          for (unsigned int k=0; k<sl.length(); ++k) 
+          {
+            long a, b;
+            if (JSON.typeof(sl[k]) == "string") 
+            {
+              String s = (const char*)sl[k];
+              int dash = s.indexOf('-');
+              a = s.toInt();
+              b = dash > 0 ? s.substring(dash + 1).toInt() : a;
+            } else 
+            {
+              a = b = (long)sl[k];
+            }
+            if (a < 1 || b > 247 || a > b || grp.slaves.size() + (b - a + 1) > 247) 
+            {
+              Serial.println(F("[MAP] group.slaves invalido (id 1..247)"));
+              return false;
+            }
+            for (long id = a; id <= b; ++id) grp.slaves.push_back((uint8_t)id);
+          }
+        }
+        if (!grp.active() || rule.toModbus->local || !isWriteFn(rule.toModbus->fn)) 
+        {
+          Serial.println(F("[MAP] group: servono slaves o broadcast su una risorsa remota in scrittura"));
+          return false;
+        }
+      }
+
       if (!r.hasOwnProperty("map") || JSON.typeof(r["map"]) != "array") 
       {
         Serial.println(F("[MAP] array 'map' mancante"));
@@ -164,23 +327,33 @@ bool parseMappingJson(const String& json,
       for (unsigned int k=0; k<mp.length(); ++k) 
       {
         JSONVar m = mp[k];
-        if (JSON.typeof(m) != "object" || !m.hasOwnProperty("src") || !m.hasOwnProperty("dst"))
+        bool hasExpr = JSON.typeof(m) == "object" && m.hasOwnProperty("expr");
+        if (JSON.typeof(m) != "object" || !m.hasOwnProperty("dst") || (!m.hasOwnProperty("src") && !hasExpr))
         {
           continue;
         }
           
-        String src = (const char*)m["src"];
+        String src = m.hasOwnProperty("src") ? (const char*)m["src"] : "";
         String dst = (const char*)m["dst"];
 
-        // validazione nomi di campo
-        const FieldSpec*   srcF = findFieldByName(rule.fromCan->fields, src);
+        // validazione nomi di campo (src facoltativo se c'e' expr)
+        const FieldSpec*   srcF = src.length() ? findFieldByName(rule.fromCan->fields, src) : nullptr;
         const ModbusField* dstF = findMbFieldByName(rule.toModbus->fields, dst);
-        if (!srcF || !dstF) 
+        if ((src.length() && !srcF) || !dstF) 
         {
           Serial.println(F("[MAP] campo src/dst non trovato in CAN2MB"));
           return false;
         }
-        rule.pairs.push_back({src, dst});
+        MapPair pair;
+        pair.src      = src;
+        pair.dst      = dst;
+        pair.canField = srcF;
+        pair.mbField  = dstF;
+        if (hasExpr && !compilePairExpr(rule, pair, (const char*)m["expr"]))
+        {
+          return false;
+        }
+        rule.pairs.push_back(pair);
       }
     }
 
@@ -190,6 +363,158 @@ bool parseMappingJson(const String& json,
   return !outRules.empty();
 }
 
+// -----------------------------------------------------------------------------
+// bool lato CAN: byte intero oppure singolo bit (FieldSpec::bit)
+// -----------------------------------------------------------------------------
+static bool readCanBool(const FieldSpec& f, const uint8_t* p)
+{
+  if (f.bit != 0xFF) return (p[0] >> f.bit) & 1;
+  return readValue<uint8_t>(p, f.endian, f.size) != 0;
+}
+
+static void writeCanBool(const FieldSpec& f, uint8_t* p, uint8_t v)
+{
+  if (f.bit != 0xFF) 
+  {
+    uint8_t mask = (uint8_t)(1u << f.bit);
+    p[0] = v ? (p[0] | mask) : (p[0] & ~mask);
+    return;
+  }
+  writeValue<uint8_t>(p, v, f.endian, f.size);
+}
+
+// -----------------------------------------------------------------------------
+// "expr": lettura delle variabili e scrittura del risultato
+// -----------------------------------------------------------------------------
+static int32_t satI(int32_t v, int32_t lo, int32_t hi)
+{
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static int32_t satF(float v, int32_t lo, int32_t hi)
+{
+  if (!(v >= (float)lo)) return lo; // anche NaN
+  if (v > (float)hi)     return hi;
+  return (int32_t)v;
+}
+
+static bool loadMbVar(const ModbusResourceSpec& res, const ModbusField& f,
+                      const uint16_t* regBuf, uint16_t regCount, XF::Slot& out)
+{
+  if (isBitFn(res.fn))
+  {
+    if (f.index >= res.count || (f.index >> 4) >= regCount) return false;
+    out.i = getBit(regBuf, f.index) ? 1 : 0;
+    return true;
+  }
+  if (f.index >= regCount) return false;
+
+  switch (f.type)
+  {
+    case FieldType::Bool:   out.i = (regBuf[f.index] >> f.bit) & 1; break;
+    case FieldType::Uint16:
+      if (f.scale == 1.0) out.i = regBuf[f.index];
+      else                out.f = (float)regBuf[f.index] / (float)f.scale;
+      break;
+    case FieldType::Int16:
+      if (f.scale == 1.0) out.i = (int16_t)regBuf[f.index];
+      else                out.f = (float)(int16_t)regBuf[f.index] / (float)f.scale;
+      break;
+    case FieldType::Float32: {
+      if (f.index + 1 >= regCount) return false;
+      union { uint32_t u; float f; } cvt;
+      cvt.u = ((uint32_t)regBuf[f.index + 1] << 16) | regBuf[f.index];
+      out.f = cvt.f / (float)f.scale;
+    } break;
+    default: return false;
+  }
+  return true;
+}
+
+static bool loadCanVar(const FieldSpec& f, const uint8_t* data, uint8_t dlc, XF::Slot& out)
+{
+  if (f.offset + f.size > dlc) return false;
+  const uint8_t* p = &data[f.offset];
+  switch (f.type)
+  {
+    case FieldType::Bool:    out.i = readCanBool(f, p) ? 1 : 0; break;
+    case FieldType::Uint16:  out.i = readValue<uint16_t>(p, f.endian, f.size); break;
+    case FieldType::Int16:   out.i = readValue<int16_t>(p, f.endian, f.size); break;
+    case FieldType::Float32: out.f = readValue<float>(p, f.endian, f.size); break;
+    default: return false;
+  }
+  return true;
+}
+
+static void storeCan(const FieldSpec& f, uint8_t* p, XF::Slot v, XF::VType t)
+{
+  const bool fl = t == XF::VType::Float;
+  switch (f.type)
+  {
+    case FieldType::Bool:
+      writeCanBool(f, p, (fl ? v.f != 0 : v.i != 0) ? 1 : 0);
+      break;
+    case FieldType::Uint16:
+      writeValue<uint16_t>(p, (uint16_t)(fl ? satF(v.f, 0, 65535) : satI(v.i, 0, 65535)), f.endian, f.size);
+      break;
+    case FieldType::Int16:
+      writeValue<int16_t>(p, (int16_t)(fl ? satF(v.f, -32768, 32767) : satI(v.i, -32768, 32767)), f.endian, f.size);
+      break;
+    case FieldType::Float32:
+      writeValue<float>(p, fl ? v.f : (float)v.i, f.endian, f.size);
+      break;
+    default: break;
+  }
+}
+
+// come la copia diretta: il valore viene moltiplicato per lo scale del registro
+static bool storeMb(const ModbusResourceSpec& res, const ModbusField& f,
+                    uint16_t* regs, uint16_t outCount, XF::Slot v, XF::VType t)
+{
+  const bool fl = t == XF::VType::Float;
+
+  if (f.type == FieldType::Bool)
+  {
+    bool b = fl ? v.f != 0 : v.i != 0;
+    if (isBitFn(res.fn))
+    {
+      if (f.index >= res.count || (f.index >> 4) >= outCount) return false;
+      setBit(regs, f.index, b);
+    } else
+    {
+      if (f.index >= outCount) return false;
+      uint16_t mask = (uint16_t)(1u << f.bit);
+      regs[f.index] = b ? (regs[f.index] | mask) : (regs[f.index] & ~mask);
+    }
+    return true;
+  }
+  if (isBitFn(res.fn)) return false;
+
+  const bool scaled = f.scale != 1.0;
+  float x = fl ? v.f : (float)v.i;
+  if (scaled) x *= (float)f.scale;
+
+  switch (f.type)
+  {
+    case FieldType::Uint16:
+      if (f.index >= outCount) return false;
+      regs[f.index] = (uint16_t)((fl || scaled) ? satF(x, 0, 65535) : satI(v.i, 0, 65535));
+      break;
+    case FieldType::Int16:
+      if (f.index >= outCount) return false;
+      regs[f.index] = (uint16_t)(int16_t)((fl || scaled) ? satF(x, -32768, 32767) : satI(v.i, -32768, 32767));
+      break;
+    case FieldType::Float32: {
+      if (f.index + 1 >= outCount) return false;
+      union { uint32_t u; float f; } cvt; cvt.f = x;
+      regs[f.index]     = (uint16_t)(cvt.u & 0xFFFF);
+      regs[f.index + 1] = (uint16_t)(cvt.u >> 16);
+    } break;
+    default: return false;
+  }
+  return true;
+}
+
 // -----------------------------------------------------------------------------
 // MB -> CAN : dai registri Modbus costruisci il payload CAN
 // -----------------------------------------------------------------------------
@@ -199,6 +524,8 @@ bool buildCanFromModbus(const MappingRule& rule,
 {
   if (rule.dir != RuleDir::MB2CAN || !rule.fromModbus || !rule.toCan) return false;
 
+  const bool bitRes = isBitFn(rule.fromModbus->fn);
+
   // imposta header CAN
   outId  = rule.toCan->id;
   outDlc = rule.toCan->dlc;
@@ -207,8 +534,22 @@ bool buildCanFromModbus(const MappingRule& rule,
   // per ogni coppia (src Modbus -> dst CAN)
   for (auto& p : rule.pairs) 
   {
-    const ModbusField* srcF = findMbFieldByName(rule.fromModbus->fields, p.src);
-    const FieldSpec*   dstF = findFieldByName   (rule.toCan->fields,       p.dst);
+    if (!p.xf.empty()) 
+    {
+      // trasformazione compilata
+      const FieldSpec* dstF = p.canField;
+      if (dstF->offset + dstF->size > outDlc) return false;
+      XF::Slot vars[XF_MAX_VARS];
+      for (uint8_t v = 0; v < p.mbVars.size(); ++v) 
+      {
+        if (!loadMbVar(*rule.fromModbus, *p.mbVars[v], regBuf, regCount, vars[v])) return false;
+      }
+      storeCan(*dstF, &outData[dstF->offset], XF::run(p.xf, vars), p.xf.result);
+      continue;
+    }
+
+    const ModbusField* srcF = p.mbField;
+    const FieldSpec*   dstF = p.canField;
 
     if (!srcF || !dstF) 
     {
@@ -222,12 +563,25 @@ bool buildCanFromModbus(const MappingRule& rule,
     uint8_t* dst = &outData[dstF->offset];
 
     // leggi dal buffer modbus
+    if (bitRes && srcF->type != FieldType::Bool) 
+    {
+      return false;
+    }
+
     switch (srcF->type) {
       case FieldType::Bool: {
-        if (srcF->index >= regCount) return false;
-        uint16_t reg = regBuf[srcF->index];
-        uint8_t b = (reg & 0x0001) ? 1 : 0;  // bit0
-        writeValue<uint8_t>(dst, b, dstF->endian, dstF->size);
+        uint8_t b;
+        if (bitRes) 
+        {
+          // coil/discrete: index = bit nel blocco impacchettato
+          if (srcF->index >= rule.fromModbus->count || (srcF->index >> 4) >= regCount) return false;
+          b = getBit(regBuf, srcF->index) ? 1 : 0;
+        } else 
+        {
+          if (srcF->index >= regCount) return false;
+          b = (regBuf[srcF->index] >> srcF->bit) & 0x0001;
+        }
+        writeCanBool(*dstF, dst, b);
       } break;
 
       case FieldType::Uint16: {
@@ -283,11 +637,25 @@ bool extractModbusFromCan(const MappingRule& rule,
     return false;
   }
 
+  const bool bitRes = isBitFn(rule.toModbus->fn);
+
   // per ogni coppia (src CAN -> dst Modbus)
   for (auto& p : rule.pairs) 
   {
-    const FieldSpec*   srcF = findFieldByName   (rule.fromCan->fields,     p.src);
-    const ModbusField* dstF = findMbFieldByName(rule.toModbus->fields,     p.dst);
+    if (!p.xf.empty()) 
+    {
+      // trasformazione compilata
+      XF::Slot vars[XF_MAX_VARS];
+      for (uint8_t v = 0; v < p.canVars.size(); ++v) 
+      {
+        if (!loadCanVar(*p.canVars[v], rxData, rxDlc, vars[v])) return false;
+      }
+      if (!storeMb(*rule.toModbus, *p.mbField, regsOut, outCount, XF::run(p.xf, vars), p.xf.result)) return false;
+      continue;
+    }
+
+    const FieldSpec*   srcF = p.canField;
+    const ModbusField* dstF = p.mbField;
     if (!srcF || !dstF) 
     {
       return false;
@@ -299,11 +667,25 @@ bool extractModbusFromCan(const MappingRule& rule,
     }
     const uint8_t* src = &rxData[srcF->offset];
 
+    if (bitRes && dstF->type != FieldType::Bool) 
+    {
+      return false;
+    }
+
     switch (dstF->type) {
       case FieldType::Bool: {
-        uint8_t v = readValue<uint8_t>(src, srcF->endian, srcF->size);
-        if (dstF->index >= outCount) return false;
-        regsOut[dstF->index] = (regsOut[dstF->index] & ~0x0001) | (v ? 1 : 0);
+        bool v = readCanBool(*srcF, src);
+        if (bitRes) 
+        {
+          // coil: un bit per field, un solo FC15 per tutto il frame
+          if (dstF->index >= rule.toModbus->count || (dstF->index >> 4) >= outCount) return false;
+          setBit(regsOut, dstF->index, v);
+        } else 
+        {
+          if (dstF->index >= outCount) return false;
+          uint16_t mask = (uint16_t)(1u << dstF->bit);
+          regsOut[dstF->index] = v ? (regsOut[dstF->index] | mask) : (regsOut[dstF->index] & ~mask);
+        }
       } break;
 
       case FieldType::Uint16: {
@@ -337,3 +719,73 @@ bool extractModbusFromCan(const MappingRule& rule,
 
   return true;
 }
+
+// -----------------------------------------------------------------------------
+// Dispatch CAN id -> regole CAN2MB
+// -----------------------------------------------------------------------------
+// ordina (id, indice regola) per id mantenendo l'ordine delle regole
+static void fillDispatch(std::vector<std::pair<uint32_t, uint16_t>>& tmp, CanDispatch& out)
+{
+  out.entries.clear();
+  out.ruleIdx.clear();
+
+  std::stable_sort(tmp.begin(), tmp.end(),
+                   [](const std::pair<uint32_t, uint16_t>& a, const std::pair<uint32_t, uint16_t>& b) { return a.first < b.first; });
+
+  for (auto& t : tmp)
+  {
+    if (out.entries.empty() || out.entries.back().id != t.first)
+    {
+      out.entries.push_back({ t.first, (uint16_t)out.ruleIdx.size(), 0 });
+    }
+    out.entries.back().count++;
+    out.ruleIdx.push_back(t.second);
+  }
+}
+
+void buildCanDispatch(const std::vector<MappingRule>& rules, CanDispatch& out)
+{
+  std::vector<std::pair<uint32_t, uint16_t>> tmp;
+  for (size_t i = 0; i < rules.size(); ++i)
+  {
+    const MappingRule& r = rules[i];
+    if (r.dir != RuleDir::CAN2MB || !r.fromCan || !r.toModbus)
+    {
+      continue;
+    }
+    tmp.push_back({ r.fromCan->id, (uint16_t)i });
+  }
+  fillDispatch(tmp, out);
+}
+
+void buildRequestDispatch(const std::vector<MappingRule>& rules, CanDispatch& out)
+{
+  std::vector<std::pair<uint32_t, uint16_t>> tmp;
+  for (size_t i = 0; i < rules.size(); ++i)
+  {
+    const MappingRule& r = rules[i];
+    if (r.dir != RuleDir::MB2CAN || !r.request.enabled || !r.fromModbus || !r.toCan)
+    {
+      continue;
+    }
+    tmp.push_back({ r.request.id, (uint16_t)i });
+  }
+  fillDispatch(tmp, out);
+}
+
+const CanDispatchEntry* dispatchCan(const CanDispatch& d, uint32_t id)
+{
+  // ricerca binaria sugli id ordinati
+  size_t lo = 0, hi = d.entries.size();
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (d.entries[mid].id < id) lo = mid + 1;
+    else                        hi = mid;
+  }
+  if (lo < d.entries.size() && d.entries[lo].id == id)
+  {
+    return &d.entries[lo];
+  }
+  return nullptr;
+}
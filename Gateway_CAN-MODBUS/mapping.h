@@ -17,14 +17,21 @@
 bool parseMappingJson(const String& json, const std::vector<ModbusResourceSpec>& mbResources, const std::vector<CanMessageSpec>&     
                       canMessages, std::vector<MappingRule>&              outRules);
 
+/**
+ * compilePairExpr
+ * Compila la "expr" di una coppia della regola (campi gia' risolti in pair);
+ * se si riduce a un solo campo la coppia torna alla copia diretta
+ */
+bool compilePairExpr(const MappingRule& rule, MapPair& pair, const char* expr);
+
 /**
  * buildCanFromModbus
  * Usa una regola MB2CAN per costruire un frame CAN a partire dai registri Modbus
  */
 bool buildCanFromModbus(
   const MappingRule& rule,
-  const uint16_t*    regs,        // buffer registri letti per la risorsa rule.fromModbus (size >= rule.fromModbus->count)
-  uint16_t           regCount,    // quanti registri sono validi in "regs"
+  const uint16_t*    regs,        // buffer registri letti per la risorsa rule.fromModbus (size >= mbResourceWords)
+  uint16_t           regCount,    // quante parole sono valide in "regs" (coil/discrete: bit impacchettati)
   uint32_t&          outId,
   uint8_t&           outDlc,
   uint8_t            outData[8]
@@ -38,6 +45,40 @@ bool extractModbusFromCan(
   const MappingRule& rule,
   const uint8_t*     rxData,
   uint8_t            rxDlc,
-  uint16_t*          outRegs,     // buffer output registri (size >= rule.toModbus->count)
-  uint16_t           outCount
+  uint16_t*          outRegs,     // buffer output registri (size >= mbResourceWords), letto-modificato-scritto
+  uint16_t           outCount     // parole valide in outRegs
 );
+
+/**
+ * Tabella di dispatch CAN id -> regole CAN2MB
+ *  - entries ordinate per id (ricerca binaria), ciascuna punta a un intervallo di ruleIdx
+ *  - ruleIdx contiene gli indici in g_rules, nell'ordine originale del mapping
+ */
+struct CanDispatchEntry {
+  uint32_t id    = 0;
+  uint16_t first = 0; // primo indice in ruleIdx
+  uint16_t count = 0; // quante regole per questo id
+};
+
+struct CanDispatch {
+  std::vector<CanDispatchEntry> entries;
+  std::vector<uint16_t>         ruleIdx;
+};
+
+/**
+ * buildCanDispatch
+ * Costruisce la tabella a partire dalle regole gia' risolte (chiamare dopo parseMappingJson)
+ */
+void buildCanDispatch(const std::vector<MappingRule>& rules, CanDispatch& out);
+
+/**
+ * buildRequestDispatch
+ * Stessa tabella, ma per gli id delle richieste delle regole MB2CAN con "request"
+ */
+void buildRequestDispatch(const std::vector<MappingRule>& rules, CanDispatch& out);
+
+/**
+ * dispatchCan
+ * @return entry con le regole per l'id, oppure nullptr se nessuna regola lo usa
+ */
+const CanDispatchEntry* dispatchCan(const CanDispatch& d, uint32_t id);
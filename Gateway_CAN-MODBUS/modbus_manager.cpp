@@ -1,97 +1,774 @@
 #include "modbus_manager.h"
+#include "capture_manager.h"
+#include <rtu_codec.h>   // libraries/GatewayCommon (installazione: vedi rtu_codec.h)
 
-static ModbusMaster g_mb;
-static uint8_t g_deRePin = 7;
-static bool    g_inited  = false;
+// errori di transazione (stessi codici di ModbusMaster, eccezioni 0x01..0x04)
+constexpr uint8_t MB_OK            = 0x00;
+constexpr uint8_t MB_INVALID_SLAVE = 0xE0;
+constexpr uint8_t MB_INVALID_FN    = 0xE1;
+constexpr uint8_t MB_TIMEOUT       = 0xE2;
+constexpr uint8_t MB_INVALID_CRC   = 0xE3;
+constexpr uint8_t MB_INVALID_LEN   = 0xE4;   // byte count incoerente o frame oltre FRAME_MAX
 
-static void preTransmission() 
-{ 
-  digitalWrite(g_deRePin, HIGH); 
+namespace MBM {
+
+enum class LineState : uint8_t { Idle, Gap, Tx, Turn, Rx };
+
+constexpr int16_t SLAVE_OF_RES = -1;
+
+// richiesta in coda: le scritture portano con se' i valori
+struct Job {
+  const ModbusResourceSpec* res = nullptr;
+  DoneFn   done     = nullptr;
+  uint16_t tag      = 0;
+  bool     write    = false;
+  bool     readBack = false;         // FC03/FC01 su una risorsa in scrittura
+  int16_t  slave    = SLAVE_OF_RES;  // 0 = broadcast
+  uint16_t count    = 0;
+  uint16_t regs[MBM_JOB_WORDS];
+
+  // gruppo: stessa richiesta a group[0..groupLen), poi groupDone
+  const uint8_t* group      = nullptr;
+  uint8_t        groupLen   = 0;
+  uint8_t        groupNext  = 0;
+  uint8_t        groupFails = 0;
+  GroupDoneFn    groupDone  = nullptr;
+};
+
+struct Line {
+  String          name;
+  HardwareSerial* port   = nullptr;
+  uint8_t         deRe   = 7;
+  uint8_t         id     = 1;      // slave_id di default
+  uint32_t        bcastMs = 100;   // attesa dopo un broadcast: gli slave eseguono senza rispondere
+  uint32_t        charUs = 1042;
+  uint32_t        t35Us  = 3646;
+  uint32_t        idleUs = 0;      // micros() di fine dell'ultimo frame sulla linea
+
+  // transazione corrente: richiesta e risposta nello stesso buffer
+  LineState st      = LineState::Idle;
+  Job       cur;
+  uint8_t   slave   = 1;
+  uint8_t   fc      = 0;
+  uint16_t  qty     = 0;
+  uint16_t  reqLen  = 0;
+  uint16_t  n       = 0;
+  bool      overrun = false;   // arrivati piu' di FRAME_MAX byte
+  uint32_t  txEndUs = 0;
+  uint32_t  lastUs  = 0;
+  uint32_t  t0Ms    = 0;
+  uint8_t   frame[RTU::FRAME_MAX];
+
+  Job       q[MBM_QUEUE_DEPTH];
+  uint8_t   qHead = 0;
+  uint8_t   qLen  = 0;
+  LineStats stats;
+};
+
+static std::vector<Line> g_lines;
+static uint16_t g_words[RTU::FRAME_MAX / 2];  // risposta spacchettata per DoneFn
+
+static uint16_t serialConfig(char parity, uint8_t stopBits);
+
+bool begin(const ModbusRtuConfig& cfg) 
+{
+  g_lines.clear();
+  g_lines.resize(cfg.lines.size());
+  for (size_t i = 0; i < cfg.lines.size(); ++i)
+  {
+    const ModbusLineConfig& c = cfg.lines[i];
+    Line& L = g_lines[i];
+    L.name = c.name;
+    L.port = portByName(c.port);
+    if (!L.port)
+    {
+      Serial.print(F("[MB] porta sconosciuta: "));
+      Serial.print(c.port);
+      Serial.println(F(" (Serial2/3 richiedono MBM_HAVE_SERIAL2/3, vedi modbus_manager.h)"));
+      g_lines.clear();
+      return false;
+    }
+    L.deRe    = c.de_re_pin;
+    L.id      = c.slave_id;
+    L.bcastMs = c.broadcast_turnaround_ms;
+    pinMode(L.deRe, OUTPUT);
+    digitalWrite(L.deRe, LOW);
+
+    uint8_t bits = 1 + 8 + (c.parity == 'N' || c.parity == 'n' ? 0 : 1) + (c.stop_bits == 2 ? 2 : 1);
+    L.charUs = (uint32_t)((bits * 1000000UL + c.baud - 1) / c.baud);
+    L.t35Us  = c.baud > 19200 ? 1750 : (L.charUs * 7) / 2;
+
+    L.port->begin(c.baud, serialConfig(c.parity, c.stop_bits));
+    L.idleUs = micros();
+
+    Serial.print(F("[MB] linea ")); Serial.print(L.name);
+    Serial.print(F(" su "));        Serial.print(c.port);
+    Serial.print(F(" baud="));      Serial.print(c.baud);
+    Serial.print(F(" DE/RE=D"));    Serial.println(L.deRe);
+  }
+  return !g_lines.empty();
 }
-static void postTransmission()
-{ 
-  digitalWrite(g_deRePin, LOW);
+
+static bool push(Line& L, const Job& j, bool front)
+{
+  if (L.qLen >= MBM_QUEUE_DEPTH)
+  {
+    L.stats.queueFull++;
+    return false;
+  }
+  uint8_t at;
+  if (front)
+  {
+    L.qHead = (uint8_t)((L.qHead + MBM_QUEUE_DEPTH - 1) % MBM_QUEUE_DEPTH);
+    at = L.qHead;
+  } else
+  {
+    at = (uint8_t)((L.qHead + L.qLen) % MBM_QUEUE_DEPTH);
+  }
+  L.q[at] = j;
+  L.qLen++;
+  if (L.qLen > L.stats.maxQueue) L.stats.maxQueue = L.qLen;
+  return true;
 }
 
-namespace MBM {
+bool submitRead(const ModbusResourceSpec& res, DoneFn done, uint16_t tag, bool urgent)
+{
+  if (res.line >= g_lines.size() || !isReadFn(res.fn)) return false;
+  Job j;
+  j.res  = &res;
+  j.done = done;
+  j.tag  = tag;
+  return push(g_lines[res.line], j, urgent);
+}
 
-bool begin(const ModbusRtuConfig& cfg, uint8_t deRePin) 
+bool promoteRead(const ModbusResourceSpec& res, DoneFn done, uint16_t tag)
 {
-  g_deRePin = deRePin;
-  pinMode(g_deRePin, OUTPUT);
-  digitalWrite(g_deRePin, LOW);
+  if (res.line >= g_lines.size()) return false;
+  Line& L = g_lines[res.line];
+  for (uint8_t k = 0; k < L.qLen; ++k)
+  {
+    const Job& j = L.q[(L.qHead + k) % MBM_QUEUE_DEPTH];
+    if (j.res != &res || j.done != done || j.tag != tag || j.write || j.readBack || j.group) continue;
+
+    // i job davanti scalano di un posto, l'ordine tra loro non cambia
+    Job moved = j;
+    for (uint8_t i = k; i > 0; --i)
+    {
+      L.q[(L.qHead + i) % MBM_QUEUE_DEPTH] = L.q[(L.qHead + i - 1) % MBM_QUEUE_DEPTH];
+    }
+    L.q[L.qHead] = moved;
+    return true;
+  }
+  return false;
+}
 
-  g_mb.begin(cfg.slave_id, Serial1);
-  Serial1.begin(cfg.baud, SERIAL_8N1); // per semplicità: 8N1 (parity/stop custom non supportati su R4 facilmente)
-  g_mb.preTransmission(preTransmission);
-  g_mb.postTransmission(postTransmission);
+// parole di una scrittura sulla risorsa (0 = non e' una scrittura)
+static uint16_t writeWords(const ModbusResourceSpec& res)
+{
+  if (res.fn == ModbusFn::WriteSingle   || res.fn == ModbusFn::WriteCoil)  return 1;
+  if (res.fn == ModbusFn::WriteMultiple || res.fn == ModbusFn::WriteCoils) return mbResourceWords(res);
+  return 0;
+}
 
-  g_inited = true;
+static bool makeWrite(Job& j, const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count)
+{
+  uint16_t need = writeWords(res);
+  if (res.line >= g_lines.size() || !need || count < need || need > MBM_JOB_WORDS) return false;
+  j.res   = &res;
+  j.write = true;
+  j.count = need;
+  memcpy(j.regs, regs, need * sizeof(uint16_t));
   return true;
 }
 
-bool readResource(const ModbusResourceSpec& res, uint16_t* outRegs) 
+bool submitWrite(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count, DoneFn done, uint16_t tag)
 {
-  if (!g_inited) return false;
-  if (res.fn != ModbusFn::ReadHolding) return false;
+  Job j;
+  if (!makeWrite(j, res, regs, count)) return false;
+  j.done = done;
+  j.tag  = tag;
+  return push(g_lines[res.line], j, false);
+}
 
-  uint8_t ec = g_mb.readHoldingRegisters(res.address, res.count);
+bool submitWriteTo(const ModbusResourceSpec& res, uint8_t slave, const uint16_t* regs, uint16_t count,
+                   DoneFn done, uint16_t tag)
+{
+  Job j;
+  if (!makeWrite(j, res, regs, count)) return false;
+  j.done  = done;
+  j.tag   = tag;
+  j.slave = slave;
+  return push(g_lines[res.line], j, false);
+}
+
+bool submitWriteGroup(const ModbusResourceSpec& res, const uint8_t* slaves, uint8_t n, const uint16_t* regs,
+                      uint16_t count, GroupDoneFn done, uint16_t tag)
+{
+  Job j;
+  if (!n || !makeWrite(j, res, regs, count)) return false;
+  j.tag       = tag;
+  j.group     = slaves;
+  j.groupLen  = n;
+  j.groupDone = done;
+  return push(g_lines[res.line], j, false);
+}
+
+bool submitReadBack(const ModbusResourceSpec& res, uint8_t slave, DoneFn done, uint16_t tag)
+{
+  if (res.line >= g_lines.size() || !writeWords(res) || !slave) return false;
+  Job j;
+  j.res      = &res;
+  j.done     = done;
+  j.tag      = tag;
+  j.readBack = true;
+  j.slave    = slave;
+  return push(g_lines[res.line], j, false);
+}
 
-  if (ec != g_mb.ku8MBSuccess) 
+// Richiesta corrente (o membro corrente del gruppo) nel buffer della linea;
+// false se il frame non si puo' costruire
+static bool buildFrame(Line& L)
+{
+  const ModbusResourceSpec& res = *L.cur.res;
+  if (L.cur.group)                       L.slave = L.cur.group[L.cur.groupNext];
+  else if (L.cur.slave != SLAVE_OF_RES)  L.slave = (uint8_t)L.cur.slave;
+  else                                   L.slave = res.slave_id ? res.slave_id : L.id;
+  L.fc  = modbusFnCode(res.fn);
+  L.qty = res.count;
+
+  if (L.cur.readBack)
   {
-    Serial.print(F("[MB] read ERR code=")); Serial.println(ec);
-    return false;
+    // stessi registri (o coil) letti invece che scritti
+    L.fc  = isBitFn(res.fn) ? RTU::FC_READ_COILS : RTU::FC_READ_HOLDING;
+    L.qty = (res.fn == ModbusFn::WriteSingle || res.fn == ModbusFn::WriteCoil) ? 1 : res.count;
+    L.reqLen = RTU::buildRead(L.frame, L.slave, L.fc, res.address, L.qty);
+    CAPM::logModbus(CAPM::RecType::MbReq, L.slave, L.fc, res.address, nullptr, L.qty, 0);
+  } else if (!L.cur.write)
+  {
+    L.reqLen = RTU::buildRead(L.frame, L.slave, L.fc, res.address, res.count);
+    CAPM::logModbus(CAPM::RecType::MbReq, L.slave, L.fc, res.address, nullptr, res.count, 0);
+  } else if (res.fn == ModbusFn::WriteSingle || res.fn == ModbusFn::WriteCoil)
+  {
+    L.qty    = 1;
+    L.reqLen = (res.fn == ModbusFn::WriteSingle)
+                 ? RTU::buildWriteSingle(L.frame, L.slave, res.address, L.cur.regs[0])
+                 : RTU::buildWriteCoil(L.frame, L.slave, res.address, getBit(L.cur.regs, 0));
+    CAPM::logModbus(CAPM::RecType::MbReq, L.slave, L.fc, res.address, L.cur.regs, 1, 0);
+  } else
+  {
+    L.reqLen = (res.fn == ModbusFn::WriteMultiple)
+                 ? RTU::buildWriteMultiple(L.frame, L.slave, res.address, L.cur.regs, res.count)
+                 : RTU::buildWriteCoils(L.frame, L.slave, res.address, L.cur.regs, res.count);
+    CAPM::logModbus(CAPM::RecType::MbReq, L.slave, L.fc, res.address, L.cur.regs, L.cur.count, 0);
   }
-  for (uint16_t i=0;i<res.count;i++) 
+  return L.reqLen != 0;
+}
+
+static bool startJob(Line& L)
+{
+  L.cur   = L.q[L.qHead];
+  L.qHead = (uint8_t)((L.qHead + 1) % MBM_QUEUE_DEPTH);
+  L.qLen--;
+  return buildFrame(L);
+}
+
+static uint8_t parse(Line& L, RTU::Response& rsp)
+{
+  if (L.overrun) return MB_INVALID_LEN;
+  switch (RTU::parseResponse(L.frame, L.n, L.slave, L.fc, L.qty, rsp))
   {
-    outRegs[i] = g_mb.getResponseBuffer(i);
+    case RTU::Status::Ok:            return MB_OK;
+    case RTU::Status::Exception:     return rsp.exception;
+    case RTU::Status::WrongSlave:    return MB_INVALID_SLAVE;
+    case RTU::Status::WrongFunction: return MB_INVALID_FN;
+    case RTU::Status::BadLength:     return MB_INVALID_LEN;
+    default:                         return MB_INVALID_CRC;
   }
-  return true;
 }
 
-bool writeResource(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count) 
+// Chiude la transazione corrente: log, statistiche e DoneFn. La linea torna
+// libera prima della callback, che puo' accodare altre richieste.
+static void finish(Line& L, uint8_t ec, const RTU::Response* rsp)
 {
-  if (!g_inited) return false;
-  if (res.fn == ModbusFn::WriteSingle) 
+  const ModbusResourceSpec& res = *L.cur.res;
+  L.idleUs = micros();
+  L.st     = LineState::Idle;
+  L.stats.requests++;
+
+  uint16_t words = 0;
+  if (ec == MB_OK && rsp && !L.cur.write)
+  {
+    // coil/discrete: bit impacchettati in parole come faceva ModbusMaster
+    const bool bits = L.fc == RTU::FC_READ_COILS || L.fc == RTU::FC_READ_DISCRETE;
+    words = bits ? (uint16_t)((L.qty + 15) / 16) : L.qty;
+    if (bits) RTU::unpackBits(rsp->data, L.qty, g_words);
+    else      RTU::unpackRegs(rsp->data, L.qty, g_words);
+  }
+  if (L.slave)   // il broadcast non ha risposta da registrare
   {
-    if (count < 1) return false;
+    CAPM::logModbus(CAPM::RecType::MbResp, L.slave, L.fc, res.address, words ? g_words : nullptr,
+                    words ? words : L.qty, ec);
+  }
 
-    uint8_t ec = g_mb.writeSingleRegister(res.address, regs[0]);
+  if (ec != MB_OK)
+  {
+    if (ec == MB_TIMEOUT) L.stats.timeouts++;
+    else                  L.stats.errors++;
+    if (!L.cur.group)
+    {
+      Serial.print(L.cur.write ? F("[MB] write ERR code=") : F("[MB] read ERR code="));
+      Serial.print(ec);
+      Serial.print(F(" linea="));
+      Serial.println(L.name);
+    }
+  }
 
-    if (ec != g_mb.ku8MBSuccess) 
+  if (L.cur.group)
+  {
+    if (ec != MB_OK) L.cur.groupFails++;
+    if (++L.cur.groupNext < L.cur.groupLen && buildFrame(L))
     {
-      Serial.print(F("[MB] writeSingle ERR code=")); 
-      Serial.println(ec);
-      return false;
+      L.st = LineState::Gap;   // prossimo slave dopo il solito t3.5
+      return;
     }
-    return true;
-  } else if (res.fn == ModbusFn::WriteMultiple) {
+    if (L.cur.groupDone) L.cur.groupDone(res, L.cur.groupLen, L.cur.groupFails, L.cur.tag);
+    return;
+  }
+  if (L.cur.done) L.cur.done(res, ec == MB_OK, g_words, words, L.cur.tag);
+}
 
-    if (count < res.count) return false;
+// Un passo della macchina a stati della linea:
+//   Idle -> Gap (silenzio t3.5, DE alto e frame alla UART)
+//        -> Tx (attesa dell'ultimo bit e DE basso, nello stesso service())
+//        -> Rx (chiusa alla lunghezza attesa, sul silenzio t3.5 o sul timeout)
+//        -> Turn invece di Rx per il broadcast: nessuna risposta, si lascia
+//           agli slave il tempo di eseguire
+static void step(Line& L)
+{
+  switch (L.st)
+  {
+    case LineState::Idle:
+      if (!L.qLen) return;
+      if (!startJob(L))
+      {
+        finish(L, MB_INVALID_FN, nullptr);
+        return;
+      }
+      L.st = LineState::Gap;
+      // fallthrough
 
-    g_mb.clearTransmitBuffer();
+    case LineState::Gap:
+      if ((uint32_t)(micros() - L.idleUs) < L.t35Us) return;
+      while (L.port->available() > 0) L.port->read();  // residui scartati
+      digitalWrite(L.deRe, HIGH);
+      L.port->write(L.frame, L.reqLen);
+      L.txEndUs = micros() + (uint32_t)L.reqLen * L.charUs + L.charUs / 2;
+      L.st = LineState::Tx;
+      return;
 
-    for (uint16_t i=0;i<res.count;i++)
-    {
-      g_mb.setTransmitBuffer(i, regs[i]);
-    } 
+    case LineState::Tx:
+      // DE/RE non aspetta il giro di loop successivo: il loop puo' durare piu'
+      // del turnaround dello slave e con DE alto il MAX485 non riceve. flush()
+      // svuota solo il buffer, l'ultimo carattere esce entro txEndUs
+      L.port->flush();
+      while ((int32_t)(micros() - L.txEndUs) < 0) {}
+      digitalWrite(L.deRe, LOW);
+      L.n       = 0;
+      L.overrun = false;
+      L.t0Ms    = millis();
+      L.lastUs  = micros();
+      if (!L.slave)
+      {
+        L.stats.broadcasts++;
+        L.st = LineState::Turn;
+        return;
+      }
+      L.st     = LineState::Rx;
+      // fallthrough
 
-    uint8_t ec = g_mb.writeMultipleRegisters(res.address, res.count);
-    
-    if (ec != g_mb.ku8MBSuccess) 
+    case LineState::Rx:
     {
-      Serial.print(F("[MB] writeMultiple ERR code=")); 
-      Serial.println(ec);
-      return false;
+      while (L.port->available() > 0)
+      {
+        uint8_t b = (uint8_t)L.port->read();
+        L.lastUs = micros();
+        if (L.n < sizeof(L.frame)) L.frame[L.n++] = b;
+        else                       L.overrun = true;
+      }
+      uint16_t need = RTU::responseLen(L.frame, L.n, L.fc);
+      if (need && L.n >= need) L.n = need;
+      else if (L.n && (uint32_t)(micros() - L.lastUs) < L.t35Us) return;   // frame in arrivo
+      else if (!L.n)
+      {
+        if (millis() - L.t0Ms >= MBM_TIMEOUT_MS) finish(L, MB_TIMEOUT, nullptr);
+        return;
+      }
+      RTU::Response rsp;
+      uint8_t ec = parse(L, rsp);
+      finish(L, ec, &rsp);
+      return;
     }
-    return true;
+
+    case LineState::Turn:
+      if (millis() - L.t0Ms < L.bcastMs) return;
+      finish(L, MB_OK, nullptr);
+      return;
+  }
+}
+
+void service()
+{
+  // prima partono le trasmissioni di tutte le linee pronte, poi si aspetta la
+  // fine di ognuna: le UART trasmettono in parallelo, l'attesa e' quella del
+  // frame piu' lungo (una richiesta di lettura: 8 caratteri)
+  for (auto& L : g_lines) step(L);
+  for (auto& L : g_lines)
+  {
+    if (L.st == LineState::Tx) step(L);
+  }
+}
+
+bool busy()
+{
+  for (auto& L : g_lines)
+  {
+    if (L.qLen || L.st == LineState::Gap || L.st == LineState::Tx || L.st == LineState::Turn) return true;
+    if (L.st == LineState::Rx && L.n) return true;
   }
   return false;
 }
 
-ModbusMaster& client() 
-{ 
-  return g_mb; 
+uint8_t lineCount()
+{
+  return (uint8_t)g_lines.size();
+}
+
+const String& lineName(uint8_t line)
+{
+  static const String none;
+  return line < g_lines.size() ? g_lines[line].name : none;
+}
+
+const LineStats& lineStats(uint8_t line)
+{
+  static const LineStats none;
+  return line < g_lines.size() ? g_lines[line].stats : none;
+}
+
+} // namespace
+
+// =============================================================================
+// Modalita' slave
+// =============================================================================
+namespace MBM {
+
+#ifndef MBS_FRAME_MAX
+#define MBS_FRAME_MAX 256
+#endif
+
+// area contigua dell'immagine: una per risorsa local
+struct SlaveArea {
+  const ModbusResourceSpec* res;
+  uint16_t start;
+  uint16_t count;
+  uint16_t pool;      // offset in s_pool
+  bool     input;     // spazio FC04 (altrimenti holding)
+  bool     writable;  // FC06/FC16 ammessi
+};
+
+static std::vector<SlaveArea> s_areas;
+static std::vector<uint16_t>  s_pool;
+static ModbusSlaveConfig s_cfg;
+static SlaveWriteFn      s_onWrite = nullptr;
+static HardwareSerial*   s_port    = nullptr;
+static SlaveStats        s_stats;
+
+static uint8_t  s_rx[MBS_FRAME_MAX];
+static uint16_t s_rxLen   = 0;
+static uint32_t s_lastRxUs = 0;
+static uint8_t  s_tx[MBS_FRAME_MAX];
+static uint16_t s_txLen   = 0;
+static bool     s_replyPending = false;
+static uint32_t s_charUs   = 1146;  // 11 bit a 9600
+static uint32_t s_t35Us    = 4010;
+
+HardwareSerial* portByName(const String& name)
+{
+  if (name.equalsIgnoreCase("Serial1")) return &Serial1;
+#ifdef MBM_HAVE_SERIAL2
+  if (name.equalsIgnoreCase("Serial2")) return &Serial2;
+#endif
+#ifdef MBM_HAVE_SERIAL3
+  if (name.equalsIgnoreCase("Serial3")) return &Serial3;
+#endif
+  return nullptr;
+}
+
+static uint16_t serialConfig(char parity, uint8_t stopBits)
+{
+  bool two = stopBits == 2;
+  if (parity == 'E' || parity == 'e') return two ? SERIAL_8E2 : SERIAL_8E1;
+  if (parity == 'O' || parity == 'o') return two ? SERIAL_8O2 : SERIAL_8O1;
+  return two ? SERIAL_8N2 : SERIAL_8N1;
+}
+
+bool slaveBegin(const ModbusSlaveConfig& cfg, const std::vector<ModbusResourceSpec>& res, SlaveWriteFn onWrite)
+{
+  s_cfg     = cfg;
+  s_onWrite = onWrite;
+  s_stats   = SlaveStats();
+  s_areas.clear();
+  s_pool.clear();
+
+  s_port = portByName(cfg.port);
+  if (!s_port)
+  {
+    Serial.print(F("[MBS] porta sconosciuta: "));
+    Serial.println(cfg.port);
+    return false;
+  }
+
+  for (auto& r : res)
+  {
+    if (!r.local) continue;
+    SlaveArea a;
+    a.res      = &r;
+    a.start    = r.address;
+    a.count    = r.count;
+    a.pool     = (uint16_t)s_pool.size();
+    a.input    = r.fn == ModbusFn::ReadInput;
+    a.writable = r.fn == ModbusFn::WriteSingle || r.fn == ModbusFn::WriteMultiple;
+
+    for (auto& o : s_areas)
+    {
+      if (o.input == a.input && a.start < o.start + o.count && o.start < a.start + a.count)
+      {
+        Serial.print(F("[MBS] aree sovrapposte: "));
+        Serial.println(r.name);
+        return false;
+      }
+    }
+    s_areas.push_back(a);
+    s_pool.resize(s_pool.size() + r.count, 0);
+  }
+
+  uint8_t bits = 1 + 8 + (s_cfg.parity == 'N' || s_cfg.parity == 'n' ? 0 : 1) + (s_cfg.stop_bits == 2 ? 2 : 1);
+  s_charUs = (uint32_t)((bits * 1000000UL + s_cfg.baud - 1) / s_cfg.baud);
+  s_t35Us  = s_cfg.baud > 19200 ? 1750 : (s_charUs * 7) / 2;
+
+  pinMode(s_cfg.de_re_pin, OUTPUT);
+  digitalWrite(s_cfg.de_re_pin, LOW);
+  s_port->begin(s_cfg.baud, serialConfig(s_cfg.parity, s_cfg.stop_bits));
+
+  s_rxLen = 0;
+  s_replyPending = false;
+
+  Serial.print(F("[MBS] slave id=")); Serial.print(s_cfg.id);
+  Serial.print(F(" aree="));          Serial.print((int)s_areas.size());
+  Serial.print(F(" registri="));      Serial.println((int)s_pool.size());
+  return true;
+}
+
+static SlaveArea* areaOf(const ModbusResourceSpec& res)
+{
+  for (auto& a : s_areas) if (a.res == &res) return &a;
+  return nullptr;
+}
+
+bool slaveStore(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count)
+{
+  SlaveArea* a = areaOf(res);
+  if (!a || count < a->count) return false;
+  memcpy(&s_pool[a->pool], regs, a->count * sizeof(uint16_t));
+  return true;
+}
+
+bool slaveLoad(const ModbusResourceSpec& res, uint16_t* regs)
+{
+  SlaveArea* a = areaOf(res);
+  if (!a) return false;
+  memcpy(regs, &s_pool[a->pool], a->count * sizeof(uint16_t));
+  return true;
+}
+
+static SlaveArea* areaAt(bool input, uint16_t addr)
+{
+  for (auto& a : s_areas)
+  {
+    if (a.input == input && addr >= a.start && addr < a.start + a.count) return &a;
+  }
+  return nullptr;
+}
+
+// Lettura dall'immagine: l'intervallo puo' attraversare piu' aree contigue
+static bool imageRead(bool input, uint16_t addr, uint16_t qty, uint8_t* out)
+{
+  while (qty)
+  {
+    SlaveArea* a = areaAt(input, addr);
+    if (!a) return false;
+    uint16_t off = addr - a->start;
+    uint16_t n   = a->count - off;
+    if (n > qty) n = qty;
+    for (uint16_t i = 0; i < n; ++i, out += 2) RTU::put16(out, s_pool[a->pool + off + i]);
+    addr += n;
+    qty  -= n;
+  }
+  return true;
+}
+
+// Scrittura: prima si verifica tutto l'intervallo, poi si copia e si notifica
+static bool imageWrite(uint16_t addr, uint16_t qty, const uint8_t* data)
+{
+  for (uint16_t a0 = addr, q = qty; q; )
+  {
+    SlaveArea* a = areaAt(false, a0);
+    if (!a || !a->writable) return false;
+    uint16_t n = a->count - (a0 - a->start);
+    if (n >= q) break;
+    a0 += n;
+    q  -= n;
+  }
+
+  while (qty)
+  {
+    SlaveArea* a = areaAt(false, addr);
+    uint16_t off = addr - a->start;
+    uint16_t n   = a->count - off;
+    if (n > qty) n = qty;
+    for (uint16_t i = 0; i < n; ++i, data += 2) s_pool[a->pool + off + i] = RTU::get16(data);
+    addr += n;
+    qty  -= n;
+    if (s_onWrite) s_onWrite(*a->res);
+  }
+  return true;
+}
+
+static void queueReply(uint16_t len)
+{
+  s_txLen = RTU::seal(s_tx, len);
+  s_replyPending = true;
+}
+
+static void queueException(uint8_t fc, uint8_t code)
+{
+  s_txLen = RTU::buildException(s_tx, s_cfg.id, fc, code);
+  s_replyPending = true;
+  s_stats.exceptions++;
+}
+
+static void handleFrame(const uint8_t* f, uint16_t n)
+{
+  if (!RTU::crcOk(f, n))
+  {
+    s_stats.crcErrors++;
+    return;
+  }
+  uint8_t id = f[0];
+  if (id != s_cfg.id && id != 0)
+  {
+    s_stats.foreign++;
+    return;
+  }
+  const bool bcast = id == 0;
+  const uint8_t fc = f[1];
+  s_stats.requests++;
+
+  uint16_t addr = RTU::get16(f + 2);
+  uint16_t qty  = n >= 6 ? RTU::get16(f + 4) : 0;
+  uint8_t  ex   = 0;
+
+  switch (fc)
+  {
+    case 3: case 4:
+    {
+      CAPM::logModbus(CAPM::RecType::MbReq, id, fc, addr, nullptr, qty, 0);
+      if (bcast) return;
+      if (n != 8 || qty < 1 || qty > 125)                  { ex = 3; break; }
+      if (!imageRead(fc == 4, addr, qty, &s_tx[3]))        { ex = 2; break; }
+      s_tx[0] = s_cfg.id;
+      s_tx[1] = fc;
+      s_tx[2] = (uint8_t)(2 * qty);
+      queueReply(3 + 2 * qty);
+    } break;
+
+    case 6:
+    {
+      CAPM::logModbus(CAPM::RecType::MbReq, id, fc, addr, nullptr, 1, 0);
+      if (n != 8)                                          { ex = 3; break; }
+      if (!imageWrite(addr, 1, f + 4))                     { ex = 2; break; }
+      if (bcast) return;
+      memcpy(s_tx, f, 6);
+      queueReply(6);
+    } break;
+
+    case 16:
+    {
+      CAPM::logModbus(CAPM::RecType::MbReq, id, fc, addr, nullptr, qty, 0);
+      if (n < 9 || qty < 1 || qty > 123 || f[6] != 2 * qty || n != 9u + f[6]) { ex = 3; break; }
+      if (!imageWrite(addr, qty, f + 7))                   { ex = 2; break; }
+      if (bcast) return;
+      memcpy(s_tx, f, 6);
+      queueReply(6);
+    } break;
+
+    default:
+      ex = 1;
+      break;
+  }
+
+  if (ex && !bcast) queueException(fc, ex);
+  if (!bcast) CAPM::logModbus(CAPM::RecType::MbResp, id, fc, addr, nullptr, qty, ex);
+}
+
+void slaveService()
+{
+  if (!s_port) return;
+  uint32_t now = micros();
+
+  // la risposta parte dopo il silenzio t3.5 che chiude la richiesta; DE/RE
+  // torna in ricezione appena uscito l'ultimo bit, come sulle linee master
+  if (s_replyPending)
+  {
+    if (now - s_lastRxUs < s_t35Us) return;
+    digitalWrite(s_cfg.de_re_pin, HIGH);
+    s_port->write(s_tx, s_txLen);
+    uint32_t txEndUs = micros() + (uint32_t)s_txLen * s_charUs + s_charUs / 2;
+    s_port->flush();
+    while ((int32_t)(micros() - txEndUs) < 0) {}
+    digitalWrite(s_cfg.de_re_pin, LOW);
+    s_replyPending = false;
+    s_stats.replies++;
+    return;
+  }
+
+  while (s_port->available() > 0)
+  {
+    uint8_t b = (uint8_t)s_port->read();
+    s_lastRxUs = micros();
+    if (s_rxLen < sizeof(s_rx)) s_rx[s_rxLen++] = b;
+
+    // la lunghezza e' nota dal codice funzione: non serve aspettare il silenzio
+    uint16_t need = RTU::requestLen(s_rx, s_rxLen);
+    if (need && s_rxLen >= need)
+    {
+      handleFrame(s_rx, need);
+      s_rxLen = 0;
+      return;
+    }
+  }
+
+  // funzione sconosciuta o frame troncato: chiude sul silenzio t3.5
+  if (s_rxLen && micros() - s_lastRxUs >= s_t35Us)
+  {
+    handleFrame(s_rx, s_rxLen);
+    s_rxLen = 0;
+  }
+}
+
+const SlaveStats& slaveStats()
+{
+  return s_stats;
 }
 
 } // namespace
@@ -1,19 +1,128 @@
 #pragma once
 #include <Arduino.h>
-#include <ModbusMaster.h>
+#include <vector>
 #include "utils.h"
 
-// uso ModbusMaster (Doc Walker) su Serial1 + MAX485 (DE/RE su un pin D7)
+// Master RTU su una o piu' linee RS-485 indipendenti (sezione "lines" di
+// modbus.json, default: Serial1 + MAX485 con DE/RE su D7). Ogni linea ha la
+// sua UART, il suo pin DE/RE, una coda di richieste e un motore di
+// transazione non bloccante: mentre una linea aspetta il suo slave le altre
+// trasmettono, la capacita' di polling cresce con il numero di linee. I frame
+// si costruiscono e si leggono nel buffer della linea con il codec di
+// GatewayCommon (rtu_codec.h).
+//
+// Porte delle linee: "Serial1" c'e' sempre. "Serial2"/"Serial3" esistono
+// solo con MBM_HAVE_SERIAL2/MBM_HAVE_SERIAL3 definiti (flag di build o qui
+// sotto) e solo se il core della scheda dichiara l'oggetto HardwareSerial
+// con quel nome. Sulla UNO R4 Minima l'unica UART libera sui pin e' Serial1
+// (Serial e' l'USB; sulla R4 WiFi Serial2 va all'ESP32): una seconda linea
+// richiede una scheda con piu' UART, altrimenti begin() la rifiuta con
+// "porta sconosciuta". Il simulatore host definisce MBM_HAVE_SERIAL2.
+// #define MBM_HAVE_SERIAL2 1
+// #define MBM_HAVE_SERIAL3 1
+
+#ifndef MBM_TIMEOUT_MS
+#define MBM_TIMEOUT_MS 2000   // attesa del primo byte di risposta
+#endif
+
+#ifndef MBM_QUEUE_DEPTH
+#define MBM_QUEUE_DEPTH 16    // richieste in attesa per linea
+#endif
+
+#ifndef MBM_JOB_WORDS
+#define MBM_JOB_WORDS 16      // parole di una scrittura in coda
+#endif
 
 namespace MBM {
-  bool begin(const ModbusRtuConfig& cfg, uint8_t deRePin);
+  // Fine di una transazione (chiamata da service()). Letture: regs/words
+  // validi solo con ok, coil e discrete impacchettati a bit (vedi getBit).
+  typedef void (*DoneFn)(const ModbusResourceSpec& res, bool ok, const uint16_t* regs, uint16_t words, uint16_t tag);
+
+  // Fine di una scrittura di gruppo: slave scritti e quanti non hanno confermato
+  typedef void (*GroupDoneFn)(const ModbusResourceSpec& res, uint8_t slaves, uint8_t failed, uint16_t tag);
+
+  struct LineStats {
+    uint32_t requests   = 0;
+    uint32_t errors     = 0;   // eccezioni, CRC, lunghezza, slave o funzione errati
+    uint32_t timeouts   = 0;
+    uint32_t queueFull  = 0;   // submit rifiutati
+    uint32_t broadcasts = 0;   // scritture a id 0, senza risposta
+    uint8_t  maxQueue   = 0;
+  };
+
+  // Apre tutte le linee di cfg.lines
+  bool begin(const ModbusRtuConfig& cfg);
+
+  // Lettura FC01/02/03/04 sulla linea della risorsa; urgent = in testa alla
+  // coda. false se la coda e' piena (done non verra' chiamata)
+  bool submitRead(const ModbusResourceSpec& res, DoneFn done, uint16_t tag, bool urgent = false);
+
+  // Porta in testa alla coda la lettura di res gia' accodata con la stessa
+  // done e tag (es. il poll periodico quando arriva una richiesta CAN).
+  // false se non e' in coda: gia' partita o mai accodata
+  bool promoteRead(const ModbusResourceSpec& res, DoneFn done, uint16_t tag);
+
+  // Scrittura FC05/06/15/16; count = parole valide in regs (copiate in coda)
+  bool submitWrite(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count, DoneFn done, uint16_t tag);
+
+  // Come submitWrite, a uno slave scelto. slave 0 = broadcast: nessuna
+  // risposta, la linea resta ferma per broadcast_turnaround_ms della linea
+  // (tempo di esecuzione degli slave) e done riceve sempre ok
+  bool submitWriteTo(const ModbusResourceSpec& res, uint8_t slave, const uint16_t* regs, uint16_t count,
+                     DoneFn done, uint16_t tag);
+
+  // La stessa scrittura a n slave, una dopo l'altra senza ripassare dalla coda
+  // ne' dal loop. slaves deve restare valido fino a done; errori contati in
+  // done, non stampati uno per uno
+  bool submitWriteGroup(const ModbusResourceSpec& res, const uint8_t* slaves, uint8_t n, const uint16_t* regs,
+                        uint16_t count, GroupDoneFn done, uint16_t tag);
+
+  // Rilettura dei valori di una risorsa in scrittura da uno slave (FC03,
+  // coil FC01): regs in done nello stesso formato della scrittura
+  bool submitReadBack(const ModbusResourceSpec& res, uint8_t slave, DoneFn done, uint16_t tag);
+
+  // Avanza le transazioni di tutte le linee, non bloccante
+  void service();
+
+  // true se una linea aspetta un istante in micros() (silenzio t3.5, fine
+  // trasmissione, fine risposta) o ha richieste da avviare: il loop non dorme
+  bool busy();
+
+  uint8_t          lineCount();
+  const String&    lineName(uint8_t line);
+  const LineStats& lineStats(uint8_t line);
+
+  // Porta seriale per nome ("Serial1", "Serial2"/"Serial3" se abilitate,
+  // vedi sopra); nullptr se non disponibile
+  HardwareSerial* portByName(const String& name);
+
+  // ----- modalita' slave (gateway interrogato da uno SCADA) -----
+  // Le risorse "local" di modbus.json formano un'immagine registri in RAM:
+  //   read_holding               -> FC03
+  //   write_single/write_multiple -> FC03 + FC06/FC16
+  //   read_input                 -> FC04
+  // Le letture si servono dall'immagine senza passare dal CAN; le scritture
+  // dello SCADA chiamano onWrite una volta per ogni risorsa toccata.
+  typedef void (*SlaveWriteFn)(const ModbusResourceSpec& res);
+
+  struct SlaveStats {
+    uint32_t requests   = 0;
+    uint32_t replies    = 0;
+    uint32_t exceptions = 0;
+    uint32_t crcErrors  = 0;  // frame scartati (CRC o lunghezza)
+    uint32_t foreign    = 0;  // indirizzati ad altri slave
+  };
+
+  bool slaveBegin(const ModbusSlaveConfig& cfg, const std::vector<ModbusResourceSpec>& res, SlaveWriteFn onWrite);
+
+  // Non bloccante: riceve, risponde al massimo a una richiesta per chiamata
+  void slaveService();
 
-  // Lettura holding registers (ReadHolding)
-  bool readResource(const ModbusResourceSpec& res, uint16_t* outRegs /*len>=res.count*/);
+  // CAN2MB verso risorsa local: aggiorna l'immagine (count = parole valide)
+  bool slaveStore(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count);
 
-  // Scrittura holding registers (WriteSingle / WriteMultiple)
-  bool writeResource(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count);
+  // Copia l'immagine della risorsa (len >= res.count)
+  bool slaveLoad(const ModbusResourceSpec& res, uint16_t* regs);
 
-  // Accesso a ModbusMaster (per eventuali debug)
-  ModbusMaster& client();
+  const SlaveStats& slaveStats();
 }
@@ -0,0 +1,225 @@
+#include "poll_planner.h"
+
+namespace PLN {
+
+// tempi e carico di una linea
+struct LinePlan {
+  ModbusLineConfig cfg;
+  uint8_t  bits    = 10;
+  uint32_t charUs  = 1042;
+  uint32_t t35Us   = 3646;
+  uint32_t loadPpm = 0;
+};
+
+static std::vector<LinePlan> s_lines;
+static std::vector<Entry>    s_entries;
+
+static uint32_t ppmOf(uint32_t wire, uint32_t periodMs)
+{
+  return periodMs ? (uint32_t)((uint64_t)wire * 1000 / periodMs) : 0;
+}
+
+// periodo minimo (ms) perche' la transazione occupi al piu' ppm della linea
+static uint32_t periodFor(uint32_t wire, uint32_t ppm)
+{
+  return ppm ? (uint32_t)(((uint64_t)wire * 1000 + ppm - 1) / ppm) : UINT32_MAX;
+}
+
+// byte di richiesta e risposta (normale, senza eccezione) per la risorsa
+static void frameBytes(const ModbusResourceSpec& r, uint16_t& req, uint16_t& resp)
+{
+  uint16_t bitBytes = (uint16_t)((r.count + 7) / 8);
+  switch (r.fn)
+  {
+    case ModbusFn::ReadCoils:
+    case ModbusFn::ReadDiscrete:  req = 8;                 resp = 5 + bitBytes;    break;
+    case ModbusFn::ReadHolding:
+    case ModbusFn::ReadInput:     req = 8;                 resp = 5 + 2 * r.count; break;
+    case ModbusFn::WriteSingle:
+    case ModbusFn::WriteCoil:     req = 8;                 resp = 8;               break;
+    case ModbusFn::WriteCoils:    req = 9 + bitBytes;      resp = 8;               break;
+    case ModbusFn::WriteMultiple: req = 9 + 2 * r.count;   resp = 8;               break;
+    default:                      req = 0;                 resp = 0;               break;
+  }
+}
+
+void begin(const ModbusRtuConfig& rtu)
+{
+  s_entries.clear();
+  s_lines.clear();
+  for (auto& c : rtu.lines)
+  {
+    LinePlan l;
+    l.cfg = c;
+    bool parity = !(c.parity == 'N' || c.parity == 'n');
+    l.bits   = (uint8_t)(1 + 8 + (parity ? 1 : 0) + (c.stop_bits == 2 ? 2 : 1));
+    l.charUs = (uint32_t)((l.bits * 1000000UL + c.baud - 1) / c.baud);
+    l.t35Us  = c.baud > 19200 ? 1750 : (l.charUs * 7 + 1) / 2;
+    s_lines.push_back(l);
+  }
+  if (s_lines.empty()) s_lines.push_back(LinePlan());
+}
+
+static LinePlan& lineOf(const ModbusResourceSpec& res)
+{
+  return s_lines[res.line < s_lines.size() ? res.line : 0];
+}
+
+uint32_t wireUs(const ModbusResourceSpec& res)
+{
+  const LinePlan& l = lineOf(res);
+  uint16_t req, resp;
+  frameBytes(res, req, resp);
+  // richiesta, t3.5, risposta dello slave, risposta, t3.5
+  return (uint32_t)(req + resp) * l.charUs + 2 * l.t35Us + l.cfg.turnaround_us;
+}
+
+uint16_t add(const ModbusResourceSpec& res)
+{
+  Entry e;
+  e.res      = &res;
+  frameBytes(res, e.reqBytes, e.respBytes);
+  e.wireUs   = wireUs(res);
+  e.periodMs = isReadFn(res.fn) ? res.period_ms : 0;
+  s_entries.push_back(e);
+  lineOf(res).loadPpm += ppmOf(e.wireUs, e.periodMs);
+  return (uint16_t)(s_entries.size() - 1);
+}
+
+uint32_t budgetPpm(uint8_t line)
+{
+  return line < s_lines.size() ? (uint32_t)s_lines[line].cfg.budget_pct * 10000UL : 0;
+}
+
+uint32_t loadPpm(uint8_t line)
+{
+  return line < s_lines.size() ? s_lines[line].loadPpm : 0;
+}
+
+void plan()
+{
+  for (uint8_t li = 0; li < s_lines.size(); ++li)
+  {
+    LinePlan& l = s_lines[li];
+    uint32_t budget = budgetPpm(li);
+    if (l.loadPpm <= budget) continue;
+
+    // allunga in proporzione i periodi adattabili della linea (entro max_period_ms)
+    uint64_t total = l.loadPpm;
+    l.loadPpm = 0;
+    for (auto& e : s_entries)
+    {
+      if (&lineOf(*e.res) != &l) continue;
+      if (e.periodMs && e.res->max_period_ms > e.periodMs)
+      {
+        uint32_t p = (uint32_t)(((uint64_t)e.periodMs * total + budget - 1) / budget);
+        e.periodMs = p < e.res->max_period_ms ? p : e.res->max_period_ms;
+      }
+      l.loadPpm += ppmOf(e.wireUs, e.periodMs);
+    }
+  }
+}
+
+uint32_t period(uint16_t idx)
+{
+  return idx < s_entries.size() ? s_entries[idx].periodMs : 0;
+}
+
+uint32_t onRead(uint16_t idx, bool changed)
+{
+  if (idx >= s_entries.size()) return 0;
+  Entry& e = s_entries[idx];
+  if (!e.periodMs) return 0; // solo su richiesta
+
+  e.polls++;
+  if (changed) e.changes++;
+  e.change = (uint16_t)((e.change * 7u + (changed ? 256u : 0u)) / 8u);
+
+  const uint32_t minMs = e.res->min_period_ms;
+  const uint32_t maxMs = e.res->max_period_ms;
+  if (minMs == maxMs) return e.periodMs; // periodo fisso
+
+  uint32_t p = e.periodMs;
+  if (e.change > 128)     p = p - p / 4;      // cambia in piu' di meta' delle letture
+  else if (e.change < 32) p = p + p / 4 + 1;  // quasi fermo
+  if (p < minMs) p = minMs;
+  if (p > maxMs) p = maxMs;
+
+  // budget: il resto della linea e' fisso, questa risorsa prende cio' che avanza
+  LinePlan& l     = lineOf(*e.res);
+  uint32_t other  = l.loadPpm - ppmOf(e.wireUs, e.periodMs);
+  uint32_t budget = (uint32_t)l.cfg.budget_pct * 10000UL;
+  if (other + ppmOf(e.wireUs, p) > budget)
+  {
+    uint32_t need = budget > other ? periodFor(e.wireUs, budget - other) : maxMs;
+    if (need > p) p = need;
+    if (p > maxMs) p = maxMs;
+  }
+
+  e.periodMs = p;
+  l.loadPpm  = other + ppmOf(e.wireUs, p);
+  return p;
+}
+
+static void printPct(Print& out, uint32_t ppm)
+{
+  out.print(ppm / 10000.0, 2);
+  out.print('%');
+}
+
+static void reportLine(Print& out, const LinePlan& l)
+{
+  out.print(F("[PLAN] linea ")); out.print(l.cfg.name);
+  out.print(' ');                out.print(l.cfg.baud);
+  out.print(F(" baud, "));       out.print(l.bits);
+  out.print(F(" bit/car, t3.5=")); out.print(l.t35Us);
+  out.print(F(" us, budget "));  out.print(l.cfg.budget_pct);
+  out.println('%');
+
+  uint32_t worst = 0;
+  for (auto& e : s_entries)
+  {
+    if (&lineOf(*e.res) != &l) continue;
+    out.print(F("  ")); out.print(e.res->name);
+    out.print(F(" fc")); out.print(modbusFnCode(e.res->fn));
+    out.print(F(" byte=")); out.print(e.reqBytes); out.print('+'); out.print(e.respBytes);
+    out.print(F(" linea=")); out.print(e.wireUs / 1000.0, 1); out.print(F(" ms"));
+    if (!e.periodMs)
+    {
+      out.println(F(" su evento/richiesta"));
+      continue;
+    }
+    out.print(F(" periodo=")); out.print(e.periodMs);
+    out.print(F(" (")); out.print(e.res->min_period_ms);
+    out.print(F("..")); out.print(e.res->max_period_ms);
+    out.print(F(") carico=")); printPct(out, ppmOf(e.wireUs, e.periodMs));
+    if (e.polls)
+    {
+      out.print(F(" var=")); out.print(e.changes); out.print('/'); out.print(e.polls);
+    }
+    out.println();
+    worst += ppmOf(e.wireUs, e.res->min_period_ms);
+  }
+
+  out.print(F("[PLAN] carico polling ")); printPct(out, l.loadPpm);
+  out.print(F(" (a periodo minimo ")); printPct(out, worst);
+  out.println(')');
+  if (l.loadPpm > (uint32_t)l.cfg.budget_pct * 10000UL)
+  {
+    out.println(F("[PLAN] ATTENZIONE: oltre budget anche ai periodi massimi"));
+  }
+}
+
+void report(Print& out)
+{
+  for (auto& l : s_lines) reportLine(out, l);
+}
+
+bool handleCommand(const char* line)
+{
+  if (strncmp(line, "PLAN", 4) != 0 || (line[4] && line[4] != ' ')) return false;
+  report(Serial);
+  return true;
+}
+
+} // namespace
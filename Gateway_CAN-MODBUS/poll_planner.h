@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "utils.h"
+
+// Pianificatore del polling sulle linee RS-485.
+//
+// Per ogni risorsa calcola il tempo di linea di una transazione (richiesta +
+// risposta a baud/framing della sua linea, due silenzi t3.5 e il tempo di
+// risposta dello slave) e quindi la quota di linea occupata al periodo
+// corrente. Le linee lavorano in parallelo: carico e budget si contano per
+// linea. Al boot stampa il piano; a runtime adatta i periodi tra
+// min_period_ms e max_period_ms:
+//   - valori che cambiano spesso -> periodo piu' corto
+//   - valori fermi               -> periodo piu' lungo
+//   - carico della linea oltre budget_pct -> si allunga, mai si accorcia
+// Il carico e' espresso in ppm della linea (1000000 = linea sempre occupata).
+
+namespace PLN {
+
+struct Entry {
+  const ModbusResourceSpec* res = nullptr;
+  uint16_t reqBytes  = 0;
+  uint16_t respBytes = 0;
+  uint32_t wireUs    = 0;   // durata di una transazione
+  uint32_t periodMs  = 0;   // periodo corrente (0 = solo su richiesta)
+  uint16_t change    = 0;   // frequenza di variazione, media mobile Q8 (256 = sempre)
+  uint32_t polls     = 0;
+  uint32_t changes   = 0;
+};
+
+void begin(const ModbusRtuConfig& rtu);
+
+// Tempo di linea di una transazione sulla risorsa
+uint32_t wireUs(const ModbusResourceSpec& res);
+
+// Registra una risorsa; ritorna l'indice da usare con period()/onRead()
+uint16_t add(const ModbusResourceSpec& res);
+
+// Dopo tutte le add(): se il piano iniziale supera il budget allunga i periodi
+void plan();
+
+uint32_t period(uint16_t idx);
+
+// Esito di una lettura periodica (non di quelle su richiesta, che non sono
+// campioni del periodo): aggiorna la statistica e ritorna il nuovo periodo
+uint32_t onRead(uint16_t idx, bool changed);
+
+uint32_t loadPpm(uint8_t line);
+uint32_t budgetPpm(uint8_t line);
+
+void report(Print& out);
+
+// Comando da seriale "PLAN": true se gestito
+bool handleCommand(const char* line);
+
+} // namespace
@@ -0,0 +1,218 @@
+#include "profiler.h"
+
+namespace PROF {
+
+#if GW_PROFILE
+
+static const char* const STAGE_NAMES[StageCount] = {
+  "loop", "can_rx", "pretty_print", "rule_scan", "extract",
+  "mb_write", "mb_read", "build_can", "can_tx", "capture"
+};
+
+static const uint8_t SLOTS = StageCount + PROF_MAX_RULES;
+static const uint8_t BUCKETS = 32; // bucket b: durate in [2^(b-1), 2^b) tick
+
+struct SlotStats {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t hist[BUCKETS];
+};
+
+struct TraceEvt {
+  uint32_t t0;
+  uint32_t dt;
+  uint8_t  slot;
+};
+
+static SlotStats s_stats[SLOTS];
+static TraceEvt  s_trace[PROF_TRACE_LEN];
+static uint16_t  s_traceHead = 0;
+static bool      s_traceWrapped = false;
+static uint32_t  s_ticksPerUs = 1;
+
+#if defined(__arm__) && (defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__))
+// DWT: registri fissi dell'architettura ARMv7-M/ARMv8-M mainline
+#define PROF_DEMCR      (*(volatile uint32_t*)0xE000EDFCu)
+#define PROF_DWT_CTRL   (*(volatile uint32_t*)0xE0001000u)
+#define PROF_DWT_CYCCNT (*(volatile uint32_t*)0xE0001004u)
+#define PROF_HAVE_DWT 1
+#else
+#define PROF_HAVE_DWT 0
+#endif
+
+void begin()
+{
+#if PROF_HAVE_DWT
+  PROF_DEMCR    |= (1u << 24);   // TRCENA
+  PROF_DWT_CYCCNT = 0;
+  PROF_DWT_CTRL |= 1u;           // CYCCNTENA
+#if defined(F_CPU)
+  s_ticksPerUs = F_CPU / 1000000UL;
+#else
+  s_ticksPerUs = 48;             // UNO R4: 48 MHz
+#endif
+#else
+  s_ticksPerUs = 1;
+#endif
+  reset();
+}
+
+uint32_t now()
+{
+#if PROF_HAVE_DWT
+  return PROF_DWT_CYCCNT;
+#else
+  return micros();
+#endif
+}
+
+uint8_t ruleSlot(uint16_t ruleIdx)
+{
+  return ruleIdx < PROF_MAX_RULES ? (uint8_t)(StageCount + ruleIdx) : 0xFF;
+}
+
+static uint8_t bucketOf(uint32_t dt)
+{
+  uint8_t b = 0;
+  while (dt && b < BUCKETS - 1) { dt >>= 1; b++; }
+  return b;
+}
+
+void record(uint8_t slot, uint32_t t0, uint32_t dt)
+{
+  SlotStats& s = s_stats[slot];
+  if (s.count == 0 || dt < s.min) s.min = dt;
+  if (dt > s.max) s.max = dt;
+  s.count++;
+  s.sum += dt;
+  s.hist[bucketOf(dt)]++;
+
+  TraceEvt& e = s_trace[s_traceHead];
+  e.t0   = t0;
+  e.dt   = dt;
+  e.slot = slot;
+  if (++s_traceHead >= PROF_TRACE_LEN)
+  {
+    s_traceHead = 0;
+    s_traceWrapped = true;
+  }
+}
+
+void reset()
+{
+  memset(s_stats, 0, sizeof(s_stats));
+  s_traceHead = 0;
+  s_traceWrapped = false;
+}
+
+// limite superiore (in tick) del bucket che contiene il percentile pct
+static uint32_t percentile(const SlotStats& s, uint8_t pct)
+{
+  uint32_t target = (uint32_t)(((uint64_t)s.count * pct + 99) / 100);
+  uint32_t acc = 0;
+  for (uint8_t b = 0; b < BUCKETS; ++b)
+  {
+    acc += s.hist[b];
+    if (acc >= target)
+    {
+      uint32_t hi = b ? (1UL << b) - 1 : 0;
+      return hi < s.max ? hi : s.max;
+    }
+  }
+  return s.max;
+}
+
+static void printUs(Print& out, uint32_t ticks)
+{
+  out.print((double)ticks / s_ticksPerUs, 1);
+}
+
+static void printSlotName(Print& out, uint8_t slot)
+{
+  if (slot < StageCount)
+  {
+    out.print(STAGE_NAMES[slot]);
+  } else
+  {
+    out.print(F("rule"));
+    out.print(slot - StageCount);
+  }
+}
+
+void report(Print& out)
+{
+  out.println(F("[PROF] tempi in us, percentili = limite del bucket log2"));
+  for (uint8_t i = 0; i < SLOTS; ++i)
+  {
+    const SlotStats& s = s_stats[i];
+    if (!s.count) continue;
+
+    out.print(F("  "));
+    printSlotName(out, i);
+    out.print(F(" n="));  out.print(s.count);
+    out.print(F(" min=")); printUs(out, s.min);
+    out.print(F(" avg=")); printUs(out, (uint32_t)(s.sum / s.count));
+    out.print(F(" max=")); printUs(out, s.max);
+    out.print(F(" p50<=")); printUs(out, percentile(s, 50));
+    out.print(F(" p90<=")); printUs(out, percentile(s, 90));
+    out.print(F(" p99<=")); printUs(out, percentile(s, 99));
+    out.println();
+  }
+}
+
+void chromeTrace(Print& out)
+{
+  uint16_t n     = s_traceWrapped ? PROF_TRACE_LEN : s_traceHead;
+  uint16_t first = s_traceWrapped ? s_traceHead : 0;
+  uint32_t base  = n ? s_trace[first].t0 : 0;
+
+  // gli scope esterni si chiudono dopo quelli interni: la base e' il t0 piu' vecchio
+  for (uint16_t k = 0; k < n; ++k)
+  {
+    uint32_t t0 = s_trace[(first + k) % PROF_TRACE_LEN].t0;
+    if ((int32_t)(t0 - base) < 0) base = t0;
+  }
+
+  out.print(F("{\"traceEvents\":["));
+  for (uint16_t k = 0; k < n; ++k)
+  {
+    const TraceEvt& e = s_trace[(first + k) % PROF_TRACE_LEN];
+    if (k) out.print(',');
+    out.print(F("{\"name\":\""));
+    printSlotName(out, e.slot);
+    out.print(F("\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":"));
+    printUs(out, e.t0 - base);
+    out.print(F(",\"dur\":"));
+    printUs(out, e.dt);
+    out.print('}');
+  }
+  out.println(F("]}"));
+}
+
+bool handleCommand(const char* line)
+{
+  if (strncmp(line, "PROF", 4) != 0 || (line[4] && line[4] != ' ')) return false;
+  const char* arg = line + 4;
+  while (*arg == ' ') arg++;
+
+  if (!*arg)                        report(Serial);
+  else if (!strcmp(arg, "TRACE"))   chromeTrace(Serial);
+  else if (!strcmp(arg, "RESET"))   { reset(); Serial.println(F("[PROF] reset")); }
+  else                              Serial.println(F("[PROF] uso: PROF [TRACE|RESET]"));
+  return true;
+}
+
+#else
+
+bool handleCommand(const char* line)
+{
+  if (strncmp(line, "PROF", 4) != 0 || (line[4] && line[4] != ' ')) return false;
+  Serial.println(F("[PROF] disabilitato (compilare con GW_PROFILE=1)"));
+  return true;
+}
+
+#endif
+
+} // namespace
@@ -0,0 +1,78 @@
+#pragma once
+#include <Arduino.h>
+
+// Profiler a stadi del main loop.
+//
+// PROF_SCOPE(Stage) misura la durata dello scope (contatore di cicli DWT su
+// Cortex-M, micros() su host) e accumula min/avg/max + istogramma log2 per i
+// percentili. Gli ultimi PROF_TRACE_LEN intervalli restano in un anello per la
+// timeline in formato Chrome trace (chrome://tracing, Perfetto).
+//
+// Con GW_PROFILE=0 le macro non generano codice: la strumentazione puo'
+// restare nel firmware di produzione.
+
+#ifndef GW_PROFILE
+#define GW_PROFILE 0
+#endif
+
+#ifndef PROF_MAX_RULES
+#define PROF_MAX_RULES 32      // regole profilate singolarmente (le altre no)
+#endif
+#ifndef PROF_TRACE_LEN
+#define PROF_TRACE_LEN 256     // eventi nella timeline
+#endif
+
+namespace PROF {
+
+enum Stage : uint8_t {
+  Loop = 0,     // giro completo di loop()
+  CanRx,        // CAN.read()
+  PrettyPrint,  // CANM::prettyPrintRx
+  RuleScan,     // ricerca regole (dispatch CAN2MB / scansione MB2CAN)
+  Extract,      // extractModbusFromCan
+  MbWrite,      // MBM::submitWrite
+  MbRead,       // MBM::submitRead
+  BuildCan,     // buildCanFromModbus
+  CanTx,        // CANM::serviceTx (coda -> mailbox)
+  Capture,      // CAPM::service
+  StageCount
+};
+
+// Comandi da seriale: "PROF", "PROF TRACE", "PROF RESET". true se gestito.
+bool handleCommand(const char* line);
+
+#if GW_PROFILE
+
+void     begin();
+uint32_t now();                                        // tick correnti
+void     record(uint8_t slot, uint32_t t0, uint32_t dt);
+uint8_t  ruleSlot(uint16_t ruleIdx);                   // 0xFF se oltre PROF_MAX_RULES
+
+void report(Print& out);
+void chromeTrace(Print& out);
+void reset();
+
+class Scope {
+public:
+  explicit Scope(uint8_t slot) : slot_(slot), t0_(now()) {}
+  ~Scope() { if (slot_ != 0xFF) record(slot_, t0_, now() - t0_); }
+private:
+  uint8_t  slot_;
+  uint32_t t0_;
+};
+
+#define PROF_CAT2(a, b) a##b
+#define PROF_CAT(a, b)  PROF_CAT2(a, b)
+#define PROF_SCOPE(stage) PROF::Scope PROF_CAT(_prof_, __LINE__)(PROF::stage)
+#define PROF_RULE(idx)    PROF::Scope PROF_CAT(_profr_, __LINE__)(PROF::ruleSlot(idx))
+#define PROF_BEGIN()      PROF::begin()
+
+#else
+
+#define PROF_SCOPE(stage) do {} while (0)
+#define PROF_RULE(idx)    do {} while (0)
+#define PROF_BEGIN()      do {} while (0)
+
+#endif
+
+} // namespace
@@ -15,3 +15,35 @@ bool SDM_readText(const char* path, String& out)
   f.close();
   return true;
 }
+
+File SDM_openAppend(const char* path) 
+{
+  return SD.open(path, FILE_WRITE);
+}
+
+bool SDM_exists(const char* path) 
+{
+  return SD.exists(path);
+}
+
+File SDM_openTruncate(const char* path) 
+{
+  if (SD.exists(path)) SD.remove(path);
+  return SD.open(path, FILE_WRITE);
+}
+
+bool SDM_remove(const char* path) 
+{
+  return !SD.exists(path) || SD.remove(path);
+}
+
+int32_t SDM_readBin(const char* path, uint8_t* buf, uint32_t max) 
+{
+  File f = SD.open(path, FILE_READ);
+
+  if (!f) return -1;
+
+  int n = f.read(buf, (uint16_t)(max > 0xFFFF ? 0xFFFF : max));
+  f.close();
+  return n < 0 ? 0 : n;
+}
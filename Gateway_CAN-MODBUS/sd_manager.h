@@ -4,3 +4,17 @@
 
 bool SDM_begin(uint8_t csPin);
 bool SDM_readText(const char* path, String& out);
+
+// File binari (capture, snapshot): apertura in append / esistenza
+File SDM_openAppend(const char* path);
+bool SDM_exists(const char* path);
+
+// File binari riscritti da zero (snapshot): il vecchio contenuto viene rimosso
+File SDM_openTruncate(const char* path);
+
+// Rimozione (true anche se il file non c'era): per spezzare openTruncate su
+// due giri di loop
+bool SDM_remove(const char* path);
+
+// Legge al piu' max byte: ritorna i byte letti, -1 se il file manca
+int32_t SDM_readBin(const char* path, uint8_t* buf, uint32_t max);
@@ -0,0 +1,181 @@
+#include "static_config.h"
+
+#if GW_STATIC_CONFIG
+#include <gw_config.h>
+
+static void copyDispatch(const GWC::Dispatch* e, uint16_t ne, const uint16_t* idx, uint16_t ni, CanDispatch& out)
+{
+  out.entries.clear();
+  out.ruleIdx.clear();
+  for (uint16_t i = 0; i < ne; ++i) out.entries.push_back({ e[i].id, e[i].first, e[i].count });
+  out.ruleIdx.assign(idx, idx + ni);
+}
+
+bool loadStaticConfig(long& outBitrate, CanShaperConfig& outShaper, std::vector<CanMessageSpec>& outMsgs,
+                      ModbusRtuConfig& outRtu, ModbusSlaveConfig& outSlave,
+                      std::vector<ModbusResourceSpec>& outRes, std::vector<MappingRule>& outRules,
+                      CanDispatch& outCanDispatch, CanDispatch& outReqDispatch)
+{
+  outBitrate = GWC::CAN_BITRATE;
+  outShaper.enabled      = GWC::SHAPER.enabled;
+  outShaper.max_load_pct = GWC::SHAPER.max_load_pct;
+  outShaper.burst_frames = GWC::SHAPER.burst_frames;
+
+  // CAN: i vettori si dimensionano prima, le regole puntano dentro di loro
+  outMsgs.clear();
+  outMsgs.reserve(GWC::N_CAN_MESSAGES);
+  for (uint16_t i = 0; i < GWC::N_CAN_MESSAGES; ++i)
+  {
+    const GWC::CanMessage& m = GWC::CAN_MESSAGES[i];
+    CanMessageSpec spec;
+    spec.name        = m.name;
+    spec.id          = m.id;
+    spec.dlc         = m.dlc;
+    spec.dir         = (CanDir)m.dir;
+    spec.max_rate_hz = m.max_rate_hz;
+    spec.stale_field = m.stale_field;
+    for (uint16_t k = 0; k < m.field_count; ++k)
+    {
+      const GWC::CanField& f = GWC::CAN_FIELDS[m.first_field + k];
+      FieldSpec fs;
+      fs.name   = f.name;
+      fs.type   = (FieldType)f.type;
+      fs.offset = f.offset;
+      fs.size   = f.size;
+      fs.endian = (Endian)f.endian;
+      fs.scale  = f.scale;
+      fs.bit    = f.bit;
+      spec.fields.push_back(fs);
+    }
+    outMsgs.push_back(spec);
+  }
+
+  // Modbus
+  const GWC::Rtu& r = GWC::RTU_CFG;
+  outRtu.baud          = r.baud;
+  outRtu.parity        = r.parity;
+  outRtu.stop_bits     = r.stop_bits;
+  outRtu.slave_id      = r.slave_id;
+  outRtu.budget_pct    = r.budget_pct;
+  outRtu.turnaround_us = r.turnaround_us;
+  outRtu.broadcast_turnaround_ms = r.broadcast_turnaround_ms;
+  outRtu.snapshot_ms   = r.snapshot_ms;
+  outRtu.ramp_ms       = r.ramp_ms;
+  outRtu.lines.clear();
+  for (uint16_t i = 0; i < GWC::N_MB_LINES; ++i)
+  {
+    const GWC::Line& g = GWC::MB_LINES[i];
+    ModbusLineConfig line;
+    line.name          = g.name;
+    line.port          = g.port;
+    line.de_re_pin     = g.de_re_pin;
+    line.baud          = g.baud;
+    line.parity        = g.parity;
+    line.stop_bits     = g.stop_bits;
+    line.slave_id      = g.slave_id;
+    line.budget_pct    = g.budget_pct;
+    line.turnaround_us = g.turnaround_us;
+    line.broadcast_turnaround_ms = g.broadcast_turnaround_ms;
+    outRtu.lines.push_back(line);
+  }
+
+  const GWC::Slave& s = GWC::SLAVE_CFG;
+  outSlave.enabled   = s.enabled;
+  outSlave.port      = s.port;
+  outSlave.de_re_pin = s.de_re_pin;
+  outSlave.baud      = s.baud;
+  outSlave.parity    = s.parity;
+  outSlave.stop_bits = s.stop_bits;
+  outSlave.id        = s.id;
+
+  outRes.clear();
+  outRes.reserve(GWC::N_MB_RESOURCES);
+  for (uint16_t i = 0; i < GWC::N_MB_RESOURCES; ++i)
+  {
+    const GWC::MbResource& m = GWC::MB_RESOURCES[i];
+    ModbusResourceSpec res;
+    res.name          = m.name;
+    res.fn            = (ModbusFn)m.fn;
+    res.address       = m.address;
+    res.count         = m.count;
+    res.period_ms     = m.period_ms;
+    res.min_period_ms = m.min_period_ms;
+    res.max_period_ms = m.max_period_ms;
+    res.local         = m.local;
+    res.line          = m.line;
+    res.slave_id      = m.slave_id;
+    for (uint16_t k = 0; k < m.field_count; ++k)
+    {
+      const GWC::MbField& f = GWC::MB_FIELDS[m.first_field + k];
+      ModbusField mf;
+      mf.name  = f.name;
+      mf.type  = (FieldType)f.type;
+      mf.index = f.index;
+      mf.count = f.count;
+      mf.scale = f.scale;
+      mf.bit   = f.bit;
+      res.fields.push_back(mf);
+    }
+    outRes.push_back(res);
+  }
+
+  // Regole: indici -> puntatori, poi le eventuali expr
+  outRules.clear();
+  outRules.reserve(GWC::N_RULES);
+  for (uint16_t i = 0; i < GWC::N_RULES; ++i)
+  {
+    const GWC::Rule& g = GWC::RULES[i];
+    const CanMessageSpec&     msg = outMsgs[g.can];
+    const ModbusResourceSpec& res = outRes[g.res];
+    MappingRule rule;
+    rule.dir = (RuleDir)g.dir;
+    const bool mb2can = rule.dir == RuleDir::MB2CAN;
+    if (mb2can) { rule.fromModbus = &res; rule.toCan = &msg; rule.from = res.name; rule.to = msg.name; }
+    else        { rule.fromCan = &msg; rule.toModbus = &res; rule.from = msg.name; rule.to = res.name; }
+    rule.request.enabled    = g.req_enabled;
+    rule.request.id         = g.req_id;
+    rule.request.rtr        = g.req_rtr;
+    rule.request.max_age_ms = g.req_max_age_ms;
+    rule.group.slaves.assign(GWC::GROUP_SLAVES + g.first_slave, GWC::GROUP_SLAVES + g.first_slave + g.slave_count);
+    rule.group.broadcast = g.broadcast;
+    rule.group.verify_ms = g.verify_ms;
+    outRules.push_back(rule);
+
+    MappingRule& rr = outRules.back();
+    for (uint16_t k = 0; k < g.pair_count; ++k)
+    {
+      const GWC::Pair& p = GWC::PAIRS[g.first_pair + k];
+      MapPair pair;
+      const ModbusField* mf = nullptr;
+      const FieldSpec*   cf = nullptr;
+      int16_t mbIdx  = mb2can ? p.src : p.dst;
+      int16_t canIdx = mb2can ? p.dst : p.src;
+      if (mbIdx  >= 0) mf = &res.fields[mbIdx];
+      if (canIdx >= 0) cf = &msg.fields[canIdx];
+      pair.mbField  = mf;
+      pair.canField = cf;
+      if (mb2can) { pair.src = mf ? mf->name : String(); pair.dst = cf->name; }
+      else        { pair.src = cf ? cf->name : String(); pair.dst = mf->name; }
+      if (p.expr && !compilePairExpr(rr, pair, p.expr))
+      {
+        return false;
+      }
+      rr.pairs.push_back(pair);
+    }
+  }
+
+  copyDispatch(GWC::CAN_DISPATCH, GWC::N_CAN_DISPATCH, GWC::CAN_DISPATCH_RULES, GWC::N_CAN_DISPATCH_RULES, outCanDispatch);
+  copyDispatch(GWC::REQ_DISPATCH, GWC::N_REQ_DISPATCH, GWC::REQ_DISPATCH_RULES, GWC::N_REQ_DISPATCH_RULES, outReqDispatch);
+  return true;
+}
+
+#else
+
+bool loadStaticConfig(long&, CanShaperConfig&, std::vector<CanMessageSpec>&, ModbusRtuConfig&, ModbusSlaveConfig&,
+                      std::vector<ModbusResourceSpec>&, std::vector<MappingRule>&, CanDispatch&, CanDispatch&)
+{
+  Serial.println(F("[CFG] configurazione statica non compilata (GW_STATIC_CONFIG=0)"));
+  return false;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "utils.h"
+#include "mapping.h"
+
+// Configurazione compilata nel firmware (installazioni fisse).
+//
+// Con GW_STATIC_CONFIG=1 il gateway non legge i JSON da SD: le tabelle
+// constexpr di gw_config.h (generate da Host/codegen a partire dagli stessi
+// can.json / modbus.json / mapping.json) restano in flash e al boot si
+// copiano nelle strutture di runtime. Nessun parse, nessun testo JSON in
+// heap; il dispatch CAN arriva gia' ordinato. Le "expr" si compilano al boot
+// come con i JSON.
+
+#ifndef GW_STATIC_CONFIG
+#define GW_STATIC_CONFIG 0
+#endif
+
+bool loadStaticConfig(long& outBitrate, CanShaperConfig& outShaper, std::vector<CanMessageSpec>& outMsgs,
+                      ModbusRtuConfig& outRtu, ModbusSlaveConfig& outSlave,
+                      std::vector<ModbusResourceSpec>& outRes, std::vector<MappingRule>& outRules,
+                      CanDispatch& outCanDispatch, CanDispatch& outReqDispatch);
@@ -0,0 +1,562 @@
+#include "transform.h"
+
+namespace XF {
+
+// -----------------------------------------------------------------------------
+// Semantica delle istruzioni (condivisa da interprete e constant folding)
+// -----------------------------------------------------------------------------
+static uint8_t arity(uint8_t op)
+{
+  switch (op)
+  {
+    case PushK: case Load:                       return 0;
+    case I2F: case F2I: case RoundF:
+    case NegI: case NegF: case AbsI: case AbsF: case NotI: return 1;
+    case ClampI: case ClampF:                    return 3;
+    default:                                     return 2;
+  }
+}
+
+static int32_t f2i(float f)
+{
+  if (f != f)             return 0;            // NaN
+  if (f >=  2147483520.0f) return INT32_MAX;
+  if (f <= -2147483648.0f) return INT32_MIN;
+  return (int32_t)f;
+}
+
+static Slot apply(uint8_t op, Slot a, Slot b, Slot c)
+{
+  Slot r;
+  switch (op)
+  {
+    case I2F:    r.f = (float)a.i; break;
+    case F2I:    r.i = f2i(a.f); break;
+    case RoundF: r.i = f2i(a.f >= 0 ? a.f + 0.5f : a.f - 0.5f); break;
+
+    case AddI:   r.i = (int32_t)((uint32_t)a.i + (uint32_t)b.i); break;
+    case AddF:   r.f = a.f + b.f; break;
+    case SubI:   r.i = (int32_t)((uint32_t)a.i - (uint32_t)b.i); break;
+    case SubF:   r.f = a.f - b.f; break;
+    case MulI:   r.i = (int32_t)((uint32_t)a.i * (uint32_t)b.i); break;
+    case MulF:   r.f = a.f * b.f; break;
+    case DivI:   r.i = (b.i == 0 || (a.i == INT32_MIN && b.i == -1)) ? 0 : a.i / b.i; break;
+    case DivF:   r.f = a.f / b.f; break;
+    case ModI:   r.i = (b.i == 0 || b.i == -1) ? 0 : a.i % b.i; break;
+
+    case NegI:   r.i = (int32_t)(0u - (uint32_t)a.i); break;
+    case NegF:   r.f = -a.f; break;
+    case AbsI:   r.i = a.i < 0 ? (int32_t)(0u - (uint32_t)a.i) : a.i; break;
+    case AbsF:   r.f = a.f < 0 ? -a.f : a.f; break;
+    case NotI:   r.i = ~a.i; break;
+
+    case AndI:   r.i = a.i & b.i; break;
+    case OrI:    r.i = a.i | b.i; break;
+    case XorI:   r.i = a.i ^ b.i; break;
+    case ShlI:   r.i = (int32_t)((uint32_t)a.i << (b.i & 31)); break;
+    case ShrI:   r.i = a.i >> (b.i & 31); break;
+
+    case LtI:    r.i = a.i <  b.i; break;
+    case LtF:    r.i = a.f <  b.f; break;
+    case LeI:    r.i = a.i <= b.i; break;
+    case LeF:    r.i = a.f <= b.f; break;
+    case GtI:    r.i = a.i >  b.i; break;
+    case GtF:    r.i = a.f >  b.f; break;
+    case GeI:    r.i = a.i >= b.i; break;
+    case GeF:    r.i = a.f >= b.f; break;
+    case EqI:    r.i = a.i == b.i; break;
+    case EqF:    r.i = a.f == b.f; break;
+    case NeI:    r.i = a.i != b.i; break;
+    case NeF:    r.i = a.f != b.f; break;
+
+    case MinI:   r.i = a.i < b.i ? a.i : b.i; break;
+    case MinF:   r.f = a.f < b.f ? a.f : b.f; break;
+    case MaxI:   r.i = a.i > b.i ? a.i : b.i; break;
+    case MaxF:   r.f = a.f > b.f ? a.f : b.f; break;
+
+    case ClampI: r.i = a.i < b.i ? b.i : (a.i > c.i ? c.i : a.i); break;
+    case ClampF: r.f = a.f < b.f ? b.f : (a.f > c.f ? c.f : a.f); break;
+
+    default:     r.i = 0; break;
+  }
+  return r;
+}
+
+// -----------------------------------------------------------------------------
+// Interprete
+// -----------------------------------------------------------------------------
+Slot run(const Program& p, const Slot* vars)
+{
+  Slot st[XF_MAX_STACK];
+  uint8_t sp = 0;
+  const Insn* ip  = p.code.data();
+  const Insn* end = ip + p.code.size();
+
+  for (; ip < end; ++ip)
+  {
+    switch (ip->op)
+    {
+      case PushK: st[sp++] = p.consts[ip->arg]; break;
+      case Load:  st[sp++] = vars[ip->arg]; break;
+      default:
+      {
+        uint8_t n = arity(ip->op);
+        Slot z; z.i = 0;
+        Slot a = st[sp - n];
+        Slot b = n > 1 ? st[sp - n + 1] : z;
+        Slot c = n > 2 ? st[sp - n + 2] : z;
+        sp -= n;
+        st[sp++] = apply(ip->op, a, b, c);
+      } break;
+    }
+  }
+  return st[0];
+}
+
+bool isPlainLoad(const Program& p, uint8_t& var)
+{
+  if (p.code.size() != 1 || p.code[0].op != Load) return false;
+  var = p.code[0].arg;
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// Compilatore: discesa ricorsiva -> albero tipizzato (con folding) -> bytecode
+// -----------------------------------------------------------------------------
+struct Node {
+  uint8_t op;
+  VType   type;
+  Slot    k;          // PushK
+  uint8_t var;        // Load
+  int16_t a, b, c;
+};
+
+struct Parser {
+  const char*       p;
+  Resolver          resolve;
+  void*             ctx;
+  std::vector<Node> nodes;
+  String            err;
+  uint8_t           depth = 0;  // parentesi e unari aperti: limita la ricorsione (stack)
+};
+
+// Un livello di annidamento per parseUnary/parsePrimary, rilasciato all'uscita
+struct DepthGuard {
+  Parser& ps;
+  explicit DepthGuard(Parser& p) : ps(p) { ps.depth++; }
+  ~DepthGuard() { ps.depth--; }
+  bool tooDeep() const { return ps.depth > XF_MAX_DEPTH; }
+};
+
+static bool fail(Parser& ps, const char* msg)
+{
+  if (!ps.err.length()) ps.err = msg;
+  return false;
+}
+
+static_assert(XF_MAX_NODES <= INT16_MAX, "indici dei nodi su int16_t");
+
+// Catene come x+x+x+... non passano da DepthGuard ma fanno crescere l'albero:
+// il tetto sui nodi limita la profondita' di emit()
+static int16_t addNode(Parser& ps, const Node& n)
+{
+  if (ps.nodes.size() >= XF_MAX_NODES)
+  {
+    fail(ps, "espressione troppo complessa");
+    return -1;
+  }
+  ps.nodes.push_back(n);
+  return (int16_t)(ps.nodes.size() - 1);
+}
+
+static int16_t constNode(Parser& ps, VType t, Slot k)
+{
+  Node n;
+  n.op = PushK; n.type = t; n.k = k; n.var = 0; n.a = n.b = n.c = -1;
+  return addNode(ps, n);
+}
+
+static bool isConst(const Parser& ps, int16_t i, float v)
+{
+  const Node& n = ps.nodes[i];
+  if (n.op != PushK) return false;
+  return n.type == VType::Int ? n.k.i == (int32_t)v : n.k.f == v;
+}
+
+// crea un nodo operazione: ripiega le costanti e toglie gli elementi neutri
+static int16_t opNode(Parser& ps, uint8_t op, VType t, int16_t a, int16_t b = -1, int16_t c = -1)
+{
+  if (a < 0) return -1;
+
+  bool allConst = ps.nodes[a].op == PushK &&
+                  (b < 0 || ps.nodes[b].op == PushK) &&
+                  (c < 0 || ps.nodes[c].op == PushK);
+  if (allConst)
+  {
+    Slot z; z.i = 0;
+    Slot r = apply(op, ps.nodes[a].k, b >= 0 ? ps.nodes[b].k : z, c >= 0 ? ps.nodes[c].k : z);
+    return constNode(ps, t, r);
+  }
+
+  switch (op)
+  {
+    case AddI: case AddF: case OrI: case XorI:
+      if (isConst(ps, b, 0)) return a;
+      if (isConst(ps, a, 0)) return b;
+      break;
+    case SubI: case SubF: case ShlI: case ShrI:
+      if (isConst(ps, b, 0)) return a;
+      break;
+    case MulI: case MulF:
+      if (isConst(ps, b, 1)) return a;
+      if (isConst(ps, a, 1)) return b;
+      break;
+    case DivI: case DivF:
+      if (isConst(ps, b, 1)) return a;
+      break;
+    default: break;
+  }
+
+  Node n;
+  n.op = op; n.type = t; n.k.i = 0; n.var = 0; n.a = a; n.b = b; n.c = c;
+  return addNode(ps, n);
+}
+
+static int16_t toType(Parser& ps, int16_t n, VType t)
+{
+  if (n < 0 || ps.nodes[n].type == t) return n;
+  return opNode(ps, t == VType::Float ? I2F : F2I, t, n);
+}
+
+// operatore aritmetico: float se almeno un operando e' float
+static int16_t arith(Parser& ps, uint8_t opI, uint8_t opF, int16_t a, int16_t b, bool boolResult = false)
+{
+  if (a < 0 || b < 0) return -1;
+  bool fl = ps.nodes[a].type == VType::Float || ps.nodes[b].type == VType::Float;
+  VType t = fl ? VType::Float : VType::Int;
+  a = toType(ps, a, t);
+  b = toType(ps, b, t);
+  return opNode(ps, fl ? opF : opI, boolResult ? VType::Int : t, a, b);
+}
+
+static int16_t intOnly(Parser& ps, uint8_t op, int16_t a, int16_t b)
+{
+  if (a < 0 || b < 0) return -1;
+  if (ps.nodes[a].type != VType::Int || ps.nodes[b].type != VType::Int)
+  {
+    fail(ps, "operando float in operazione intera (usare int())");
+    return -1;
+  }
+  return opNode(ps, op, VType::Int, a, b);
+}
+
+static void skipWs(Parser& ps)
+{
+  while (*ps.p == ' ' || *ps.p == '\t') ps.p++;
+}
+
+static bool accept(Parser& ps, const char* tok)
+{
+  skipWs(ps);
+  size_t n = strlen(tok);
+  if (strncmp(ps.p, tok, n) != 0) return false;
+  // "<" non deve mangiare "<<" o "<="
+  if (n == 1 && (tok[0] == '<' || tok[0] == '>') && (ps.p[1] == tok[0] || ps.p[1] == '=')) return false;
+  if (n == 1 && (tok[0] == '&' || tok[0] == '|') && ps.p[1] == tok[0]) return false;
+  ps.p += n;
+  return true;
+}
+
+static int16_t parseExpr(Parser& ps);
+
+static bool isIdStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+static bool isIdChar(char c)  { return isIdStart(c) || (c >= '0' && c <= '9'); }
+
+static int16_t parseNumber(Parser& ps)
+{
+  const char* s = ps.p;
+  char* end;
+  Slot k;
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+  {
+    k.i = (int32_t)strtoul(s, &end, 16);
+    ps.p = end;
+    return constNode(ps, VType::Int, k);
+  }
+
+  double d = strtod(s, &end);
+  bool fl = false;
+  for (const char* q = s; q < end; ++q) if (*q == '.' || *q == 'e' || *q == 'E') fl = true;
+  ps.p = end;
+  if (fl || d > INT32_MAX || d < INT32_MIN)
+  {
+    k.f = (float)d;
+    return constNode(ps, VType::Float, k);
+  }
+  k.i = (int32_t)d;
+  return constNode(ps, VType::Int, k);
+}
+
+static int16_t parseCall(Parser& ps, const char* name, uint8_t len)
+{
+  int16_t args[3];
+  uint8_t n = 0;
+  skipWs(ps);
+  if (!accept(ps, ")"))
+  {
+    do
+    {
+      if (n >= 3) { fail(ps, "troppi argomenti"); return -1; }
+      args[n++] = parseExpr(ps);
+      if (args[n - 1] < 0) return -1;
+    } while (accept(ps, ","));
+    if (!accept(ps, ")")) { fail(ps, "')' mancante"); return -1; }
+  }
+
+  auto is = [&](const char* f, uint8_t want) -> bool {
+    if (strlen(f) != len || strncmp(f, name, len) != 0) return false;
+    if (n != want) fail(ps, "numero di argomenti errato");
+    return true;
+  };
+
+  if (is("min", 2))   return n == 2 ? arith(ps, MinI, MinF, args[0], args[1]) : -1;
+  if (is("max", 2))   return n == 2 ? arith(ps, MaxI, MaxF, args[0], args[1]) : -1;
+  if (is("clamp", 3))
+  {
+    if (n != 3) return -1;
+    bool fl = false;
+    for (uint8_t i = 0; i < 3; ++i) fl |= ps.nodes[args[i]].type == VType::Float;
+    VType t = fl ? VType::Float : VType::Int;
+    return opNode(ps, fl ? ClampF : ClampI, t, toType(ps, args[0], t), toType(ps, args[1], t), toType(ps, args[2], t));
+  }
+  if (is("abs", 1))
+  {
+    if (n != 1) return -1;
+    bool fl = ps.nodes[args[0]].type == VType::Float;
+    return opNode(ps, fl ? AbsF : AbsI, ps.nodes[args[0]].type, args[0]);
+  }
+  if (is("round", 1))
+  {
+    if (n != 1) return -1;
+    if (ps.nodes[args[0]].type == VType::Int) return args[0];
+    return opNode(ps, RoundF, VType::Int, args[0]);
+  }
+  if (is("int", 1))   return n == 1 ? toType(ps, args[0], VType::Int) : -1;
+  if (is("float", 1)) return n == 1 ? toType(ps, args[0], VType::Float) : -1;
+
+  fail(ps, "funzione sconosciuta");
+  return -1;
+}
+
+static int16_t parsePrimary(Parser& ps)
+{
+  DepthGuard g(ps);
+  if (g.tooDeep()) { fail(ps, "espressione troppo annidata"); return -1; }
+  skipWs(ps);
+  char c = *ps.p;
+
+  if (c == '(')
+  {
+    ps.p++;
+    int16_t e = parseExpr(ps);
+    if (e >= 0 && !accept(ps, ")")) { fail(ps, "')' mancante"); return -1; }
+    return e;
+  }
+  if ((c >= '0' && c <= '9') || c == '.')
+  {
+    return parseNumber(ps);
+  }
+  if (isIdStart(c))
+  {
+    const char* name = ps.p;
+    while (isIdChar(*ps.p)) ps.p++;
+    uint8_t len = (uint8_t)(ps.p - name);
+    skipWs(ps);
+    if (*ps.p == '(')
+    {
+      ps.p++;
+      return parseCall(ps, name, len);
+    }
+
+    uint8_t var; VType t;
+    if (!ps.resolve(ps.ctx, name, len, var, t))
+    {
+      fail(ps, "campo sconosciuto");
+      return -1;
+    }
+    Node n;
+    n.op = Load; n.type = t; n.k.i = 0; n.var = var; n.a = n.b = n.c = -1;
+    return addNode(ps, n);
+  }
+
+  fail(ps, c ? "carattere inatteso" : "espressione incompleta");
+  return -1;
+}
+
+static int16_t parseUnary(Parser& ps)
+{
+  DepthGuard g(ps);
+  if (g.tooDeep()) { fail(ps, "espressione troppo annidata"); return -1; }
+  if (accept(ps, "-"))
+  {
+    int16_t a = parseUnary(ps);
+    if (a < 0) return -1;
+    bool fl = ps.nodes[a].type == VType::Float;
+    return opNode(ps, fl ? NegF : NegI, ps.nodes[a].type, a);
+  }
+  if (accept(ps, "~"))
+  {
+    int16_t a = parseUnary(ps);
+    if (a < 0) return -1;
+    if (ps.nodes[a].type != VType::Int) { fail(ps, "operando float in operazione intera (usare int())"); return -1; }
+    return opNode(ps, NotI, VType::Int, a);
+  }
+  if (accept(ps, "+")) return parseUnary(ps);
+  return parsePrimary(ps);
+}
+
+static int16_t parseMul(Parser& ps)
+{
+  int16_t a = parseUnary(ps);
+  while (a >= 0)
+  {
+    if      (accept(ps, "*")) a = arith(ps, MulI, MulF, a, parseUnary(ps));
+    else if (accept(ps, "/")) a = arith(ps, DivI, DivF, a, parseUnary(ps));
+    else if (accept(ps, "%")) a = intOnly(ps, ModI, a, parseUnary(ps));
+    else break;
+  }
+  return a;
+}
+
+static int16_t parseAdd(Parser& ps)
+{
+  int16_t a = parseMul(ps);
+  while (a >= 0)
+  {
+    if      (accept(ps, "+")) a = arith(ps, AddI, AddF, a, parseMul(ps));
+    else if (accept(ps, "-")) a = arith(ps, SubI, SubF, a, parseMul(ps));
+    else break;
+  }
+  return a;
+}
+
+static int16_t parseShift(Parser& ps)
+{
+  int16_t a = parseAdd(ps);
+  while (a >= 0)
+  {
+    if      (accept(ps, "<<")) a = intOnly(ps, ShlI, a, parseAdd(ps));
+    else if (accept(ps, ">>")) a = intOnly(ps, ShrI, a, parseAdd(ps));
+    else break;
+  }
+  return a;
+}
+
+static int16_t parseRel(Parser& ps)
+{
+  int16_t a = parseShift(ps);
+  while (a >= 0)
+  {
+    if      (accept(ps, "<=")) a = arith(ps, LeI, LeF, a, parseShift(ps), true);
+    else if (accept(ps, ">=")) a = arith(ps, GeI, GeF, a, parseShift(ps), true);
+    else if (accept(ps, "<"))  a = arith(ps, LtI, LtF, a, parseShift(ps), true);
+    else if (accept(ps, ">"))  a = arith(ps, GtI, GtF, a, parseShift(ps), true);
+    else break;
+  }
+  return a;
+}
+
+static int16_t parseEq(Parser& ps)
+{
+  int16_t a = parseRel(ps);
+  while (a >= 0)
+  {
+    if      (accept(ps, "==")) a = arith(ps, EqI, EqF, a, parseRel(ps), true);
+    else if (accept(ps, "!=")) a = arith(ps, NeI, NeF, a, parseRel(ps), true);
+    else break;
+  }
+  return a;
+}
+
+static int16_t parseBitAnd(Parser& ps)
+{
+  int16_t a = parseEq(ps);
+  while (a >= 0 && accept(ps, "&")) a = intOnly(ps, AndI, a, parseEq(ps));
+  return a;
+}
+
+static int16_t parseBitXor(Parser& ps)
+{
+  int16_t a = parseBitAnd(ps);
+  while (a >= 0 && accept(ps, "^")) a = intOnly(ps, XorI, a, parseBitAnd(ps));
+  return a;
+}
+
+static int16_t parseExpr(Parser& ps)
+{
+  int16_t a = parseBitXor(ps);
+  while (a >= 0 && accept(ps, "|")) a = intOnly(ps, OrI, a, parseBitXor(ps));
+  return a;
+}
+
+static bool emit(Parser& ps, int16_t i, Program& out, uint8_t& depth)
+{
+  const Node& n = ps.nodes[i];
+  Insn in;
+  in.op = n.op;
+  in.arg = 0;
+
+  if (n.op == PushK)
+  {
+    if (out.consts.size() >= 255) return fail(ps, "troppe costanti");
+    in.arg = (uint8_t)out.consts.size();
+    out.consts.push_back(n.k);
+  } else if (n.op == Load)
+  {
+    in.arg = n.var;
+  } else
+  {
+    const int16_t kids[3] = { n.a, n.b, n.c };
+    uint8_t ar = arity(n.op);
+    for (uint8_t k = 0; k < ar; ++k)
+    {
+      if (!emit(ps, kids[k], out, depth)) return false;
+    }
+    depth -= ar;
+  }
+
+  if (++depth > out.maxStack) out.maxStack = depth;
+  if (out.maxStack > XF_MAX_STACK) return fail(ps, "espressione troppo complessa");
+  out.code.push_back(in);
+  return true;
+}
+
+bool compile(const char* expr, Resolver resolve, void* ctx, Program& out, String& err)
+{
+  out = Program();
+
+  Parser ps;
+  ps.p       = expr;
+  ps.resolve = resolve;
+  ps.ctx     = ctx;
+
+  int16_t root = parseExpr(ps);
+  if (root >= 0)
+  {
+    skipWs(ps);
+    if (*ps.p) { root = -1; fail(ps, "carattere inatteso"); }
+  }
+  if (ps.err.length()) root = -1;   // un errore a meta' (es. nodi esauriti) non lascia un albero parziale
+
+  uint8_t depth = 0;
+  if (root < 0 || !emit(ps, root, out, depth))
+  {
+    err = ps.err;
+    out = Program();
+    return false;
+  }
+  out.result = ps.nodes[root].type;
+  return true;
+}
+
+} // namespace
@@ -0,0 +1,80 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+
+// Trasformazioni dei campi di mapping ("expr" in mapping.json).
+//
+// L'espressione viene compilata al caricamento in un bytecode a stack con
+// slot tipizzati (int32 / float): i tipi sono noti a compile time, quindi le
+// istruzioni sono gia' specializzate e l'interprete non controlla tag.
+// Le sottoespressioni costanti vengono ripiegate e gli elementi neutri
+// (x*1, x+0, ...) eliminati: un'espressione che si riduce a un solo campo
+// torna alla copia diretta del mapping.
+//
+// Sintassi (precedenze come in C):
+//   numeri 12, 0x1F, 1.5, 2e3    campi sorgente per nome, "x" = campo "src"
+//   + - * / %   & | ^ ~ << >>   < <= > >= == !=
+//   min(a,b) max(a,b) clamp(v,lo,hi) abs(v) round(v) int(v) float(v)
+// Gli operatori su bit e % accettano solo interi (usare int()).
+
+#ifndef XF_MAX_STACK
+#define XF_MAX_STACK 8      // profondita' massima dello stack di valutazione
+#endif
+#ifndef XF_MAX_VARS
+#define XF_MAX_VARS  8      // campi sorgente distinti per espressione
+#endif
+#ifndef XF_MAX_DEPTH
+#define XF_MAX_DEPTH 16     // annidamento di parentesi e operatori unari nel parser
+#endif
+#ifndef XF_MAX_NODES
+#define XF_MAX_NODES 64     // nodi dell'albero: limita anche la ricorsione di emit()
+#endif
+
+namespace XF {
+
+enum class VType : uint8_t { Int, Float };
+
+union Slot {
+  int32_t i;
+  float   f;
+};
+
+enum Op : uint8_t {
+  PushK, Load,                        // arg = costante / variabile
+  I2F, F2I, RoundF,
+  AddI, AddF, SubI, SubF, MulI, MulF, DivI, DivF, ModI,
+  NegI, NegF, AbsI, AbsF, NotI,
+  AndI, OrI, XorI, ShlI, ShrI,
+  LtI, LtF, LeI, LeF, GtI, GtF, GeI, GeF, EqI, EqF, NeI, NeF,
+  MinI, MinF, MaxI, MaxF,
+  ClampI, ClampF,
+  OpCount
+};
+
+struct Insn {
+  uint8_t op;
+  uint8_t arg;
+};
+
+struct Program {
+  std::vector<Insn> code;
+  std::vector<Slot> consts;
+  VType   result   = VType::Int;
+  uint8_t maxStack = 0;
+
+  bool empty() const { return code.empty(); }
+};
+
+// Risolve un nome di variabile: indice dello slot in ingresso e suo tipo
+typedef bool (*Resolver)(void* ctx, const char* name, uint8_t len, uint8_t& var, VType& type);
+
+// false con messaggio in err se l'espressione non e' valida
+bool compile(const char* expr, Resolver resolve, void* ctx, Program& out, String& err);
+
+// true se il programma e' solo "Load var" (copia diretta di un campo)
+bool isPlainLoad(const Program& p, uint8_t& var);
+
+// Esegue il programma; vars indicizzate come restituito dal resolver
+Slot run(const Program& p, const Slot* vars);
+
+} // namespace
@@ -40,6 +40,33 @@ bool strToBool(const String& s, bool& out)
   return false;
 }
 
+bool strEqI(const char* a, const char* b) 
+{
+  while (*a && *b) 
+  {
+    char ca = *a++, cb = *b++;
+    if (ca >= 'a' && ca <= 'z') ca -= 32;
+    if (cb >= 'a' && cb <= 'z') cb -= 32;
+    if (ca != cb) return false;
+  }
+  return *a == *b;
+}
+
+bool strToBool(const char* s, bool& out) 
+{
+  if (strEqI(s, "1") || strEqI(s, "true") || strEqI(s, "on"))  
+  { 
+    out=true;  
+    return true; 
+  }
+  if (strEqI(s, "0") || strEqI(s, "false")|| strEqI(s, "off")) 
+  { 
+    out=false; 
+    return true; 
+  }
+  return false;
+}
+
 Endian parseEndianStr(const String& s) {
   return s.equalsIgnoreCase("big") ? Endian::Big : Endian::Little;
 }
@@ -63,11 +90,31 @@ ModbusFn parseModbusFn(const String& s) {
   if (s.equalsIgnoreCase("read_holding"))   return ModbusFn::ReadHolding;
   if (s.equalsIgnoreCase("write_single"))   return ModbusFn::WriteSingle;
   if (s.equalsIgnoreCase("write_multiple")) return ModbusFn::WriteMultiple;
+  if (s.equalsIgnoreCase("read_input"))     return ModbusFn::ReadInput;
+  if (s.equalsIgnoreCase("read_coils"))     return ModbusFn::ReadCoils;
+  if (s.equalsIgnoreCase("read_discrete"))  return ModbusFn::ReadDiscrete;
+  if (s.equalsIgnoreCase("write_coil"))     return ModbusFn::WriteCoil;
+  if (s.equalsIgnoreCase("write_coils"))    return ModbusFn::WriteCoils;
   return ModbusFn::Unknown;
 }
 
+uint8_t modbusFnCode(ModbusFn fn) {
+  switch (fn) {
+    case ModbusFn::ReadCoils:     return 0x01;
+    case ModbusFn::ReadDiscrete:  return 0x02;
+    case ModbusFn::ReadHolding:   return 0x03;
+    case ModbusFn::ReadInput:     return 0x04;
+    case ModbusFn::WriteCoil:     return 0x05;
+    case ModbusFn::WriteSingle:   return 0x06;
+    case ModbusFn::WriteCoils:    return 0x0F;
+    case ModbusFn::WriteMultiple: return 0x10;
+    default:                      return 0;
+  }
+}
+
 // ============ JSON → CAN ============
-bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSpec>& outMsgs)
+bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSpec>& outMsgs,
+                  CanShaperConfig* outShaper)
 {
   outMsgs.clear();
   outBitrate = 500000;
@@ -82,6 +129,22 @@ bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSp
   {
     outBitrate = (long)root["bitrate"];
   }
+  if (outShaper) 
+  {
+    *outShaper = CanShaperConfig();
+    if (root.hasOwnProperty("shaper")) 
+    {
+      JSONVar sh = root["shaper"];
+      outShaper->enabled = !sh.hasOwnProperty("enabled") || (bool)sh["enabled"];
+      if (sh.hasOwnProperty("max_load_pct")) outShaper->max_load_pct = (uint8_t)((long)sh["max_load_pct"]);
+      if (sh.hasOwnProperty("burst_frames")) outShaper->burst_frames = (uint8_t)((long)sh["burst_frames"]);
+      if (outShaper->max_load_pct > 100 || outShaper->burst_frames == 0) 
+      {
+        Serial.println(F("[JSON] shaper: max_load_pct 0..100, burst_frames >= 1"));
+        return false;
+      }
+    }
+  }
   if (!root.hasOwnProperty("messages") || JSON.typeof(root["messages"])!="array") 
   {
     Serial.println(F("[JSON] CAN 'messages' mancante o non array"));
@@ -114,7 +177,7 @@ bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSp
     }
 
     uint32_t idv; 
-    if (!idStr.length() || !parseUIntFlexible(idStr, idv)) 
+    if (!idStr.length() || !parseUIntFlexible(idStr, idv) || idv > 0x1FFFFFFF) 
     { 
       Serial.println(F("[JSON] id invalido")); 
       continue; 
@@ -145,6 +208,10 @@ bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSp
     }
 
     spec.dir = parseDirStr((const char*)m["dir"]);
+    if (m.hasOwnProperty("max_rate_hz")) 
+    {
+      spec.max_rate_hz = (uint16_t)((long)m["max_rate_hz"]);
+    }
 
     if (spec.dir==CanDir::INVALID) 
     { 
@@ -175,6 +242,10 @@ bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSp
       fs.size   = (uint8_t)((long)f["size"]);
       fs.endian = parseEndianStr(f.hasOwnProperty("endian") ? (const char*)f["endian"] : "little");
       fs.scale  = f.hasOwnProperty("scale") ? (double)f["scale"] : 1.0;
+      if (f.hasOwnProperty("bit")) 
+      {
+        fs.bit = (uint8_t)((long)f["bit"]);
+      }
 
       if (fs.type==FieldType::Unknown || fs.size==0) 
       { 
@@ -182,6 +253,12 @@ bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSp
         continue; 
       }
 
+      if (fs.bit != 0xFF && (fs.type != FieldType::Bool || fs.size != 1 || fs.bit > 7)) 
+      { 
+        Serial.println(F("[JSON] bit valido solo per bool size 1 (0..7)")); 
+        continue; 
+      }
+
       if (fs.offset + fs.size > spec.dlc)            
       { 
         Serial.println(F("[JSON] field fuori DLC")); 
@@ -195,13 +272,27 @@ bool parseCanJson(const String& json, long& outBitrate, std::vector<CanMessageSp
         maxUsed = fs.offset + fs.size;
       }
     }
+    if (m.hasOwnProperty("stale_field") && JSON.typeof(m["stale_field"])=="string") 
+    {
+      const char* sn = (const char*)m["stale_field"];
+      for (size_t k = 0; k < spec.fields.size(); ++k) 
+      {
+        if (spec.fields[k].name == sn && spec.fields[k].type == FieldType::Bool) spec.stale_field = (int8_t)k;
+      }
+      if (spec.stale_field < 0) 
+      { 
+        Serial.println(F("[JSON] stale_field deve indicare un campo bool")); 
+        continue; 
+      }
+    }
     outMsgs.push_back(spec);
   }
   return !outMsgs.empty();
 }
 
 // ============ JSON → Modbus ============
-bool parseModbusJson(const String& json, ModbusRtuConfig& outRTU, std::vector<ModbusResourceSpec>& outRes)
+bool parseModbusJson(const String& json, ModbusRtuConfig& outRTU, std::vector<ModbusResourceSpec>& outRes,
+                     ModbusSlaveConfig* outSlave)
 {
   outRes.clear();
   outRTU = ModbusRtuConfig();
@@ -221,6 +312,80 @@ bool parseModbusJson(const String& json, ModbusRtuConfig& outRTU, std::vector<Mo
     if (rtu.hasOwnProperty("parity"))    outRTU.parity    = ((const char*)rtu["parity"])[0];
     if (rtu.hasOwnProperty("stop_bits")) outRTU.stop_bits = (uint8_t)((long)rtu["stop_bits"]);
     if (rtu.hasOwnProperty("slave_id"))  outRTU.slave_id  = (uint8_t)((long)rtu["slave_id"]);
+    if (rtu.hasOwnProperty("budget_pct"))    outRTU.budget_pct    = (uint8_t)((long)rtu["budget_pct"]);
+    if (rtu.hasOwnProperty("turnaround_us")) outRTU.turnaround_us = (uint32_t)((long)rtu["turnaround_us"]);
+    if (rtu.hasOwnProperty("broadcast_turnaround_ms"))
+    {
+      outRTU.broadcast_turnaround_ms = (uint32_t)((long)rtu["broadcast_turnaround_ms"]);
+    }
+    if (rtu.hasOwnProperty("snapshot_ms"))   outRTU.snapshot_ms   = (uint32_t)((long)rtu["snapshot_ms"]);
+    if (rtu.hasOwnProperty("ramp_ms"))       outRTU.ramp_ms       = (uint32_t)((long)rtu["ramp_ms"]);
+  }
+
+  // Linee del master: formato, slave, budget e turnaround ereditati da "rtu"
+  ModbusLineConfig def;
+  def.baud          = outRTU.baud;
+  def.parity        = outRTU.parity;
+  def.stop_bits     = outRTU.stop_bits;
+  def.slave_id      = outRTU.slave_id;
+  def.budget_pct    = outRTU.budget_pct;
+  def.turnaround_us = outRTU.turnaround_us;
+  def.broadcast_turnaround_ms = outRTU.broadcast_turnaround_ms;
+
+  if (root.hasOwnProperty("lines") && JSON.typeof(root["lines"]) == "array") 
+  {
+    JSONVar larr = root["lines"];
+    for (unsigned int i=0; i<larr.length(); ++i) 
+    {
+      JSONVar l = larr[i];
+      ModbusLineConfig line = def;
+      line.name = "";
+      if (l.hasOwnProperty("name") && JSON.typeof(l["name"])=="string") line.name = (const char*)l["name"];
+      if (l.hasOwnProperty("port"))          line.port          = (const char*)l["port"];
+      if (l.hasOwnProperty("de_re_pin"))     line.de_re_pin     = (uint8_t)((long)l["de_re_pin"]);
+      if (l.hasOwnProperty("baud"))          line.baud          = (long)l["baud"];
+      if (l.hasOwnProperty("parity"))        line.parity        = ((const char*)l["parity"])[0];
+      if (l.hasOwnProperty("stop_bits"))     line.stop_bits     = (uint8_t)((long)l["stop_bits"]);
+      if (l.hasOwnProperty("slave_id"))      line.slave_id      = (uint8_t)((long)l["slave_id"]);
+      if (l.hasOwnProperty("budget_pct"))    line.budget_pct    = (uint8_t)((long)l["budget_pct"]);
+      if (l.hasOwnProperty("turnaround_us")) line.turnaround_us = (uint32_t)((long)l["turnaround_us"]);
+      if (l.hasOwnProperty("broadcast_turnaround_ms"))
+      {
+        line.broadcast_turnaround_ms = (uint32_t)((long)l["broadcast_turnaround_ms"]);
+      }
+
+      bool dup = false;
+      for (auto& o : outRTU.lines) 
+      {
+        dup |= o.name == line.name || o.port.equalsIgnoreCase(line.port);
+      }
+      if (line.name.length() == 0 || line.baud == 0 || dup) 
+      {
+        Serial.println(F("[JSON] Modbus linea invalida (nome, baud o porta duplicata)"));
+        continue;
+      }
+      outRTU.lines.push_back(line);
+    }
+  }
+  if (outRTU.lines.empty()) 
+  {
+    outRTU.lines.push_back(def);
+  }
+
+  if (outSlave) 
+  {
+    *outSlave = ModbusSlaveConfig();
+    if (root.hasOwnProperty("slave")) 
+    {
+      JSONVar sl = root["slave"];
+      outSlave->enabled = !sl.hasOwnProperty("enabled") || (bool)sl["enabled"];
+      if (sl.hasOwnProperty("port"))      outSlave->port      = (const char*)sl["port"];
+      if (sl.hasOwnProperty("de_re_pin")) outSlave->de_re_pin = (uint8_t)((long)sl["de_re_pin"]);
+      if (sl.hasOwnProperty("baud"))      outSlave->baud      = (long)sl["baud"];
+      if (sl.hasOwnProperty("parity"))    outSlave->parity    = ((const char*)sl["parity"])[0];
+      if (sl.hasOwnProperty("stop_bits")) outSlave->stop_bits = (uint8_t)((long)sl["stop_bits"]);
+      if (sl.hasOwnProperty("id"))        outSlave->id        = (uint8_t)((long)sl["id"]);
+    }
   }
 
   if (!root.hasOwnProperty("resources") || JSON.typeof(root["resources"])!="array") 
@@ -244,6 +409,45 @@ bool parseModbusJson(const String& json, ModbusRtuConfig& outRTU, std::vector<Mo
     res.address   = (uint16_t)((long)r["address"]);
     res.count     = (uint16_t)((long)r["count"]);
     res.period_ms = r.hasOwnProperty("period_ms") ? (uint32_t)((long)r["period_ms"]) : 0;
+    res.local     = r.hasOwnProperty("local") && (bool)r["local"];
+    res.min_period_ms = r.hasOwnProperty("min_period_ms") ? (uint32_t)((long)r["min_period_ms"]) : res.period_ms;
+    res.max_period_ms = r.hasOwnProperty("max_period_ms") ? (uint32_t)((long)r["max_period_ms"]) : res.period_ms;
+    if (res.period_ms && (res.min_period_ms == 0 || res.min_period_ms > res.period_ms || res.max_period_ms < res.period_ms)) 
+    {
+      Serial.println(F("[JSON] Modbus min/max_period_ms incoerenti con period_ms"));
+      res.min_period_ms = res.max_period_ms = res.period_ms;
+    }
+
+    if (res.local) 
+    {
+      // area dello slave: solo registri (FC03/04 in lettura, FC06/16 in scrittura), mai interrogata
+      if (isBitFn(res.fn) || res.fn == ModbusFn::Unknown || res.count == 0 || res.count > 125) 
+      {
+        Serial.println(F("[JSON] Modbus risorsa local invalida"));
+        continue;
+      }
+      res.period_ms = res.min_period_ms = res.max_period_ms = 0;
+    } else if (r.hasOwnProperty("line")) 
+    {
+      // risorsa remota su una linea con nome (default: la prima)
+      String ln = (const char*)r["line"];
+      int li = -1;
+      for (unsigned int k=0; k<outRTU.lines.size(); ++k) 
+      {
+        if (outRTU.lines[k].name == ln) li = (int)k;
+      }
+      if (li < 0) 
+      {
+        Serial.print(F("[JSON] Modbus linea sconosciuta: "));
+        Serial.println(ln);
+        continue;
+      }
+      res.line = (uint8_t)li;
+    }
+    if (!res.local && r.hasOwnProperty("slave_id")) 
+    {
+      res.slave_id = (uint8_t)((long)r["slave_id"]);
+    }
 
     if (!r.hasOwnProperty("fields") || JSON.typeof(r["fields"])!="array") 
     { 
@@ -263,8 +467,23 @@ bool parseModbusJson(const String& json, ModbusRtuConfig& outRTU, std::vector<Mo
         mf.name = (const char*)f["name"];
       }
       mf.type  = parseFieldType(f.hasOwnProperty("type") ? (const char*)f["type"] : "");
-      mf.index = (uint8_t)((long)f["index"]);
+      mf.index = (uint16_t)((long)f["index"]);
       mf.scale = f.hasOwnProperty("scale") ? (double)f["scale"] : 1.0;
+      mf.bit   = f.hasOwnProperty("bit") ? (uint8_t)((long)f["bit"]) : 0;
+
+      if (isBitFn(res.fn)) 
+      {
+        // coil / discrete: solo bool, index = posizione del bit nel blocco
+        if (mf.type != FieldType::Bool || mf.index >= res.count) 
+        { 
+          Serial.println(F("[JSON] Modbus field a bit invalido")); 
+          continue; 
+        }
+      } else if (mf.bit > 15) 
+      { 
+        Serial.println(F("[JSON] Modbus bit fuori registro")); 
+        continue; 
+      }
       res.fields.push_back(mf);
     }
     outRes.push_back(res);
@@ -2,6 +2,7 @@
 #include <Arduino.h>
 #include <Arduino_JSON.h>
 #include <vector>
+#include "transform.h"
 
 // ======================= Tipi generali =======================
 enum class Endian : uint8_t { Little, Big };
@@ -16,6 +17,7 @@ struct FieldSpec {
   uint8_t   size       = 0;   // 1,2,4  (coerente con type)
   Endian    endian     = Endian::Little;
   double    scale      = 1.0; // opzionale
+  uint8_t   bit        = 0xFF; // bool: bit 0..7 nel byte a offset, 0xFF = byte intero
 };
 
 struct CanMessageSpec {
@@ -23,18 +25,38 @@ struct CanMessageSpec {
   uint32_t             id      = 0;
   uint8_t              dlc     = 0;
   CanDir               dir     = CanDir::INVALID;
+  uint16_t             max_rate_hz = 0; // tetto di trasmissione per questo id (0 = nessuno)
+  int8_t               stale_field = -1; // indice del campo bool "dato non aggiornato" (-1 = nessuno)
   std::vector<FieldSpec> fields;
 };
 
+// Shaper della coda TX (sezione "shaper" di can.json)
+struct CanShaperConfig {
+  bool    enabled      = false;
+  uint8_t max_load_pct = 0;   // tetto sul totale trasmesso dal gateway (0 = nessuno)
+  uint8_t burst_frames = 2;   // profondita' dei bucket, in frame
+};
+
 // ======================= Modbus spec =========================
-enum class ModbusFn : uint8_t { ReadHolding, WriteSingle, WriteMultiple, Unknown };
+enum class ModbusFn : uint8_t {
+  ReadHolding,    // FC03
+  WriteSingle,    // FC06
+  WriteMultiple,  // FC16
+  ReadInput,      // FC04
+  ReadCoils,      // FC01
+  ReadDiscrete,   // FC02
+  WriteCoil,      // FC05
+  WriteCoils,     // FC15
+  Unknown
+};
 
 struct ModbusField {
   String    name;
   FieldType type   = FieldType::Unknown; // supporta u16/i16/float32/bool
-  uint16_t  index  = 0;                  // indice nel blocco di registri
+  uint16_t  index  = 0;                  // indice nel blocco di registri (o di bit per coil/discrete)
   uint8_t   count  = 1;                  // numero registri (es. float=2)
   double    scale  = 1.0;                // opzionale
+  uint8_t   bit    = 0;                  // bool su registro: bit 0..15 del registro
 };
 
 struct ModbusResourceSpec {
@@ -43,14 +65,54 @@ struct ModbusResourceSpec {
   uint16_t              address   = 0;
   uint16_t              count     = 0;       // n registri coinvolti
   uint32_t              period_ms = 0;       // 0 = nessun polling
+  uint32_t              min_period_ms = 0;   // limiti del periodo adattivo (default = period_ms)
+  uint32_t              max_period_ms = 0;
+  bool                  local     = false;   // servita dallo slave del gateway (immagine in RAM)
+  uint8_t               line      = 0;       // indice in ModbusRtuConfig::lines
+  uint8_t               slave_id  = 0;       // 0 = slave_id della linea
   std::vector<ModbusField> fields;
 };
 
+// Linea RS-485 del master (sezione "lines" di modbus.json): UART, pin DE/RE,
+// formato e slave di default delle risorse che la usano. Di serie solo
+// "Serial1": per altre porte vedi MBM_HAVE_SERIAL2/3 in modbus_manager.h
+struct ModbusLineConfig {
+  String   name      = "rtu";
+  String   port      = "Serial1";
+  uint8_t  de_re_pin = 7;
+  uint32_t baud      = 9600;
+  char     parity    = 'N'; // 'N','E','O'
+  uint8_t  stop_bits = 1;
+  uint8_t  slave_id  = 1;
+  uint8_t  budget_pct    = 70;   // quota massima della linea per il polling
+  uint32_t turnaround_us = 1000; // tempo di risposta atteso dello slave
+  uint32_t broadcast_turnaround_ms = 100; // pausa dopo un broadcast (spec seriale: 100..200 ms)
+};
+
+// I campi di linea della sezione "rtu" fanno da default per "lines"; senza
+// "lines" diventano l'unica linea ("rtu", Serial1, DE/RE su D7)
 struct ModbusRtuConfig {
   uint32_t baud      = 9600;
   char     parity    = 'N'; // 'N','E','O'
   uint8_t  stop_bits = 1;
   uint8_t  slave_id  = 1;
+  uint8_t  budget_pct    = 70;   // quota massima della linea per il polling
+  uint32_t turnaround_us = 1000; // tempo di risposta atteso dello slave
+  uint32_t broadcast_turnaround_ms = 100; // pausa dopo un broadcast (spec seriale: 100..200 ms)
+  uint32_t snapshot_ms   = 10000; // foto delle letture su SD per la ripartenza (0 = mai)
+  uint32_t ramp_ms       = 3000;  // al boot le prime letture si distribuiscono su questo intervallo
+  std::vector<ModbusLineConfig> lines; // almeno una dopo parseModbusJson
+};
+
+// Gateway come slave RTU verso uno SCADA (sezione "slave" di modbus.json)
+struct ModbusSlaveConfig {
+  bool     enabled   = false;
+  String   port      = "Serial1";
+  uint8_t  de_re_pin = 8;
+  uint32_t baud      = 9600;
+  char     parity    = 'N';
+  uint8_t  stop_bits = 1;
+  uint8_t  id        = 1;   // indirizzo a cui risponde il gateway
 };
 
 // ======================= Mapping spec ========================
@@ -59,6 +121,35 @@ enum class RuleDir : uint8_t { MB2CAN, CAN2MB };
 struct MapPair {
   String src; // nome field sorgente
   String dst; // nome field destinazione
+
+  // campi risolti dopo parsing (evita la ricerca per nome a ogni frame)
+  const FieldSpec*   canField = nullptr; // lato CAN (dst se MB2CAN, src se CAN2MB)
+  const ModbusField* mbField  = nullptr; // lato Modbus (src se MB2CAN, dst se CAN2MB)
+
+  // "expr" opzionale: vuoto = copia diretta src -> dst
+  String                          expr;     // testo, tenuto solo se resta un programma
+  XF::Program                     xf;
+  std::vector<const ModbusField*> mbVars;   // variabili dell'espressione (MB2CAN)
+  std::vector<const FieldSpec*>   canVars;  // variabili dell'espressione (CAN2MB)
+};
+
+// MB2CAN su richiesta: un frame CAN (remoto o su un id di query) chiede il valore
+struct CanRequestSpec {
+  bool     enabled    = false;
+  uint32_t id         = 0;      // id della richiesta (default: id del messaggio to_can)
+  bool     rtr        = false;  // richiesta = frame remoto / senza dati su quell'id
+  uint32_t max_age_ms = 0;      // risposta dalla cache se piu' giovane, altrimenti lettura
+};
+
+// CAN2MB verso un gruppo di slave identici sulla linea della risorsa
+// ("group" della regola): un broadcast (id 0, nessuna risposta) oppure la
+// stessa scrittura agli slave in fila
+struct MbGroupSpec {
+  std::vector<uint8_t> slaves;     // id 1..247; con broadcast servono solo alla verifica
+  bool     broadcast = false;
+  uint32_t verify_ms = 0;          // broadcast: rilettura di uno slave ogni verify_ms (0 = mai)
+
+  bool active() const { return broadcast || !slaves.empty(); }
 };
 
 struct MappingRule {
@@ -73,12 +164,58 @@ struct MappingRule {
   const CanMessageSpec*     toCan      = nullptr;
 
   std::vector<MapPair> pairs; // <— era "map"
+
+  CanRequestSpec request;     // solo MB2CAN
+  MbGroupSpec    group;       // solo CAN2MB
 };
 
+// ======================= Helpers Modbus ======================
+// Le risorse a bit (coil / discrete input) usano lo stesso buffer uint16_t dei
+// registri, impacchettato come ModbusMaster: bit n = word n/16, bit n%16.
+inline bool isBitFn(ModbusFn fn)
+{
+  return fn == ModbusFn::ReadCoils || fn == ModbusFn::ReadDiscrete ||
+         fn == ModbusFn::WriteCoil || fn == ModbusFn::WriteCoils;
+}
+
+inline bool isReadFn(ModbusFn fn)
+{
+  return fn == ModbusFn::ReadHolding || fn == ModbusFn::ReadInput ||
+         fn == ModbusFn::ReadCoils   || fn == ModbusFn::ReadDiscrete;
+}
+
+inline bool isWriteFn(ModbusFn fn)
+{
+  return fn == ModbusFn::WriteSingle   || fn == ModbusFn::WriteCoil ||
+         fn == ModbusFn::WriteMultiple || fn == ModbusFn::WriteCoils;
+}
+
+// parole uint16_t occupate dal blocco della risorsa nel buffer
+inline uint16_t mbResourceWords(const ModbusResourceSpec& r)
+{
+  return isBitFn(r.fn) ? (uint16_t)((r.count + 15) / 16) : r.count;
+}
+
+inline bool getBit(const uint16_t* words, uint16_t n)
+{
+  return (words[n >> 4] >> (n & 15)) & 1;
+}
+
+inline void setBit(uint16_t* words, uint16_t n, bool v)
+{
+  if (v) words[n >> 4] |=  (uint16_t)(1u << (n & 15));
+  else   words[n >> 4] &= (uint16_t)~(1u << (n & 15));
+}
+
+// codice funzione Modbus della risorsa (0 se sconosciuta)
+uint8_t modbusFnCode(ModbusFn fn);
+
 // ======================= Helpers string/parse =================
 String   trimBoth(const String& s);
 bool     parseUIntFlexible(const String& s, uint32_t& v);
 bool     strToBool(const String& s, bool& out);
+bool     strToBool(const char* s, bool& out);
+bool     strEqI(const char* a, const char* b);      // confronto case-insensitive
 
 Endian    parseEndianStr(const String& s);
 FieldType parseFieldType(const String& s);
@@ -94,10 +231,12 @@ T readValue(const uint8_t* buf, Endian e, uint8_t size);
 
 // ======================= Parsers JSON =========================
 bool parseCanJson     (const String& json, long& outBitrate,
-                       std::vector<CanMessageSpec>& outMsgs);
+                       std::vector<CanMessageSpec>& outMsgs,
+                       CanShaperConfig* outShaper = nullptr);
 
 bool parseModbusJson  (const String& json, ModbusRtuConfig& outRTU,
-                       std::vector<ModbusResourceSpec>& outRes);
+                       std::vector<ModbusResourceSpec>& outRes,
+                       ModbusSlaveConfig* outSlave = nullptr);
 
 bool parseMappingJson (const String& json,
                        const std::vector<ModbusResourceSpec>& mbRes,
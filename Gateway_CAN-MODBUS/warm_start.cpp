@@ -0,0 +1,203 @@
+#include "warm_start.h"
+#include "sd_manager.h"
+
+namespace WARM {
+
+static const char* const SLOT_PATH[2] = { "/WARMA.BIN", "/WARMB.BIN" };
+
+static uint8_t  s_buf[WARM_MAX_BYTES];
+static uint16_t s_len     = 0;      // byte dell'immagine in costruzione / in scrittura
+static uint16_t s_count   = 0;
+static uint32_t s_seq     = 0;      // ultima sequenza scritta o letta
+static uint8_t  s_slot    = 1;      // ultima copia valida: si scrive sull'altra
+// scrittura a passi, uno per service(): nessun accesso SD dal commit()
+enum class Step : uint8_t { Idle, Remove, Open, Write, Close };
+static Step     s_step    = Step::Idle;
+static uint16_t s_written = 0;
+static File     s_file;
+static uint16_t s_regs[125];        // record allineato per la callback di load()
+
+// CRC-32 (poly 0xEDB88320), bit a bit: poche centinaia di byte ogni tanto
+static uint32_t crc32(const uint8_t* p, uint32_t n, uint32_t crc = 0xFFFFFFFFUL)
+{
+  while (n--)
+  {
+    crc ^= *p++;
+    for (uint8_t b = 0; b < 8; ++b)
+    {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+uint32_t resourceKey(const ModbusResourceSpec& res)
+{
+  uint8_t tail[5] = {
+    modbusFnCode(res.fn),
+    (uint8_t)(res.address & 0xFF), (uint8_t)(res.address >> 8),
+    (uint8_t)(res.count & 0xFF),   (uint8_t)(res.count >> 8)
+  };
+  uint32_t crc = crc32((const uint8_t*)res.name.c_str(), res.name.length());
+  return ~crc32(tail, sizeof(tail), crc);
+}
+
+// copia valida in s_buf: ritorna la sequenza tramite outSeq
+static bool readSlot(uint8_t slot, uint32_t& outSeq)
+{
+  int32_t n = SDM_readBin(SLOT_PATH[slot], s_buf, sizeof(s_buf));
+  if (n < (int32_t)sizeof(Hdr)) return false;
+
+  Hdr h;
+  memcpy(&h, s_buf, sizeof(h));
+  if (memcmp(h.magic, "GWWS", 4) != 0)            return false;
+  if ((int32_t)sizeof(Hdr) + h.bytes > n)          return false;
+  if (~crc32(s_buf + sizeof(Hdr), h.bytes) != h.crc) return false;
+  outSeq = h.seq;
+  return true;
+}
+
+bool load(RecordFn fn)
+{
+  uint32_t seqA = 0, seqB = 0;
+  bool okA = readSlot(0, seqA);
+  bool okB = readSlot(1, seqB);
+  if (!okA && !okB)
+  {
+    Serial.println(F("[WARM] nessuna immagine valida"));
+    return false;
+  }
+
+  // la piu' recente; se e' B e' gia' nel buffer
+  uint8_t slot = (okA && (!okB || (int32_t)(seqA - seqB) > 0)) ? 0 : 1;
+  if (slot == 0) readSlot(0, seqA);
+  s_slot = slot;
+  s_seq  = slot == 0 ? seqA : seqB;
+
+  Hdr h;
+  memcpy(&h, s_buf, sizeof(h));
+  const uint8_t* p   = s_buf + sizeof(Hdr);
+  const uint8_t* end = p + h.bytes;
+  uint16_t used = 0;
+  for (uint16_t i = 0; i < h.count && p + 10 <= end; ++i)
+  {
+    uint32_t key, age;
+    uint16_t words;
+    memcpy(&key,   p,     4);
+    memcpy(&age,   p + 4, 4);
+    memcpy(&words, p + 8, 2);
+    p += 10;
+    if (words > 125 || p + 2 * words > end) break;
+    memcpy(s_regs, p, 2 * words);
+    p += 2 * words;
+    fn(key, s_regs, words, age);
+    used++;
+  }
+
+  Serial.print(F("[WARM] ")); Serial.print(SLOT_PATH[slot]);
+  Serial.print(F(" seq=")); Serial.print(s_seq);
+  Serial.print(F(" record=")); Serial.println(used);
+  return true;
+}
+
+bool beginSnapshot()
+{
+  if (s_step != Step::Idle) return false; // la foto precedente non e' ancora su SD
+  s_len   = sizeof(Hdr);
+  s_count = 0;
+  return true;
+}
+
+bool add(uint32_t key, const uint16_t* regs, uint16_t words, uint32_t ageMs)
+{
+  if (s_step != Step::Idle) return false;
+  uint32_t need = 10UL + 2UL * words;
+  if (s_len + need > sizeof(s_buf)) return false;
+
+  uint8_t* p = s_buf + s_len;
+  memcpy(p,     &key,   4);
+  memcpy(p + 4, &ageMs, 4);
+  memcpy(p + 8, &words, 2);
+  memcpy(p + 10, regs, 2 * words);
+  s_len += (uint16_t)need;
+  s_count++;
+  return true;
+}
+
+void commit()
+{
+  if (s_step != Step::Idle || !s_count) return;
+
+  Hdr h;
+  memcpy(h.magic, "GWWS", 4);
+  h.seq   = s_seq + 1;
+  h.count = s_count;
+  h.bytes = (uint16_t)(s_len - sizeof(Hdr));
+  h.crc   = ~crc32(s_buf + sizeof(Hdr), h.bytes);
+  memcpy(s_buf, &h, sizeof(h));
+
+  s_written = 0;
+  s_step    = Step::Remove;
+}
+
+bool service()
+{
+  const char* path = SLOT_PATH[s_slot ^ 1];
+  switch (s_step)
+  {
+    case Step::Idle:
+      return false;
+
+    case Step::Remove:
+      if (!SDM_remove(path))
+      {
+        Serial.println(F("[WARM] remove FAIL"));
+        s_step = Step::Idle;   // la copia precedente resta quella buona
+        return false;
+      }
+      s_step = Step::Open;
+      return true;
+
+    case Step::Open:
+      s_file = SDM_openAppend(path);
+      if (!s_file)
+      {
+        Serial.println(F("[WARM] open FAIL"));
+        s_step = Step::Idle;
+        return false;
+      }
+      s_step = Step::Write;
+      return true;
+
+    case Step::Write:
+    {
+      uint16_t n = s_len - s_written;
+      if (n > WARM_CHUNK) n = WARM_CHUNK;
+      if (s_file.write(s_buf + s_written, n) != n)
+      {
+        Serial.println(F("[WARM] write FAIL"));
+        s_file.close();
+        s_step = Step::Idle;
+        return false;
+      }
+      s_written += n;
+      if (s_written >= s_len) s_step = Step::Close;
+      return true;
+    }
+
+    case Step::Close:
+      s_file.close();
+      s_step = Step::Idle;
+      s_slot ^= 1;
+      s_seq++;
+      return false;
+  }
+  return false;
+}
+
+bool busy()
+{
+  return s_step != Step::Idle;
+}
+
+} // namespace
@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+#include "utils.h"
+
+// Ripartenza "a caldo" dall'ultima immagine dei registri letti.
+//
+// Il loop fotografa periodicamente le cache dei poller in un'immagine binaria
+// in RAM; service() la scrive su SD un accesso per chiamata (rimozione della
+// copia vecchia, apertura, pezzi di WARM_CHUNK byte, chiusura), alternando due
+// file (WARMA.BIN / WARMB.BIN): se la scrittura si interrompe resta valido
+// l'altro. Al boot load() sceglie la copia con CRC valido e sequenza piu' alta.
+//
+// Formato (little endian):
+//   Hdr (16 byte) + record { u32 key, u32 age_ms, u16 words, u16 regs[words] }
+//   key = CRC32 di nome, funzione, indirizzo e count della risorsa: una
+//   risorsa cambiata in modbus.json non riceve valori della vecchia.
+//   crc = CRC32 dei byte dopo l'header.
+// age_ms e' l'eta' del dato al momento della foto: il tempo passato da
+// spento non e' noto (niente RTC), quindi il dato e' vecchio "almeno" age_ms.
+
+#ifndef WARM_MAX_BYTES
+#define WARM_MAX_BYTES 1024   // immagine massima (header compreso)
+#endif
+#ifndef WARM_CHUNK
+#define WARM_CHUNK     512    // byte scritti su SD per chiamata di service()
+#endif
+
+namespace WARM {
+
+#pragma pack(push, 1)
+struct Hdr {
+  char     magic[4];   // "GWWS"
+  uint32_t seq;        // copia piu' recente = seq piu' alta
+  uint16_t count;      // record
+  uint16_t bytes;      // byte dopo l'header
+  uint32_t crc;
+};
+#pragma pack(pop)
+
+typedef void (*RecordFn)(uint32_t key, const uint16_t* regs, uint16_t words, uint32_t ageMs);
+
+uint32_t resourceKey(const ModbusResourceSpec& res);
+
+// Boot: legge le due copie e passa i record di quella valida; false se nessuna
+bool load(RecordFn fn);
+
+// Nuova foto: begin, un add per risorsa, commit (la scrittura avviene in service)
+// beginSnapshot() e' false finche' la foto precedente non e' su SD
+bool beginSnapshot();
+bool add(uint32_t key, const uint16_t* regs, uint16_t words, uint32_t ageMs);
+void commit();
+
+// true se c'e' ancora una foto da scrivere
+bool service();
+bool busy();
+
+} // namespace
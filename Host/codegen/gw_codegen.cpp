@@ -0,0 +1,317 @@
+// =============================================================================
+// gw_codegen — genera gw_config.h (tabelle constexpr) da can.json, modbus.json
+// e mapping.json, per i firmware compilati con GW_STATIC_CONFIG=1 e per lo
+// slave di prova (mappa registri).
+//
+// I JSON passano dagli stessi parser del firmware (utils.cpp / mapping.cpp):
+// una configurazione che il gateway rifiuterebbe da SD qui non genera nulla.
+// Nel header finiscono:
+//   - campi, messaggi CAN, campi e risorse Modbus, coppie e regole, in array
+//     piatti collegati da indici (tipi in gw_config_types.h);
+//   - le tabelle di dispatch CAN2MB e delle richieste, gia' ordinate per id;
+//   - per lo slave: indirizzo e count di ogni risorsa holding remota e
+//     l'indirizzo di ogni suo campo (REG_<risorsa>, REG_<risorsa>_<campo>).
+//
+// Build (dalla root del repo, Arduino_JSON = cartella della libreria):
+//   g++ -O2 -std=c++17 -IHost/compat -IGateway_CAN-MODBUS -I$Arduino_JSON/src
+//       Host/codegen/gw_codegen.cpp Host/compat/Arduino.cpp
+//       Gateway_CAN-MODBUS/mapping.cpp Gateway_CAN-MODBUS/utils.cpp Gateway_CAN-MODBUS/transform.cpp
+//       $Arduino_JSON/src/*.cpp $Arduino_JSON/src/cjson/cJSON.c -o gw_codegen
+//
+// Uso:
+//   gw_codegen [-j dir_json] [-o libraries/GatewayCommon/src/gw_config.h]
+// =============================================================================
+#include <Arduino.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "mapping.h"
+
+static bool readFile(const std::string& path, String& out)
+{
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  std::stringstream ss;
+  ss << f.rdbuf();
+  out = String(ss.str().c_str());
+  return true;
+}
+
+static std::string quoted(const String& s)
+{
+  std::string q = "\"";
+  for (const char* p = s.c_str(); *p; ++p)
+  {
+    if (*p == '"' || *p == '\\') q += '\\';
+    q += *p;
+  }
+  return q + "\"";
+}
+
+// nome JSON -> identificatore C
+static std::string ident(const String& s)
+{
+  std::string id;
+  for (const char* p = s.c_str(); *p; ++p)
+  {
+    char c = *p;
+    id += ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) ? c : '_';
+  }
+  if (id.empty() || (id[0] >= '0' && id[0] <= '9')) id = "_" + id;
+  return id;
+}
+
+static std::string num(double d)
+{
+  char b[40];
+  snprintf(b, sizeof(b), "%.17g", d);
+  std::string s = b;
+  if (s.find_first_of(".eEn") == std::string::npos) s += ".0";
+  return s;
+}
+
+template <typename T, typename F>
+static int16_t indexOf(const std::vector<T>& v, const F* p)
+{
+  for (size_t i = 0; i < v.size(); ++i) if (&v[i] == p) return (int16_t)i;
+  return -1;
+}
+
+// Array constexpr: con zero elementi si emette una voce vuota (C++ non
+// ammette array di lunghezza 0), il conteggio N_... resta 0
+static void openArray(FILE* o, const char* type, const char* name)
+{
+  fprintf(o, "constexpr %s %s[] = {\n", type, name);
+}
+
+static void closeArray(FILE* o, const char* name, size_t n, const char* empty)
+{
+  if (!n) fprintf(o, "  %s\n", empty);
+  fprintf(o, "};\nconstexpr uint16_t N_%s = %u;\n\n", name, (unsigned)n);
+}
+
+static void emitDispatch(FILE* o, const char* name, const CanDispatch& d)
+{
+  std::string rules = std::string(name) + "_RULES";
+  openArray(o, "Dispatch", name);
+  for (auto& e : d.entries) fprintf(o, "  { 0x%X, %u, %u },\n", (unsigned)e.id, e.first, e.count);
+  closeArray(o, name, d.entries.size(), "{ 0, 0, 0 }");
+
+  openArray(o, "uint16_t", rules.c_str());
+  if (!d.ruleIdx.empty())
+  {
+    fprintf(o, " ");
+    for (auto i : d.ruleIdx) fprintf(o, " %u,", i);
+    fprintf(o, "\n");
+  }
+  closeArray(o, rules.c_str(), d.ruleIdx.size(), "0");
+}
+
+static bool isHoldingFn(ModbusFn fn)
+{
+  return fn == ModbusFn::ReadHolding || fn == ModbusFn::WriteSingle || fn == ModbusFn::WriteMultiple;
+}
+
+int main(int argc, char** argv)
+{
+  std::string dir = "Json";
+  std::string out = "libraries/GatewayCommon/src/gw_config.h";
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string a = argv[i];
+    if      (a == "-j" && i + 1 < argc) dir = argv[++i];
+    else if (a == "-o" && i + 1 < argc) out = argv[++i];
+    else
+    {
+      fprintf(stderr, "uso: %s [-j dir_json] [-o gw_config.h]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  String canJson, mbJson, mapJson;
+  if (!readFile(dir + "/can.json", canJson) || !readFile(dir + "/modbus.json", mbJson) ||
+      !readFile(dir + "/mapping.json", mapJson))
+  {
+    fprintf(stderr, "JSON mancanti in %s\n", dir.c_str());
+    return 1;
+  }
+
+  long bitrate = 0;
+  CanShaperConfig shaper;
+  std::vector<CanMessageSpec> msgs;
+  ModbusRtuConfig rtu;
+  ModbusSlaveConfig slave;
+  std::vector<ModbusResourceSpec> res;
+  std::vector<MappingRule> rules;
+  if (!parseCanJson(canJson, bitrate, msgs, &shaper) ||
+      !parseModbusJson(mbJson, rtu, res, &slave) ||
+      !parseMappingJson(mapJson, res, msgs, rules))
+  {
+    fprintf(stderr, "configurazione non valida\n");
+    return 1;
+  }
+  CanDispatch canD, reqD;
+  buildCanDispatch(rules, canD);
+  buildRequestDispatch(rules, reqD);
+
+  FILE* o = fopen(out.c_str(), "w");
+  if (!o)
+  {
+    fprintf(stderr, "impossibile scrivere %s\n", out.c_str());
+    return 1;
+  }
+
+  fprintf(o, "#pragma once\n");
+  fprintf(o, "// GENERATO da Host/codegen/gw_codegen a partire da %s/{can,modbus,mapping}.json:\n", dir.c_str());
+  fprintf(o, "// non modificare a mano, rigenerare dopo ogni modifica ai JSON.\n");
+  fprintf(o, "#include \"gw_config_types.h\"\n\nnamespace GWC {\n\n");
+
+  // ----- CAN -----
+  fprintf(o, "constexpr long CAN_BITRATE = %ld;\n", bitrate);
+  fprintf(o, "constexpr Shaper SHAPER = { %s, %u, %u };\n\n", shaper.enabled ? "true" : "false",
+          shaper.max_load_pct, shaper.burst_frames);
+
+  openArray(o, "CanField", "CAN_FIELDS");
+  size_t nf = 0;
+  for (auto& m : msgs)
+  {
+    for (auto& f : m.fields)
+    {
+      fprintf(o, "  { %s, %u, %u, %u, %u, %s, 0x%02X },\n", quoted(f.name).c_str(), (unsigned)f.type,
+              f.offset, f.size, (unsigned)f.endian, num(f.scale).c_str(), f.bit);
+      nf++;
+    }
+  }
+  closeArray(o, "CAN_FIELDS", nf, "{ \"\", 0, 0, 0, 0, 1.0, 0xFF }");
+
+  openArray(o, "CanMessage", "CAN_MESSAGES");
+  nf = 0;
+  for (auto& m : msgs)
+  {
+    fprintf(o, "  { %s, 0x%X, %u, %u, %u, %d, %u, %u },\n", quoted(m.name).c_str(), (unsigned)m.id, m.dlc,
+            (unsigned)m.dir, m.max_rate_hz, m.stale_field, (unsigned)nf, (unsigned)m.fields.size());
+    nf += m.fields.size();
+  }
+  closeArray(o, "CAN_MESSAGES", msgs.size(), "{ \"\", 0, 0, 0, 0, -1, 0, 0 }");
+
+  // ----- Modbus -----
+  fprintf(o, "constexpr Rtu RTU_CFG = { %u, '%c', %u, %u, %u, %u, %u, %u, %u };\n", (unsigned)rtu.baud, rtu.parity,
+          rtu.stop_bits, rtu.slave_id, rtu.budget_pct, (unsigned)rtu.turnaround_us,
+          (unsigned)rtu.broadcast_turnaround_ms, (unsigned)rtu.snapshot_ms, (unsigned)rtu.ramp_ms);
+  openArray(o, "Line", "MB_LINES");
+  for (auto& l : rtu.lines)
+  {
+    fprintf(o, "  { %s, %s, %u, %u, '%c', %u, %u, %u, %u, %u },\n", quoted(l.name).c_str(), quoted(l.port).c_str(),
+            l.de_re_pin, (unsigned)l.baud, l.parity, l.stop_bits, l.slave_id, l.budget_pct,
+            (unsigned)l.turnaround_us, (unsigned)l.broadcast_turnaround_ms);
+  }
+  closeArray(o, "MB_LINES", rtu.lines.size(), "{ \"\", \"\", 0, 0, 'N', 1, 0, 0, 0, 0 }");
+  fprintf(o, "constexpr Slave SLAVE_CFG = { %s, %s, %u, %u, '%c', %u, %u };\n\n", slave.enabled ? "true" : "false",
+          quoted(slave.port).c_str(), slave.de_re_pin, (unsigned)slave.baud, slave.parity, slave.stop_bits, slave.id);
+
+  openArray(o, "MbField", "MB_FIELDS");
+  nf = 0;
+  for (auto& r : res)
+  {
+    for (auto& f : r.fields)
+    {
+      fprintf(o, "  { %s, %u, %u, %u, %s, %u },\n", quoted(f.name).c_str(), (unsigned)f.type, f.index, f.count,
+              num(f.scale).c_str(), f.bit);
+      nf++;
+    }
+  }
+  closeArray(o, "MB_FIELDS", nf, "{ \"\", 0, 0, 1, 1.0, 0 }");
+
+  openArray(o, "MbResource", "MB_RESOURCES");
+  nf = 0;
+  for (auto& r : res)
+  {
+    fprintf(o, "  { %s, %u, %u, %u, %u, %u, %u, %s, %u, %u, %u, %u },\n", quoted(r.name).c_str(), (unsigned)r.fn,
+            r.address, r.count, (unsigned)r.period_ms, (unsigned)r.min_period_ms, (unsigned)r.max_period_ms,
+            r.local ? "true" : "false", r.line, r.slave_id, (unsigned)nf, (unsigned)r.fields.size());
+    nf += r.fields.size();
+  }
+  closeArray(o, "MB_RESOURCES", res.size(), "{ \"\", 0, 0, 0, 0, 0, 0, false, 0, 0, 0, 0 }");
+
+  // ----- mapping -----
+  openArray(o, "Pair", "PAIRS");
+  size_t np = 0;
+  for (auto& r : rules)
+  {
+    const bool mb2can = r.dir == RuleDir::MB2CAN;
+    const ModbusResourceSpec& mr = mb2can ? *r.fromModbus : *r.toModbus;
+    const CanMessageSpec&     cm = mb2can ? *r.toCan : *r.fromCan;
+    for (auto& p : r.pairs)
+    {
+      int16_t mi = p.mbField  ? indexOf(mr.fields, p.mbField)  : -1;
+      int16_t ci = p.canField ? indexOf(cm.fields, p.canField) : -1;
+      std::string expr = p.xf.empty() ? "nullptr" : quoted(p.expr);
+      fprintf(o, "  { %d, %d, %s },\n", mb2can ? mi : ci, mb2can ? ci : mi, expr.c_str());
+      np++;
+    }
+  }
+  closeArray(o, "PAIRS", np, "{ -1, -1, nullptr }");
+
+  // slave dei gruppi CAN2MB, di seguito per regola
+  openArray(o, "uint8_t", "GROUP_SLAVES");
+  size_t ns = 0;
+  for (auto& r : rules)
+  {
+    if (r.group.slaves.empty()) continue;
+    fprintf(o, " ");
+    for (auto id : r.group.slaves) fprintf(o, " %u,", id);
+    fprintf(o, "\n");
+    ns += r.group.slaves.size();
+  }
+  closeArray(o, "GROUP_SLAVES", ns, "0");
+
+  openArray(o, "Rule", "RULES");
+  np = 0;
+  ns = 0;
+  for (auto& r : rules)
+  {
+    const bool mb2can = r.dir == RuleDir::MB2CAN;
+    int16_t ci = indexOf(msgs, mb2can ? r.toCan : r.fromCan);
+    int16_t ri = indexOf(res,  mb2can ? r.fromModbus : r.toModbus);
+    fprintf(o, "  { %u, %d, %d, %s, 0x%X, %s, %u, %u, %u, %u, %u, %s, %u },\n", (unsigned)r.dir, ci, ri,
+            r.request.enabled ? "true" : "false", (unsigned)r.request.id, r.request.rtr ? "true" : "false",
+            (unsigned)r.request.max_age_ms, (unsigned)np, (unsigned)r.pairs.size(), (unsigned)ns,
+            (unsigned)r.group.slaves.size(), r.group.broadcast ? "true" : "false", (unsigned)r.group.verify_ms);
+    np += r.pairs.size();
+    ns += r.group.slaves.size();
+  }
+  closeArray(o, "RULES", rules.size(), "{ 0, 0, 0, false, 0, false, 0, 0, 0, 0, 0, false, 0 }");
+
+  emitDispatch(o, "CAN_DISPATCH", canD);
+  emitDispatch(o, "REQ_DISPATCH", reqD);
+
+  // ----- mappa registri dello slave remoto (holding) -----
+  fprintf(o, "// Slave RTU remoto (prima linea): indirizzo, formato e holding register usati dal gateway\n");
+  fprintf(o, "constexpr uint8_t  RTU_SLAVE_ID = %u;\n", rtu.lines[0].slave_id);
+  fprintf(o, "constexpr uint32_t RTU_BAUD     = %u;\n", (unsigned)rtu.lines[0].baud);
+  uint32_t end = 0;
+  for (auto& r : res)
+  {
+    if (r.local || !isHoldingFn(r.fn)) continue;
+    std::string id = ident(r.name);
+    fprintf(o, "constexpr uint16_t REG_%s = %u;\n", id.c_str(), r.address);
+    fprintf(o, "constexpr uint16_t REG_%s_COUNT = %u;\n", id.c_str(), r.count);
+    for (auto& f : r.fields)
+    {
+      fprintf(o, "constexpr uint16_t REG_%s_%s = %u;\n", id.c_str(), ident(f.name).c_str(), r.address + f.index);
+    }
+    if (r.address + r.count > end) end = r.address + r.count;
+  }
+  fprintf(o, "constexpr uint16_t HREG_END = %u;   // primo indirizzo oltre la mappa\n", (unsigned)end);
+
+  fprintf(o, "\n} // namespace GWC\n");
+  fclose(o);
+
+  printf("%s: %u messaggi, %u risorse, %u regole\n", out.c_str(), (unsigned)msgs.size(), (unsigned)res.size(),
+         (unsigned)rules.size());
+  return 0;
+}
@@ -0,0 +1,268 @@
+#include "Arduino.h"
+#include <chrono>
+#include <thread>
+#include <cstdio>
+
+HostSerial Serial;
+
+// ----- String -----
+String::String(double v, unsigned char decimals)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+  s_ = buf;
+}
+
+void String::fromInt(long v, unsigned char base)
+{
+  if (v < 0 && base == 10)
+  {
+    fromUInt((unsigned long)(-(v + 1)) + 1, base);
+    s_.insert(s_.begin(), '-');
+    return;
+  }
+  fromUInt((unsigned long)v, base);
+}
+
+void String::fromUInt(unsigned long v, unsigned char base)
+{
+  if (base < 2 || base > 36) base = 10;
+  char buf[8 * sizeof(unsigned long) + 1];
+  char* p = &buf[sizeof(buf) - 1];
+  *p = 0;
+  do
+  {
+    unsigned d = (unsigned)(v % base);
+    *--p = (char)(d < 10 ? '0' + d : 'A' + d - 10);
+    v /= base;
+  } while (v);
+  s_ = p;
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+  if (from > to) { unsigned int t = from; from = to; to = t; }
+  if (from >= s_.size()) return String();
+  if (to > s_.size()) to = (unsigned int)s_.size();
+  return String(s_.substr(from, to - from));
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+  size_t p = s_.find(c, from);
+  return p == std::string::npos ? -1 : (int)p;
+}
+
+int String::indexOf(const String& s, unsigned int from) const
+{
+  size_t p = s_.find(s.s_, from);
+  return p == std::string::npos ? -1 : (int)p;
+}
+
+bool String::equalsIgnoreCase(const String& o) const
+{
+  if (s_.size() != o.s_.size()) return false;
+  for (size_t i = 0; i < s_.size(); ++i)
+  {
+    if (tolower((unsigned char)s_[i]) != tolower((unsigned char)o.s_[i])) return false;
+  }
+  return true;
+}
+
+bool String::endsWith(const String& p) const
+{
+  return s_.size() >= p.s_.size() && s_.compare(s_.size() - p.s_.size(), p.s_.size(), p.s_) == 0;
+}
+
+void String::trim()
+{
+  size_t i = 0, j = s_.size();
+  while (i < j && isspace((unsigned char)s_[i])) i++;
+  while (j > i && isspace((unsigned char)s_[j - 1])) j--;
+  s_ = s_.substr(i, j - i);
+}
+
+void String::toUpperCase() { for (auto& c : s_) c = (char)toupper((unsigned char)c); }
+void String::toLowerCase() { for (auto& c : s_) c = (char)tolower((unsigned char)c); }
+
+// ----- Print -----
+size_t Print::write(const uint8_t* buf, size_t n)
+{
+  size_t w = 0;
+  while (n--) w += write(*buf++);
+  return w;
+}
+
+size_t Print::print(long v, int base)
+{
+  return print(String(v, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long v, int base)
+{
+  return print(String(v, (unsigned char)base));
+}
+
+size_t Print::print(long long v, int base)
+{
+  if (base == 10) { char b[24]; snprintf(b, sizeof(b), "%lld", v); return write(b); }
+  return print((unsigned long long)v, base);
+}
+
+size_t Print::print(unsigned long long v, int base)
+{
+  char b[72];
+  if (base == 16) snprintf(b, sizeof(b), "%llX", v);
+  else            snprintf(b, sizeof(b), "%llu", v);
+  return write(b);
+}
+
+size_t Print::print(double v, int digits)
+{
+  return print(String(v, (unsigned char)digits));
+}
+
+// ----- Serial -----
+static bool g_serialMuted = false;
+
+void hostSerialMute(bool on) { g_serialMuted = on; }
+
+static bool g_simClock = false;
+
+size_t HostSerial::write(uint8_t c)
+{
+  if (g_simClock)
+  {
+    // 10 bit per carattere; oltre HOST_SERIAL_TX_BUF in coda si aspetta
+    uint64_t charUs = (10000000ULL + baud_ - 1) / baud_;
+    uint64_t now    = hostNowUs();
+    if (txFree_ < now) txFree_ = now;
+    txFree_ += charUs;
+    uint64_t bufUs = HOST_SERIAL_TX_BUF * charUs;
+    if (txFree_ - now > bufUs)
+    {
+      blockedUs_ += txFree_ - now - bufUs;
+      hostAdvanceTo(txFree_ - bufUs);
+    }
+  }
+  bytes_++;
+  if (g_serialMuted) return 1;
+  if (c == '\r') return 1; // su host basta '\n'
+  fputc(c, stdout);
+  return 1;
+}
+
+size_t HostSerial::write(const uint8_t* buf, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) write(buf[i]);
+  return n;
+}
+
+void HostSerial::flush() { fflush(stdout); }
+
+// ----- tempo -----
+static const auto g_t0 = std::chrono::steady_clock::now();
+
+static uint64_t g_simUs     = 0;
+static uint32_t g_simCallUs = 1;
+static uint64_t (*g_simWake)() = nullptr;
+
+unsigned long micros()
+{
+  if (g_simClock)
+  {
+    g_simUs += g_simCallUs;
+    return (unsigned long)(uint32_t)g_simUs; // 32 bit come sul target
+  }
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now() - g_t0).count();
+}
+
+unsigned long millis()
+{
+  if (g_simClock)
+  {
+    g_simUs += g_simCallUs;
+    return (unsigned long)(uint32_t)(g_simUs / 1000UL);
+  }
+  return micros() / 1000UL;
+}
+
+void delay(unsigned long ms)
+{
+  if (g_simClock) { g_simUs += 1000ULL * ms; return; }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if (g_simClock) { g_simUs += us; return; }
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void hostSimClock(bool on, uint32_t callUs)
+{
+  g_simClock  = on;
+  g_simCallUs = callUs;
+}
+
+uint64_t hostNowUs()
+{
+  return g_simUs;
+}
+
+void hostAdvanceTo(uint64_t us)
+{
+  if (us > g_simUs) g_simUs = us;
+}
+
+void hostCharge(uint32_t us)
+{
+  if (g_simClock) g_simUs += us;
+}
+
+static void (*g_pinWrite)(uint8_t, uint8_t) = nullptr;
+
+void hostOnPinWrite(void (*fn)(uint8_t, uint8_t))
+{
+  g_pinWrite = fn;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (g_pinWrite) g_pinWrite(pin, val);
+}
+
+void hostSetWakeup(uint64_t (*nextEventUs)())
+{
+  g_simWake = nextEventUs;
+}
+
+void hostIdle()
+{
+  if (!g_simClock) return;
+  uint64_t tick = (g_simUs / 1000 + 1) * 1000;   // prossimo tick di millis()
+  uint64_t t    = g_simWake ? g_simWake() : tick;
+  hostAdvanceTo(t < tick ? t : tick);
+}
+
+// ----- random -----
+static uint32_t g_rnd = 0x2545F491u;
+
+void randomSeed(unsigned long seed)
+{
+  if (seed) g_rnd = (uint32_t)seed;
+}
+
+long random(long howbig)
+{
+  if (howbig <= 0) return 0;
+  g_rnd ^= g_rnd << 13; g_rnd ^= g_rnd >> 17; g_rnd ^= g_rnd << 5; // xorshift32
+  return (long)(g_rnd % (uint32_t)howbig);
+}
+
+long random(long howsmall, long howbig)
+{
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
@@ -0,0 +1,233 @@
+#pragma once
+// =============================================================================
+// Shim minimale dell'API Arduino per compilare il core del gateway su host
+// (Linux/macOS, g++/clang++). Copre solo quello che usano i sorgenti del
+// gateway e la libreria Arduino_JSON: String, Print/Printable, Serial su
+// stdout, millis()/micros() e pochi helper.
+// =============================================================================
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#define F(s)     (s)
+#define PROGMEM
+#define HEX 16
+#define DEC 10
+#define OCT 8
+#define BIN 2
+
+#define HIGH   1
+#define LOW    0
+#define INPUT  0
+#define OUTPUT 1
+
+// ----------------------------------------------------------------------------
+// String (sottoinsieme compatibile con arduino::String)
+// ----------------------------------------------------------------------------
+class String {
+public:
+  String() {}
+  String(const char* s)        : s_(s ? s : "") {}
+  String(const std::string& s) : s_(s) {}
+  String(const String& o) = default;
+  String(String&& o) = default;
+  explicit String(char c)      : s_(1, c) {}
+  explicit String(int v, unsigned char base = 10)           { fromInt((long)v, base); }
+  explicit String(unsigned int v, unsigned char base = 10)  { fromUInt((unsigned long)v, base); }
+  explicit String(long v, unsigned char base = 10)          { fromInt(v, base); }
+  explicit String(unsigned long v, unsigned char base = 10) { fromUInt(v, base); }
+  explicit String(double v, unsigned char decimals = 2);
+
+  String& operator=(const String& o) = default;
+  String& operator=(String&& o) = default;
+  String& operator=(const char* s) { s_ = s ? s : ""; return *this; }
+
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  const char*  c_str()  const { return s_.c_str(); }
+  bool         reserve(unsigned int n) { s_.reserve(n); return true; }
+
+  char  operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+  char& operator[](unsigned int i)       { return s_[i]; }
+  char  charAt(unsigned int i)     const { return (*this)[i]; }
+
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const;
+
+  int  indexOf(char c, unsigned int from = 0) const;
+  int  indexOf(const String& s, unsigned int from = 0) const;
+
+  bool equals(const String& o) const { return s_ == o.s_; }
+  bool equals(const char* o)   const { return s_ == (o ? o : ""); }
+  bool equalsIgnoreCase(const String& o) const;
+  bool startsWith(const String& p) const { return s_.compare(0, p.s_.size(), p.s_) == 0; }
+  bool endsWith(const String& p) const;
+
+  void trim();
+  void toUpperCase();
+  void toLowerCase();
+  long   toInt()    const { return strtol(s_.c_str(), nullptr, 10); }
+  float  toFloat()  const { return (float)strtod(s_.c_str(), nullptr); }
+  double toDouble() const { return strtod(s_.c_str(), nullptr); }
+
+  bool concat(const String& o) { s_ += o.s_; return true; }
+  bool concat(const char* o)   { if (o) s_ += o; return true; }
+  bool concat(char c)          { s_ += c; return true; }
+  bool concat(const char* o, unsigned int n) { if (o) s_.append(o, n); return true; }
+
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* o)   { if (o) s_ += o; return *this; }
+  String& operator+=(char c)          { s_ += c; return *this; }
+
+  friend String operator+(const String& a, const String& b) { return String(a.s_ + b.s_); }
+  friend String operator+(const String& a, const char* b)   { return String(a.s_ + (b ? b : "")); }
+  friend String operator+(const char* a, const String& b)   { return String((a ? a : "") + b.s_); }
+
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  bool operator==(const char* o)   const { return equals(o); }
+  bool operator!=(const String& o) const { return s_ != o.s_; }
+  bool operator!=(const char* o)   const { return !equals(o); }
+  bool operator<(const String& o)  const { return s_ < o.s_; }
+
+  const std::string& str() const { return s_; }
+
+private:
+  void fromInt(long v, unsigned char base);
+  void fromUInt(unsigned long v, unsigned char base);
+  std::string s_;
+};
+
+// ----------------------------------------------------------------------------
+// Print / Printable
+// ----------------------------------------------------------------------------
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t n);
+  size_t write(const char* s) { return s ? write((const uint8_t*)s, strlen(s)) : 0; }
+
+  size_t print(const char* s)        { return write(s); }
+  size_t print(const String& s)      { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(char c)               { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC)           { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC)  { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC);
+  size_t print(unsigned long v, int base = DEC);
+  size_t print(long long v, int base = DEC);
+  size_t print(unsigned long long v, int base = DEC);
+  size_t print(double v, int digits = 2);
+  size_t print(const Printable& p)   { return p.printTo(*this); }
+
+  size_t println()                   { return write("\r\n"); }
+  template<typename T>
+  size_t println(const T& v)         { size_t n = print(v); return n + println(); }
+  template<typename T>
+  size_t println(const T& v, int f)  { size_t n = print(v, f); return n + println(); }
+
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual int availableForWrite() { return 0; }
+};
+
+// Serial su host: stdout, nessun input. Col tempo simulato ogni carattere
+// occupa la UART al baud di begin() e write() aspetta quando il buffer TX
+// (HOST_SERIAL_TX_BUF byte, come il core) e' pieno
+#ifndef HOST_SERIAL_TX_BUF
+#define HOST_SERIAL_TX_BUF 64
+#endif
+
+class HostSerial : public Stream {
+public:
+  void begin(unsigned long baud) { baud_ = baud ? baud : 115200; }
+  void end() {}
+  explicit operator bool() const { return true; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t n) override;
+  using Print::write;
+  int  available() override { return 0; }
+  int  read() override { return -1; }
+  int  peek() override { return -1; }
+  void flush() override;
+
+  // ----- lato simulatore -----
+  uint64_t bytes() const     { return bytes_; }
+  uint64_t blockedUs() const { return blockedUs_; }
+
+private:
+  unsigned long baud_      = 115200;
+  uint64_t      txFree_    = 0;   // fine dell'ultimo carattere accodato
+  uint64_t      bytes_     = 0;
+  uint64_t      blockedUs_ = 0;   // tempo passato in write() con il buffer pieno
+};
+
+extern HostSerial Serial;
+
+// ----------------------------------------------------------------------------
+// tempo, GPIO e varie
+// ----------------------------------------------------------------------------
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+inline void pinMode(uint8_t, uint8_t) {}
+void        digitalWrite(uint8_t pin, uint8_t val);
+inline int  digitalRead(uint8_t) { return LOW; }
+inline int  analogRead(uint8_t) { return 0; }
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// ----------------------------------------------------------------------------
+// tempo simulato (Host/sim)
+// Con hostSimClock(true) millis()/micros() leggono un orologio virtuale:
+// ogni lettura costa callUs (le attese attive del firmware finiscono),
+// delay() e hostIdle() lo spostano in avanti senza dormire.
+// hostIdle() fa le veci di WFI: salta al prossimo evento dichiarato dalle
+// periferiche simulate (hostSetWakeup), al piu' fino al tick di millis().
+// ----------------------------------------------------------------------------
+void     hostSimClock(bool on, uint32_t callUs = 1);
+uint64_t hostNowUs();
+void     hostAdvanceTo(uint64_t us);
+void     hostSetWakeup(uint64_t (*nextEventUs)());
+void     hostIdle();
+
+// Costo modellato di un'operazione del firmware (SD, lavoro del loop):
+// sposta l'orologio simulato in avanti di us; senza tempo simulato non fa nulla
+void     hostCharge(uint32_t us);
+
+// digitalWrite() passa dalla periferica simulata (DE/RE delle UART RS-485)
+void     hostOnPinWrite(void (*fn)(uint8_t pin, uint8_t val));
+
+// Serial su stdout silenziato (il simulatore stampa solo il suo report)
+void     hostSerialMute(bool on);
+
+#if defined(GW_HOST_SIM)
+#include <sim_hw.h>   // Serial1 e costanti SERIAL_xxx delle periferiche simulate
+#endif
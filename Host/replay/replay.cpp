@@ -0,0 +1,664 @@
+// =============================================================================
+// gw_replay — riproduce offline una traccia CAN attraverso il motore di
+// mapping del gateway (stessi mapping.cpp / utils.cpp del firmware).
+//
+// Per ogni frame della traccia:
+//   - dispatchCan + extractModbusFromCan per le regole CAN2MB → scritture
+//     Modbus applicate a un'immagine dei registri dello slave;
+//   - i poller MB2CAN girano nel tempo della traccia (period_ms) e
+//     leggono dall'immagine → frame CAN sintetici via buildCanFromModbus.
+// Alla fine stampa le scritture/uscite per risorsa e il throughput di decode.
+//
+// Formati traccia:
+//   - candump log   : "(1600000000.123456) can0 101#B00401"
+//   - candump testo : "  can0  101   [3]  B0 04 01"  (anche con "(ts)" davanti)
+//   - binario GWTR  : header 16 byte + record da 24 byte (vedi TraceRec);
+//                     "-o" converte una traccia testuale in GWTR
+//   - cattura GWCP  : file CAPxxxxx.BIN scritti dal gateway (capture_manager),
+//                     si riproducono i record CanRx
+//
+// Build (dalla root del repo, Arduino_JSON = cartella della libreria):
+//   g++ -O2 -std=c++17 -IHost/compat -IGateway_CAN-MODBUS -I$Arduino_JSON/src
+//       Host/replay/replay.cpp Host/compat/Arduino.cpp
+//       Gateway_CAN-MODBUS/mapping.cpp Gateway_CAN-MODBUS/utils.cpp Gateway_CAN-MODBUS/transform.cpp
+//       $Arduino_JSON/src/*.cpp $Arduino_JSON/src/cjson/cJSON.c -o gw_replay
+//
+// Uso:
+//   gw_replay [-j dir_json] [-v] [-o out.gwtr] traccia.log
+// =============================================================================
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "mapping.h"
+#include "capture_manager.h"
+
+// ----- formato binario GWTR -----
+static const char     TRACE_MAGIC[4] = { 'G', 'W', 'T', 'R' };
+static const uint32_t TRACE_VERSION  = 1;
+
+#pragma pack(push, 1)
+struct TraceHdr {
+  char     magic[4];
+  uint32_t version;
+  uint32_t recSize;   // sizeof(TraceRec)
+  uint32_t reserved;
+};
+
+struct TraceRec {
+  uint64_t t_us;      // timestamp in microsecondi
+  uint32_t id;        // id CAN (11 o 29 bit)
+  uint8_t  dlc;
+  uint8_t  flags;     // TRACE_FLAG_*
+  uint16_t reserved;
+  uint8_t  data[8];
+};
+#pragma pack(pop)
+
+static const uint8_t TRACE_FLAG_EXT = 0x01;
+static const uint8_t TRACE_FLAG_RTR = 0x02;
+
+// ----- stato della simulazione -----
+struct Frame {
+  uint64_t t_us;
+  uint32_t id;
+  uint8_t  dlc;
+  uint8_t  flags;
+  uint8_t  data[8];
+};
+
+struct ResStats {
+  const ModbusResourceSpec* res = nullptr;
+  uint64_t writes = 0;
+  uint64_t fails  = 0;
+};
+
+struct MsgStats {
+  const CanMessageSpec* msg = nullptr;
+  uint64_t frames = 0;
+  uint8_t  dlc    = 0;
+  uint8_t  last[8] = {0};
+};
+
+struct Poller {
+  const ModbusResourceSpec* res = nullptr;
+  uint64_t next_us = 0;
+};
+
+static long                            g_canBitrate = 500000;
+static std::vector<CanMessageSpec>     g_canMsgs;
+static ModbusRtuConfig                 g_rtu;
+static std::vector<ModbusResourceSpec> g_mbRes;
+static std::vector<MappingRule>        g_rules;
+static CanDispatch                     g_dispatch;
+
+static const uint16_t MAX_WORDS = 128;          // parole per blocco (come il buffer del firmware)
+static std::vector<uint16_t> g_image(65536, 0); // holding register dello slave simulato
+static std::vector<uint8_t>  g_coils(65536, 0); // coil dello slave simulato
+static std::vector<ResStats> g_resStats;
+static std::vector<MsgStats> g_msgStats;
+static std::vector<Poller>   g_pollers;
+
+static bool     g_verbose   = false;
+static bool     g_timeBase  = false;
+static uint64_t g_frames    = 0;
+static uint64_t g_matched   = 0;
+static uint64_t g_rtr       = 0;
+static uint64_t g_badLines  = 0;
+static uint64_t g_polls     = 0;
+static uint64_t g_synth     = 0;
+
+// ----------------------------------------------------------------------------
+// config
+// ----------------------------------------------------------------------------
+static bool readFile(const std::string& path, String& out)
+{
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  std::string s;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) s.append(buf, n);
+  fclose(f);
+  out = String(s);
+  return true;
+}
+
+static bool loadConfig(const std::string& dir)
+{
+  String canJson, mbJson, mapJson;
+  if (!readFile(dir + "/can.json", canJson) ||
+      !readFile(dir + "/modbus.json", mbJson) ||
+      !readFile(dir + "/mapping.json", mapJson))
+  {
+    fprintf(stderr, "[REPLAY] json mancanti in %s\n", dir.c_str());
+    return false;
+  }
+  if (!parseCanJson(canJson, g_canBitrate, g_canMsgs))       return false;
+  if (!parseModbusJson(mbJson, g_rtu, g_mbRes))              return false;
+  if (!parseMappingJson(mapJson, g_mbRes, g_canMsgs, g_rules)) return false;
+  buildCanDispatch(g_rules, g_dispatch);
+
+  for (auto& r : g_mbRes)   { ResStats s; s.res = &r; g_resStats.push_back(s); }
+  for (auto& m : g_canMsgs) { MsgStats s; s.msg = &m; g_msgStats.push_back(s); }
+
+  // stessi poller del firmware: una voce per risorsa usata in regole MB2CAN
+  for (auto& r : g_rules)
+  {
+    if (r.dir != RuleDir::MB2CAN || !r.fromModbus || r.fromModbus->period_ms == 0) continue;
+    bool already = false;
+    for (auto& p : g_pollers) if (p.res == r.fromModbus) { already = true; break; }
+    if (!already) { Poller p; p.res = r.fromModbus; g_pollers.push_back(p); }
+  }
+  return true;
+}
+
+static ResStats& resStats(const ModbusResourceSpec* r) { return g_resStats[r - &g_mbRes[0]]; }
+static MsgStats& msgStats(const CanMessageSpec* m)     { return g_msgStats[m - &g_canMsgs[0]]; }
+
+// ----------------------------------------------------------------------------
+// immagine dello slave: holding register e coil (input/discrete restano a 0,
+// il master non li puo' scrivere)
+// ----------------------------------------------------------------------------
+static bool isCoilSpace(ModbusFn fn)
+{
+  return fn == ModbusFn::ReadCoils || fn == ModbusFn::WriteCoil || fn == ModbusFn::WriteCoils;
+}
+
+static bool isHoldingSpace(ModbusFn fn)
+{
+  return fn == ModbusFn::ReadHolding || fn == ModbusFn::WriteSingle || fn == ModbusFn::WriteMultiple;
+}
+
+// riempie buf come la lettura di MBM (submitRead); ritorna le parole valide
+static uint16_t loadBlock(const ModbusResourceSpec& res, uint16_t* buf, uint16_t cap)
+{
+  uint16_t words = mbResourceWords(res);
+  if (words > cap || res.address + res.count > 65536u) return 0;
+  memset(buf, 0, words * sizeof(uint16_t));
+
+  if (isHoldingSpace(res.fn))
+  {
+    memcpy(buf, &g_image[res.address], res.count * sizeof(uint16_t));
+  }
+  else if (isCoilSpace(res.fn))
+  {
+    for (uint16_t i = 0; i < res.count; ++i) setBit(buf, i, g_coils[res.address + i] != 0);
+  }
+  return words;
+}
+
+static bool storeBlock(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count)
+{
+  if (res.address + res.count > 65536u) return false;
+  switch (res.fn)
+  {
+    case ModbusFn::WriteSingle:
+      if (count < 1) return false;
+      g_image[res.address] = regs[0];
+      return true;
+    case ModbusFn::WriteMultiple:
+      if (count < res.count) return false;
+      memcpy(&g_image[res.address], regs, res.count * sizeof(uint16_t));
+      return true;
+    case ModbusFn::WriteCoil:
+      if (count < 1) return false;
+      g_coils[res.address] = getBit(regs, 0);
+      return true;
+    case ModbusFn::WriteCoils:
+      if (count < mbResourceWords(res)) return false;
+      for (uint16_t i = 0; i < res.count; ++i) g_coils[res.address + i] = getBit(regs, i);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// motore: stessi passi di loop() ma con l'immagine registri al posto del bus
+// ----------------------------------------------------------------------------
+static void pollResource(const ModbusResourceSpec* res, uint64_t t_us)
+{
+  g_polls++;
+  uint16_t regs[MAX_WORDS];
+  uint16_t count = loadBlock(*res, regs, MAX_WORDS);
+  if (!count) return;
+
+  for (auto& rule : g_rules)
+  {
+    if (rule.dir != RuleDir::MB2CAN || rule.fromModbus != res || !rule.toCan) continue;
+
+    uint32_t id; uint8_t dlc; uint8_t data[8];
+    if (!buildCanFromModbus(rule, regs, count, id, dlc, data)) continue;
+
+    g_synth++;
+    MsgStats& ms = msgStats(rule.toCan);
+    ms.frames++;
+    ms.dlc = dlc;
+    memcpy(ms.last, data, dlc);
+
+    if (g_verbose)
+    {
+      printf("%llu.%06llu TX  %s id=0x%X [%u]", (unsigned long long)(t_us / 1000000),
+             (unsigned long long)(t_us % 1000000), rule.toCan->name.c_str(), (unsigned)id, dlc);
+      for (uint8_t i = 0; i < dlc; ++i) printf(" %02X", data[i]);
+      printf("\n");
+    }
+  }
+}
+
+static void advancePollers(uint64_t t_us)
+{
+  if (!g_timeBase)
+  {
+    g_timeBase = true;
+    for (auto& p : g_pollers) p.next_us = t_us;
+  }
+  for (auto& p : g_pollers)
+  {
+    uint64_t period = (uint64_t)p.res->period_ms * 1000ULL;
+    while (p.next_us <= t_us)
+    {
+      pollResource(p.res, p.next_us);
+      p.next_us += period;
+    }
+  }
+}
+
+static void applyWrite(const ModbusResourceSpec& res, const uint16_t* regs, uint16_t count, uint64_t t_us)
+{
+  ResStats& st = resStats(&res);
+  if (!storeBlock(res, regs, count)) { st.fails++; return; }
+  st.writes++;
+
+  if (g_verbose)
+  {
+    printf("%llu.%06llu WR  %s @%u [", (unsigned long long)(t_us / 1000000),
+           (unsigned long long)(t_us % 1000000), res.name.c_str(), res.address);
+    bool     single = res.fn == ModbusFn::WriteSingle || res.fn == ModbusFn::WriteCoil;
+    uint16_t n = single ? 1 : res.count;
+    for (uint16_t i = 0; i < n; ++i)
+    {
+      unsigned v = isBitFn(res.fn) ? (unsigned)getBit(regs, i) : regs[i];
+      printf(i ? " %u" : "%u", v);
+    }
+    printf("]\n");
+  }
+}
+
+static void processFrame(const Frame& f)
+{
+  g_frames++;
+  advancePollers(f.t_us);
+  if (f.flags & TRACE_FLAG_RTR) { g_rtr++; return; }
+
+  const CanDispatchEntry* d = dispatchCan(g_dispatch, f.id);
+  if (!d) return;
+  g_matched++;
+
+  uint16_t regs[MAX_WORDS];
+  for (uint16_t k = 0; k < d->count; ++k)
+  {
+    const MappingRule& rule = g_rules[g_dispatch.ruleIdx[d->first + k]];
+    const ModbusResourceSpec& res = *rule.toModbus;
+    uint16_t count = mbResourceWords(res);
+    if (count > MAX_WORDS || res.address + res.count > 65536u) { resStats(&res).fails++; continue; }
+
+    // come il firmware: bit/registri non mappati partono da 0
+    memset(regs, 0, count * sizeof(uint16_t));
+    if (!extractModbusFromCan(rule, f.data, f.dlc, regs, count))
+    {
+      resStats(&res).fails++;
+      continue;
+    }
+    applyWrite(res, regs, count, f.t_us);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// parser candump (senza allocazioni)
+// ----------------------------------------------------------------------------
+static inline int hexVal(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+static inline const char* skipWs(const char* p, const char* e)
+{
+  while (p < e && (*p == ' ' || *p == '\t')) p++;
+  return p;
+}
+
+static inline const char* skipTok(const char* p, const char* e)
+{
+  while (p < e && *p != ' ' && *p != '\t') p++;
+  return p;
+}
+
+// "(sec.usec)" → microsecondi
+static const char* parseTs(const char* p, const char* e, uint64_t& t_us)
+{
+  uint64_t sec = 0, frac = 0;
+  int fd = 0;
+  p++; // '('
+  while (p < e && *p >= '0' && *p <= '9') sec = sec * 10 + (uint64_t)(*p++ - '0');
+  if (p < e && *p == '.')
+  {
+    p++;
+    while (p < e && *p >= '0' && *p <= '9')
+    {
+      if (fd < 6) { frac = frac * 10 + (uint64_t)(*p - '0'); fd++; }
+      p++;
+    }
+  }
+  while (fd < 6) { frac *= 10; fd++; }
+  while (p < e && *p != ')') p++;
+  if (p < e) p++;
+  t_us = sec * 1000000ULL + frac;
+  return p;
+}
+
+static bool parseLine(const char* p, const char* e, uint64_t& lastTs, Frame& f)
+{
+  p = skipWs(p, e);
+  if (p >= e || *p == '#') return false;
+
+  f.t_us  = lastTs;
+  f.flags = 0;
+  f.dlc   = 0;
+  if (*p == '(')
+  {
+    p = parseTs(p, e, f.t_us);
+    lastTs = f.t_us;
+    p = skipWs(p, e);
+  }
+
+  // interfaccia
+  p = skipTok(p, e);
+  p = skipWs(p, e);
+
+  // id
+  const char* idStart = p;
+  uint32_t id = 0;
+  int v;
+  while (p < e && (v = hexVal(*p)) >= 0) { id = (id << 4) | (uint32_t)v; p++; }
+  if (p == idStart) return false;
+  if (p - idStart > 3) f.flags |= TRACE_FLAG_EXT;
+  f.id = id;
+
+  if (p < e && *p == '#')
+  {
+    // formato log: ID#DATA, ID#R, ID##F... (CAN FD non gestito)
+    p++;
+    if (p < e && *p == '#') return false;
+    if (p < e && (*p == 'R' || *p == 'r')) { f.flags |= TRACE_FLAG_RTR; return true; }
+    while (p + 1 < e && f.dlc < 8)
+    {
+      int h = hexVal(p[0]), l = hexVal(p[1]);
+      if (h < 0 || l < 0) break;
+      f.data[f.dlc++] = (uint8_t)((h << 4) | l);
+      p += 2;
+      if (p < e && *p == '.') p++;
+    }
+    return true;
+  }
+
+  // formato testo: ID [n] b0 b1 ...
+  p = skipWs(p, e);
+  if (p >= e || *p != '[') return false;
+  p++;
+  uint8_t n = 0;
+  while (p < e && *p >= '0' && *p <= '9') n = (uint8_t)(n * 10 + (*p++ - '0'));
+  if (p < e && *p == ']') p++;
+  if (n > 8) return false;
+  p = skipWs(p, e);
+  if (p + 6 <= e && !memcmp(p, "remote", 6)) { f.flags |= TRACE_FLAG_RTR; f.dlc = n; return true; }
+  for (uint8_t i = 0; i < n; ++i)
+  {
+    p = skipWs(p, e);
+    if (p + 1 >= e) return false;
+    int h = hexVal(p[0]), l = hexVal(p[1]);
+    if (h < 0 || l < 0) return false;
+    f.data[i] = (uint8_t)((h << 4) | l);
+    p += 2;
+  }
+  f.dlc = n;
+  return true;
+}
+
+template<typename Fn>
+static void forEachTextFrame(const char* buf, size_t len, Fn fn)
+{
+  const char* p = buf;
+  const char* end = buf + len;
+  uint64_t lastTs = 0;
+  Frame f;
+  while (p < end)
+  {
+    const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+    const char* le = nl ? nl : end;
+    const char* lt = le;
+    if (lt > p && lt[-1] == '\r') lt--;
+    if (lt > p)
+    {
+      if (parseLine(p, lt, lastTs, f)) fn(f);
+      else if (*skipWs(p, lt) != '#') g_badLines++;
+    }
+    p = le + 1;
+  }
+}
+
+template<typename Fn>
+static void forEachCapFrame(const char* buf, size_t len, Fn fn)
+{
+  uint64_t hi = 0;
+  uint32_t last = 0;
+  bool     first = true;
+  Frame f;
+  for (size_t off = 0; off + CAPM_BLOCK_SIZE <= len; off += CAPM_BLOCK_SIZE)
+  {
+    const char* b = buf + off;
+    CAPM::BlockHdr h;
+    memcpy(&h, b, sizeof(h));
+    if (memcmp(h.magic, "GWCP", 4) || h.used > CAPM_BLOCK_SIZE) { g_badLines++; continue; }
+
+    size_t p = sizeof(CAPM::BlockHdr);
+    while (p + sizeof(CAPM::RecHdr) <= h.used)
+    {
+      CAPM::RecHdr r;
+      memcpy(&r, b + p, sizeof(r));
+      p += sizeof(r);
+      if (p + r.len > h.used) break;
+
+      // micros() a 32 bit: si ricostruisce il tempo assoluto sui wrap
+      if (!first && r.t_us < last) hi += 1ULL << 32;
+      first = false;
+      last  = r.t_us;
+
+      if (r.type == (uint8_t)CAPM::RecType::CanRx && r.len >= 4)
+      {
+        memcpy(&f.id, b + p, 4);
+        f.t_us  = hi | r.t_us;
+        f.dlc   = (uint8_t)std::min<uint32_t>(r.len - 4u, 8u);
+        f.flags = f.id > 0x7FF ? TRACE_FLAG_EXT : 0;
+        memcpy(f.data, b + p + 4, f.dlc);
+        fn(f);
+      }
+      p += r.len;
+    }
+  }
+}
+
+template<typename Fn>
+static bool forEachBinFrame(const char* buf, size_t len, Fn fn)
+{
+  TraceHdr h;
+  memcpy(&h, buf, sizeof(h));
+  if (h.version != TRACE_VERSION || h.recSize != sizeof(TraceRec))
+  {
+    fprintf(stderr, "[REPLAY] GWTR versione %u / record %u non supportati\n", h.version, h.recSize);
+    return false;
+  }
+  size_t n = (len - sizeof(TraceHdr)) / sizeof(TraceRec);
+  const char* p = buf + sizeof(TraceHdr);
+  Frame f;
+  for (size_t i = 0; i < n; ++i, p += sizeof(TraceRec))
+  {
+    TraceRec r;
+    memcpy(&r, p, sizeof(r));
+    f.t_us  = r.t_us;
+    f.id    = r.id;
+    f.dlc   = r.dlc > 8 ? 8 : r.dlc;
+    f.flags = r.flags;
+    memcpy(f.data, r.data, 8);
+    fn(f);
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// report
+// ----------------------------------------------------------------------------
+static void printReport(double secs, size_t bytes)
+{
+  printf("\n[REPLAY] frame=%llu (rtr=%llu, righe scartate=%llu) matched CAN2MB=%llu\n",
+         (unsigned long long)g_frames, (unsigned long long)g_rtr,
+         (unsigned long long)g_badLines, (unsigned long long)g_matched);
+  printf("[REPLAY] decode %.3f s → %.0f frame/s, %.1f MB/s\n", secs,
+         secs > 0 ? g_frames / secs : 0.0, secs > 0 ? bytes / secs / 1e6 : 0.0);
+
+  printf("[REPLAY] scritture Modbus (CAN2MB):\n");
+  for (auto& st : g_resStats)
+  {
+    if (!st.writes && !st.fails) continue;
+    const ModbusResourceSpec& r = *st.res;
+    printf("  %-16s @%-5u writes=%llu fail=%llu last=[", r.name.c_str(), r.address,
+           (unsigned long long)st.writes, (unsigned long long)st.fails);
+    for (uint16_t i = 0; i < r.count && r.address + i < 65536u; ++i)
+      printf(i ? " %u" : "%u", isCoilSpace(r.fn) ? (unsigned)g_coils[r.address + i] : g_image[r.address + i]);
+    printf("]\n");
+  }
+
+  printf("[REPLAY] uscite MB2CAN sintetiche: poll=%llu frame=%llu\n",
+         (unsigned long long)g_polls, (unsigned long long)g_synth);
+  for (auto& ms : g_msgStats)
+  {
+    if (!ms.frames) continue;
+    printf("  %-16s id=0x%-4X frames=%llu last=[", ms.msg->name.c_str(), (unsigned)ms.msg->id,
+           (unsigned long long)ms.frames);
+    for (uint8_t i = 0; i < ms.dlc; ++i) printf(i ? " %02X" : "%02X", ms.last[i]);
+    printf("]\n");
+  }
+}
+
+static int convertToBin(const char* buf, size_t len, const char* outPath)
+{
+  FILE* out = fopen(outPath, "wb");
+  if (!out) { perror(outPath); return 1; }
+
+  TraceHdr h;
+  memcpy(h.magic, TRACE_MAGIC, 4);
+  h.version  = TRACE_VERSION;
+  h.recSize  = sizeof(TraceRec);
+  h.reserved = 0;
+  fwrite(&h, sizeof(h), 1, out);
+
+  std::vector<TraceRec> chunk;
+  chunk.reserve(65536);
+  uint64_t n = 0;
+  forEachTextFrame(buf, len, [&](const Frame& f) {
+    TraceRec r;
+    memset(&r, 0, sizeof(r));
+    r.t_us  = f.t_us;
+    r.id    = f.id;
+    r.dlc   = f.dlc;
+    r.flags = f.flags;
+    memcpy(r.data, f.data, f.dlc);
+    chunk.push_back(r);
+    if (chunk.size() == chunk.capacity())
+    {
+      fwrite(chunk.data(), sizeof(TraceRec), chunk.size(), out);
+      chunk.clear();
+    }
+    n++;
+  });
+  fwrite(chunk.data(), sizeof(TraceRec), chunk.size(), out);
+  fclose(out);
+  printf("[REPLAY] %llu frame scritti in %s\n", (unsigned long long)n, outPath);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  std::string jsonDir = "Json";
+  const char* outPath = nullptr;
+  const char* tracePath = nullptr;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc)      jsonDir = argv[++i];
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc) outPath = argv[++i];
+    else if (!strcmp(argv[i], "-v"))                 g_verbose = true;
+    else if (argv[i][0] != '-')                      tracePath = argv[i];
+    else { tracePath = nullptr; break; }
+  }
+  if (!tracePath)
+  {
+    fprintf(stderr, "uso: %s [-j dir_json] [-v] [-o out.gwtr] traccia\n", argv[0]);
+    return 2;
+  }
+
+  int fd = open(tracePath, O_RDONLY);
+  if (fd < 0) { perror(tracePath); return 1; }
+  struct stat st;
+  fstat(fd, &st);
+  size_t len = (size_t)st.st_size;
+  const char* buf = "";
+  if (len)
+  {
+    void* m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) { perror("mmap"); return 1; }
+    madvise(m, len, MADV_SEQUENTIAL);
+    buf = (const char*)m;
+  }
+
+  bool binary  = len >= sizeof(TraceHdr) && !memcmp(buf, TRACE_MAGIC, 4);
+  bool capture = len >= CAPM_BLOCK_SIZE && !memcmp(buf, "GWCP", 4);
+  if (outPath)
+  {
+    if (binary || capture) { fprintf(stderr, "[REPLAY] traccia gia' in formato binario\n"); return 1; }
+    return convertToBin(buf, len, outPath);
+  }
+
+  if (!loadConfig(jsonDir)) return 1;
+  printf("[REPLAY] CAN bitrate=%ld msgs=%zu, MB res=%zu, rules=%zu, pollers=%zu\n", g_canBitrate,
+         g_canMsgs.size(), g_mbRes.size(), g_rules.size(), g_pollers.size());
+
+  auto t0 = std::chrono::steady_clock::now();
+  if (binary)
+  {
+    if (!forEachBinFrame(buf, len, processFrame)) return 1;
+  }
+  else if (capture)
+  {
+    forEachCapFrame(buf, len, processFrame);
+  }
+  else
+  {
+    forEachTextFrame(buf, len, processFrame);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  printReport(std::chrono::duration<double>(t1 - t0).count(), len);
+  return 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+// =============================================================================
+// Arduino_CAN simulato per gw_sim: la stessa API usata dal gateway (CanMsg,
+// CanStandardId/CanExtendedId, CAN.begin/write/available/read) sopra un bus
+// virtuale in-process (vcan.cpp).
+//
+// Sul bus ci sono due nodi: il gateway (CAN) e il "resto della rete" (PEER),
+// pilotato dal simulatore. La durata di ogni frame e' calcolata bit per bit,
+// stuffing e CRC compresi, al bitrate di begin(); a bus libero vince l'id
+// piu' basso. Il bus avanza in modo pigro: ogni chiamata porta lo stato
+// all'orologio simulato corrente.
+// =============================================================================
+#include <Arduino.h>
+
+#ifndef VCAN_TX_MAILBOXES
+#define VCAN_TX_MAILBOXES 3    // mailbox TX del gateway
+#endif
+#ifndef VCAN_RX_DEPTH
+#define VCAN_RX_DEPTH     32   // buffer RX della libreria sul gateway
+#endif
+
+constexpr uint32_t CAN_EFF_FLAG = 0x80000000UL;
+
+struct CanStandardId {
+  uint32_t id;
+  explicit CanStandardId(uint32_t i) : id(i & 0x7FF) {}
+};
+
+struct CanExtendedId {
+  uint32_t id;
+  explicit CanExtendedId(uint32_t i) : id((i & 0x1FFFFFFF) | CAN_EFF_FLAG) {}
+};
+
+class CanMsg {
+public:
+  static constexpr uint8_t MAX_DATA_LENGTH = 8;
+
+  CanMsg() : id(0), data_length(0) { memset(data, 0, sizeof(data)); }
+  CanMsg(CanStandardId i, uint8_t len, const uint8_t* d) : id(i.id) { set(len, d); }
+  CanMsg(CanExtendedId i, uint8_t len, const uint8_t* d) : id(i.id) { set(len, d); }
+
+  bool     isExtendedId()  const { return (id & CAN_EFF_FLAG) != 0; }
+  bool     isStandardId()  const { return !isExtendedId(); }
+  uint32_t getStandardId() const { return id & 0x7FF; }
+  uint32_t getExtendedId() const { return id & 0x1FFFFFFF; }
+
+  uint32_t id;
+  uint8_t  data_length;
+  uint8_t  data[MAX_DATA_LENGTH];
+
+private:
+  void set(uint8_t len, const uint8_t* d)
+  {
+    data_length = len > MAX_DATA_LENGTH ? MAX_DATA_LENGTH : len;
+    memset(data, 0, sizeof(data));
+    if (d) memcpy(data, d, data_length);
+  }
+};
+
+class SimCan {
+public:
+  bool   begin(long bitrate);
+  int    write(const CanMsg& msg);   // 1 = in mailbox, -1 = mailbox occupate
+  size_t available();
+  CanMsg read();
+};
+
+extern SimCan CAN;
+
+// ----- lato simulatore -----
+namespace VCAN {
+
+struct Stats {
+  uint32_t gwTx       = 0;   // frame del gateway completati sul bus
+  uint32_t peerTx     = 0;
+  uint32_t gwRx       = 0;   // frame letti dal gateway
+  uint32_t rxOverflow = 0;   // frame persi: buffer RX del gateway pieno
+  uint32_t mailboxFull = 0;  // write() rifiutate
+  uint64_t busyUs     = 0;   // tempo di bus occupato
+};
+
+// Frame del resto della rete pronto a readyUs (anche nel futuro)
+void peerSend(const CanMsg& m, uint64_t readyUs);
+
+// Sorgente pigra del traffico PEER: pull(t) chiama peerSend per tutto cio'
+// che e' pronto entro t, peek() da' il prossimo istante (0 = nessuno)
+void setPeerSource(void (*pull)(uint64_t upToUs), uint64_t (*peek)());
+
+// Frame completati: verso il PEER (tutti quelli del gateway) e verso il
+// gateway (dropped = buffer RX pieno)
+void onPeerRx(void (*fn)(const CanMsg& m, uint64_t endUs));
+void onGatewayRx(void (*fn)(const CanMsg& m, uint64_t endUs, bool dropped));
+
+void     advance(uint64_t nowUs);
+uint64_t nextEventUs();               // 0 = nessun evento in vista
+uint16_t frameBits(const CanMsg& m);  // bit sul filo, stuffing compreso
+long     bitrate();
+const Stats& stats();
+
+} // namespace VCAN
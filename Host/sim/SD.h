@@ -0,0 +1,76 @@
+#pragma once
+// =============================================================================
+// SD simulata per gw_sim: i file stanno in una cartella dell'host (SD.root)
+// con gli stessi nomi 8.3 usati dal gateway. FILE_WRITE apre in append come
+// la libreria SD. Ogni accesso costa un tempo fisso sull'orologio simulato
+// (stime per una microSD su SPI, non misure): il loop resta fermo come sulla
+// scheda.
+// =============================================================================
+#include <Arduino.h>
+#include <cstdio>
+#include <string>
+
+#define FILE_READ  0
+#define FILE_WRITE 1
+
+#ifndef SIMSD_OPEN_US
+#define SIMSD_OPEN_US    3000   // open, exists, remove (ricerca nella directory)
+#endif
+#ifndef SIMSD_CLOSE_US
+#define SIMSD_CLOSE_US   2000   // close, flush (aggiornamento FAT e directory)
+#endif
+#ifndef SIMSD_SECTOR_US
+#define SIMSD_SECTOR_US  1500   // scrittura o lettura di 512 byte
+#endif
+
+// tempo di SD addebitato al firmware
+void simSdCharge(uint32_t us);
+
+class File : public Stream {
+public:
+  File() {}
+  explicit File(FILE* f) : f_(f) {}
+
+  explicit operator bool() const { return f_ != nullptr; }
+
+  size_t write(uint8_t c) override                   { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) override
+  {
+    if (!f_) return 0;
+    simSdCharge((uint32_t)((n + 511) / 512) * SIMSD_SECTOR_US);
+    return fwrite(b, 1, n, f_);
+  }
+  using Print::write;
+
+  int  available() override;
+  int  read() override;
+  int  peek() override;
+  int  read(void* buf, uint16_t n)                   { return f_ ? (int)fread(buf, 1, n, f_) : -1; }
+  String readString();
+
+  void     flush() override { if (f_) { simSdCharge(SIMSD_CLOSE_US); fflush(f_); } }
+  void     close()          { if (f_) { simSdCharge(SIMSD_CLOSE_US); fclose(f_); } f_ = nullptr; }
+  uint32_t size();
+  uint32_t position()       { return f_ ? (uint32_t)ftell(f_) : 0; }
+  bool     seek(uint32_t p) { return f_ && fseek(f_, (long)p, SEEK_SET) == 0; }
+
+private:
+  FILE* f_ = nullptr;
+};
+
+class SDClass {
+public:
+  bool begin(uint8_t) { return !root.empty(); }
+  File open(const char* path, uint8_t mode = FILE_READ);
+  bool exists(const char* path);
+  bool remove(const char* path);
+
+  std::string root;   // cartella host che fa da radice della scheda
+  uint32_t    ops = 0;      // accessi addebitati
+  uint64_t    busyUs = 0;   // tempo di SD addebitato al loop
+
+private:
+  std::string hostPath(const char* path) const;
+};
+
+extern SDClass SD;
@@ -0,0 +1,537 @@
+// =============================================================================
+// gw_sim — il firmware del gateway su host, in tempo simulato, con un bus CAN
+// virtuale (vcan.cpp) e slave Modbus RTU simulati su ogni linea del master
+// (rtu_slave.cpp, Serial1 e Serial2). setup() e loop() sono quelli dello sketch; l'orologio
+// avanza con le letture di micros()/millis(), con i tempi di linea e, a
+// gateway fermo in EVQ::idle(), fino al prossimo evento delle periferiche.
+//
+// Costi modellati (stime fisse, non misure sulla scheda):
+//   - ogni lettura di micros()/millis() 1 us;
+//   - ogni passata di loop() -L us (default 20) per il lavoro del firmware
+//     che non tocca le periferiche;
+//   - Serial (USB/debug) al baud di begin(): oltre 64 byte in coda print()
+//     blocca il loop fino a che il buffer si svuota;
+//   - SD: open/exists/remove 3 ms, close/flush 2 ms, 1.5 ms ogni 512 byte;
+//   - DE/RE dei transceiver: i byte che arrivano dalla linea RTU
+//     mentre DE e' alto si perdono e sono contati nel report.
+// Non modellati: tempo CPU reale del codice (solo il costo fisso per
+// passata), interrupt, contesa SPI, latenza variabile della scheda SD.
+//
+// Traffico:
+//   - il resto della rete invia comandi CAN (-c id:hz, default: ogni id delle
+//     regole CAN2MB a 10 Hz) con payload casuale, piu' eventuale traffico di
+//     fondo a bassa priorita' (-b carico%);
+//   - lo slave fa variare i registri delle risorse lette dai poller (-v hz,
+//     processo di Poisson per risorsa), risponde dopo -l us[:jitter] e perde
+//     -d risposte per mille.
+//
+// Misure:
+//   CAN->MB  fine del frame di comando sul bus -> fine della richiesta di
+//            scrittura allo slave (per risorsa, in ordine di arrivo);
+//   MB->CAN  prima variazione non ancora letta di una risorsa -> fine sul bus
+//            del primo frame MB2CAN successivo alla lettura che la vede;
+//   perdite (buffer RX, coda TX, risposte mancanti), throughput, carico di
+//   bus e di linea.
+//
+// Build (dalla root del repo, Arduino_JSON = cartella della libreria):
+//   g++ -O2 -std=c++17 -DGW_HOST_SIM -IHost/sim -IHost/compat -IGateway_CAN-MODBUS
+//       -Ilibraries/GatewayCommon/src -I$Arduino_JSON/src
+//       Host/sim/*.cpp Host/compat/Arduino.cpp Gateway_CAN-MODBUS/*.cpp
+//       $Arduino_JSON/src/*.cpp $Arduino_JSON/src/cjson/cJSON.c -o gw_sim
+//
+// Uso:
+//   gw_sim [-j dir_json] [-t secondi] [-c id:hz]... [-b carico%] [-v hz]
+//          [-l us[:jitter_us]] [-d permille] [-L us_per_loop] [-s seed] [-V]
+// =============================================================================
+#include "Gateway_CAN-MODBUS.ino"
+#include "rtu_slave.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+// opzioni
+// ----------------------------------------------------------------------------
+struct CmdStream {
+  uint32_t id;
+  double   hz;
+  uint8_t  dlc      = 8;
+  uint64_t next     = 0;
+  uint64_t periodUs = 0;
+};
+
+static std::string            g_simJson  = "Json";
+static double                 g_simSecs  = 10.0;
+static std::vector<CmdStream> g_cmds;
+static double                 g_bgLoad   = 0.0;   // 0..1
+static double                 g_changeHz = 2.0;
+static RTUSIM::Config         g_slaveCfg;
+static bool                   g_simVerbose = false;
+static uint32_t               g_loopUs   = 20;
+
+// ----------------------------------------------------------------------------
+// misure
+// ----------------------------------------------------------------------------
+struct LatStats {
+  std::vector<uint32_t> us;
+  uint32_t lost = 0;
+};
+
+static LatStats g_can2mb, g_mb2can;
+static uint32_t g_cmdSent   = 0;
+static uint32_t g_bgSent    = 0;
+static uint32_t g_mb2canRx  = 0;   // frame MB2CAN ricevuti dal resto della rete
+
+// una voce per risorsa remota coinvolta nelle regole
+struct SimRes {
+  const ModbusResourceSpec* res;
+  const HardwareSerial*     port;   // linea della risorsa
+  uint8_t  id;                      // slave che la serve
+  uint8_t  fc;
+  // CAN2MB: istanti di fine dei comandi ricevuti, in attesa della scrittura
+  std::deque<uint64_t> pending;
+  std::vector<uint32_t> cmdIds;
+  // MB2CAN: variazioni dello slave
+  bool     polled     = false;
+  uint64_t nextChange = 0;
+  uint64_t unseen     = 0;     // prima variazione non ancora letta (0 = nessuna)
+  uint64_t observed   = 0;     // prima variazione letta, non ancora sul bus
+  uint64_t observedAt = 0;     // inizio della risposta che l'ha vista
+  std::vector<uint32_t> outIds;
+  uint32_t changes    = 0;
+};
+static std::vector<SimRes> g_simRes;
+
+static SimRes* simResOf(const ModbusResourceSpec* r)
+{
+  for (auto& s : g_simRes) if (s.res == r) return &s;
+  g_simRes.push_back(SimRes());
+  SimRes& s = g_simRes.back();
+  s.res  = r;
+  s.port = MBM::portByName(g_rtu.lines[r->line].port);
+  s.id   = r->slave_id ? r->slave_id : g_rtu.lines[r->line].slave_id;
+  s.fc   = modbusFnCode(r->fn);
+  return &s;
+}
+
+// ----------------------------------------------------------------------------
+// traffico del resto della rete (sorgente pigra del bus virtuale)
+// ----------------------------------------------------------------------------
+static uint64_t g_bgNext = 0, g_bgPeriod = 0;
+
+static uint64_t expUs(double hz)
+{
+  double u = (random(1000000) + 1) / 1000001.0;
+  return (uint64_t)(-std::log(u) / hz * 1e6) + 1;
+}
+
+static void peerPull(uint64_t upTo)
+{
+  for (auto& c : g_cmds)
+  {
+    while (c.next <= upTo)
+    {
+      uint8_t d[8];
+      for (uint8_t i = 0; i < 8; ++i) d[i] = (uint8_t)random(256);
+      VCAN::peerSend(CANM::makeMsg(c.id, c.dlc, d), c.next);
+      c.next += c.periodUs;
+      g_cmdSent++;
+    }
+  }
+  while (g_bgPeriod && g_bgNext <= upTo)
+  {
+    uint8_t d[8];
+    for (uint8_t i = 0; i < 8; ++i) d[i] = (uint8_t)random(256);
+    VCAN::peerSend(CanMsg(CanStandardId(0x700 + random(0x100)), 8, d), g_bgNext);
+    g_bgNext += g_bgPeriod;
+    g_bgSent++;
+  }
+}
+
+static uint64_t peerPeek()
+{
+  uint64_t next = g_bgPeriod ? g_bgNext : 0;
+  for (auto& c : g_cmds)
+  {
+    if (!next || c.next < next) next = c.next;
+  }
+  return next;
+}
+
+static uint64_t nextEvent()
+{
+  uint64_t next = VCAN::nextEventUs();
+  for (const HardwareSerial* port : { &Serial1, &Serial2 })
+  {
+    uint64_t t = port->nextRxUs();
+    if (t && (!next || t < next)) next = t;
+  }
+  return next;
+}
+
+// ----------------------------------------------------------------------------
+// eventi del bus e dello slave
+// ----------------------------------------------------------------------------
+static void onGwRx(const CanMsg& m, uint64_t endUs, bool dropped)
+{
+  for (auto& s : g_simRes)
+  {
+    if (std::find(s.cmdIds.begin(), s.cmdIds.end(), CANM::msgId(m)) == s.cmdIds.end()) continue;
+    if (dropped) g_can2mb.lost++;
+    else         s.pending.push_back(endUs);
+  }
+}
+
+static void onPeerRx(const CanMsg& m, uint64_t endUs)
+{
+  bool mine = false;
+  for (auto& s : g_simRes)
+  {
+    if (std::find(s.outIds.begin(), s.outIds.end(), CANM::msgId(m)) == s.outIds.end()) continue;
+    mine = true;
+    if (s.observed && s.observedAt < endUs)
+    {
+      g_mb2can.us.push_back((uint32_t)(endUs - s.observed));
+      s.observed = 0;
+    }
+  }
+  if (mine) g_mb2canRx++;
+}
+
+// valori dello slave fino ad atUs: un registro (o un bit) per variazione
+static void slaveBefore(uint64_t atUs)
+{
+  for (auto& s : g_simRes)
+  {
+    if (!s.polled || g_changeHz <= 0) continue;
+    while (s.nextChange <= atUs)
+    {
+      uint16_t a = s.res->address + (uint16_t)random(s.res->count);
+      switch (s.res->fn)
+      {
+        case ModbusFn::ReadHolding:  RTUSIM::holding()[a]++;  break;
+        case ModbusFn::ReadInput:    RTUSIM::input()[a]++;    break;
+        case ModbusFn::ReadCoils:    RTUSIM::coils()[a]    ^= 1; break;
+        case ModbusFn::ReadDiscrete: RTUSIM::discrete()[a] ^= 1; break;
+        default: break;
+      }
+      if (!s.unseen) s.unseen = s.nextChange;
+      s.changes++;
+      s.nextChange += expUs(g_changeHz);
+    }
+  }
+}
+
+static void slaveServed(const HardwareSerial& port, uint8_t id, uint8_t fc, uint16_t addr, uint16_t qty,
+                        uint64_t reqEndUs, uint64_t rspUs)
+{
+  for (auto& s : g_simRes)
+  {
+    if (s.port != &port || s.id != id || s.fc != fc || s.res->address != addr) continue;
+
+    if (isReadFn(s.res->fn))
+    {
+      if (!rspUs || !s.unseen) continue;
+      if (!s.observed) s.observed = s.unseen;
+      s.unseen     = 0;
+      s.observedAt = rspUs;
+    } else if (!s.pending.empty())
+    {
+      g_can2mb.us.push_back((uint32_t)(reqEndUs - s.pending.front()));
+      s.pending.pop_front();
+    }
+  }
+  (void)qty;
+}
+
+// ----------------------------------------------------------------------------
+// preparazione
+// ----------------------------------------------------------------------------
+static bool readHostFile(const std::string& path, std::string& out)
+{
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  char buf[4096];
+  size_t n;
+  out.clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+// SD in una cartella temporanea, con i nomi 8.3 attesi dallo sketch; i JSON
+// sono validati qui perche' setup() su errore resta in un while(true)
+static bool prepareSd()
+{
+  char dir[] = "/tmp/gw_simXXXXXX";
+  if (!mkdtemp(dir)) { perror("mkdtemp"); return false; }
+  SD.root = dir;
+
+  static const char* const SRC[3] = { "can.json", "modbus.json", "mapping.json" };
+  const char* const DST[3] = { CAN_PATH, MB_PATH, MAP_PATH };
+  std::string text[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    if (!readHostFile(g_simJson + "/" + SRC[i], text[i]))
+    {
+      fprintf(stderr, "[SIM] %s mancante in %s\n", SRC[i], g_simJson.c_str());
+      return false;
+    }
+    FILE* f = fopen((SD.root + DST[i]).c_str(), "wb");
+    if (!f) { perror(DST[i]); return false; }
+    fwrite(text[i].data(), 1, text[i].size(), f);
+    fclose(f);
+  }
+
+#if !GW_STATIC_CONFIG
+  long bitrate;
+  std::vector<CanMessageSpec> msgs;
+  ModbusRtuConfig rtu;
+  std::vector<ModbusResourceSpec> res;
+  std::vector<MappingRule> rules;
+  if (!parseCanJson(String(text[0]), bitrate, msgs) ||
+      !parseModbusJson(String(text[1]), rtu, res) ||
+      !parseMappingJson(String(text[2]), res, msgs, rules))
+  {
+    fprintf(stderr, "[SIM] configurazione non valida (-V per i dettagli)\n");
+    return false;
+  }
+#endif
+  return true;
+}
+
+// dopo setup(): risorse misurate e flussi di comandi di default
+static void prepareTraffic(uint64_t t0)
+{
+  for (auto& r : g_rules)
+  {
+    if (r.dir == RuleDir::CAN2MB && r.toModbus && !r.toModbus->local && r.fromCan)
+    {
+      SimRes* s = simResOf(r.toModbus);
+      s->cmdIds.push_back(r.fromCan->id);
+      // gruppo: il comando e' scritto con il broadcast o con l'ultimo slave
+      if (r.group.active()) s->id = r.group.broadcast ? 0 : r.group.slaves.back();
+    }
+    if (r.dir == RuleDir::MB2CAN && r.fromModbus && !r.fromModbus->local && r.toCan)
+    {
+      simResOf(r.fromModbus)->outIds.push_back(r.toCan->id);
+    }
+  }
+  for (auto& p : g_pollers)
+  {
+    SimRes* s = simResOf(p.res);
+    s->polled     = true;
+    s->nextChange = t0 + (g_changeHz > 0 ? expUs(g_changeHz) : 0);
+  }
+
+  if (g_cmds.empty())
+  {
+    for (auto& s : g_simRes)
+    {
+      for (uint32_t id : s.cmdIds)
+      {
+        bool dup = false;
+        for (auto& c : g_cmds) dup |= c.id == id;
+        if (!dup) g_cmds.push_back({ id, 10.0 });
+      }
+    }
+  }
+  for (auto& c : g_cmds)
+  {
+    const CanMessageSpec* spec = nullptr;
+    for (auto& m : g_canMsgs) if (m.id == c.id) spec = &m;
+    c.dlc      = spec ? spec->dlc : 8;
+    c.periodUs = (uint64_t)(1e6 / c.hz);
+    c.next     = t0 + (uint64_t)random((long)c.periodUs);   // fasi sparse
+  }
+  if (g_bgLoad > 0)
+  {
+    uint64_t frameUs = (uint64_t)VCAN::frameBits(CanMsg(CanStandardId(0x7FF), 8, nullptr)) * 1000000ULL / VCAN::bitrate();
+    g_bgPeriod = (uint64_t)(frameUs / g_bgLoad);
+    g_bgNext   = t0;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// report
+// ----------------------------------------------------------------------------
+static void printLat(const char* name, LatStats& l, uint32_t inFlight)
+{
+  printf("[E2E] %-8s n=%zu", name, l.us.size());
+  if (!l.us.empty())
+  {
+    std::sort(l.us.begin(), l.us.end());
+    auto pct = [&](double p) { return l.us[(size_t)(p * (l.us.size() - 1))] / 1000.0; };
+    printf("  p50=%.2f p90=%.2f p99=%.2f max=%.2f ms", pct(0.50), pct(0.90), pct(0.99), l.us.back() / 1000.0);
+  }
+  printf("  persi=%u in_volo=%u\n", l.lost, inFlight);
+  if (l.us.empty()) return;
+
+  static const double EDGE_MS[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+  constexpr size_t N = sizeof(EDGE_MS) / sizeof(EDGE_MS[0]);
+  size_t cnt[N + 1] = {};
+  for (uint32_t us : l.us)
+  {
+    size_t b = 0;
+    while (b < N && us / 1000.0 >= EDGE_MS[b]) b++;
+    cnt[b]++;
+  }
+  printf("      ");
+  for (size_t b = 0; b <= N; ++b)
+  {
+    if (!cnt[b]) continue;
+    if (b < N) printf(" <%g:%zu", EDGE_MS[b], cnt[b]);
+    else       printf(" >=%g:%zu", EDGE_MS[N - 1], cnt[b]);
+  }
+  printf("  (ms)\n");
+}
+
+static void printSimReport(double secs)
+{
+  const VCAN::Stats&    c  = VCAN::stats();
+  const CANM::TxStats&  tx = CANM::txStats();
+  const RTUSIM::Stats&  s  = RTUSIM::stats();
+
+  printf("\n[SIM] %.3f s simulati  CAN %ld bit/s  linee RTU %u  SD %s\n",
+         secs, VCAN::bitrate(), (unsigned)g_rtu.lines.size(), SD.root.c_str());
+  printf("[CAN] carico %.1f%%  gateway tx=%u (%.1f/s) rx=%u  rete tx=%u (comandi %u, fondo %u)\n",
+         100.0 * c.busyUs / (secs * 1e6), c.gwTx, c.gwTx / secs, c.gwRx, c.peerTx, g_cmdSent, g_bgSent);
+  printf("[CAN] persi: buffer RX gateway=%u  coda TX piena=%u  tentativi esauriti=%u  (mailbox occupate=%u, shaped=%u)\n",
+         c.rxOverflow, tx.dropsFull, tx.dropsRetry, c.mailboxFull, tx.shaped);
+  printf("[RTU] richieste=%u (%.1f/s) risposte=%u  senza risposta=%u eccezioni=%u crc=%u\n",
+         s.requests, s.requests / secs, s.responses, s.dropped, s.exceptions, s.crcErrors);
+  for (auto& l : g_rtu.lines)
+  {
+    const HardwareSerial* port = MBM::portByName(l.port);
+    if (!port) continue;
+    printf("[RTU] linea %s (%s, %u baud) carico %.1f%%  byte persi con DE alto=%u\n",
+           l.name.c_str(), l.port.c_str(), (unsigned)port->baud(),
+           100.0 * port->busyUs() / (secs * 1e6), port->deafBytes());
+  }
+
+  printf("[CPU] loop=%u us/passata  Serial %u byte, bloccato %.1f ms  SD %u accessi, %.1f ms\n",
+         g_loopUs, (unsigned)Serial.bytes(), Serial.blockedUs() / 1000.0,
+         SD.ops, SD.busyUs / 1000.0);
+
+  const GRP::Stats& g = GRP::stats();
+  if (g.commands || g.rejected)
+  {
+    printf("[GRP] comandi=%u rifiutati=%u senza conferma=%u verifiche=%u diverse=%u riscritture=%u\n",
+           g.commands, g.rejected, g.failed, g.verifies, g.mismatches, g.repairs);
+  }
+
+  uint32_t pend = 0, changes = 0, unseen = 0;
+  for (auto& r : g_simRes)
+  {
+    pend    += (uint32_t)r.pending.size();
+    changes += r.changes;
+    unseen  += (r.unseen || r.observed) ? 1 : 0;
+  }
+  uint32_t done = (uint32_t)g_can2mb.us.size();
+  printf("[E2E] throughput: comandi CAN->MB %.1f/s, frame MB->CAN %.1f/s, variazioni slave %u\n",
+         done / secs, g_mb2canRx / secs, changes);
+  printLat("CAN->MB", g_can2mb, pend);
+  printLat("MB->CAN", g_mb2can, unseen);
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+  unsigned long seed = 1;
+  bool ok = true;
+  for (int i = 1; i < argc && ok; ++i)
+  {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if      (!strcmp(a, "-j") && v) { g_simJson = v; i++; }
+    else if (!strcmp(a, "-t") && v) { g_simSecs = atof(v); i++; }
+    else if (!strcmp(a, "-b") && v) { g_bgLoad = atof(v) / 100.0; i++; }
+    else if (!strcmp(a, "-v") && v) { g_changeHz = atof(v); i++; }
+    else if (!strcmp(a, "-d") && v) { g_slaveCfg.dropPm = (uint16_t)atoi(v); i++; }
+    else if (!strcmp(a, "-s") && v) { seed = strtoul(v, nullptr, 0); i++; }
+    else if (!strcmp(a, "-L") && v) { g_loopUs = (uint32_t)strtoul(v, nullptr, 0); i++; }
+    else if (!strcmp(a, "-l") && v)
+    {
+      g_slaveCfg.turnUs = (uint32_t)strtoul(v, nullptr, 0);
+      const char* j = strchr(v, ':');
+      if (j) g_slaveCfg.jitterUs = (uint32_t)strtoul(j + 1, nullptr, 0);
+      i++;
+    }
+    else if (!strcmp(a, "-c") && v)
+    {
+      CmdStream c;
+      char* end;
+      c.id = (uint32_t)strtoul(v, &end, 0);
+      c.hz = *end == ':' ? atof(end + 1) : 0;
+      ok = c.hz > 0;
+      g_cmds.push_back(c);
+      i++;
+    }
+    else if (!strcmp(a, "-V")) g_simVerbose = true;
+    else ok = false;
+  }
+  if (!ok || g_simSecs <= 0 || g_bgLoad < 0 || g_bgLoad >= 1)
+  {
+    fprintf(stderr, "uso: %s [-j dir_json] [-t secondi] [-c id:hz]... [-b carico%%] [-v hz]\n"
+                    "          [-l us[:jitter_us]] [-d permille] [-L us_per_loop] [-s seed] [-V]\n", argv[0]);
+    return 2;
+  }
+
+  randomSeed(seed);
+  if (!prepareSd()) return 1;
+
+  hostSimClock(true);
+  hostSetWakeup(nextEvent);
+  hostSerialMute(!g_simVerbose);
+  hostOnPinWrite(simPinWrite);
+  VCAN::onGatewayRx(onGwRx);
+  VCAN::onPeerRx(onPeerRx);
+
+  // su ogni linea gli slave che il master interroga, dalla stessa configurazione
+  setup();
+  for (auto& l : g_rtu.lines)
+  {
+    HardwareSerial* port = MBM::portByName(l.port);
+    if (!port) continue;
+    port->setDePin(l.de_re_pin);
+    RTUSIM::Config cfg = g_slaveCfg;
+    cfg.id = l.slave_id;
+    RTUSIM::begin(*port, cfg, slaveBefore, slaveServed);
+    for (auto& r : g_mbRes)
+    {
+      if (r.local || !r.slave_id || &g_rtu.lines[r.line] != &l) continue;
+      cfg.id = r.slave_id;
+      RTUSIM::begin(*port, cfg, slaveBefore, slaveServed);
+    }
+    for (auto& r : g_rules)
+    {
+      if (!r.group.active() || &g_rtu.lines[r.toModbus->line] != &l) continue;
+      for (uint8_t id : r.group.slaves)
+      {
+        cfg.id = id;
+        RTUSIM::begin(*port, cfg, slaveBefore, slaveServed);
+      }
+    }
+  }
+
+  uint64_t t0 = hostNowUs();
+  prepareTraffic(t0);
+  VCAN::setPeerSource(peerPull, peerPeek);
+
+  uint64_t end = t0 + (uint64_t)(g_simSecs * 1e6);
+  while (hostNowUs() < end)
+  {
+    loop();
+    hostCharge(g_loopUs);
+  }
+  VCAN::advance(hostNowUs());
+
+  hostSerialMute(false);
+  printSimReport((hostNowUs() - t0) / 1e6);
+  return 0;
+}
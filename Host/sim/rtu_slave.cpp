@@ -0,0 +1,183 @@
+#include "rtu_slave.h"
+#include <rtu_codec.h>
+#include <vector>
+
+namespace RTUSIM {
+
+static std::vector<uint16_t> s_hreg(65536), s_ireg(65536);
+static std::vector<uint8_t>  s_coil(65536), s_disc(65536);
+
+static Stats           s_stats;
+static BeforeFn        s_before = nullptr;
+static ServedFn        s_served = nullptr;
+
+// uno per porta: gli slave della stessa linea ne condividono i tempi
+class Device : public UartDevice {
+public:
+  HardwareSerial* port = nullptr;
+  Config          cfg;
+  bool            ids[256] = {};
+  uint8_t         buf[RTU::FRAME_MAX];
+  uint16_t        len     = 0;
+  uint64_t        lastEnd = 0;
+
+  void onByte(uint8_t b, uint64_t endUs) override;
+};
+
+static std::vector<Device*> s_devs;
+
+static bool inMap(uint16_t addr, uint16_t qty)
+{
+  return (uint32_t)addr + qty <= 65536UL;
+}
+
+// risposta in d.buf; 0 = nessuna (broadcast)
+static uint16_t serve(Device& d, bool bcast, uint64_t atUs)
+{
+  uint8_t* buf = d.buf;
+  const uint8_t  fc   = buf[1];
+  const uint16_t addr = RTU::get16(buf + 2);
+  const uint16_t qty  = RTU::get16(buf + 4);
+  uint8_t ex = 0;
+
+  switch (fc)
+  {
+    case RTU::FC_READ_COILS:
+    case RTU::FC_READ_DISCRETE:
+    {
+      if (bcast) return 0;
+      if (qty < 1 || qty > 2000) { ex = RTU::EX_ILLEGAL_VALUE;   break; }
+      if (!inMap(addr, qty))     { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      if (s_before) s_before(atUs);
+      const uint8_t* src = (fc == RTU::FC_READ_COILS ? s_coil : s_disc).data() + addr;
+      uint8_t bytes = (uint8_t)((qty + 7) / 8);
+      buf[2] = bytes;
+      memset(buf + 3, 0, bytes);
+      for (uint16_t i = 0; i < qty; ++i)
+      {
+        if (src[i]) buf[3 + i / 8] |= (uint8_t)(1 << (i % 8));
+      }
+      return RTU::seal(buf, (uint16_t)(3 + bytes));
+    }
+
+    case RTU::FC_READ_HOLDING:
+    case RTU::FC_READ_INPUT:
+    {
+      if (bcast) return 0;
+      if (qty < 1 || qty > 125)  { ex = RTU::EX_ILLEGAL_VALUE;   break; }
+      if (!inMap(addr, qty))     { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      if (s_before) s_before(atUs);
+      const uint16_t* src = (fc == RTU::FC_READ_HOLDING ? s_hreg : s_ireg).data() + addr;
+      buf[2] = (uint8_t)(2 * qty);
+      for (uint16_t i = 0; i < qty; ++i) RTU::put16(buf + 3 + 2 * i, src[i]);
+      return RTU::seal(buf, (uint16_t)(3 + 2 * qty));
+    }
+
+    case RTU::FC_WRITE_COIL:
+      if (qty != 0xFF00 && qty != 0x0000) { ex = RTU::EX_ILLEGAL_VALUE; break; }
+      s_coil[addr] = qty == 0xFF00;
+      return bcast ? 0 : 8;   // eco della richiesta
+
+    case RTU::FC_WRITE_SINGLE:
+      s_hreg[addr] = qty;
+      return bcast ? 0 : 8;
+
+    case RTU::FC_WRITE_COILS:
+      if (qty < 1 || buf[6] != (qty + 7) / 8) { ex = RTU::EX_ILLEGAL_VALUE;   break; }
+      if (!inMap(addr, qty))                    { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      for (uint16_t i = 0; i < qty; ++i) s_coil[addr + i] = (buf[7 + i / 8] >> (i % 8)) & 1;
+      return bcast ? 0 : RTU::seal(buf, 6);
+
+    case RTU::FC_WRITE_MULTIPLE:
+      if (qty < 1 || buf[6] != 2 * qty) { ex = RTU::EX_ILLEGAL_VALUE;   break; }
+      if (!inMap(addr, qty))              { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      for (uint16_t i = 0; i < qty; ++i) s_hreg[addr + i] = RTU::get16(buf + 7 + 2 * i);
+      return bcast ? 0 : RTU::seal(buf, 6);
+
+    default:
+      ex = RTU::EX_ILLEGAL_FUNCTION;
+      break;
+  }
+  if (bcast) return 0;
+  s_stats.exceptions++;
+  return RTU::buildException(buf, buf[0], fc, ex);
+}
+
+static void handle(Device& d, uint16_t n, uint64_t endUs)
+{
+  if (!RTU::crcOk(d.buf, n))
+  {
+    s_stats.crcErrors++;
+    return;
+  }
+  const uint8_t id = d.buf[0];
+  if (id != 0 && !d.ids[id]) return;
+  s_stats.requests++;
+
+  const uint8_t  fc   = d.buf[1];
+  const uint16_t addr = RTU::get16(d.buf + 2);
+  const uint16_t qty  = RTU::get16(d.buf + 4);
+
+  const Config& c = d.cfg;
+  uint64_t rspUs = endUs + c.turnUs + (c.jitterUs ? (uint64_t)random((long)c.jitterUs + 1) : 0);
+  uint16_t len   = serve(d, id == 0, rspUs);
+  if (len && c.dropPm && random(1000) < c.dropPm)
+  {
+    s_stats.dropped++;
+    len = 0;
+  }
+  if (!len)
+  {
+    if (s_served) s_served(*d.port, id, fc, addr, qty, endUs, 0);
+    return;
+  }
+
+  for (uint16_t i = 0; i < len; ++i) d.port->deliver(d.buf[i], rspUs);
+  s_stats.responses++;
+  if (s_served) s_served(*d.port, id, fc, addr, qty, endUs, rspUs);
+}
+
+void Device::onByte(uint8_t b, uint64_t endUs)
+{
+  // silenzio oltre t3.5 tra due byte: nuovo frame
+  uint32_t t35 = port->baud() > 19200 ? 1750 : port->charUs() * 7 / 2;
+  if (len && endUs - lastEnd > (uint64_t)t35 + port->charUs()) len = 0;
+  lastEnd = endUs;
+  if (len < sizeof(buf)) buf[len++] = b;
+
+  uint16_t need = RTU::requestLen(buf, len);
+  // funzione sconosciuta: sul target si chiude sul silenzio, qui a 8 byte
+  if ((need && len >= need) || (!need && len >= 8))
+  {
+    handle(*this, need ? need : len, endUs);
+    len = 0;
+  }
+}
+
+void begin(HardwareSerial& port, const Config& cfg, BeforeFn before, ServedFn served)
+{
+  s_before = before;
+  s_served = served;
+
+  Device* d = nullptr;
+  for (Device* o : s_devs) if (o->port == &port) d = o;
+  if (!d)
+  {
+    d = new Device();
+    d->port = &port;
+    s_devs.push_back(d);
+    port.attach(d);
+  }
+  d->cfg = cfg;
+  d->ids[cfg.id] = true;
+  d->len = 0;
+}
+
+uint16_t* holding()  { return s_hreg.data(); }
+uint16_t* input()    { return s_ireg.data(); }
+uint8_t*  coils()    { return s_coil.data(); }
+uint8_t*  discrete() { return s_disc.data(); }
+
+const Stats& stats() { return s_stats; }
+
+} // namespace RTUSIM
@@ -0,0 +1,45 @@
+#pragma once
+// =============================================================================
+// Slave Modbus RTU simulati all'altro capo delle UART del gateway. Ricevono
+// i byte con i loro tempi di linea, chiudono la richiesta alla lunghezza
+// attesa e rispondono dopo un turnaround configurabile, un carattere alla
+// volta al baud della porta. Una begin() per slave: piu' id sulla stessa
+// porta condividono la linea (e l'ultima Config). Tutti vedono la stessa
+// mappa completa (65536 indirizzi) per holding, input, coil e discrete; il
+// broadcast (id 0) scrive senza risposta.
+// =============================================================================
+#include <Arduino.h>
+
+namespace RTUSIM {
+
+struct Config {
+  uint8_t  id       = 1;
+  uint32_t turnUs   = 1000;   // fine richiesta -> primo byte di risposta
+  uint32_t jitterUs = 0;      // + uniforme 0..jitterUs
+  uint16_t dropPm   = 0;      // richieste lasciate senza risposta, per mille
+};
+
+struct Stats {
+  uint32_t requests   = 0;
+  uint32_t responses  = 0;
+  uint32_t dropped    = 0;
+  uint32_t exceptions = 0;
+  uint32_t crcErrors  = 0;
+};
+
+// Prima di servire una lettura: porta i valori simulati all'istante atUs
+typedef void (*BeforeFn)(uint64_t atUs);
+// Richiesta servita: rspUs = inizio della risposta (0 = nessuna risposta)
+typedef void (*ServedFn)(const HardwareSerial& port, uint8_t id, uint8_t fc, uint16_t addr, uint16_t qty,
+                         uint64_t reqEndUs, uint64_t rspUs);
+
+void begin(HardwareSerial& port, const Config& cfg, BeforeFn before, ServedFn served);
+
+uint16_t* holding();
+uint16_t* input();
+uint8_t*  coils();      // un byte per bit
+uint8_t*  discrete();
+
+const Stats& stats();
+
+} // namespace RTUSIM
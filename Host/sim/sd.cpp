@@ -0,0 +1,74 @@
+#include "SD.h"
+#include <sys/stat.h>
+
+SDClass SD;
+
+void simSdCharge(uint32_t us)
+{
+  SD.ops++;
+  SD.busyUs += us;
+  hostCharge(us);
+}
+
+int File::available()
+{
+  if (!f_) return 0;
+  long p = ftell(f_);
+  return (int)(size() - (uint32_t)p);
+}
+
+int File::read()
+{
+  if (!f_) return -1;
+  int c = fgetc(f_);
+  return c == EOF ? -1 : c;
+}
+
+int File::peek()
+{
+  int c = read();
+  if (c >= 0) ungetc(c, f_);
+  return c;
+}
+
+String File::readString()
+{
+  std::string s;
+  int c;
+  while ((c = read()) >= 0) s += (char)c;
+  return String(s);
+}
+
+uint32_t File::size()
+{
+  if (!f_) return 0;
+  long p = ftell(f_);
+  fseek(f_, 0, SEEK_END);
+  long e = ftell(f_);
+  fseek(f_, p, SEEK_SET);
+  return (uint32_t)e;
+}
+
+std::string SDClass::hostPath(const char* path) const
+{
+  return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+File SDClass::open(const char* path, uint8_t mode)
+{
+  simSdCharge(SIMSD_OPEN_US);
+  return File(fopen(hostPath(path).c_str(), mode == FILE_READ ? "rb" : "ab+"));
+}
+
+bool SDClass::exists(const char* path)
+{
+  simSdCharge(SIMSD_OPEN_US);
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool SDClass::remove(const char* path)
+{
+  simSdCharge(SIMSD_OPEN_US);
+  return ::remove(hostPath(path).c_str()) == 0;
+}
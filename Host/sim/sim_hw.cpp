@@ -0,0 +1,103 @@
+#include <Arduino.h>
+
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+
+void HardwareSerial::begin(unsigned long baud, uint16_t config)
+{
+  uint8_t bits = 1 + 8 + ((config & 0x30) ? 1 : 0) + ((config & 0x08) ? 2 : 1);
+  baud_   = baud ? (uint32_t)baud : 9600;
+  charUs_ = (uint32_t)((bits * 1000000ULL + baud_ - 1) / baud_);
+  rx_.clear();
+  txFree_ = rxFree_ = hostNowUs();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  uint64_t now   = hostNowUs();
+  uint64_t start = txFree_ > now ? txFree_ : now;
+  txFree_  = start + charUs_;
+  busyUs_ += charUs_;
+  if (dev_) dev_->onByte(c, txFree_);
+  return 1;
+}
+
+void HardwareSerial::flush()
+{
+  hostAdvanceTo(txFree_);
+}
+
+int HardwareSerial::available()
+{
+  uint64_t now = hostNowUs();
+  int n = 0;
+  for (const RxByte& r : rx_)
+  {
+    if (r.t > now) break;
+    n++;
+  }
+  return n;
+}
+
+int HardwareSerial::read()
+{
+  if (rx_.empty() || rx_.front().t > hostNowUs()) return -1;
+  uint8_t b = rx_.front().b;
+  rx_.pop_front();
+  return b;
+}
+
+int HardwareSerial::peek()
+{
+  if (rx_.empty() || rx_.front().t > hostNowUs()) return -1;
+  return rx_.front().b;
+}
+
+uint64_t HardwareSerial::deliver(uint8_t b, uint64_t startUs)
+{
+  uint64_t start = rxFree_ > startUs ? rxFree_ : startUs;
+  rxFree_  = start + charUs_;
+  busyUs_ += charUs_;
+  rx_.push_back({ b, rxFree_ });
+  return rxFree_;
+}
+
+// DE basso: i byte che si sovrappongono all'intervallo con DE alto non sono
+// mai arrivati alla UART
+void HardwareSerial::onDe(uint8_t level)
+{
+  uint64_t now = hostNowUs();
+  if (level)
+  {
+    if (!deHigh_) deFrom_ = now;
+    deHigh_ = true;
+    return;
+  }
+  if (!deHigh_) return;
+  deHigh_ = false;
+  for (auto it = rx_.begin(); it != rx_.end();)
+  {
+    bool overlap = it->t > deFrom_ && it->t - charUs_ < now;
+    if (!overlap) { ++it; continue; }
+    it = rx_.erase(it);
+    deafBytes_++;
+  }
+}
+
+void simPinWrite(uint8_t pin, uint8_t val)
+{
+  for (HardwareSerial* p : { &Serial1, &Serial2 })
+  {
+    if (p->dePin() == pin) p->onDe(val);
+  }
+}
+
+uint64_t HardwareSerial::nextRxUs() const
+{
+  uint64_t now = hostNowUs();
+  for (const RxByte& r : rx_)
+  {
+    if (r.t > now) return r.t;
+  }
+  return 0;
+}
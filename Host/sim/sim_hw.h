@@ -0,0 +1,87 @@
+#pragma once
+// =============================================================================
+// sim_hw.h — UART simulata per gw_sim (inclusa dallo shim Arduino.h quando
+// si compila con GW_HOST_SIM).
+//
+// Ogni carattere occupa la linea per 1 + 8 + parita' + stop bit al baud di
+// begin(): write() mette i byte sul filo uno dopo l'altro, flush() porta
+// l'orologio simulato alla fine dell'ultimo bit, available()/read() vedono
+// solo i byte il cui ultimo bit e' gia' arrivato. All'altro capo della linea
+// c'e' un UartDevice (lo slave RTU simulato) che risponde con deliver().
+// Con setDePin() la porta segue il DE/RE del transceiver: i byte in arrivo
+// mentre DE e' alto (ricevitore del MAX485 spento) si perdono e si contano.
+// =============================================================================
+#include <deque>
+
+// stessi valori del core Arduino (bit 3 = 2 stop, bit 4..5 = parita')
+#define SERIAL_8N1 0x06
+#define SERIAL_8N2 0x0E
+#define SERIAL_8E1 0x26
+#define SERIAL_8E2 0x2E
+#define SERIAL_8O1 0x36
+#define SERIAL_8O2 0x3E
+
+class UartDevice {
+public:
+  virtual ~UartDevice() {}
+  // byte trasmesso dal gateway, ultimo bit sulla linea a endUs
+  virtual void onByte(uint8_t b, uint64_t endUs) = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud, uint16_t config = SERIAL_8N1);
+  void end() {}
+  explicit operator bool() const { return true; }
+
+  size_t write(uint8_t c) override;
+  using Print::write;
+  int  available() override;
+  int  read() override;
+  int  peek() override;
+  void flush() override;
+
+  // ----- lato simulatore -----
+  void attach(UartDevice* dev) { dev_ = dev; }
+
+  // byte verso il gateway: parte non prima di startUs ne' prima della fine
+  // del byte precedente; ritorna l'istante del suo ultimo bit
+  uint64_t deliver(uint8_t b, uint64_t startUs);
+
+  uint32_t charUs() const { return charUs_; }
+  uint32_t baud() const   { return baud_; }
+
+  // arrivo del prossimo byte non ancora visibile (0 = nessuno)
+  uint64_t nextRxUs() const;
+
+  // tempo di linea occupato nelle due direzioni
+  uint64_t busyUs() const { return busyUs_; }
+
+  // pin DE/RE del transceiver di questa porta; byte persi con DE alto
+  void     setDePin(uint8_t pin) { dePin_ = pin; }
+  uint8_t  dePin() const         { return dePin_; }
+  void     onDe(uint8_t level);
+  uint32_t deafBytes() const     { return deafBytes_; }
+
+private:
+  struct RxByte { uint8_t b; uint64_t t; };
+  std::deque<RxByte> rx_;
+  UartDevice* dev_     = nullptr;
+  uint32_t    baud_    = 9600;
+  uint32_t    charUs_  = 1042;
+  uint64_t    txFree_  = 0;   // fine dell'ultimo byte trasmesso dal gateway
+  uint64_t    rxFree_  = 0;   // fine dell'ultimo byte consegnato al gateway
+  uint64_t    busyUs_  = 0;
+  uint8_t     dePin_   = 0xFF;
+  bool        deHigh_  = false;
+  uint64_t    deFrom_  = 0;   // DE alto da
+  uint32_t    deafBytes_ = 0;
+};
+
+// due UART per le linee RTU del master (modbus.json "lines")
+#define MBM_HAVE_SERIAL2 1
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+// digitalWrite() del firmware (hostOnPinWrite): DE/RE delle porte simulate
+void simPinWrite(uint8_t pin, uint8_t val);
@@ -0,0 +1,243 @@
+#include "Arduino_CAN.h"
+#include <deque>
+#include <vector>
+
+SimCan CAN;
+
+namespace VCAN {
+
+enum Node : uint8_t { GATEWAY = 0, PEER = 1 };
+
+struct Pending {
+  CanMsg   m;
+  uint64_t ready;
+  uint8_t  node;
+};
+
+static long                 s_bitrate = 500000;
+static std::vector<Pending> s_mailbox;        // gateway, al piu' VCAN_TX_MAILBOXES
+static std::vector<Pending> s_peer;           // resto della rete
+static std::deque<CanMsg>   s_rx;             // buffer RX del gateway
+static bool     s_busy    = false;
+static Pending  s_cur;
+static uint64_t s_curEnd  = 0;
+static uint64_t s_busFree = 0;
+static Stats    s_stats;
+
+static void     (*s_pull)(uint64_t) = nullptr;
+static uint64_t (*s_peek)()         = nullptr;
+static void     (*s_peerRx)(const CanMsg&, uint64_t) = nullptr;
+static void     (*s_gwRx)(const CanMsg&, uint64_t, bool) = nullptr;
+
+// CRC-15 CAN (poly 0x4599) su un bit alla volta
+static uint16_t crc15(const uint8_t* bits, uint16_t n)
+{
+  uint16_t crc = 0;
+  for (uint16_t i = 0; i < n; ++i)
+  {
+    bool nxt = bits[i] ^ ((crc >> 14) & 1);
+    crc = (uint16_t)((crc << 1) & 0x7FFF);
+    if (nxt) crc ^= 0x4599;
+  }
+  return crc;
+}
+
+uint16_t frameBits(const CanMsg& m)
+{
+  uint8_t  bits[160];
+  uint16_t n = 0;
+  auto put = [&](uint32_t v, uint8_t w) {
+    while (w--) bits[n++] = (v >> w) & 1;
+  };
+
+  put(0, 1);                                   // SOF
+  if (m.isExtendedId())
+  {
+    uint32_t id = m.getExtendedId();
+    put(id >> 18, 11);
+    put(1, 1);                                 // SRR
+    put(1, 1);                                 // IDE
+    put(id & 0x3FFFF, 18);
+    put(0, 1);                                 // RTR (frame dati)
+    put(0, 2);                                 // r1 r0
+  } else
+  {
+    put(m.getStandardId(), 11);
+    put(0, 1);                                 // RTR
+    put(0, 1);                                 // IDE
+    put(0, 1);                                 // r0
+  }
+  put(m.data_length, 4);
+  for (uint8_t i = 0; i < m.data_length; ++i) put(m.data[i], 8);
+  put(crc15(bits, n), 15);
+
+  // un bit di stuffing dopo 5 uguali (SOF..CRC), che apre la serie successiva
+  uint16_t stuff = 0;
+  uint8_t  prev  = bits[0];
+  uint8_t  run   = 1;
+  for (uint16_t i = 1; i < n; ++i)
+  {
+    if (bits[i] == prev) run++;
+    else { prev = bits[i]; run = 1; }
+    if (run == 5)
+    {
+      stuff++;
+      prev ^= 1;
+      run = 1;
+    }
+  }
+  return (uint16_t)(n + stuff + 13);           // + delimitatore CRC, ACK 2, EOF 7, IFS 3
+}
+
+// ordine di arbitraggio: id base, poi SRR/IDE (lo standard vince), poi id esteso
+static uint32_t arbKey(const CanMsg& m)
+{
+  if (!m.isExtendedId()) return m.getStandardId() << 19;
+  uint32_t id = m.getExtendedId();
+  return ((id >> 18) << 19) | (1UL << 18) | (id & 0x3FFFF);
+}
+
+static void complete(const Pending& p, uint64_t endUs)
+{
+  if (p.node == GATEWAY)
+  {
+    s_stats.gwTx++;
+    if (s_peerRx) s_peerRx(p.m, endUs);
+    return;
+  }
+  s_stats.peerTx++;
+  bool dropped = s_rx.size() >= VCAN_RX_DEPTH;
+  if (dropped) s_stats.rxOverflow++;
+  else         s_rx.push_back(p.m);
+  if (s_gwRx) s_gwRx(p.m, endUs, dropped);
+}
+
+// il prossimo frame pronto in una delle due code: ready minimo
+static bool earliest(uint64_t& t)
+{
+  bool any = false;
+  for (auto* q : { &s_mailbox, &s_peer })
+  {
+    for (const Pending& p : *q)
+    {
+      if (!any || p.ready < t) t = p.ready;
+      any = true;
+    }
+  }
+  return any;
+}
+
+void advance(uint64_t nowUs)
+{
+  if (s_pull) s_pull(nowUs);
+  for (;;)
+  {
+    if (s_busy)
+    {
+      if (s_curEnd > nowUs) return;
+      s_busy    = false;
+      s_busFree = s_curEnd;
+      complete(s_cur, s_curEnd);
+    }
+
+    uint64_t t;
+    if (!earliest(t)) return;
+    uint64_t start = t > s_busFree ? t : s_busFree;
+    if (start > nowUs) return;
+
+    // arbitraggio tra tutti i frame pronti all'inizio dello slot
+    std::vector<Pending>* bestQ = nullptr;
+    size_t   best    = 0;
+    uint32_t bestKey = 0;
+    for (auto* q : { &s_mailbox, &s_peer })
+    {
+      for (size_t i = 0; i < q->size(); ++i)
+      {
+        const Pending& p = (*q)[i];
+        if (p.ready > start) continue;
+        uint32_t k = arbKey(p.m);
+        if (!bestQ || k < bestKey) { bestQ = q; best = i; bestKey = k; }
+      }
+    }
+    s_cur = (*bestQ)[best];
+    bestQ->erase(bestQ->begin() + best);
+
+    uint64_t us = ((uint64_t)frameBits(s_cur.m) * 1000000ULL + s_bitrate - 1) / s_bitrate;
+    s_busy   = true;
+    s_curEnd = start + us;
+    s_stats.busyUs += us;
+  }
+}
+
+uint64_t nextEventUs()
+{
+  uint64_t next = 0;
+  auto take = [&](uint64_t t) { if (t && (!next || t < next)) next = t; };
+
+  if (s_busy)
+  {
+    take(s_curEnd);
+  } else
+  {
+    uint64_t t;
+    if (earliest(t)) take(t > s_busFree ? t : s_busFree);
+  }
+  if (s_peek) take(s_peek());
+  return next;
+}
+
+void peerSend(const CanMsg& m, uint64_t readyUs)
+{
+  s_peer.push_back({ m, readyUs, PEER });
+}
+
+void setPeerSource(void (*pull)(uint64_t), uint64_t (*peek)())
+{
+  s_pull = pull;
+  s_peek = peek;
+}
+
+void onPeerRx(void (*fn)(const CanMsg&, uint64_t))           { s_peerRx = fn; }
+void onGatewayRx(void (*fn)(const CanMsg&, uint64_t, bool))  { s_gwRx = fn; }
+
+long bitrate()             { return s_bitrate; }
+const Stats& stats()       { return s_stats; }
+
+} // namespace VCAN
+
+// ----- API Arduino_CAN lato gateway -----
+bool SimCan::begin(long bitrate)
+{
+  if (bitrate <= 0) return false;
+  VCAN::s_bitrate = bitrate;
+  VCAN::s_busFree = hostNowUs();
+  return true;
+}
+
+int SimCan::write(const CanMsg& msg)
+{
+  VCAN::advance(hostNowUs());
+  if (VCAN::s_mailbox.size() >= VCAN_TX_MAILBOXES)
+  {
+    VCAN::s_stats.mailboxFull++;
+    return -1;
+  }
+  VCAN::s_mailbox.push_back({ msg, hostNowUs(), VCAN::GATEWAY });
+  return 1;
+}
+
+size_t SimCan::available()
+{
+  VCAN::advance(hostNowUs());
+  return VCAN::s_rx.size();
+}
+
+CanMsg SimCan::read()
+{
+  VCAN::advance(hostNowUs());
+  if (VCAN::s_rx.empty()) return CanMsg();
+  CanMsg m = VCAN::s_rx.front();
+  VCAN::s_rx.pop_front();
+  VCAN::s_stats.gwRx++;
+  return m;
+}
@@ -0,0 +1,678 @@
+// =============================================================================
+// gw_tests — controlli su host dei moduli del gateway, in tempo simulato
+// (stessi stub di gw_sim: bus CAN virtuale, UART e slave RTU simulati, SD in
+// una cartella temporanea). Ogni test usa direttamente l'API del modulo;
+// l'ultimo passa da setup() e handleCanFrame() dello sketch.
+//
+// Coperti:
+//   XF     limiti di parse/emit (catene x+x+..., annidamento), tipi, clamp
+//   RTU    CRC16 tabellare contro bit a bit, parseResponse
+//   PLN    tempi di linea, carico, plan() sul budget, periodo adattivo
+//   CANM   token bucket dello shaper per id e sul totale
+//   WARM   CRC32 della chiave, scelta della copia piu' recente e valida
+//   MBM    promoteRead() porta in testa la lettura accodata
+//   GRP    broadcast, verifica e riscrittura dello slave divergente
+//   CAPM   drop contati nell'header del blocco che li segue
+//   sketch CAN2MB su risorsa local con mapping parziale: i campi non
+//          mappati restano quelli dell'immagine
+//
+// Build (dalla root del repo, Arduino_JSON = cartella della libreria):
+//   g++ -O2 -std=c++17 -DGW_HOST_SIM -IHost/sim -IHost/compat -IGateway_CAN-MODBUS
+//       -Ilibraries/GatewayCommon/src -I$Arduino_JSON/src
+//       Host/tests/gw_tests.cpp Host/sim/rtu_slave.cpp Host/sim/sd.cpp
+//       Host/sim/sim_hw.cpp Host/sim/vcan.cpp Host/compat/Arduino.cpp
+//       Gateway_CAN-MODBUS/*.cpp
+//       $Arduino_JSON/src/*.cpp $Arduino_JSON/src/cjson/cJSON.c -o gw_tests
+//
+// Uso:
+//   gw_tests [-V]        exit 0 se tutti i controlli passano, -V = log dei moduli
+// =============================================================================
+#include "Gateway_CAN-MODBUS.ino"
+#include "rtu_slave.h"
+#include "rtu_codec.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+static int g_checks = 0;
+static int g_fails  = 0;
+
+#define CHECK(c) do { g_checks++; if (!(c)) { g_fails++; \
+  fprintf(stderr, "%s:%d: FALLITO %s\n", __FILE__, __LINE__, #c); } } while (0)
+
+// SD simulata in una cartella temporanea nuova
+static bool freshSd()
+{
+  char dir[] = "/tmp/gw_testsXXXXXX";
+  if (!mkdtemp(dir)) { perror("mkdtemp"); return false; }
+  SD.root = dir;
+  return true;
+}
+
+static bool writeSdFile(const char* path, const std::string& text)
+{
+  FILE* f = fopen((SD.root + path).c_str(), "wb");
+  if (!f) return false;
+  fwrite(text.data(), 1, text.size(), f);
+  fclose(f);
+  return true;
+}
+
+// avanza l'orologio a passi di stepUs chiamando step() a ogni passo
+static void runFor(uint32_t ms, void (*step)(), uint32_t stepUs = 100)
+{
+  uint64_t end = hostNowUs() + (uint64_t)ms * 1000;
+  while (hostNowUs() < end)
+  {
+    step();
+    hostAdvanceTo(hostNowUs() + stepUs);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// XF
+// ----------------------------------------------------------------------------
+static bool xfResolve(void*, const char* name, uint8_t len, uint8_t& var, XF::VType& type)
+{
+  if (len != 1 || name[0] != 'x') return false;
+  var  = 0;
+  type = XF::VType::Int;
+  return true;
+}
+
+static bool xfCompile(const std::string& expr, XF::Program& p, String& err)
+{
+  return XF::compile(expr.c_str(), xfResolve, nullptr, p, err);
+}
+
+static std::string xfChain(unsigned terms)
+{
+  std::string s = "x";
+  for (unsigned i = 1; i < terms; ++i) s += "+x";
+  return s;
+}
+
+static void testTransform()
+{
+  XF::Program p;
+  String err;
+  XF::Slot in[1];
+
+  CHECK(xfCompile("clamp(x, 0, 100)", p, err));
+  in[0].i = 150;
+  CHECK(XF::run(p, in).i == 100);
+  in[0].i = -3;
+  CHECK(XF::run(p, in).i == 0);
+
+  uint8_t var = 0xFF;
+  CHECK(xfCompile("x*1+0", p, err) && XF::isPlainLoad(p, var) && var == 0);
+
+  CHECK(xfCompile("x*1.5", p, err) && p.result == XF::VType::Float);
+  in[0].i = 4;
+  CHECK(XF::run(p, in).f == 6.0f);
+  CHECK(!xfCompile("x*1.5 & 3", p, err));
+
+  // catena sinistra: n termini = 2n-1 nodi, stack di 2 posti
+  CHECK(xfCompile(xfChain(32), p, err));
+  in[0].i = 7;
+  CHECK(XF::run(p, in).i == 32 * 7);
+  CHECK(p.maxStack <= XF_MAX_STACK);
+
+  err = "";
+  CHECK(!xfCompile(xfChain(33), p, err) && err.indexOf("troppo complessa") >= 0);
+  CHECK(p.empty());
+
+  err = "";
+  CHECK(!xfCompile(xfChain(100000), p, err) && err.indexOf("troppo complessa") >= 0);
+
+  // annidamento: ogni parentesi costa due livelli (unario + primario);
+  // oltre XF_MAX_DEPTH errore pulito, senza ricorsione profonda
+  const unsigned ok = XF_MAX_DEPTH / 2 - 1;
+  CHECK(xfCompile(std::string(ok, '(') + "x" + std::string(ok, ')'), p, err));
+  err = "";
+  CHECK(!xfCompile(std::string(ok + 1, '(') + "x" + std::string(ok + 1, ')'), p, err) &&
+        err.indexOf("troppo annidata") >= 0);
+  err = "";
+  CHECK(!xfCompile(std::string(100000, '(') + "x", p, err) && err.indexOf("troppo annidata") >= 0);
+  err = "";
+  CHECK(!xfCompile(std::string(100000, '-') + "x", p, err) && err.indexOf("troppo annidata") >= 0);
+
+  CHECK(!xfCompile("y+1", p, err));
+  CHECK(!xfCompile("x+", p, err));
+  CHECK(!xfCompile("min(x)", p, err));
+}
+
+// ----------------------------------------------------------------------------
+// RTU
+// ----------------------------------------------------------------------------
+static void testRtuCodec()
+{
+  const uint8_t check[] = "123456789";
+  CHECK(RTU::crc16(check, 9) == 0x4B37);
+
+  uint8_t buf[RTU::FRAME_MAX + 64];
+  for (uint16_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)random(256);
+  CHECK(RTU::crc16(buf, sizeof(buf)) == RTU::crc16Bitwise(buf, sizeof(buf)));
+
+  // risposta FC03 a 2 registri dello slave 5
+  uint8_t f[RTU::FRAME_MAX + 44];
+  f[0] = 5; f[1] = RTU::FC_READ_HOLDING; f[2] = 4;
+  RTU::put16(f + 3, 0x1234);
+  RTU::put16(f + 5, 0xBEEF);
+  uint16_t n = RTU::seal(f, 7);
+  CHECK(n == 9);
+  CHECK(RTU::responseLen(f, 3, RTU::FC_READ_HOLDING) == 9);
+
+  RTU::Response r;
+  CHECK(RTU::parseResponse(f, n, 5, RTU::FC_READ_HOLDING, 2, r) == RTU::Status::Ok);
+  uint16_t regs[2] = { 0, 0 };
+  RTU::unpackRegs(r.data, 2, regs);
+  CHECK(regs[0] == 0x1234 && regs[1] == 0xBEEF);
+
+  CHECK(RTU::parseResponse(f, n, 6, RTU::FC_READ_HOLDING, 2, r) == RTU::Status::WrongSlave);
+  CHECK(RTU::parseResponse(f, n, 5, RTU::FC_READ_INPUT, 2, r) == RTU::Status::WrongFunction);
+  CHECK(RTU::parseResponse(f, n, 5, RTU::FC_READ_HOLDING, 3, r) == RTU::Status::BadLength);
+  CHECK(RTU::parseResponse(f, 300, 5, RTU::FC_READ_HOLDING, 2, r) == RTU::Status::BadLength);
+
+  f[4] ^= 0x01;
+  CHECK(RTU::parseResponse(f, n, 5, RTU::FC_READ_HOLDING, 2, r) == RTU::Status::BadCrc);
+  CHECK(RTU::parseResponse(f, 4, 5, RTU::FC_READ_HOLDING, 2, r) == RTU::Status::BadCrc);
+
+  n = RTU::buildException(f, 5, RTU::FC_READ_HOLDING, 2);
+  CHECK(RTU::parseResponse(f, n, 5, RTU::FC_READ_HOLDING, 2, r) == RTU::Status::Exception && r.exception == 2);
+
+  // eco di una scrittura e richiesta FC16
+  uint16_t w[3] = { 1, 2, 3 };
+  n = RTU::buildWriteMultiple(f, 5, 100, w, 3);
+  CHECK(n == 15 && RTU::crcOk(f, n) && RTU::requestLen(f, n) == 15);
+  n = RTU::buildWriteSingle(f, 5, 100, 9);
+  CHECK(RTU::parseResponse(f, n, 5, RTU::FC_WRITE_SINGLE, 1, r) == RTU::Status::Ok);
+}
+
+// ----------------------------------------------------------------------------
+// PLN
+// ----------------------------------------------------------------------------
+static ModbusResourceSpec plnRes(uint32_t periodMs, uint32_t minMs, uint32_t maxMs)
+{
+  ModbusResourceSpec r;
+  r.name          = "ENV";
+  r.fn            = ModbusFn::ReadHolding;
+  r.count         = 3;
+  r.period_ms     = periodMs;
+  r.min_period_ms = minMs;
+  r.max_period_ms = maxMs;
+  return r;
+}
+
+static void testPlanner()
+{
+  ModbusRtuConfig rtu;
+  ModbusLineConfig line;  // 9600 8N1, turnaround 1000 us
+  rtu.lines.push_back(line);
+
+  // 1042 us/car, t3.5 = 3647 us: (8 + 11) car + 2 t3.5 + turnaround
+  ModbusResourceSpec env = plnRes(2000, 100, 10000);
+  PLN::begin(rtu);
+  CHECK(PLN::wireUs(env) == 19 * 1042 + 2 * 3647 + 1000);
+  uint16_t i = PLN::add(env);
+  CHECK(PLN::loadPpm(0) == 28092u * 1000 / 2000);
+  CHECK(PLN::budgetPpm(0) == 700000u);
+
+  PLN::plan();                          // sotto budget: invariato
+  CHECK(PLN::period(i) == 2000);
+
+  for (int k = 0; k < 60; ++k) PLN::onRead(i, true);
+  CHECK(PLN::period(i) == 100);
+  for (int k = 0; k < 60; ++k) PLN::onRead(i, false);
+  CHECK(PLN::period(i) == 10000);
+
+  // budget 1%: periodo minimo ceil(28092 * 1000 / 10000) = 2810 ms
+  rtu.lines[0].budget_pct = 1;
+  PLN::begin(rtu);
+  i = PLN::add(env);
+  PLN::plan();
+  CHECK(PLN::period(i) == 2810);
+  CHECK(PLN::loadPpm(0) <= PLN::budgetPpm(0));
+  for (int k = 0; k < 60; ++k) PLN::onRead(i, true);
+  CHECK(PLN::period(i) == 2810);
+
+  // periodo fisso: nessun adattamento
+  ModbusResourceSpec fixed = plnRes(500, 500, 500);
+  rtu.lines[0].budget_pct = 70;
+  PLN::begin(rtu);
+  i = PLN::add(fixed);
+  for (int k = 0; k < 20; ++k) PLN::onRead(i, k & 1);
+  CHECK(PLN::period(i) == 500);
+
+  // scrittura: solo su evento
+  ModbusResourceSpec wr = plnRes(0, 0, 0);
+  wr.fn = ModbusFn::WriteMultiple;
+  i = PLN::add(wr);
+  CHECK(PLN::period(i) == 0 && PLN::onRead(i, true) == 0);
+}
+
+// ----------------------------------------------------------------------------
+// CANM shaper
+// ----------------------------------------------------------------------------
+static uint32_t shaperSent(const CanShaperConfig& cfg, const CanMessageSpec& spec, uint32_t ms)
+{
+  std::vector<CanMessageSpec> specs(1, spec);
+  CANM::begin(500000);
+  CANM::shaperBegin(cfg, specs);
+  uint32_t sent0 = CANM::txStats().sent;
+
+  // un valore nuovo ogni ms: in coda resta solo l'ultimo
+  uint64_t end = hostNowUs() + (uint64_t)ms * 1000;
+  uint8_t data[8] = { 0 };
+  while (hostNowUs() < end)
+  {
+    data[0]++;
+    CANM::enqueue(spec.id, spec.dlc, data);
+    CANM::serviceTx();
+    hostAdvanceTo(hostNowUs() + 1000);
+  }
+  return CANM::txStats().sent - sent0;
+}
+
+static void testShaper()
+{
+  CanMessageSpec m;
+  m.name        = "FAST";
+  m.id          = 0x200;
+  m.dlc         = 8;
+  m.dir         = CanDir::BOTH;
+  m.max_rate_hz = 10;
+
+  // per id: burst di 2 frame, poi 10 Hz
+  CanShaperConfig cfg;
+  cfg.enabled      = true;
+  cfg.burst_frames = 2;
+  uint32_t sent = shaperSent(cfg, m, 1000);
+  CHECK(sent >= 11 && sent <= 12);
+  CHECK(CANM::txStats().shaped > 0);
+
+  // id esteso: stesso tetto in frame/s, il costo segue il frame vero
+  m.id = 0x18FF0010;
+  sent = shaperSent(cfg, m, 1000);
+  CHECK(sent >= 11 && sent <= 12);
+
+  // solo tetto totale: 1% di 500 kbit/s a frame standard da 8 byte
+  m.id          = 0x200;
+  m.max_rate_hz = 0;
+  cfg.max_load_pct = 1;
+  uint32_t bits   = CANM::frameBits(8, false, true);
+  uint32_t expect = 2 + 5000 / bits;
+  sent = shaperSent(cfg, m, 1000);
+  CHECK(sent + 1 >= expect && sent <= expect + 1);
+
+  // shaper spento: un frame per valore
+  cfg.enabled = false;
+  sent = shaperSent(cfg, m, 100);
+  CHECK(sent >= 99);
+}
+
+// ----------------------------------------------------------------------------
+// WARM
+// ----------------------------------------------------------------------------
+static uint32_t refCrc32(const uint8_t* p, size_t n, uint32_t crc = 0xFFFFFFFFUL)
+{
+  while (n--)
+  {
+    crc ^= *p++;
+    for (int b = 0; b < 8; ++b) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+  }
+  return crc;
+}
+
+static uint16_t g_warmRegs[4];
+static uint32_t g_warmKey   = 0;
+static int      g_warmCalls = 0;
+
+static void onWarm(uint32_t key, const uint16_t* regs, uint16_t words, uint32_t)
+{
+  g_warmCalls++;
+  g_warmKey = key;
+  memcpy(g_warmRegs, regs, (words < 4 ? words : 4) * sizeof(uint16_t));
+}
+
+static void warmWrite(uint32_t key, uint16_t a, uint16_t b)
+{
+  uint16_t regs[2] = { a, b };
+  CHECK(WARM::beginSnapshot());
+  CHECK(WARM::add(key, regs, 2, 100));
+  WARM::commit();
+  CHECK(!WARM::beginSnapshot());       // foto in corso
+  for (int k = 0; k < 20 && WARM::service(); ++k) {}
+  CHECK(!WARM::busy());
+}
+
+static bool warmLoad()
+{
+  g_warmCalls = 0;
+  memset(g_warmRegs, 0, sizeof(g_warmRegs));
+  return WARM::load(onWarm);
+}
+
+// copia scritta a mano: header valido con la sequenza data
+static void warmSlot(const char* path, uint32_t seq, uint32_t key, uint16_t v)
+{
+  uint8_t body[12];
+  uint32_t age = 0;
+  uint16_t words = 1;
+  memcpy(body, &key, 4);
+  memcpy(body + 4, &age, 4);
+  memcpy(body + 8, &words, 2);
+  memcpy(body + 10, &v, 2);
+  WARM::Hdr h;
+  memcpy(h.magic, "GWWS", 4);
+  h.seq   = seq;
+  h.count = 1;
+  h.bytes = sizeof(body);
+  h.crc   = ~refCrc32(body, sizeof(body));
+  CHECK(writeSdFile(path, std::string((const char*)&h, sizeof(h)) + std::string((const char*)body, sizeof(body))));
+}
+
+static void testWarm()
+{
+  const uint8_t check[] = "123456789";
+  CHECK(~refCrc32(check, 9) == 0xCBF43926UL);
+
+  // chiave = CRC32 di nome, fc, indirizzo e count (little endian)
+  ModbusResourceSpec res = plnRes(1000, 1000, 1000);
+  res.address = 0x0102;
+  std::string raw = "ENV";
+  raw += (char)3; raw += (char)0x02; raw += (char)0x01; raw += (char)3; raw += (char)0;
+  const uint32_t key = WARM::resourceKey(res);
+  CHECK(key == ~refCrc32((const uint8_t*)raw.data(), raw.size()));
+  res.count = 4;
+  CHECK(WARM::resourceKey(res) != key);
+
+  CHECK(freshSd() && SDM_begin(PIN_SD_CS));
+  CHECK(!warmLoad());
+
+  warmWrite(key, 1, 2);
+  warmWrite(key, 3, 4);
+  CHECK(warmLoad() && g_warmCalls == 1 && g_warmKey == key);
+  CHECK(g_warmRegs[0] == 3 && g_warmRegs[1] == 4);
+
+  // la copia piu' recente rovinata (CRC): si riparte dall'altra
+  CHECK(SDM_exists("/WARMA.BIN") && SDM_exists("/WARMB.BIN"));
+  for (const char* path : { "/WARMA.BIN", "/WARMB.BIN" })
+  {
+    std::string full = SD.root + path;
+    FILE* f = fopen(full.c_str(), "r+b");
+    if (!f) continue;
+    uint8_t tail[4];
+    fseek(f, (long)sizeof(WARM::Hdr) + 10, SEEK_SET);
+    size_t got = fread(tail, 1, 2, f);
+    uint16_t v = got == 2 ? (uint16_t)(tail[0] | tail[1] << 8) : 0;
+    if (v == 3)
+    {
+      tail[0] ^= 0x40;
+      fseek(f, (long)sizeof(WARM::Hdr) + 10, SEEK_SET);
+      fwrite(tail, 1, 2, f);
+    }
+    fclose(f);
+  }
+  CHECK(warmLoad() && g_warmRegs[0] == 1 && g_warmRegs[1] == 2);
+
+  // la foto successiva va sull'altra copia: quella rovinata
+  warmWrite(key, 5, 6);
+  CHECK(warmLoad() && g_warmRegs[0] == 5 && g_warmRegs[1] == 6);
+
+  // sequenza che riparte da 0 dopo 0xFFFFFFFF
+  warmSlot("/WARMA.BIN", 0xFFFFFFFFUL, key, 7);
+  warmSlot("/WARMB.BIN", 0, key, 8);
+  CHECK(warmLoad() && g_warmRegs[0] == 8);
+  warmSlot("/WARMA.BIN", 9, key, 9);
+  warmSlot("/WARMB.BIN", 8, key, 10);
+  CHECK(warmLoad() && g_warmRegs[0] == 9);
+
+  // magic errato e file troncato: copie ignorate
+  CHECK(writeSdFile("/WARMA.BIN", "XXXX"));
+  CHECK(warmLoad() && g_warmRegs[0] == 10);
+  CHECK(writeSdFile("/WARMB.BIN", ""));
+  CHECK(!warmLoad());
+}
+
+// ----------------------------------------------------------------------------
+// MBM / GRP
+// ----------------------------------------------------------------------------
+static ModbusRtuConfig                 g_tRtu;
+static std::vector<ModbusResourceSpec> g_tRes;
+static std::vector<MappingRule>        g_tRules;
+static std::vector<uint16_t>           g_doneTags;
+
+static void onTestRead(const ModbusResourceSpec&, bool ok, const uint16_t*, uint16_t, uint16_t tag)
+{
+  if (ok) g_doneTags.push_back(tag);
+}
+
+static void stepMbm()
+{
+  MBM::service();
+}
+
+static void stepGroup()
+{
+  MBM::service();
+  GRP::service(millis());
+}
+
+static void testModbusLine()
+{
+  ModbusLineConfig line;
+  line.name = "rs485a";
+  line.port = "Serial1";
+  g_tRtu.lines.assign(1, line);
+  CHECK(MBM::begin(g_tRtu));
+
+  RTUSIM::Config sc;
+  for (uint8_t id = 1; id <= 3; ++id)
+  {
+    sc.id = id;
+    RTUSIM::begin(Serial1, sc, nullptr, nullptr);
+  }
+
+  // risorse: tre letture e un comando di gruppo (indirizzi stabili nel vector)
+  g_tRes.resize(4);
+  for (uint8_t k = 0; k < 3; ++k)
+  {
+    g_tRes[k] = plnRes(0, 0, 0);
+    g_tRes[k].name    = k == 0 ? "R0" : k == 1 ? "R1" : "R2";
+    g_tRes[k].address = (uint16_t)(10 * k);
+    g_tRes[k].count   = 1;
+  }
+  ModbusResourceSpec& fan = g_tRes[3];
+  fan.name     = "FAN";
+  fan.fn       = ModbusFn::WriteSingle;
+  fan.address  = 40;
+  fan.count    = 1;
+  fan.slave_id = 1;
+
+  // promoteRead: la lettura C passa davanti alle altre due in coda
+  g_doneTags.clear();
+  for (uint16_t k = 0; k < 3; ++k) CHECK(MBM::submitRead(g_tRes[k], onTestRead, k));
+  CHECK(MBM::promoteRead(g_tRes[2], onTestRead, 2));
+  CHECK(!MBM::promoteRead(g_tRes[2], onTestRead, 7));      // tag diverso: non e' la stessa lettura
+  runFor(300, stepMbm);
+  CHECK(g_doneTags.size() == 3);
+  if (g_doneTags.size() == 3)
+  {
+    CHECK(g_doneTags[0] == 2 && g_doneTags[1] == 0 && g_doneTags[2] == 1);
+  }
+  CHECK(!MBM::promoteRead(g_tRes[0], onTestRead, 0));      // gia' servita
+
+  // gruppo in broadcast con verifica ogni 100 ms sugli slave 1..3
+  MappingRule rule;
+  rule.dir      = RuleDir::CAN2MB;
+  rule.toModbus = &fan;
+  rule.group.slaves    = { 1, 2, 3 };
+  rule.group.broadcast = true;
+  rule.group.verify_ms = 100;
+  g_tRules.assign(1, rule);
+  GRP::begin(g_tRules);
+  CHECK(GRP::isGroup(0));
+
+  uint16_t v = 500;
+  CHECK(GRP::write(0, &v, 1));
+  runFor(400, stepGroup);
+  CHECK(MBM::lineStats(0).broadcasts == 1);
+  CHECK(RTUSIM::holding()[40] == 500);
+  CHECK(GRP::stats().verifies >= 1 && GRP::stats().mismatches == 0);
+
+  // uno slave perde il valore: la verifica lo trova e lo riscrive
+  RTUSIM::holding()[40] = 7;
+  runFor(400, stepGroup);
+  CHECK(GRP::stats().mismatches >= 1 && GRP::stats().repairs >= 1);
+  CHECK(RTUSIM::holding()[40] == 500);
+  uint32_t mism = GRP::stats().mismatches;
+  runFor(400, stepGroup);
+  CHECK(GRP::stats().mismatches == mism);
+
+  // unicast: la stessa scrittura in fila a ogni slave
+  g_tRules[0].group.broadcast = false;
+  GRP::begin(g_tRules);
+  v = 321;
+  CHECK(GRP::write(0, &v, 1));
+  runFor(300, stepGroup);
+  CHECK(RTUSIM::holding()[40] == 321 && GRP::stats().failed == 0);
+}
+
+// ----------------------------------------------------------------------------
+// CAPM
+// ----------------------------------------------------------------------------
+static void stepCapture()
+{
+  CAPM::service();
+}
+
+static void testCapture()
+{
+  CHECK(freshSd() && SDM_begin(PIN_SD_CS));
+  CAPM::Config cfg;
+  cfg.enabled = true;
+  cfg.sealMs  = 1000;
+  CHECK(CAPM::begin(cfg));
+  runFor(50, stepCapture);             // rotazione: apertura del primo file
+
+  // record CAN da 8 byte: 18 byte, 27 per blocco; l'anello ne tiene
+  // CAPM_BLOCKS blocchi (uno in riempimento), gli ultimi 5 si perdono
+  const uint16_t perBlock = (CAPM_BLOCK_SIZE - sizeof(CAPM::BlockHdr)) / (sizeof(CAPM::RecHdr) + 4 + 8);
+  const uint32_t fit      = (uint32_t)perBlock * CAPM_BLOCKS;
+  const uint8_t  data[8]  = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  for (uint32_t k = 0; k < fit + 5; ++k) CAPM::logCan(CAPM::RecType::CanRx, 0x100 + k, 8, data);
+  CHECK(CAPM::stats().drops == 5);
+
+  uint64_t end = hostNowUs() + 2000000;
+  while (CAPM::hasPending() && hostNowUs() < end)
+  {
+    CAPM::service();
+    hostAdvanceTo(hostNowUs() + 100);
+  }
+  CAPM::logCan(CAPM::RecType::CanRx, 0x7FF, 8, data);
+  runFor(1500, stepCapture, 1000);
+  CHECK(!CAPM::hasPending());
+  fflush(nullptr);
+
+  char path[32];
+  snprintf(path, sizeof(path), "/CAP%05u.BIN", (unsigned)CAPM::stats().fileIndex);
+  FILE* f = fopen((SD.root + path).c_str(), "rb");
+  CHECK(f != nullptr);
+  if (!f) return;
+
+  uint8_t  blk[CAPM_BLOCK_SIZE];
+  uint32_t blocks = 0, drops = 0, records = 0;
+  int32_t  dropSeq = -1;
+  while (fread(blk, 1, sizeof(blk), f) == sizeof(blk))
+  {
+    CAPM::BlockHdr h;
+    memcpy(&h, blk, sizeof(h));
+    CHECK(memcmp(h.magic, "GWCP", 4) == 0 && h.seq == blocks);
+    if (h.drops)
+    {
+      drops  += h.drops;
+      dropSeq = (int32_t)h.seq;
+    }
+    for (uint16_t o = sizeof(h); o + sizeof(CAPM::RecHdr) <= h.used; )
+    {
+      CAPM::RecHdr r;
+      memcpy(&r, blk + o, sizeof(r));
+      if (r.type == (uint8_t)CAPM::RecType::CanRx) records++;
+      o += sizeof(r) + r.len;
+    }
+    blocks++;
+  }
+  fclose(f);
+
+  // i drop sono dopo l'ultimo record del blocco pieno: li porta il blocco
+  // che contiene il record successivo
+  CHECK(blocks == CAPM_BLOCKS + 1u);
+  CHECK(drops == 5 && dropSeq == CAPM_BLOCKS);
+  CHECK(records == fit + 1);
+}
+
+// ----------------------------------------------------------------------------
+// sketch: CAN2MB su risorsa local con mapping parziale
+// ----------------------------------------------------------------------------
+#if !GW_STATIC_CONFIG
+static void testPartialLocalMapping()
+{
+  CHECK(freshSd());
+  CHECK(writeSdFile(CAN_PATH,
+    "{ \"bitrate\": 500000, \"messages\": [ { \"name\": \"CAN_LOC\", \"id\": \"0x120\", \"dlc\": 2,"
+    "  \"dir\": \"INT2NET\", \"fields\": [ { \"name\": \"b\", \"type\": \"uint16\", \"offset\": 0, \"size\": 2 } ] } ] }"));
+  CHECK(writeSdFile(MB_PATH,
+    "{ \"rtu\": { \"baud\": 9600, \"slave_id\": 1 },"
+    "  \"lines\": [ { \"name\": \"rs485a\", \"port\": \"Serial1\", \"de_re_pin\": 7 } ],"
+    "  \"slave\": { \"enabled\": true, \"port\": \"Serial2\", \"de_re_pin\": 8, \"baud\": 19200, \"id\": 10 },"
+    "  \"resources\": [ { \"name\": \"LOC\", \"local\": true, \"fn\": \"write_multiple\", \"address\": 0, \"count\": 3,"
+    "    \"fields\": [ { \"name\": \"a\", \"type\": \"uint16\", \"index\": 0 },"
+    "                 { \"name\": \"b\", \"type\": \"uint16\", \"index\": 1 },"
+    "                 { \"name\": \"c\", \"type\": \"uint16\", \"index\": 2 } ] } ] }"));
+  CHECK(writeSdFile(MAP_PATH,
+    "{ \"rules\": [ { \"dir\": \"CAN2MB\", \"from_can\": { \"message\": \"CAN_LOC\" },"
+    "  \"to_modbus\": { \"resource\": \"LOC\" }, \"map\": [ { \"src\": \"b\", \"dst\": \"b\" } ] } ] }"));
+
+  setup();
+  CHECK(g_mbRes.size() == 1 && g_rules.size() == 1);
+  if (g_mbRes.size() != 1) return;
+
+  const uint16_t before[3] = { 11, 22, 33 };
+  CHECK(MBM::slaveStore(g_mbRes[0], before, 3));
+
+  const uint8_t data[2] = { 0x34, 0x12 };
+  handleCanFrame(CANM::makeMsg(0x120, 2, data));
+
+  uint16_t after[3] = { 0, 0, 0 };
+  CHECK(MBM::slaveLoad(g_mbRes[0], after));
+  CHECK(after[0] == 11 && after[1] == 0x1234 && after[2] == 33);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+  bool verbose = argc > 1 && strcmp(argv[1], "-V") == 0;
+
+  randomSeed(1);
+  hostSimClock(true);
+  hostSerialMute(!verbose);
+  if (!freshSd()) return 1;
+
+  testTransform();
+  testRtuCodec();
+  testPlanner();
+  testShaper();
+  testWarm();
+  testModbusLine();
+  testCapture();
+#if !GW_STATIC_CONFIG
+  testPartialLocalMapping();   // per ultimo: setup() riparte tutti i moduli
+#endif
+
+  hostSerialMute(false);
+  printf("[TEST] controlli=%d falliti=%d\n", g_checks, g_fails);
+  return g_fails ? 1 : 0;
+}
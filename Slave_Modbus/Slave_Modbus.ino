@@ -1,46 +1,148 @@
-// ===== UNO R3 — Modbus RTU SLAVE via MAX485 =====
+// ===== UNO R3 — Modbus RTU SLAVE via MAX485 (anche banco di prova del gateway) =====
 // RX  = D8 (AltSoftSerial RX)
 // TX  = D9 (AltSoftSerial TX)
 // RE+DE = D7 (Driver enable RS485)
-// LED_RX = D4 (lampeggia su scrittura dal master)
-// LED_TX = D5 (lampeggia quando aggiorno i registri ambiente)
+// LED_RX = D4 (impulso su scrittura dal master)
+// LED_TX = D5 (impulso quando aggiorno i registri ambiente)
+//
+// Funzioni servite: FC01/02/03/04/05/06/15/16 (FC02 e FC04 leggono le stesse
+// tabelle di FC01 e FC03).
+//
+// Installazione (Arduino IDE / arduino-cli): rtu_codec.h e gw_config.h sono
+// nella libreria libraries/GatewayCommon di questo repository. O si imposta
+// come "Sketchbook location" la root del repo (File > Preferenze), cosi' l'IDE
+// trova gli sketch e libraries/ insieme, oppure si copia o si collega la
+// cartella in <sketchbook>/libraries:
+//   ln -s "$PWD/libraries/GatewayCommon" ~/Arduino/libraries/GatewayCommon
+// Con arduino-cli basta: arduino-cli compile --library libraries/GatewayCommon ...
+//
+// Niente delay(): il loop e' uno scheduler cooperativo e il bus viene servito
+// tra un task e l'altro, cosi' il tempo di risposta dipende solo dal frame.
+// Per i test di carico lo slave puo' simulare piu' id, centinaia di registri
+// che cambiano con un certo ritmo, latenza ed errori (vedi "Simulazione").
+// Da monitor seriale (115200):
+//   SIM                         stampa la configurazione
+//   SIM lat=5 drop=10 pat=rnd   cambia i parametri (chiavi sotto)
+//   STAT                        contatori; STAT 0 li azzera
 
 #include <AltSoftSerial.h>
-#include <ModbusRTU.h>
+#include <rtu_codec.h>   // libraries/GatewayCommon: stesso codec del gateway
+#include <gw_config.h>   // mappa registri generata dai JSON (Host/codegen)
 
 // ---------- Pin ----------
 constexpr uint8_t PIN_RE_DE = 7;
 constexpr uint8_t LED_RX    = 4;
 constexpr uint8_t LED_TX    = 5;
+constexpr uint16_t LED_PULSE_MS = 50;
 
 // ---------- Parametri RTU ----------
-constexpr uint32_t MB_BAUD    = 9600;
-constexpr uint8_t  MB_SLAVEID = 1;     // deve combaciare con il JSON del gateway
+constexpr uint32_t MB_BAUD    = GWC::RTU_BAUD;
+constexpr uint8_t  MB_SLAVEID = GWC::RTU_SLAVE_ID;
 
-// ---------- Indirizzi registri (coerenti con i JSON) ----------
-constexpr uint16_t ADDR_ENV_BASE   = 0;   // temp float a 0..1, humidity a 2
-constexpr uint16_t ADDR_FAN_BASE   = 20;  // fan_speed 20, fan_on 21
+// ---------- Indirizzi registri (da modbus.json, via gw_config.h) ----------
+constexpr uint16_t ADDR_TEMP      = GWC::REG_MB_ENV_temperature;   // float su 2 registri
+constexpr uint16_t ADDR_HUM       = GWC::REG_MB_ENV_humidity;
+constexpr uint16_t ADDR_FAN_SPEED = GWC::REG_MB_FAN_CMD_fan_speed;
+constexpr uint16_t ADDR_FAN_ON    = GWC::REG_MB_FAN_CMD_fan_on;
 
 // ---------- Periodo aggiornamento "ambiente" ----------
 constexpr uint32_t ENV_PERIOD_MS = 2000;
 
+// ---------- Simulazione: dimensioni (compile time, decidono la RAM) ----------
+#ifndef SIM_SLAVE_COUNT
+#define SIM_SLAVE_COUNT 1      // id serviti: MB_SLAVEID .. MB_SLAVEID + N - 1
+#endif
+#ifndef SIM_HREG_COUNT
+#define SIM_HREG_COUNT  128    // holding register per id
+#endif
+#ifndef SIM_COIL_COUNT
+#define SIM_COIL_COUNT  64     // coil per id (multiplo di 8)
+#endif
+static_assert(SIM_SLAVE_COUNT >= 1 && MB_SLAVEID + SIM_SLAVE_COUNT - 1 <= 247, "id fuori range");
+static_assert(SIM_HREG_COUNT >= GWC::HREG_END, "la mappa deve contenere i registri del gateway");
+static_assert(SIM_COIL_COUNT % 8 == 0 && SIM_COIL_COUNT <= 2000, "coil a byte interi, al massimo una lettura");
+static_assert(SIM_SLAVE_COUNT * (SIM_HREG_COUNT + SIM_COIL_COUNT / 16) <= 512,
+              "oltre 1 KB di registri: la UNO ha 2 KB di RAM");
+
+// ---------- Simulazione: comportamento (modificabile da console) ----------
+// I registri oltre la mappa del gateway (da GWC::HREG_END) cambiano secondo
+// "pat": ogni "period" ms ne vengono toccati "batch", a giro su tutti gli id.
+// Gli errori sono in per mille delle richieste unicast.
+enum Pattern : uint8_t { PAT_STATIC, PAT_COUNTER, PAT_RANDOM, PAT_TOGGLE };
+
+struct SimConfig {
+  uint8_t  pattern  = PAT_COUNTER;
+  uint16_t periodMs = 1000;   // 0 = registri fermi
+  uint8_t  batch    = 8;      // registri cambiati per periodo
+  uint16_t latMs    = 0;      // ritardo aggiunto prima della risposta
+  uint16_t jitMs    = 0;      // + casuale 0..jit
+  uint16_t dropPm   = 0;      // nessuna risposta (timeout lato master)
+  uint16_t crcPm    = 0;      // risposta con CRC sbagliato
+  uint16_t busyPm   = 0;      // eccezione 06 (slave occupato)
+  bool     log      = false;  // log di ENV e delle scritture FAN_CMD (SIM log=1)
+};
+
+// Con log attivo al massimo una riga di scritture FAN_CMD ogni LOG_MS: a
+// 115200 una riga per banco ad ogni giro di ledTask riempie il buffer TX e
+// Serial.print() blocca il loop, e con lui le risposte sul bus
+constexpr uint32_t LOG_MS = 1000;
+SimConfig sim;
+
+struct SimStats {
+  uint32_t req      = 0;      // richieste per uno dei nostri id (CRC valido)
+  uint32_t bcast    = 0;
+  uint32_t writes   = 0;
+  uint32_t resp     = 0;
+  uint32_t exc      = 0;      // eccezioni "vere" (indirizzo, funzione, ...)
+  uint32_t badCrc   = 0;      // frame ricevuti con CRC errato
+  uint32_t drop     = 0;      // errori iniettati
+  uint32_t crc      = 0;
+  uint32_t busy     = 0;
+  uint32_t changes  = 0;      // registri cambiati dal pattern
+  uint32_t maxTurnUs = 0;     // fine richiesta -> inizio risposta (latenza iniettata esclusa)
+};
+SimStats st;
+
+// ---------- Mappa holding register (FC03 / FC06 / FC16), un banco per id ----------
+// FC04 (input register) legge lo stesso banco: una tabella separata non
+// starebbe nei 2 KB della UNO e al banco di prova non serve
+uint16_t hreg[SIM_SLAVE_COUNT][SIM_HREG_COUNT];
+
+// ---------- Coil (FC01 / FC05 / FC15), bit n = byte n/8, bit n%8 ----------
+// FC02 (discrete input) legge gli stessi bit
+uint8_t coil[SIM_SLAVE_COUNT][SIM_COIL_COUNT / 8];
+
 // ---------- Oggetti ----------
 AltSoftSerial  ASerial;  // usa 8/9
-ModbusRTU      mb;
 
-// Buffer locale degli HREG che esponiamo (solo per confronto/LED)
-uint16_t prevFanSpeed = 0;
-uint16_t prevFanOn    = 0;
+// Frame RTU: richiesta ricevuta e risposta costruita nello stesso buffer
+constexpr uint16_t FRAME_LEN = RTU::FRAME_MAX;
+uint8_t  frame[FRAME_LEN];
+uint16_t frameLen = 0;
+uint32_t lastByteUs = 0;
+constexpr uint32_t CHAR_US = (11UL * 1000000UL + MB_BAUD - 1) / MB_BAUD;
+constexpr uint32_t T35_US  = MB_BAUD > 19200 ? 1750 : CHAR_US * 7 / 2;
+
+// Risposta pronta in frame[0..txLen) in attesa della latenza iniettata;
+// finche' e' pendente la ricezione resta nel buffer di AltSoftSerial
+uint16_t txLen  = 0;
+uint32_t txAtUs = 0;
+
+// Ultimi valori FAN_CMD visti, per il log delle scritture
+uint16_t prevFanSpeed[SIM_SLAVE_COUNT];
+uint16_t prevFanOn[SIM_SLAVE_COUNT];
 
-// Helpers
-static void blink(uint8_t pin, uint16_t ms = 50) {
+// ---------- LED non bloccanti ----------
+uint32_t ledOffAt[2];   // 0 = spento
+static void ledPulse(uint8_t i, uint8_t pin)
+{
   digitalWrite(pin, HIGH);
-  delay(ms);
-  digitalWrite(pin, LOW);
+  ledOffAt[i] = millis() + LED_PULSE_MS;
+  if (!ledOffAt[i]) ledOffAt[i] = 1;
 }
 
 // Converte float32 in due registri 16-bit (little-endian)
-static void floatToRegsLE(float f, uint16_t& lo, uint16_t& hi) 
+static void floatToRegsLE(float f, uint16_t& lo, uint16_t& hi)
 {
   union { float f; uint8_t b[4]; } u;
   u.f = f;
@@ -49,102 +151,243 @@ static void floatToRegsLE(float f, uint16_t& lo, uint16_t& hi)
   hi = (uint16_t) (u.b[2] | (uint16_t(u.b[3]) << 8));
 }
 
-// Per simulare dati "reali"
-static float fakeTemperature() 
+static uint16_t capped(uint32_t n, uint16_t hi)
 {
-  // ~20.0 .. 30.0 °C con un po' di jitter
-  return 20.0f + (millis() % 1000) / 100.0f + random(-5, 6) * 0.1f;
+  return n > hi ? hi : (uint16_t)n;
 }
-static uint16_t fakeHumidity() 
+
+static bool chance(uint16_t perMille)
 {
-  // 40 .. 70 %RH
-  return 40 + (millis()/1000) % 31;
+  return perMille && (uint16_t)random(1000) < perMille;
 }
 
-void setup() 
+// ---------- Slave RTU ----------
+// flush() attende l'ultimo bit prima di liberare la linea: e' tempo di bus,
+// durante il quale il master non puo' comunque trasmettere
+static void sendFrame(uint16_t len)
 {
-  pinMode(PIN_RE_DE, OUTPUT);
-  digitalWrite(PIN_RE_DE, LOW); // ricezione di default
+  digitalWrite(PIN_RE_DE, HIGH);
+  ASerial.write(frame, len);
+  ASerial.flush();
+  digitalWrite(PIN_RE_DE, LOW);
+  st.resp++;
+}
 
-  pinMode(LED_RX, OUTPUT);
-  pinMode(LED_TX, OUTPUT);
-  digitalWrite(LED_RX, LOW);
-  digitalWrite(LED_TX, LOW);
+// Risposta subito o dopo la latenza iniettata; errori iniettati qui
+static void reply(uint16_t len, uint32_t reqEndUs)
+{
+  if (chance(sim.dropPm)) { st.drop++; return; }
+  if (chance(sim.busyPm))
+  {
+    st.busy++;
+    len = RTU::buildException(frame, frame[0], frame[1], RTU::EX_DEVICE_BUSY);
+  }
+  if (chance(sim.crcPm))
+  {
+    st.crc++;
+    frame[len - 1] ^= 0x5A;
+  }
 
-  Serial.begin(115200);
-  while (!Serial) {}
-  Serial.println(F("\n[SLAVE] UNO R3 Modbus RTU via MAX485 (AltSoftSerial 8/9)"));
+  uint32_t delayUs = 1000UL * sim.latMs + (sim.jitMs ? 1000UL * random(sim.jitMs + 1) : 0);
+  uint32_t turn = micros() - reqEndUs;
+  if (turn > st.maxTurnUs) st.maxTurnUs = turn;
+  if (!delayUs)
+  {
+    sendFrame(len);
+    return;
+  }
+  txLen  = len;
+  txAtUs = micros() + delayUs;
+}
 
-  // AltSoftSerial parte sempre a 8N1; ModbusRTU imposterà il formato
-  ASerial.begin(MB_BAUD);
+static bool inMap(uint16_t addr, uint16_t qty)
+{
+  return qty >= 1 && addr < SIM_HREG_COUNT && qty <= SIM_HREG_COUNT - addr;
+}
 
-  // ModbusRTU: collega allo stream AltSoftSerial e pin RE/DE
-  mb.begin(&ASerial, PIN_RE_DE);
-  mb.slave(MB_SLAVEID);
+static bool inCoils(uint16_t addr, uint16_t qty)
+{
+  return qty >= 1 && addr < SIM_COIL_COUNT && qty <= SIM_COIL_COUNT - addr;
+}
 
-  // Aggiungi Holding Registers come blocchi contigui
-  // ENV: 3 registri da 0 a 2
-  mb.addHreg(ADDR_ENV_BASE, 0, 3);
-  // FAN_CMD: 2 registri 20..21
-  mb.addHreg(ADDR_FAN_BASE, 0, 2);
+static bool getCoil(uint8_t b, uint16_t i)
+{
+  return coil[b][i / 8] & (1u << (i % 8));
+}
 
-  // Inizializza
-  uint16_t lo, hi;
-  floatToRegsLE(22.5f, lo, hi);
-  mb.Hreg(ADDR_ENV_BASE + 0, lo);
-  mb.Hreg(ADDR_ENV_BASE + 1, hi);
-  mb.Hreg(ADDR_ENV_BASE + 2, 50);   // humidity 50 %
+static void setCoil(uint8_t b, uint16_t i, bool on)
+{
+  if (on) coil[b][i / 8] |=  (uint8_t)(1u << (i % 8));
+  else    coil[b][i / 8] &= (uint8_t)~(1u << (i % 8));
+}
 
-  mb.Hreg(ADDR_FAN_BASE + 0, 0);    // fan_speed
-  mb.Hreg(ADDR_FAN_BASE + 1, 0);    // fan_on (0/1)
+static void onWrite()
+{
+  st.writes++;
+  ledPulse(0, LED_RX);
+}
 
-  prevFanSpeed = 0;
-  prevFanOn    = 0;
+// Richiesta completa in frame[0..n): risposta costruita sul posto
+static void handleRequest(uint16_t n)
+{
+  const uint32_t endUs = micros();
+  if (!RTU::crcOk(frame, n)) { st.badCrc++; return; }
+  const uint8_t id = frame[0];
+  const bool    bcast = id == 0;
+  if (!bcast && (id < MB_SLAVEID || id >= MB_SLAVEID + SIM_SLAVE_COUNT)) return;
+  if (bcast) st.bcast++; else st.req++;
 
-  randomSeed(analogRead(A0));       // per la simulazione
-  Serial.println(F("[SLAVE] pronto. Indirizzo=1, 9600 8N1"));
-}
+  const uint8_t fc    = frame[1];
+  const uint16_t addr = RTU::get16(frame + 2);
+  const uint16_t qty  = RTU::get16(frame + 4);
+  uint8_t ex = 0;
 
-void loop() {
-  // Servizio Modbus (risponde automaticamente a read/write del master)
-  mb.task();
+  // broadcast: scrive su tutti i banchi
+  const uint8_t first = bcast ? 0 : id - MB_SLAVEID;
+  const uint8_t last  = bcast ? SIM_SLAVE_COUNT - 1 : first;
 
-  // Rileva eventuali scritture del master sui comandi ventola (per LED RX/log)
-  uint16_t curFanSpeed = mb.Hreg(ADDR_FAN_BASE + 0);
-  uint16_t curFanOn    = mb.Hreg(ADDR_FAN_BASE + 1);
-  if (curFanSpeed != prevFanSpeed || curFanOn != prevFanOn) 
+  switch (fc)
   {
-    // un WRITE del master ha cambiato i registri → LED_RX
-    blink(LED_RX);
-    prevFanSpeed = curFanSpeed;
-    prevFanOn    = curFanOn;
+    case RTU::FC_READ_COILS:
+    case RTU::FC_READ_DISCRETE:
+    {
+      if (bcast) return;
+      if (n != 8 || qty > 2000)   { ex = RTU::EX_ILLEGAL_VALUE;   break; }
+      if (!inCoils(addr, qty))    { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      const uint8_t bytes = (uint8_t)((qty + 7) / 8);
+      frame[2] = bytes;
+      memset(frame + 3, 0, bytes);
+      for (uint16_t i = 0; i < qty; ++i)
+      {
+        if (getCoil(first, addr + i)) frame[3 + i / 8] |= (uint8_t)(1u << (i % 8));
+      }
+      reply(RTU::seal(frame, 3 + bytes), endUs);
+      return;
+    }
+
+    case RTU::FC_READ_HOLDING:
+    case RTU::FC_READ_INPUT:
+      if (bcast) return;
+      if (n != 8 || qty > 125)    { ex = RTU::EX_ILLEGAL_VALUE;   break; }
+      if (!inMap(addr, qty))      { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      frame[2] = (uint8_t)(2 * qty);
+      for (uint16_t i = 0; i < qty; ++i) RTU::put16(frame + 3 + 2 * i, hreg[first][addr + i]);
+      reply(RTU::seal(frame, 3 + 2 * qty), endUs);
+      return;
+
+    case RTU::FC_WRITE_COIL:
+      if (qty != 0xFF00 && qty != 0x0000) { ex = RTU::EX_ILLEGAL_VALUE; break; }
+      if (!inCoils(addr, 1))      { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      for (uint8_t b = first; b <= last; ++b) setCoil(b, addr, qty == 0xFF00);
+      onWrite();
+      if (!bcast) reply(8, endUs);   // risposta = eco della richiesta
+      return;
+
+    case RTU::FC_WRITE_COILS:
+      if (qty < 1 || qty > 1968 || frame[6] != (qty + 7) / 8 || n != 9u + frame[6])
+      {
+        ex = RTU::EX_ILLEGAL_VALUE;
+        break;
+      }
+      if (!inCoils(addr, qty))    { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      for (uint8_t b = first; b <= last; ++b)
+      {
+        for (uint16_t i = 0; i < qty; ++i) setCoil(b, addr + i, frame[7 + i / 8] & (1u << (i % 8)));
+      }
+      onWrite();
+      if (!bcast) reply(RTU::seal(frame, 6), endUs);
+      return;
+
+    case RTU::FC_WRITE_SINGLE:
+      if (!inMap(addr, 1))        { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      for (uint8_t b = first; b <= last; ++b) hreg[b][addr] = qty;   // per FC06 il campo "quantita'" e' il valore
+      onWrite();
+      if (!bcast) reply(8, endUs);   // risposta = eco della richiesta
+      return;
 
-    Serial.print(F("[SLAVE] FAN_CMD updated by master → speed="));
-    Serial.print(curFanSpeed);
-    Serial.print(F(" on="));
-    Serial.println(curFanOn ? F("true") : F("false"));
+    case RTU::FC_WRITE_MULTIPLE:
+      if (qty < 1 || frame[6] != 2 * qty || n != 9u + frame[6]) { ex = RTU::EX_ILLEGAL_VALUE; break; }
+      if (!inMap(addr, qty))      { ex = RTU::EX_ILLEGAL_ADDRESS; break; }
+      for (uint8_t b = first; b <= last; ++b)
+      {
+        for (uint16_t i = 0; i < qty; ++i) hreg[b][addr + i] = RTU::get16(frame + 7 + 2 * i);
+      }
+      onWrite();
+      if (!bcast) reply(RTU::seal(frame, 6), endUs);
+      return;
+
+    default:
+      ex = RTU::EX_ILLEGAL_FUNCTION;
+      break;
   }
+  if (bcast) return;
+  st.exc++;
+  reply(RTU::buildException(frame, id, fc, ex), endUs);
+}
 
-  // Aggiorna periodicamente i registri "ambiente"
-  static uint32_t lastEnv = 0;
-  uint32_t now = millis();
+// Riceve dalla seriale: il frame si chiude alla lunghezza attesa o sul silenzio t3.5
+static void mbTask()
+{
+  if (txLen)
+  {
+    if ((int32_t)(micros() - txAtUs) < 0) return;
+    sendFrame(txLen);
+    txLen = 0;
+  }
 
-  if (now - lastEnv >= ENV_PERIOD_MS) 
+  while (ASerial.available() > 0)
   {
-    lastEnv = now;
+    uint8_t b = (uint8_t)ASerial.read();
+    lastByteUs = micros();
+    if (frameLen < FRAME_LEN) frame[frameLen++] = b;
 
-    float   t  = fakeTemperature();
-    uint16_t h = fakeHumidity();
+    uint16_t need = RTU::requestLen(frame, frameLen);
+    if (need && frameLen >= need)
+    {
+      if (need <= FRAME_LEN) handleRequest(need);
+      frameLen = 0;
+      return;
+    }
+  }
+  if (frameLen && micros() - lastByteUs >= T35_US)
+  {
+    handleRequest(frameLen);       // funzione sconosciuta: risponde 01
+    frameLen = 0;
+  }
+}
 
+// ---------- Task ----------
+// Per simulare dati "reali"
+static float fakeTemperature()
+{
+  // ~20.0 .. 30.0 °C con un po' di jitter
+  return 20.0f + (millis() % 1000) / 100.0f + random(-5, 6) * 0.1f;
+}
+static uint16_t fakeHumidity()
+{
+  // 40 .. 70 %RH
+  return 40 + (millis()/1000) % 31;
+}
+
+// Aggiorna i registri "ambiente" di ogni id (ogni id un po' piu' caldo)
+static void envTask(uint32_t)
+{
+  float    t = fakeTemperature();
+  uint16_t h = fakeHumidity();
+  for (uint8_t b = 0; b < SIM_SLAVE_COUNT; ++b)
+  {
     uint16_t lo, hi;
-    floatToRegsLE(t, lo, hi);
-    mb.Hreg(ADDR_ENV_BASE + 0, lo);
-    mb.Hreg(ADDR_ENV_BASE + 1, hi);
-    mb.Hreg(ADDR_ENV_BASE + 2, h);
+    floatToRegsLE(t + 0.5f * b, lo, hi);
+    hreg[b][ADDR_TEMP + 0] = lo;
+    hreg[b][ADDR_TEMP + 1] = hi;
+    hreg[b][ADDR_HUM]      = h;
+  }
 
-    // LED_TX per indicare che abbiamo “pronto” un nuovo dato da servire
-    blink(LED_TX);
+  // LED_TX per indicare che abbiamo “pronto” un nuovo dato da servire
+  ledPulse(1, LED_TX);
 
+  if (sim.log)
+  {
     Serial.print(F("[SLAVE] ENV update → T="));
     Serial.print(t, 2);
     Serial.print(F("C  H="));
@@ -152,3 +395,225 @@ void loop() {
     Serial.println(F("%"));
   }
 }
+
+// Registri oltre la mappa del gateway: "batch" per giro, a rotazione
+static void patternTask(uint32_t)
+{
+  constexpr uint16_t SPAN = SIM_HREG_COUNT - GWC::HREG_END;
+  static uint16_t next = 0;   // posizione nel giro (banco * SPAN + offset)
+  if (!SPAN || sim.pattern == PAT_STATIC) return;
+
+  for (uint8_t i = 0; i < sim.batch; ++i)
+  {
+    uint16_t& r = hreg[next / SPAN][GWC::HREG_END + next % SPAN];
+    switch (sim.pattern)
+    {
+      case PAT_COUNTER: r++;                           break;
+      case PAT_RANDOM:  r = (uint16_t)random(0x10000); break;
+      case PAT_TOGGLE:  r = r ? 0 : 1;                 break;
+    }
+    st.changes++;
+    if (++next >= (uint16_t)(SPAN * SIM_SLAVE_COUNT)) next = 0;
+  }
+}
+
+// Spegne i LED scaduti e riassume le scritture del master su FAN_CMD
+static void ledTask(uint32_t now)
+{
+  static uint16_t changed = 0;   // banchi cambiati dall'ultima riga
+  static uint8_t  lastB   = 0;
+  static uint32_t logAt   = 0;
+  static const uint8_t PIN[2] = { LED_RX, LED_TX };
+  for (uint8_t i = 0; i < 2; ++i)
+  {
+    if (ledOffAt[i] && (int32_t)(now - ledOffAt[i]) >= 0)
+    {
+      digitalWrite(PIN[i], LOW);
+      ledOffAt[i] = 0;
+    }
+  }
+
+  for (uint8_t b = 0; b < SIM_SLAVE_COUNT; ++b)
+  {
+    uint16_t curFanSpeed = hreg[b][ADDR_FAN_SPEED];
+    uint16_t curFanOn    = hreg[b][ADDR_FAN_ON];
+    if (curFanSpeed == prevFanSpeed[b] && curFanOn == prevFanOn[b]) continue;
+    prevFanSpeed[b] = curFanSpeed;
+    prevFanOn[b]    = curFanOn;
+    if (changed < 0xFFFF) changed++;
+    lastB = b;
+  }
+
+  if (!sim.log) { changed = 0; return; }
+  if (!changed || now - logAt < LOG_MS) return;
+  logAt = now;
+  Serial.print(F("[SLAVE] FAN_CMD scritto dal master x"));
+  Serial.print(changed);
+  Serial.print(F(", ultimo id="));
+  Serial.print(MB_SLAVEID + lastB);
+  Serial.print(F(" speed="));
+  Serial.print(prevFanSpeed[lastB]);
+  Serial.print(F(" on="));
+  Serial.println(prevFanOn[lastB] ? 1 : 0);
+  changed = 0;
+}
+
+static void printConfig()
+{
+  static const char* const PAT[] = { "static", "cnt", "rnd", "toggle" };
+  Serial.print(F("[SIM] id="));     Serial.print(MB_SLAVEID);
+  Serial.print(F(".."));            Serial.print(MB_SLAVEID + SIM_SLAVE_COUNT - 1);
+  Serial.print(F(" hreg="));        Serial.print(SIM_HREG_COUNT);
+  Serial.print(F(" pat="));         Serial.print(PAT[sim.pattern]);
+  Serial.print(F(" period="));      Serial.print(sim.periodMs);
+  Serial.print(F(" batch="));       Serial.print(sim.batch);
+  Serial.print(F(" lat="));         Serial.print(sim.latMs);
+  Serial.print(F(" jit="));         Serial.print(sim.jitMs);
+  Serial.print(F(" drop="));        Serial.print(sim.dropPm);
+  Serial.print(F(" crc="));         Serial.print(sim.crcPm);
+  Serial.print(F(" busy="));        Serial.print(sim.busyPm);
+  Serial.print(F(" log="));         Serial.println(sim.log ? 1 : 0);
+}
+
+static void printStats()
+{
+  Serial.print(F("[SIM] req="));    Serial.print(st.req);
+  Serial.print(F(" bcast="));       Serial.print(st.bcast);
+  Serial.print(F(" writes="));      Serial.print(st.writes);
+  Serial.print(F(" resp="));        Serial.print(st.resp);
+  Serial.print(F(" exc="));         Serial.print(st.exc);
+  Serial.print(F(" rxCrc="));       Serial.print(st.badCrc);
+  Serial.print(F(" inj drop/crc/busy="));
+  Serial.print(st.drop); Serial.print('/'); Serial.print(st.crc); Serial.print('/'); Serial.print(st.busy);
+  Serial.print(F(" changes="));     Serial.print(st.changes);
+  Serial.print(F(" maxTurnUs="));   Serial.println(st.maxTurnUs);
+}
+
+static void applyKey(const char* k, const char* v);
+
+// Console su USB: una riga alla volta, senza bloccare
+static void consoleTask(uint32_t)
+{
+  static char    line[64];
+  static uint8_t len = 0;
+  while (Serial.available() > 0)
+  {
+    char c = (char)Serial.read();
+    if (c != '\n' && c != '\r')
+    {
+      if (len < sizeof(line) - 1) line[len++] = c;
+      continue;
+    }
+    if (!len) continue;
+    line[len] = 0;
+    len = 0;
+
+    char* tok = strtok(line, " ");
+    if (!strcmp(tok, "STAT"))
+    {
+      tok = strtok(nullptr, " ");
+      if (tok && !strcmp(tok, "0")) st = SimStats();
+      printStats();
+    }
+    else if (!strcmp(tok, "SIM"))
+    {
+      while ((tok = strtok(nullptr, " ")) != nullptr)
+      {
+        char* eq = strchr(tok, '=');
+        if (!eq) continue;
+        *eq = 0;
+        applyKey(tok, eq + 1);
+      }
+      printConfig();
+    }
+    else
+    {
+      Serial.println(F("[SIM] comandi: SIM [chiave=valore ...] | STAT [0]"));
+    }
+  }
+}
+
+// ---------- Scheduler cooperativo ----------
+// Un task gira quando e' passato il suo periodo (0 = fermo); il bus viene
+// servito prima di ogni task, quindi l'attesa massima di una richiesta e'
+// il task piu' lungo, non la somma.
+struct Task {
+  void   (*fn)(uint32_t now);
+  uint32_t periodMs;
+  uint32_t last;
+};
+enum : uint8_t { T_ENV, T_PATTERN, T_LED, T_CONSOLE, N_TASKS };
+Task tasks[N_TASKS] = {
+  { envTask,     ENV_PERIOD_MS, 0 },
+  { patternTask, 1000,          0 },
+  { ledTask,     5,             0 },
+  { consoleTask, 20,            0 },
+};
+
+static void applyKey(const char* k, const char* v)
+{
+  uint32_t n = strtoul(v, nullptr, 10);
+  if      (!strcmp(k, "pat"))
+  {
+    if      (!strcmp(v, "static")) sim.pattern = PAT_STATIC;
+    else if (!strcmp(v, "cnt"))    sim.pattern = PAT_COUNTER;
+    else if (!strcmp(v, "rnd"))    sim.pattern = PAT_RANDOM;
+    else if (!strcmp(v, "toggle")) sim.pattern = PAT_TOGGLE;
+  }
+  else if (!strcmp(k, "period")) sim.periodMs = (uint16_t)n;
+  else if (!strcmp(k, "batch"))  sim.batch    = n ? (uint8_t)capped(n, 64) : 1;
+  else if (!strcmp(k, "lat"))    sim.latMs    = capped(n, 2000);
+  else if (!strcmp(k, "jit"))    sim.jitMs    = capped(n, 2000);
+  else if (!strcmp(k, "drop"))   sim.dropPm   = capped(n, 1000);
+  else if (!strcmp(k, "crc"))    sim.crcPm    = capped(n, 1000);
+  else if (!strcmp(k, "busy"))   sim.busyPm   = capped(n, 1000);
+  else if (!strcmp(k, "log"))    sim.log      = n != 0;
+  else
+  {
+    Serial.print(F("[SIM] chiave sconosciuta: ")); Serial.println(k);
+    return;
+  }
+  tasks[T_PATTERN].periodMs = sim.periodMs;
+}
+
+void setup()
+{
+  pinMode(PIN_RE_DE, OUTPUT);
+  digitalWrite(PIN_RE_DE, LOW); // ricezione di default
+
+  pinMode(LED_RX, OUTPUT);
+  pinMode(LED_TX, OUTPUT);
+  digitalWrite(LED_RX, LOW);
+  digitalWrite(LED_TX, LOW);
+
+  Serial.begin(115200);
+  while (!Serial) {}
+  Serial.println(F("\n[SLAVE] UNO R3 Modbus RTU via MAX485 (AltSoftSerial 8/9)"));
+
+  // AltSoftSerial lavora solo a 8N1
+  ASerial.begin(MB_BAUD);
+
+  // Tutti i banchi a 0, poi ENV iniziale; FAN_CMD parte a 0
+  randomSeed(analogRead(A0));       // per la simulazione
+  envTask(millis());
+  tasks[T_PATTERN].periodMs = sim.periodMs;
+
+  Serial.print(F("[SLAVE] pronto. Indirizzo=")); Serial.print(MB_SLAVEID);
+  Serial.print(F(", ")); Serial.print(MB_BAUD); Serial.println(F(" 8N1"));
+  printConfig();
+}
+
+void loop() {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < N_TASKS; ++i)
+  {
+    mbTask();   // il bus ha la precedenza su tutto il resto
+
+    Task& t = tasks[i];
+    if (t.periodMs && now - t.last >= t.periodMs)
+    {
+      t.last = now;
+      t.fn(now);
+    }
+  }
+}
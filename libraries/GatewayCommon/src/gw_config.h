@@ -0,0 +1,102 @@
+#pragma once
+// GENERATO da Host/codegen/gw_codegen a partire da Json/{can,modbus,mapping}.json:
+// non modificare a mano, rigenerare dopo ogni modifica ai JSON.
+#include "gw_config_types.h"
+
+namespace GWC {
+
+constexpr long CAN_BITRATE = 500000;
+constexpr Shaper SHAPER = { true, 30, 2 };
+
+constexpr CanField CAN_FIELDS[] = {
+  { "temperature", 2, 0, 4, 0, 1.0, 0xFF },
+  { "humidity", 0, 4, 2, 0, 1.0, 0xFF },
+  { "stale", 3, 0, 1, 0, 1.0, 0x00 },
+  { "fan_speed", 0, 0, 2, 0, 1.0, 0xFF },
+  { "fan_on", 3, 2, 1, 0, 1.0, 0xFF },
+};
+constexpr uint16_t N_CAN_FIELDS = 5;
+
+constexpr CanMessage CAN_MESSAGES[] = {
+  { "CAN_ENV", 0x100, 6, 0, 20, -1, 0, 2 },
+  { "CAN_ENV_STATUS", 0x102, 1, 1, 20, 0, 2, 1 },
+  { "CAN_CMD", 0x101, 3, 2, 0, -1, 3, 2 },
+};
+constexpr uint16_t N_CAN_MESSAGES = 3;
+
+constexpr Rtu RTU_CFG = { 9600, 'N', 1, 1, 70, 1000, 100, 10000, 3000 };
+constexpr Line MB_LINES[] = {
+  { "rs485a", "Serial1", 7, 9600, 'N', 1, 1, 70, 1000, 100 },
+};
+constexpr uint16_t N_MB_LINES = 1;
+
+constexpr Slave SLAVE_CFG = { false, "Serial1", 8, 19200, 'N', 1, 10 };
+
+constexpr MbField MB_FIELDS[] = {
+  { "temperature", 2, 0, 1, 1.0, 0 },
+  { "humidity", 0, 2, 1, 1.0, 0 },
+  { "fan_speed", 0, 0, 1, 1.0, 0 },
+  { "fan_on", 3, 1, 1, 1.0, 0 },
+};
+constexpr uint16_t N_MB_FIELDS = 4;
+
+constexpr MbResource MB_RESOURCES[] = {
+  { "MB_ENV", 0, 0, 3, 2000, 500, 10000, false, 0, 0, 0, 2 },
+  { "MB_FAN_CMD", 2, 20, 2, 0, 0, 0, false, 0, 0, 2, 2 },
+};
+constexpr uint16_t N_MB_RESOURCES = 2;
+
+constexpr Pair PAIRS[] = {
+  { 0, 0, nullptr },
+  { 1, 1, "clamp(x, 0, 100)" },
+  { 0, 0, nullptr },
+  { 1, 1, nullptr },
+};
+constexpr uint16_t N_PAIRS = 4;
+
+constexpr uint8_t GROUP_SLAVES[] = {
+  0
+};
+constexpr uint16_t N_GROUP_SLAVES = 0;
+
+constexpr Rule RULES[] = {
+  { 0, 0, 0, true, 0x100, true, 500, 0, 2, 0, 0, false, 0 },
+  { 0, 1, 0, false, 0x0, false, 0, 2, 0, 0, 0, false, 0 },
+  { 1, 2, 1, false, 0x0, false, 0, 2, 2, 0, 0, false, 0 },
+};
+constexpr uint16_t N_RULES = 3;
+
+constexpr Dispatch CAN_DISPATCH[] = {
+  { 0x101, 0, 1 },
+};
+constexpr uint16_t N_CAN_DISPATCH = 1;
+
+constexpr uint16_t CAN_DISPATCH_RULES[] = {
+  2,
+};
+constexpr uint16_t N_CAN_DISPATCH_RULES = 1;
+
+constexpr Dispatch REQ_DISPATCH[] = {
+  { 0x100, 0, 1 },
+};
+constexpr uint16_t N_REQ_DISPATCH = 1;
+
+constexpr uint16_t REQ_DISPATCH_RULES[] = {
+  0,
+};
+constexpr uint16_t N_REQ_DISPATCH_RULES = 1;
+
+// Slave RTU remoto (prima linea): indirizzo, formato e holding register usati dal gateway
+constexpr uint8_t  RTU_SLAVE_ID = 1;
+constexpr uint32_t RTU_BAUD     = 9600;
+constexpr uint16_t REG_MB_ENV = 0;
+constexpr uint16_t REG_MB_ENV_COUNT = 3;
+constexpr uint16_t REG_MB_ENV_temperature = 0;
+constexpr uint16_t REG_MB_ENV_humidity = 2;
+constexpr uint16_t REG_MB_FAN_CMD = 20;
+constexpr uint16_t REG_MB_FAN_CMD_COUNT = 2;
+constexpr uint16_t REG_MB_FAN_CMD_fan_speed = 20;
+constexpr uint16_t REG_MB_FAN_CMD_fan_on = 21;
+constexpr uint16_t HREG_END = 22;   // primo indirizzo oltre la mappa
+
+} // namespace GWC
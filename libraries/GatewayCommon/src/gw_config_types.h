@@ -0,0 +1,129 @@
+#pragma once
+// =============================================================================
+// gw_config_types.h — tabelle di configurazione generate da Host/codegen
+// (gw_config.h). Solo tipi letterali: gli array generati sono constexpr e sul
+// gateway restano in flash. I campi "enum" portano il valore numerico degli
+// enum del gateway (utils.h: FieldType, Endian, CanDir, ModbusFn, RuleDir).
+// Gli indici (first/count) puntano negli array piatti dello stesso header.
+// =============================================================================
+#include <stdint.h>
+
+namespace GWC {
+
+struct CanField {
+  const char* name;
+  uint8_t     type;      // FieldType
+  uint16_t    offset;
+  uint8_t     size;
+  uint8_t     endian;    // Endian
+  double      scale;
+  uint8_t     bit;       // 0xFF = byte intero
+};
+
+struct CanMessage {
+  const char* name;
+  uint32_t    id;
+  uint8_t     dlc;
+  uint8_t     dir;       // CanDir
+  uint16_t    max_rate_hz;
+  int8_t      stale_field;
+  uint16_t    first_field;
+  uint16_t    field_count;
+};
+
+struct MbField {
+  const char* name;
+  uint8_t     type;      // FieldType
+  uint16_t    index;
+  uint8_t     count;
+  double      scale;
+  uint8_t     bit;
+};
+
+struct MbResource {
+  const char* name;
+  uint8_t     fn;        // ModbusFn
+  uint16_t    address;
+  uint16_t    count;
+  uint32_t    period_ms;
+  uint32_t    min_period_ms;
+  uint32_t    max_period_ms;
+  bool        local;
+  uint8_t     line;      // indice in MB_LINES
+  uint8_t     slave_id;  // 0 = slave_id della linea
+  uint16_t    first_field;
+  uint16_t    field_count;
+};
+
+// src/dst sono indici nei campi della risorsa o del messaggio della regola
+// (-1 = assente); expr = testo dell'espressione, compilato al boot
+struct Pair {
+  int16_t     src;
+  int16_t     dst;
+  const char* expr;
+};
+
+struct Rule {
+  uint8_t     dir;       // RuleDir
+  uint16_t    can;       // indice in CAN_MESSAGES
+  uint16_t    res;       // indice in MB_RESOURCES
+  bool        req_enabled;
+  uint32_t    req_id;
+  bool        req_rtr;
+  uint32_t    req_max_age_ms;
+  uint16_t    first_pair;
+  uint16_t    pair_count;
+  uint16_t    first_slave; // gruppo CAN2MB: indice in GROUP_SLAVES
+  uint8_t     slave_count;
+  bool        broadcast;
+  uint32_t    verify_ms;
+};
+
+struct Dispatch {
+  uint32_t    id;
+  uint16_t    first;     // primo indice nell'array di regole del dispatch
+  uint16_t    count;
+};
+
+struct Rtu {
+  uint32_t    baud;
+  char        parity;
+  uint8_t     stop_bits;
+  uint8_t     slave_id;
+  uint8_t     budget_pct;
+  uint32_t    turnaround_us;
+  uint32_t    broadcast_turnaround_ms;
+  uint32_t    snapshot_ms;
+  uint32_t    ramp_ms;
+};
+
+struct Line {
+  const char* name;
+  const char* port;
+  uint8_t     de_re_pin;
+  uint32_t    baud;
+  char        parity;
+  uint8_t     stop_bits;
+  uint8_t     slave_id;
+  uint8_t     budget_pct;
+  uint32_t    turnaround_us;
+  uint32_t    broadcast_turnaround_ms;
+};
+
+struct Slave {
+  bool        enabled;
+  const char* port;
+  uint8_t     de_re_pin;
+  uint32_t    baud;
+  char        parity;
+  uint8_t     stop_bits;
+  uint8_t     id;
+};
+
+struct Shaper {
+  bool        enabled;
+  uint8_t     max_load_pct;
+  uint8_t     burst_frames;
+};
+
+} // namespace GWC
@@ -0,0 +1,315 @@
+#pragma once
+// =============================================================================
+// rtu_codec.h — frame Modbus RTU senza copie, condiviso da gateway, slave e
+// strumenti host (solo header, nessuna dipendenza da Arduino).
+//
+//  - CRC-16/MODBUS a tabella (256 voci, in flash su AVR): un accesso per byte
+//    invece di 8 passi di shift/xor del calcolo bit a bit.
+//  - Le richieste si costruiscono direttamente nel buffer di trasmissione e
+//    le risposte si leggono sul buffer di ricezione: parseResponse() lascia
+//    i dati dove sono e restituisce solo un puntatore.
+//  - requestLen()/responseLen() dicono dopo quanti byte il frame e' completo,
+//    cosi' chi riceve non deve aspettare il silenzio t3.5.
+// I valori sul filo sono big endian; il CRC e' little endian in coda.
+//
+// Per gli sketch la cartella libraries/GatewayCommon va resa visibile
+// all'IDE: sketchbook = root del repo, oppure copia/symlink in
+// <sketchbook>/libraries (dettagli in testa a Slave_Modbus.ino).
+// =============================================================================
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define RTU_TABLE_ATTR     PROGMEM
+#define RTU_TABLE_READ(p)  pgm_read_word(p)
+#else
+#define RTU_TABLE_ATTR
+#define RTU_TABLE_READ(p)  (*(p))
+#endif
+
+namespace RTU {
+
+constexpr uint16_t FRAME_MAX = 256;
+
+enum : uint8_t {
+  FC_READ_COILS      = 0x01,
+  FC_READ_DISCRETE   = 0x02,
+  FC_READ_HOLDING    = 0x03,
+  FC_READ_INPUT      = 0x04,
+  FC_WRITE_COIL      = 0x05,
+  FC_WRITE_SINGLE    = 0x06,
+  FC_WRITE_COILS     = 0x0F,
+  FC_WRITE_MULTIPLE  = 0x10,
+};
+
+enum : uint8_t {
+  EX_ILLEGAL_FUNCTION = 0x01,
+  EX_ILLEGAL_ADDRESS  = 0x02,
+  EX_ILLEGAL_VALUE    = 0x03,
+  EX_DEVICE_FAILURE   = 0x04,
+  EX_DEVICE_BUSY      = 0x06,
+};
+
+// ----- CRC -----
+// Tabella come membro statico di un template: una sola copia anche se
+// l'header e' incluso da piu' unita' di compilazione (C++11).
+template<typename T = void>
+struct CrcTable {
+  static const uint16_t t[256];
+};
+
+template<typename T>
+const uint16_t CrcTable<T>::t[256] RTU_TABLE_ATTR = {
+  0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+  0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+  0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+  0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+  0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+  0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+  0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+  0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+  0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+  0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+  0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+  0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+  0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+  0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+  0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+  0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+  0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+  0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+  0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+  0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+  0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+  0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+  0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+  0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+  0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+  0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+  0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+  0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+  0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+  0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+  0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+  0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+inline uint16_t crc16(const uint8_t* p, uint16_t n, uint16_t crc = 0xFFFF)
+{
+  while (n--)
+  {
+    crc = (uint16_t)((crc >> 8) ^ RTU_TABLE_READ(&CrcTable<>::t[(uint8_t)(crc ^ *p++)]));
+  }
+  return crc;
+}
+
+// Riferimento bit a bit (stesso risultato, per confronti e benchmark)
+inline uint16_t crc16Bitwise(const uint8_t* p, uint16_t n, uint16_t crc = 0xFFFF)
+{
+  while (n--)
+  {
+    crc ^= *p++;
+    for (uint8_t b = 0; b < 8; ++b)
+    {
+      crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+    }
+  }
+  return crc;
+}
+
+// ----- campi -----
+inline uint16_t get16(const uint8_t* p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+inline void put16(uint8_t* p, uint16_t v)
+{
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+// Aggiunge il CRC ai primi len byte: ritorna la lunghezza del frame completo
+inline uint16_t seal(uint8_t* f, uint16_t len)
+{
+  uint16_t crc = crc16(f, len);
+  f[len]     = (uint8_t)(crc & 0xFF);
+  f[len + 1] = (uint8_t)(crc >> 8);
+  return (uint16_t)(len + 2);
+}
+
+inline bool crcOk(const uint8_t* f, uint16_t n)
+{
+  return n >= 4 && crc16(f, (uint16_t)(n - 2)) == (uint16_t)(f[n - 2] | (f[n - 1] << 8));
+}
+
+inline bool isBitFc(uint8_t fc)
+{
+  return fc == FC_READ_COILS || fc == FC_READ_DISCRETE || fc == FC_WRITE_COILS;
+}
+
+// ----- richieste (master) -----
+// Tutte scrivono in f e ritornano la lunghezza con CRC (0 = argomenti invalidi)
+inline uint16_t buildRead(uint8_t* f, uint8_t slave, uint8_t fc, uint16_t addr, uint16_t qty)
+{
+  if (fc < FC_READ_COILS || fc > FC_READ_INPUT) return 0;
+  if (qty == 0 || qty > (isBitFc(fc) ? 2000 : 125)) return 0;
+  f[0] = slave;
+  f[1] = fc;
+  put16(f + 2, addr);
+  put16(f + 4, qty);
+  return seal(f, 6);
+}
+
+inline uint16_t buildWriteSingle(uint8_t* f, uint8_t slave, uint16_t addr, uint16_t value)
+{
+  f[0] = slave;
+  f[1] = FC_WRITE_SINGLE;
+  put16(f + 2, addr);
+  put16(f + 4, value);
+  return seal(f, 6);
+}
+
+inline uint16_t buildWriteCoil(uint8_t* f, uint8_t slave, uint16_t addr, bool on)
+{
+  f[0] = slave;
+  f[1] = FC_WRITE_COIL;
+  put16(f + 2, addr);
+  put16(f + 4, on ? 0xFF00 : 0x0000);
+  return seal(f, 6);
+}
+
+inline uint16_t buildWriteMultiple(uint8_t* f, uint8_t slave, uint16_t addr, const uint16_t* regs, uint16_t qty)
+{
+  if (qty == 0 || qty > 123) return 0;
+  f[0] = slave;
+  f[1] = FC_WRITE_MULTIPLE;
+  put16(f + 2, addr);
+  put16(f + 4, qty);
+  f[6] = (uint8_t)(2 * qty);
+  for (uint16_t i = 0; i < qty; ++i) put16(f + 7 + 2 * i, regs[i]);
+  return seal(f, (uint16_t)(7 + 2 * qty));
+}
+
+// bits impacchettati in parole: bit n = parola n/16, bit n%16
+inline uint16_t buildWriteCoils(uint8_t* f, uint8_t slave, uint16_t addr, const uint16_t* bits, uint16_t qty)
+{
+  if (qty == 0 || qty > 1968) return 0;
+  uint8_t bytes = (uint8_t)((qty + 7) / 8);
+  f[0] = slave;
+  f[1] = FC_WRITE_COILS;
+  put16(f + 2, addr);
+  put16(f + 4, qty);
+  f[6] = bytes;
+  for (uint8_t k = 0; k < bytes; ++k)
+  {
+    uint8_t b = (uint8_t)(bits[k / 2] >> (8 * (k % 2)));
+    if (k == bytes - 1 && (qty % 8)) b &= (uint8_t)((1u << (qty % 8)) - 1);
+    f[7 + k] = b;
+  }
+  return seal(f, (uint16_t)(7 + bytes));
+}
+
+// ----- lunghezze -----
+// Byte attesi per una richiesta ricevuta (slave): 0 = non ancora noto o
+// funzione sconosciuta (si chiude sul silenzio t3.5)
+inline uint16_t requestLen(const uint8_t* f, uint16_t have)
+{
+  if (have < 2) return 0;
+  switch (f[1])
+  {
+    case FC_READ_COILS: case FC_READ_DISCRETE: case FC_READ_HOLDING: case FC_READ_INPUT:
+    case FC_WRITE_COIL: case FC_WRITE_SINGLE:
+      return 8;
+    case FC_WRITE_COILS: case FC_WRITE_MULTIPLE:
+      return have >= 7 ? (uint16_t)(9 + f[6]) : 0;
+    default:
+      return 0;
+  }
+}
+
+// Byte attesi per la risposta a fc (master): 0 = non ancora noto
+inline uint16_t responseLen(const uint8_t* f, uint16_t have, uint8_t fc)
+{
+  if (have < 2) return 0;
+  if (f[1] & 0x80) return 5; // eccezione
+  switch (fc)
+  {
+    case FC_READ_COILS: case FC_READ_DISCRETE: case FC_READ_HOLDING: case FC_READ_INPUT:
+      return have >= 3 ? (uint16_t)(5 + f[2]) : 0;
+    default:
+      return 8; // eco di indirizzo e quantita'/valore
+  }
+}
+
+// ----- risposte (master) -----
+enum class Status : uint8_t {
+  Ok,
+  BadCrc,        // CRC errato o frame troppo corto
+  WrongSlave,
+  WrongFunction,
+  BadLength,     // byte count incoerente con la richiesta o frame oltre FRAME_MAX
+  Exception,     // risposta di eccezione: codice in Response::exception
+};
+
+struct Response {
+  const uint8_t* data      = nullptr;  // nel buffer di ricezione
+  uint8_t        bytes     = 0;
+  uint8_t        exception = 0;
+};
+
+inline Status parseResponse(const uint8_t* f, uint16_t n, uint8_t slave, uint8_t fc, uint16_t qty, Response& out)
+{
+  out = Response();
+  if (n > FRAME_MAX)                return Status::BadLength;
+  if (n < 5 || !crcOk(f, n))        return Status::BadCrc;
+  if (f[0] != slave)                return Status::WrongSlave;
+  if (f[1] == (uint8_t)(fc | 0x80))
+  {
+    out.exception = f[2];
+    return Status::Exception;
+  }
+  if (f[1] != fc)                   return Status::WrongFunction;
+
+  if (fc >= FC_READ_COILS && fc <= FC_READ_INPUT)
+  {
+    uint16_t expect = isBitFc(fc) ? (uint16_t)((qty + 7) / 8) : (uint16_t)(2 * qty);
+    if (f[2] != expect || n != 5u + f[2]) return Status::BadLength;
+    out.data  = f + 3;
+    out.bytes = f[2];
+    return Status::Ok;
+  }
+  if (n != 8)                       return Status::BadLength;
+  out.data  = f + 2;
+  out.bytes = 4;
+  return Status::Ok;
+}
+
+// Registri big endian -> parole
+inline void unpackRegs(const uint8_t* data, uint16_t qty, uint16_t* out)
+{
+  for (uint16_t i = 0; i < qty; ++i) out[i] = get16(data + 2 * i);
+}
+
+// Bit di coil/discrete -> parole impacchettate (bit n = parola n/16, bit n%16)
+inline void unpackBits(const uint8_t* data, uint16_t qty, uint16_t* out)
+{
+  uint16_t bytes = (uint16_t)((qty + 7) / 8);
+  for (uint16_t k = 0; k < bytes; ++k)
+  {
+    if (k % 2 == 0) out[k / 2] = data[k];
+    else             out[k / 2] |= (uint16_t)(data[k] << 8);
+  }
+}
+
+// ----- risposte (slave) -----
+inline uint16_t buildException(uint8_t* f, uint8_t slave, uint8_t fc, uint8_t code)
+{
+  f[0] = slave;
+  f[1] = (uint8_t)(fc | 0x80);
+  f[2] = code;
+  return seal(f, 3);
+}
+
+} // namespace RTU